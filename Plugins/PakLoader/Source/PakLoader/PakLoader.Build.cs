@@ -18,6 +18,8 @@ public class PakLoader : ModuleRules
                 "Engine",
                 "PakFile",
                 "HTTP",
+                "Json",
+                "JsonUtilities",
                 "AssetRegistry",
                 "RenderCore"
             }
@@ -2,61 +2,409 @@
 
 #include "LogHelper.h"
 #include "PakLoaderModule.h"
+#include "HAL/Event.h"
+#include "HAL/FileManager.h"
+#include "HAL/Runnable.h"
+#include "HAL/RunnableThread.h"
 #include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Misc/ScopeLock.h"
+#include "Misc/ScopeExit.h"
+#include <atomic>
 
 bool FLogHelper::bEnableLogging = false;
 FString FLogHelper::LogPath = "";
+ELogHelperLogLevel FLogHelper::MinLevel = LL_VERBOSE;
+
+namespace LogHelper
+{
+	// Messages queued before the oldest are dropped, logging must not grow without bound while the disk is slow.
+	static constexpr int32 RingCapacity = 8192;
+
+	// The writer thread wakes up at least this often to write queued messages.
+	static constexpr uint32 FlushIntervalMs = 200;
+
+	static const TCHAR* GetLevelName(ELogHelperLogLevel Level)
+	{
+		switch (Level)
+		{
+		case LL_VERBOSE: return TEXT("Verbose");
+		case LL_LOG: return TEXT("Log");
+		case LL_WARNING: return TEXT("Warning");
+		case LL_ERROR: return TEXT("Error");
+		default: return TEXT("");
+		}
+	}
+}
+
+/* Background thread that writes queued log messages to the log file. */
+class FLogHelperWriter : public FRunnable
+{
+public:
+	explicit FLogHelperWriter(const FString& InPath)
+		: Path(InPath)
+	{
+		Entries.SetNum(LogHelper::RingCapacity);
+		WakeEvent = FPlatformProcess::GetSynchEventFromPool(false);
+		FlushedEvent = FPlatformProcess::GetSynchEventFromPool(false);
+		Thread = FRunnableThread::Create(this, TEXT("PakLoaderLogWriter"), 0, TPri_BelowNormal);
+		bThreadExited = Thread == nullptr;
+	}
+
+	virtual ~FLogHelperWriter()
+	{
+		StopThread();
+
+		FPlatformProcess::ReturnSynchEventToPool(WakeEvent);
+		FPlatformProcess::ReturnSynchEventToPool(FlushedEvent);
+	}
+
+	/* Writes what is queued and joins the thread. Messages queued later are not written. */
+	void StopThread()
+	{
+		bStopRequested = true;
+		WakeEvent->Trigger();
+
+		if (Thread)
+		{
+			Thread->WaitForCompletion();
+			delete Thread;
+			Thread = nullptr;
+		}
+	}
+
+	void Enqueue(ELogHelperLogLevel Level, const FString& Text)
+	{
+		FScopeLock Lock(&EntriesLock);
+
+		if (NumEntries == LogHelper::RingCapacity)
+		{
+			FirstEntry = (FirstEntry + 1) % LogHelper::RingCapacity;
+			--NumEntries;
+			++NumDropped;
+		}
+
+		FEntry& Entry = Entries[(FirstEntry + NumEntries) % LogHelper::RingCapacity];
+		Entry.Time = FDateTime::Now();
+		Entry.Level = Level;
+		Entry.Text = Text;
+		++NumEntries;
+		++EnqueuedSequence;
+	}
+
+	void SetPath(const FString& InPath)
+	{
+		FScopeLock Lock(&EntriesLock);
+		Path = InPath;
+	}
+
+	void Flush()
+	{
+		int64 FlushSequence = 0;
+		{
+			FScopeLock Lock(&EntriesLock);
+			FlushSequence = EnqueuedSequence;
+		}
+
+		// One flush at a time, the event wakes up a single waiter. It may have been triggered by an earlier batch,
+		// only the written sequence tells whether the messages queued before this call are written.
+		FScopeLock Lock(&FlushLock);
+
+		while (WrittenSequence.load() < FlushSequence && !bThreadExited)
+		{
+			WakeEvent->Trigger();
+			FlushedEvent->Wait(LogHelper::FlushIntervalMs);
+		}
+	}
+
+	void SetRotation(int64 InMaxBytes, int32 InMaxBackups)
+	{
+		MaxFileSize = InMaxBytes;
+		MaxBackups = InMaxBackups;
+	}
+
+	virtual uint32 Run() override
+	{
+		while (!bStopRequested)
+		{
+			WakeEvent->Wait(LogHelper::FlushIntervalMs);
+			WriteEntries();
+			FlushedEvent->Trigger();
+		}
+
+		WriteEntries();
+		CloseFile();
+
+		// A flush racing with shutdown must not wait forever.
+		bThreadExited = true;
+		FlushedEvent->Trigger();
+		return 0;
+	}
+
+private:
+	struct FEntry
+	{
+		FDateTime Time;
+		ELogHelperLogLevel Level = LL_LOG;
+		FString Text;
+	};
+
+	void WriteEntries()
+	{
+		// Take the messages out of the ring, formatting and writing happens without the lock.
+		TArray<FEntry> Batch;
+		int32 Dropped = 0;
+		FString CurrentPath;
+		int64 BatchSequence = 0;
+		{
+			FScopeLock Lock(&EntriesLock);
+
+			Batch.Reserve(NumEntries);
+			for (int32 Index = 0; Index < NumEntries; ++Index)
+			{
+				Batch.Add(MoveTemp(Entries[(FirstEntry + Index) % LogHelper::RingCapacity]));
+			}
+
+			FirstEntry = 0;
+			NumEntries = 0;
+			Dropped = NumDropped;
+			NumDropped = 0;
+			CurrentPath = Path;
+			BatchSequence = EnqueuedSequence;
+		}
+
+		// Dropped messages count as written, nothing will write them.
+		ON_SCOPE_EXIT
+		{
+			WrittenSequence = BatchSequence;
+		};
+
+		if (Batch.Num() == 0 && Dropped == 0)
+		{
+			return;
+		}
+
+		FString Text;
+		if (Dropped > 0)
+		{
+			Text += FString::Printf(TEXT("[%s] Warning: %d log messages were dropped\n"), *FDateTime::Now().ToString(), Dropped);
+		}
+
+		for (const FEntry& Entry : Batch)
+		{
+			Text += FString::Printf(TEXT("[%s] %s: %s\n"), *Entry.Time.ToString(), LogHelper::GetLevelName(Entry.Level), *Entry.Text);
+		}
+
+		FTCHARToUTF8 Utf8(*Text);
+
+		if (CurrentPath != OpenPath)
+		{
+			CloseFile();
+		}
+
+		if (FileHandle && MaxFileSize > 0 && FileHandle->Tell() + Utf8.Length() > MaxFileSize)
+		{
+			CloseFile();
+			RotateFiles(CurrentPath);
+		}
+
+		if (!FileHandle && !CurrentPath.IsEmpty())
+		{
+			FileHandle = IFileManager::Get().CreateFileWriter(*CurrentPath, FILEWRITE_Append | FILEWRITE_AllowRead);
+			OpenPath = CurrentPath;
+		}
+
+		if (FileHandle)
+		{
+			FileHandle->Serialize(const_cast<ANSICHAR*>(Utf8.Get()), Utf8.Length());
+			FileHandle->Flush();
+		}
+	}
+
+	void RotateFiles(const FString& Filename)
+	{
+		IFileManager& FileManager = IFileManager::Get();
+
+		auto GetBackupName = [&Filename](int32 Index)
+		{
+			return FPaths::GetPath(Filename) / FString::Printf(TEXT("%s.%d.%s"), *FPaths::GetBaseFilename(Filename), Index, *FPaths::GetExtension(Filename));
+		};
+
+		if (MaxBackups <= 0)
+		{
+			FileManager.Delete(*Filename);
+			return;
+		}
+
+		FileManager.Delete(*GetBackupName(MaxBackups));
+		for (int32 Index = MaxBackups - 1; Index >= 1; --Index)
+		{
+			FileManager.Move(*GetBackupName(Index + 1), *GetBackupName(Index));
+		}
+
+		FileManager.Move(*GetBackupName(1), *Filename);
+	}
+
+	void CloseFile()
+	{
+		delete FileHandle;
+		FileHandle = nullptr;
+		OpenPath.Empty();
+	}
+
+	TArray<FEntry> Entries;
+	int32 FirstEntry = 0;
+	int32 NumEntries = 0;
+	int32 NumDropped = 0;
+	FString Path;
+	FCriticalSection EntriesLock;
+
+	// Number of messages ever queued, and how many of them are written. Flush waits for the count at its call.
+	int64 EnqueuedSequence = 0;
+	std::atomic<int64> WrittenSequence{0};
+
+	FCriticalSection FlushLock;
+
+	FEvent* WakeEvent = nullptr;
+	FEvent* FlushedEvent = nullptr;
+	FRunnableThread* Thread = nullptr;
+
+	std::atomic<bool> bStopRequested{false};
+	std::atomic<bool> bThreadExited{false};
+
+	std::atomic<int64> MaxFileSize{10 * 1024 * 1024};
+	std::atomic<int32> MaxBackups{3};
+
+	// Owned by the writer thread.
+	FArchive* FileHandle = nullptr;
+	FString OpenPath;
+};
+
+static std::atomic<FLogHelperWriter*> GLogHelperWriter{nullptr};
+static FCriticalSection GLogHelperWriterLock;
+
+// Set by Shutdown, messages logged after it only go to the engine log.
+static std::atomic<bool> GLogHelperShutDown{false};
+
+static FLogHelperWriter* GetLogHelperWriter()
+{
+	if (GLogHelperShutDown)
+	{
+		return nullptr;
+	}
+
+	if (FLogHelperWriter* Writer = GLogHelperWriter.load(std::memory_order_acquire))
+	{
+		return Writer;
+	}
+
+	FScopeLock Lock(&GLogHelperWriterLock);
+
+	if (!GLogHelperWriter.load() && !GLogHelperShutDown && FPlatformProcess::SupportsMultithreading())
+	{
+		GLogHelperWriter.store(new FLogHelperWriter(FLogHelper::LogPath), std::memory_order_release);
+	}
+
+	return GLogHelperWriter.load();
+}
 
 void FLogHelper::Log(ELogHelperLogLevel Level, const TCHAR *LogText)
 {
+	if (!IsEnabled(Level))
+		return;
+
 	FLogHelper::Log(Level, FString(LogText));
 }
 
 void FLogHelper::Log(ELogHelperLogLevel Level, const FString &LogText)
 {
-	if (!FLogHelper::bEnableLogging)
+	if (!IsEnabled(Level))
 		return;
 
-	FString LogLevelName = "";
-
 	if (Level == ELogHelperLogLevel::LL_VERBOSE)
 	{
 		UE_LOG(LogPakLoader, Verbose, TEXT("%s"), *LogText);
-		LogLevelName = "Verbose";
 	}
 	else if (Level == ELogHelperLogLevel::LL_LOG)
 	{
 		UE_LOG(LogPakLoader, Log, TEXT("%s"), *LogText);
-		LogLevelName = "Log";
 	}
 	else if (Level == ELogHelperLogLevel::LL_WARNING)
 	{
 		UE_LOG(LogPakLoader, Warning, TEXT("%s"), *LogText);
-		LogLevelName = "Warning";
 	}
 	else if (Level == ELogHelperLogLevel::LL_ERROR)
 	{
 		UE_LOG(LogPakLoader, Error, TEXT("%s"), *LogText);
-		LogLevelName = "Error";
 	}
 
-	FString MessageLog = FString::Printf(TEXT("[%s] %s: %s\n"), *FDateTime::Now().ToString(), *LogLevelName, *LogText);
-
-	FFileHelper::SaveStringToFile(MessageLog, *LogPath, FFileHelper::EEncodingOptions::AutoDetect, &IFileManager::Get(), EFileWrite::FILEWRITE_Append);
+	if (FLogHelperWriter* Writer = GetLogHelperWriter())
+	{
+		Writer->Enqueue(Level, LogText);
+	}
+	else if (!GLogHelperShutDown && !FPlatformProcess::SupportsMultithreading())
+	{
+		// Without threads there is no writer, append right away.
+		const FString Message = FString::Printf(TEXT("[%s] %s: %s\n"), *FDateTime::Now().ToString(), LogHelper::GetLevelName(Level), *LogText);
+		FFileHelper::SaveStringToFile(Message, *LogPath, FFileHelper::EEncodingOptions::ForceUTF8WithoutBOM, &IFileManager::Get(), FILEWRITE_Append);
+	}
 }
 
 void FLogHelper::Flush()
 {
-	// Flush log file
-	FFileHelper::SaveStringToFile(TEXT("\n"), *LogPath);
+	if (FLogHelperWriter* Writer = GLogHelperWriter.load(std::memory_order_acquire))
+	{
+		Writer->Flush();
+	}
 }
 
 void FLogHelper::EnableLogging(bool bEnable)
 {
 	bEnableLogging = bEnable;
+
+	if (!bEnable)
+	{
+		Flush();
+	}
 }
 
 void FLogHelper::SetLogPath(const FString &InLogPath)
 {
+	// Messages queued so far belong to the previous file.
+	Flush();
+
+	FScopeLock Lock(&GLogHelperWriterLock);
+
 	LogPath = InLogPath;
+
+	if (FLogHelperWriter* Writer = GLogHelperWriter.load())
+	{
+		Writer->SetPath(InLogPath);
+	}
+}
+
+void FLogHelper::SetMinLevel(ELogHelperLogLevel Level)
+{
+	MinLevel = Level;
+}
+
+void FLogHelper::SetRotation(int64 MaxBytes, int32 MaxBackups)
+{
+	if (FLogHelperWriter* Writer = GetLogHelperWriter())
+	{
+		Writer->SetRotation(MaxBytes, MaxBackups);
+	}
+}
+
+void FLogHelper::Shutdown()
+{
+	FScopeLock Lock(&GLogHelperWriterLock);
+
+	GLogHelperShutDown = true;
+
+	// Threads that got the writer before may still be queueing to it, it is stopped but never deleted.
+	if (FLogHelperWriter* Writer = GLogHelperWriter.load())
+	{
+		Writer->StopThread();
+	}
 }
@@ -0,0 +1,394 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#include "PakAccessOrderPlatformFile.h"
+#include "PakTraceRecorder.h"
+#include "LogHelper.h"
+#include "Async/Async.h"
+#include "Async/AsyncFileHandle.h"
+#include "HAL/FileManager.h"
+#include "Misc/CoreDelegates.h"
+#include "Misc/Paths.h"
+#include "Misc/ScopeLock.h"
+
+namespace PakAccessOrder
+{
+	static constexpr uint32 FileMagic = 0x4150414B;
+	static constexpr int32 FileVersion = 1;
+
+	// Adjacent blocks are prefetched with one read up to this size.
+	static constexpr int64 MaxReadSize = 1024 * 1024;
+}
+
+/* Read handle that records the blocks it reads. */
+class FPakAccessOrderFileHandle : public IFileHandle
+{
+public:
+	FPakAccessOrderFileHandle(IFileHandle* InInner, const TSharedRef<FPakAccessOrder, ESPMode::ThreadSafe>& InAccessOrder)
+		: Inner(InInner)
+		, AccessOrder(InAccessOrder)
+	{
+	}
+
+	virtual int64 Tell() override { return Inner->Tell(); }
+	virtual bool Seek(int64 NewPosition) override { return Inner->Seek(NewPosition); }
+	virtual bool SeekFromEnd(int64 NewPositionRelativeToEnd = 0) override { return Inner->SeekFromEnd(NewPositionRelativeToEnd); }
+	virtual int64 Size() override { return Inner->Size(); }
+	virtual bool Write(const uint8* Source, int64 BytesToWrite) override { return Inner->Write(Source, BytesToWrite); }
+	virtual bool Flush(const bool bFullFlush = false) override { return Inner->Flush(bFullFlush); }
+	virtual bool Truncate(int64 NewSize) override { return Inner->Truncate(NewSize); }
+
+	virtual bool Read(uint8* Destination, int64 BytesToRead) override
+	{
+		AccessOrder->Record(Inner->Tell(), BytesToRead);
+		return Inner->Read(Destination, BytesToRead);
+	}
+
+private:
+	TUniquePtr<IFileHandle> Inner;
+	TSharedRef<FPakAccessOrder, ESPMode::ThreadSafe> AccessOrder;
+};
+
+/* Async read handle that records the blocks it reads and keeps the native implementation of the lower level. */
+class FPakAccessOrderAsyncReadFileHandle : public IAsyncReadFileHandle
+{
+public:
+	FPakAccessOrderAsyncReadFileHandle(IAsyncReadFileHandle* InInner, const TSharedRef<FPakAccessOrder, ESPMode::ThreadSafe>& InAccessOrder)
+		: Inner(InInner)
+		, AccessOrder(InAccessOrder)
+	{
+	}
+
+	virtual IAsyncReadRequest* SizeRequest(FAsyncFileCallBack* CompleteCallback = nullptr) override
+	{
+		return Inner->SizeRequest(CompleteCallback);
+	}
+
+	virtual IAsyncReadRequest* ReadRequest(int64 Offset, int64 BytesToRead, EAsyncIOPriorityAndFlags PriorityAndFlags = AIOP_Normal, FAsyncFileCallBack* CompleteCallback = nullptr, uint8* UserSuppliedMemory = nullptr) override
+	{
+		AccessOrder->Record(Offset, BytesToRead);
+		return Inner->ReadRequest(Offset, BytesToRead, PriorityAndFlags, CompleteCallback, UserSuppliedMemory);
+	}
+
+private:
+	TUniquePtr<IAsyncReadFileHandle> Inner;
+	TSharedRef<FPakAccessOrder, ESPMode::ThreadSafe> AccessOrder;
+};
+
+void FPakAccessOrder::Record(int64 Offset, int64 Size)
+{
+	if (Offset < 0 || Size <= 0)
+	{
+		return;
+	}
+
+	const int32 FirstBlock = (int32)(Offset / BlockSize);
+	const int32 LastBlock = (int32)((Offset + Size - 1) / BlockSize);
+
+	FScopeLock ScopeLock(&Lock);
+
+	for (int32 Block = FirstBlock; Block <= LastBlock; Block++)
+	{
+		bool bAlreadySeen = false;
+		Seen.Add(Block, &bAlreadySeen);
+
+		if (!bAlreadySeen)
+		{
+			Order.Add(Block);
+		}
+	}
+}
+
+TArray<int32> FPakAccessOrder::GetMergedOrder(int32 MaxBlocks) const
+{
+	FScopeLock ScopeLock(&Lock);
+
+	TArray<int32> Merged = Order;
+	for (const int32 Block : PreviousOrder)
+	{
+		if (!Seen.Contains(Block))
+		{
+			Merged.Add(Block);
+		}
+	}
+
+	if (Merged.Num() > MaxBlocks)
+	{
+		Merged.SetNum(MaxBlocks);
+	}
+
+	return Merged;
+}
+
+int32 FPakAccessOrder::GetNumRecordedBlocks() const
+{
+	FScopeLock ScopeLock(&Lock);
+	return Order.Num();
+}
+
+FPakAccessOrderPlatformFile::FPakAccessOrderPlatformFile()
+{
+	// Mounted paks are rarely unmounted before exit, their orders would be lost otherwise.
+	PreExitHandle = FCoreDelegates::OnPreExit.AddRaw(this, &FPakAccessOrderPlatformFile::SaveAll);
+}
+
+FPakAccessOrderPlatformFile::~FPakAccessOrderPlatformFile()
+{
+	FCoreDelegates::OnPreExit.Remove(PreExitHandle);
+}
+
+void FPakAccessOrderPlatformFile::RegisterFile(const FString& PakFilename)
+{
+	FWriteScopeLock Lock(FilesLock);
+
+	Files.Add(GetKey(*PakFilename), MakeShared<FPakAccessOrder, ESPMode::ThreadSafe>(PakFilename));
+	NumFiles = Files.Num();
+}
+
+void FPakAccessOrderPlatformFile::SetContentRoot(const FString& PakFilename, const FString& RootPath, bool bPrefetch)
+{
+	TSharedPtr<FPakAccessOrder, ESPMode::ThreadSafe> AccessOrder = FindFile(*PakFilename);
+	if (!AccessOrder.IsValid() || RootPath.IsEmpty())
+	{
+		return;
+	}
+
+	AccessOrder->RootPath = RootPath;
+
+	if (LoadOrder(*AccessOrder) && bPrefetch && MaxPrefetchBytes > 0)
+	{
+		StartPrefetch(AccessOrder.ToSharedRef());
+	}
+}
+
+void FPakAccessOrderPlatformFile::UnregisterFile(const FString& PakFilename, bool bSave)
+{
+	TSharedPtr<FPakAccessOrder, ESPMode::ThreadSafe> AccessOrder;
+	{
+		FWriteScopeLock Lock(FilesLock);
+
+		const FString Key = GetKey(*PakFilename);
+		if (const TSharedRef<FPakAccessOrder, ESPMode::ThreadSafe>* Found = Files.Find(Key))
+		{
+			AccessOrder = *Found;
+			Files.Remove(Key);
+		}
+
+		NumFiles = Files.Num();
+	}
+
+	if (!AccessOrder.IsValid())
+	{
+		return;
+	}
+
+	AccessOrder->bCancelPrefetch = true;
+
+	if (bSave)
+	{
+		SaveOrder(*AccessOrder);
+	}
+}
+
+void FPakAccessOrderPlatformFile::SaveAll()
+{
+	TArray<TSharedRef<FPakAccessOrder, ESPMode::ThreadSafe>> AccessOrders;
+	{
+		FReadScopeLock Lock(FilesLock);
+		Files.GenerateValueArray(AccessOrders);
+	}
+
+	for (const TSharedRef<FPakAccessOrder, ESPMode::ThreadSafe>& AccessOrder : AccessOrders)
+	{
+		SaveOrder(*AccessOrder);
+	}
+}
+
+FString FPakAccessOrderPlatformFile::GetOrderFilename(const FString& RootPath)
+{
+	FString RootName = RootPath;
+	RootName.RemoveFromStart(TEXT("/"));
+	RootName.RemoveFromEnd(TEXT("/"));
+
+	return FPaths::ProjectSavedDir() / TEXT("PakLoader") / TEXT("AccessOrder") / RootName + TEXT(".order");
+}
+
+IFileHandle* FPakAccessOrderPlatformFile::OpenRead(const TCHAR* Filename, bool bAllowWrite)
+{
+	IFileHandle* Inner = LowerLevel->OpenRead(Filename, bAllowWrite);
+
+	TSharedPtr<FPakAccessOrder, ESPMode::ThreadSafe> AccessOrder = FindFile(Filename);
+	if (!Inner || !AccessOrder.IsValid())
+	{
+		return Inner;
+	}
+
+	return new FPakAccessOrderFileHandle(Inner, AccessOrder.ToSharedRef());
+}
+
+IAsyncReadFileHandle* FPakAccessOrderPlatformFile::OpenAsyncRead(const TCHAR* Filename)
+{
+	IAsyncReadFileHandle* Inner = LowerLevel->OpenAsyncRead(Filename);
+
+	TSharedPtr<FPakAccessOrder, ESPMode::ThreadSafe> AccessOrder = FindFile(Filename);
+	if (!Inner || !AccessOrder.IsValid())
+	{
+		return Inner;
+	}
+
+	return new FPakAccessOrderAsyncReadFileHandle(Inner, AccessOrder.ToSharedRef());
+}
+
+TSharedPtr<FPakAccessOrder, ESPMode::ThreadSafe> FPakAccessOrderPlatformFile::FindFile(const TCHAR* Filename) const
+{
+	if (NumFiles.load() == 0)
+	{
+		return nullptr;
+	}
+
+	const FString Key = GetKey(Filename);
+
+	FReadScopeLock Lock(FilesLock);
+
+	const TSharedRef<FPakAccessOrder, ESPMode::ThreadSafe>* AccessOrder = Files.Find(Key);
+	return AccessOrder ? TSharedPtr<FPakAccessOrder, ESPMode::ThreadSafe>(*AccessOrder) : nullptr;
+}
+
+bool FPakAccessOrderPlatformFile::LoadOrder(FPakAccessOrder& AccessOrder)
+{
+	const FString OrderFilename = GetOrderFilename(AccessOrder.RootPath);
+
+	TUniquePtr<FArchive> Reader(IFileManager::Get().CreateFileReader(*OrderFilename));
+	if (!Reader)
+	{
+		return false;
+	}
+
+	uint32 Magic = 0;
+	int32 Version = 0;
+	int64 PakSize = 0;
+	int64 PakTimestamp = 0;
+	int64 OrderBlockSize = 0;
+
+	*Reader << Magic;
+	*Reader << Version;
+
+	if (Magic != PakAccessOrder::FileMagic || Version != PakAccessOrder::FileVersion)
+	{
+		return false;
+	}
+
+	*Reader << PakSize;
+	*Reader << PakTimestamp;
+	*Reader << OrderBlockSize;
+
+	// Offsets of a replaced pak point at other data.
+	if (PakSize != LowerLevel->FileSize(*AccessOrder.PakFilename) || PakTimestamp != LowerLevel->GetTimeStamp(*AccessOrder.PakFilename).GetTicks() || OrderBlockSize != FPakAccessOrder::BlockSize)
+	{
+		PAKLOADER_LOG(LL_VERBOSE, TEXT("Discarding access order %s, the pak changed"), *OrderFilename);
+		return false;
+	}
+
+	*Reader << AccessOrder.PreviousOrder;
+
+	return !Reader->IsError() && AccessOrder.PreviousOrder.Num() > 0;
+}
+
+bool FPakAccessOrderPlatformFile::SaveOrder(const FPakAccessOrder& AccessOrder)
+{
+	// Nothing new was read, the saved order is still current.
+	if (AccessOrder.RootPath.IsEmpty() || AccessOrder.GetNumRecordedBlocks() == 0)
+	{
+		return false;
+	}
+
+	const int32 MaxBlocks = (int32)FMath::Max<int64>(MaxPrefetchBytes / FPakAccessOrder::BlockSize, 1);
+	TArray<int32> Order = AccessOrder.GetMergedOrder(MaxBlocks);
+
+	const FString OrderFilename = GetOrderFilename(AccessOrder.RootPath);
+
+	TUniquePtr<FArchive> Writer(IFileManager::Get().CreateFileWriter(*OrderFilename));
+	if (!Writer)
+	{
+		PAKLOADER_LOG(LL_WARNING, TEXT("Unable to write access order %s"), *OrderFilename);
+		return false;
+	}
+
+	uint32 Magic = PakAccessOrder::FileMagic;
+	int32 Version = PakAccessOrder::FileVersion;
+	int64 PakSize = LowerLevel->FileSize(*AccessOrder.PakFilename);
+	int64 PakTimestamp = LowerLevel->GetTimeStamp(*AccessOrder.PakFilename).GetTicks();
+	int64 OrderBlockSize = FPakAccessOrder::BlockSize;
+
+	*Writer << Magic;
+	*Writer << Version;
+	*Writer << PakSize;
+	*Writer << PakTimestamp;
+	*Writer << OrderBlockSize;
+	*Writer << Order;
+
+	PAKLOADER_LOG(LL_VERBOSE, TEXT("Saved access order of %s with %d blocks"), *AccessOrder.PakFilename, Order.Num());
+	return Writer->Close();
+}
+
+void FPakAccessOrderPlatformFile::StartPrefetch(const TSharedRef<FPakAccessOrder, ESPMode::ThreadSafe>& AccessOrder)
+{
+	const int32 MaxBlocks = (int32)FMath::Max<int64>(MaxPrefetchBytes / FPakAccessOrder::BlockSize, 1);
+
+	TArray<int32> Blocks = AccessOrder->PreviousOrder;
+	if (Blocks.Num() > MaxBlocks)
+	{
+		Blocks.SetNum(MaxBlocks);
+	}
+
+	// Reads the lower level directly, the prefetch must not show up in the recorded order.
+	IPlatformFile* PlatformFile = LowerLevel;
+
+	Async(EAsyncExecution::ThreadPool, [PlatformFile, AccessOrder, Blocks]()
+	{
+		const double StartSeconds = FPlatformTime::Seconds();
+
+		TUniquePtr<IFileHandle> Handle(PlatformFile->OpenRead(*AccessOrder->PakFilename));
+		if (!Handle)
+		{
+			return;
+		}
+
+		const int64 FileSize = Handle->Size();
+		TArray<uint8> Buffer;
+		Buffer.SetNumUninitialized(PakAccessOrder::MaxReadSize);
+
+		int64 BytesRead = 0;
+		int32 Index = 0;
+
+		while (Index < Blocks.Num() && !AccessOrder->bCancelPrefetch)
+		{
+			// Blocks that were read one after another in the recorded order are read together.
+			int32 NumBlocks = 1;
+			while (Index + NumBlocks < Blocks.Num() && Blocks[Index + NumBlocks] == Blocks[Index] + NumBlocks && NumBlocks * FPakAccessOrder::BlockSize < PakAccessOrder::MaxReadSize)
+			{
+				NumBlocks++;
+			}
+
+			const int64 Offset = (int64)Blocks[Index] * FPakAccessOrder::BlockSize;
+			const int64 Size = FMath::Min<int64>(NumBlocks * FPakAccessOrder::BlockSize, FileSize - Offset);
+			Index += NumBlocks;
+
+			if (Size <= 0 || !Handle->Seek(Offset) || !Handle->Read(Buffer.GetData(), Size))
+			{
+				continue;
+			}
+
+			BytesRead += Size;
+		}
+
+		FPakTraceRecorder::AddEvent(TEXT("Prefetch"), TEXT("IO"), StartSeconds, FPlatformTime::Seconds() - StartSeconds, BytesRead, AccessOrder->PakFilename);
+		PAKLOADER_LOG(LL_VERBOSE, TEXT("Prefetched %lld bytes of %s"), BytesRead, *AccessOrder->PakFilename);
+	});
+}
+
+FString FPakAccessOrderPlatformFile::GetKey(const TCHAR* Filename)
+{
+	FString Key = FPaths::ConvertRelativePathToFull(Filename);
+	FPaths::NormalizeFilename(Key);
+	return Key;
+}
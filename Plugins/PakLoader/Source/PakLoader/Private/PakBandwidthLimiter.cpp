@@ -0,0 +1,139 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#include "PakBandwidthLimiter.h"
+#include "HAL/PlatformTime.h"
+#include "Misc/ScopeLock.h"
+
+namespace PakBandwidthLimiter
+{
+	// Ranges cover this many seconds of the rate, short enough to keep bursts small, long enough to not drown in requests.
+	static constexpr double RequestSeconds = 0.25;
+
+	static constexpr int64 MinRequestSize = 64 * 1024;
+	static constexpr int64 MaxRequestSize = 16 * 1024 * 1024;
+}
+
+void FPakBandwidthLimiter::SetLimit(int64 InBytesPerSecond)
+{
+	{
+		FScopeLock ScopeLock(&Lock);
+
+		BytesPerSecond = FMath::Max<int64>(InBytesPerSecond, 0);
+
+		// Start with a full bucket, i.e. allow a burst of one second.
+		Tokens = static_cast<double>(BytesPerSecond.load());
+		LastRefillTime = FPlatformTime::Seconds();
+	}
+
+	Tick();
+}
+
+int64 FPakBandwidthLimiter::GetRequestSize() const
+{
+	const int64 Limit = BytesPerSecond.load();
+
+	if (Limit <= 0)
+	{
+		return 0;
+	}
+
+	return FMath::Clamp<int64>(static_cast<int64>(Limit * PakBandwidthLimiter::RequestSeconds), PakBandwidthLimiter::MinRequestSize, PakBandwidthLimiter::MaxRequestSize);
+}
+
+bool FPakBandwidthLimiter::TryReserve(int64 Bytes)
+{
+	FScopeLock ScopeLock(&Lock);
+	return TryReserve_Locked(Bytes);
+}
+
+bool FPakBandwidthLimiter::TryReserve_Locked(int64 Bytes)
+{
+	const int64 Limit = BytesPerSecond.load();
+
+	if (Limit <= 0)
+	{
+		return true;
+	}
+
+	const double Now = FPlatformTime::Seconds();
+	Tokens = FMath::Min<double>(Limit, Tokens + (Now - LastRefillTime) * Limit);
+	LastRefillTime = Now;
+
+	if (Tokens <= 0.0)
+	{
+		return false;
+	}
+
+	// Going into debt lets ranges larger than the bucket pass, the next one waits until the debt is paid off.
+	Tokens -= Bytes;
+	return true;
+}
+
+void FPakBandwidthLimiter::Consume(int64 Bytes)
+{
+	FScopeLock ScopeLock(&Lock);
+
+	if (BytesPerSecond.load() > 0)
+	{
+		Tokens -= Bytes;
+	}
+}
+
+void FPakBandwidthLimiter::StartWhenAvailable(const void* Owner, int64 Bytes, TFunction<void()>&& Start)
+{
+	{
+		FScopeLock ScopeLock(&Lock);
+
+		// Starts that waited before go first.
+		if (DeferredStarts.Num() > 0 || !TryReserve_Locked(Bytes))
+		{
+			FDeferredStart& Deferred = DeferredStarts.AddDefaulted_GetRef();
+			Deferred.Owner = Owner;
+			Deferred.Bytes = Bytes;
+			Deferred.Start = MoveTemp(Start);
+			return;
+		}
+	}
+
+	Start();
+}
+
+void FPakBandwidthLimiter::Defer(const void* Owner, int64 Bytes, TFunction<void()>&& Start)
+{
+	FScopeLock ScopeLock(&Lock);
+
+	FDeferredStart& Deferred = DeferredStarts.AddDefaulted_GetRef();
+	Deferred.Owner = Owner;
+	Deferred.Bytes = Bytes;
+	Deferred.Start = MoveTemp(Start);
+}
+
+void FPakBandwidthLimiter::CancelDeferredStarts(const void* Owner)
+{
+	FScopeLock ScopeLock(&Lock);
+
+	DeferredStarts.RemoveAll([Owner](const FDeferredStart& Deferred) { return Deferred.Owner == Owner; });
+}
+
+void FPakBandwidthLimiter::Tick()
+{
+	// Starts send requests and may defer further starts, run them outside of the lock.
+	TArray<TFunction<void()>> Starts;
+	{
+		FScopeLock ScopeLock(&Lock);
+
+		int32 NumReady = 0;
+		while (NumReady < DeferredStarts.Num() && TryReserve_Locked(DeferredStarts[NumReady].Bytes))
+		{
+			Starts.Add(MoveTemp(DeferredStarts[NumReady].Start));
+			++NumReady;
+		}
+
+		DeferredStarts.RemoveAt(0, NumReady);
+	}
+
+	for (TFunction<void()>& Start : Starts)
+	{
+		Start();
+	}
+}
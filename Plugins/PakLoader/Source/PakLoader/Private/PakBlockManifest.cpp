@@ -0,0 +1,265 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#include "PakBlockManifest.h"
+#include "LogHelper.h"
+#include "HAL/PlatformFileManager.h"
+#include "Misc/FileHelper.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+namespace PakBlockManifest
+{
+	static constexpr uint32 Magic = 0x504B424D; // "PKBM"
+	static constexpr uint32 Version = 1;
+
+	static FSHAHash HashBuffer(const uint8* Data, int64 Length)
+	{
+		FSHAHash Hash;
+		FSHA1::HashBuffer(Data, Length, Hash.Hash);
+		return Hash;
+	}
+}
+
+bool FPakBlockManifest::Generate(const FString& Filename, int32 InBlockSize, FPakBlockManifest& OutManifest)
+{
+	TUniquePtr<IFileHandle> FileHandle(FPlatformFileManager::Get().GetPlatformFile().OpenRead(*Filename));
+
+	if (!FileHandle || InBlockSize <= 0)
+	{
+		return false;
+	}
+
+	OutManifest.BlockSize = InBlockSize;
+	OutManifest.FileSize = FileHandle->Size();
+	OutManifest.Blocks.Reset();
+
+	TArray<uint8> Block;
+	Block.SetNumUninitialized(InBlockSize);
+
+	FSHA1 FileSha;
+
+	for (int64 Offset = 0; Offset < OutManifest.FileSize; Offset += InBlockSize)
+	{
+		const int64 Length = FMath::Min<int64>(InBlockSize, OutManifest.FileSize - Offset);
+		if (!FileHandle->Read(Block.GetData(), Length))
+		{
+			return false;
+		}
+
+		FBlock& Entry = OutManifest.Blocks.AddDefaulted_GetRef();
+		Entry.WeakHash = ComputeWeakHash(Block.GetData(), Length);
+		Entry.StrongHash = PakBlockManifest::HashBuffer(Block.GetData(), Length);
+
+		FileSha.Update(Block.GetData(), Length);
+	}
+
+	FileSha.Final();
+	FileSha.GetHash(OutManifest.FileHash.Hash);
+	return true;
+}
+
+bool FPakBlockManifest::SaveToFile(const FString& Filename) const
+{
+	TArray<uint8> Data;
+	FMemoryWriter Writer(Data);
+	const_cast<FPakBlockManifest*>(this)->Serialize(Writer);
+
+	return FFileHelper::SaveArrayToFile(Data, *Filename);
+}
+
+bool FPakBlockManifest::LoadFromMemory(const TArray<uint8>& Data)
+{
+	FMemoryReader Reader(Data);
+	Serialize(Reader);
+
+	return !Reader.IsError() && BlockSize > 0 && Blocks.Num() == FMath::DivideAndRoundUp<int64>(FileSize, BlockSize);
+}
+
+void FPakBlockManifest::Serialize(FArchive& Ar)
+{
+	uint32 Magic = PakBlockManifest::Magic;
+	uint32 Version = PakBlockManifest::Version;
+	Ar << Magic << Version;
+
+	if (Magic != PakBlockManifest::Magic || Version != PakBlockManifest::Version)
+	{
+		Ar.SetError();
+		return;
+	}
+
+	int32 NumBlocks = Blocks.Num();
+	Ar << BlockSize << FileSize << FileHash << NumBlocks;
+
+	if (Ar.IsLoading())
+	{
+		// Guard against garbage before allocating.
+		if (NumBlocks < 0 || static_cast<int64>(NumBlocks) * 24 > Ar.TotalSize())
+		{
+			Ar.SetError();
+			return;
+		}
+
+		Blocks.SetNum(NumBlocks);
+	}
+
+	for (FBlock& Block : Blocks)
+	{
+		Ar << Block.WeakHash << Block.StrongHash;
+	}
+}
+
+int64 FPakBlockManifest::GetBlockLength(int32 BlockIndex) const
+{
+	return FMath::Min<int64>(BlockSize, FileSize - static_cast<int64>(BlockIndex) * BlockSize);
+}
+
+uint32 FPakBlockManifest::ComputeWeakHash(const uint8* Data, int64 Length)
+{
+	uint32 A = 0;
+	uint32 B = 0;
+
+	for (int64 Index = 0; Index < Length; ++Index)
+	{
+		A += Data[Index];
+		B += static_cast<uint32>(Length - Index) * Data[Index];
+	}
+
+	return (A & 0xFFFF) | (B << 16);
+}
+
+bool FPakBlockManifest::ComputeDeltaPlan(const FString& LocalFilename, FPakDeltaPlan& OutPlan) const
+{
+	TUniquePtr<IFileHandle> FileHandle(FPlatformFileManager::Get().GetPlatformFile().OpenRead(*LocalFilename));
+
+	if (!FileHandle)
+	{
+		return false;
+	}
+
+	OutPlan.LocalOffsets.Init(INDEX_NONE, Blocks.Num());
+	OutPlan.ReusedBytes = 0;
+	OutPlan.MissingBytes = 0;
+
+	// Only full sized blocks take part in the rolling search, a short last block is checked at the end of the local file.
+	const int32 NumFullBlocks = FileSize % BlockSize == 0 ? Blocks.Num() : Blocks.Num() - 1;
+
+	TMap<uint32, TArray<int32>> BlocksByWeakHash;
+	for (int32 Index = 0; Index < NumFullBlocks; ++Index)
+	{
+		BlocksByWeakHash.FindOrAdd(Blocks[Index].WeakHash).Add(Index);
+	}
+
+	const int64 LocalSize = FileHandle->Size();
+	int32 NumUnmatched = NumFullBlocks;
+
+	// Sliding window over the local file, the buffer always holds the current block plus read ahead.
+	TArray<uint8> Buffer;
+	Buffer.SetNumUninitialized(FMath::Max<int64>(BlockSize * 2, 4 * 1024 * 1024));
+
+	int64 BufferStart = 0;
+	int64 BufferLength = 0;
+	int64 Position = 0;
+
+	uint32 A = 0;
+	uint32 B = 0;
+	bool bHashValid = false;
+
+	while (NumUnmatched > 0 && Position + BlockSize <= LocalSize)
+	{
+		// Rolling needs the byte behind the window as well.
+		const int64 Needed = FMath::Min<int64>(Position + BlockSize + 1, LocalSize);
+		if (Needed > BufferStart + BufferLength)
+		{
+			const int64 Keep = BufferStart + BufferLength - Position;
+			FMemory::Memmove(Buffer.GetData(), Buffer.GetData() + (Position - BufferStart), Keep);
+
+			const int64 ToRead = FMath::Min<int64>(Buffer.Num() - Keep, LocalSize - (Position + Keep));
+			if (!FileHandle->Seek(Position + Keep) || !FileHandle->Read(Buffer.GetData() + Keep, ToRead))
+			{
+				return false;
+			}
+
+			BufferStart = Position;
+			BufferLength = Keep + ToRead;
+		}
+
+		const uint8* Window = Buffer.GetData() + (Position - BufferStart);
+
+		if (!bHashValid)
+		{
+			const uint32 Weak = ComputeWeakHash(Window, BlockSize);
+			A = Weak & 0xFFFF;
+			B = Weak >> 16;
+			bHashValid = true;
+		}
+
+		bool bMatched = false;
+		if (const TArray<int32>* Candidates = BlocksByWeakHash.Find((A & 0xFFFF) | (B << 16)))
+		{
+			const FSHAHash StrongHash = PakBlockManifest::HashBuffer(Window, BlockSize);
+
+			// Identical blocks in the new file can all be served from the same local bytes.
+			for (int32 Index : *Candidates)
+			{
+				if (OutPlan.LocalOffsets[Index] == INDEX_NONE && Blocks[Index].StrongHash == StrongHash)
+				{
+					OutPlan.LocalOffsets[Index] = Position;
+					--NumUnmatched;
+					bMatched = true;
+				}
+			}
+		}
+
+		if (bMatched)
+		{
+			Position += BlockSize;
+			bHashValid = false;
+			continue;
+		}
+
+		if (Position + BlockSize >= LocalSize)
+		{
+			break;
+		}
+
+		const uint32 Out = Window[0];
+		const uint32 In = Window[BlockSize];
+		A = A - Out + In;
+		B = B - static_cast<uint32>(BlockSize) * Out + A;
+		++Position;
+	}
+
+	// Appended content usually leaves the old tail in place, compare a short last block at the same offset.
+	if (NumFullBlocks < Blocks.Num())
+	{
+		const int32 LastIndex = Blocks.Num() - 1;
+		const int64 LastOffset = static_cast<int64>(LastIndex) * BlockSize;
+		const int64 LastLength = GetBlockLength(LastIndex);
+
+		if (LastOffset + LastLength <= LocalSize)
+		{
+			TArray<uint8> LastBlock;
+			LastBlock.SetNumUninitialized(LastLength);
+
+			if (FileHandle->Seek(LastOffset) && FileHandle->Read(LastBlock.GetData(), LastLength) &&
+				PakBlockManifest::HashBuffer(LastBlock.GetData(), LastLength) == Blocks[LastIndex].StrongHash)
+			{
+				OutPlan.LocalOffsets[LastIndex] = LastOffset;
+			}
+		}
+	}
+
+	for (int32 Index = 0; Index < Blocks.Num(); ++Index)
+	{
+		if (OutPlan.LocalOffsets[Index] == INDEX_NONE)
+		{
+			OutPlan.MissingBytes += GetBlockLength(Index);
+		}
+		else
+		{
+			OutPlan.ReusedBytes += GetBlockLength(Index);
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,303 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#include "PakBundleDownloader.h"
+#include "PakBundleExtractor.h"
+#include "PakDownloadManager.h"
+#include "PakDownloader.h"
+#include "PakBandwidthLimiter.h"
+#include "PakDownloadState.h"
+#include "PakLoader.h"
+#include "LogHelper.h"
+#include "HttpModule.h"
+#include "Async/Async.h"
+#include "Misc/Paths.h"
+
+UAsyncPakBundleDownloader::UAsyncPakBundleDownloader(const FObjectInitializer& ObjectInitializer)
+	: Super(ObjectInitializer)
+{
+	if (HasAnyFlags(RF_ClassDefaultObject) == false)
+	{
+		AddToRoot();
+	}
+}
+
+UAsyncPakBundleDownloader* UAsyncPakBundleDownloader::DownloadPakBundle(const FString &URL, const FString &Directory, bool bMountPaks, int32 Priority)
+{
+	checkf(IsHttpUrl(URL), TEXT("Url passed to DownloadPakBundle does not start with http:// or https://. Since UE 5.3 this is required."));
+
+	UAsyncPakBundleDownloader* DownloadTask = NewObject<UAsyncPakBundleDownloader>();
+	DownloadTask->DownloadURL = URL;
+	DownloadTask->ExtractDirectory = Directory;
+	DownloadTask->bMountPaks = bMountPaks;
+	DownloadTask->DownloadPriority = Priority;
+
+	UPakDownloadManager* Manager = UPakDownloadManager::Get();
+	if (Manager)
+	{
+		Manager->QueueDownload(DownloadTask);
+	}
+	else
+	{
+		DownloadTask->StartDownload();
+	}
+
+	return DownloadTask;
+}
+
+void UAsyncPakBundleDownloader::StartDownload()
+{
+	Extractor = MakeShared<FPakBundleExtractor, ESPMode::ThreadSafe>(ExtractDirectory);
+
+	QueueRequest();
+}
+
+void UAsyncPakBundleDownloader::QueueRequest()
+{
+	UPakDownloadManager* Manager = UPakDownloadManager::Get();
+	RequestSize = Manager ? Manager->GetBandwidthLimiter()->GetRequestSize() : 0;
+
+	if (RequestSize <= 0)
+	{
+		SendRequest();
+		return;
+	}
+
+	bWaitingForBandwidth = true;
+
+	TWeakObjectPtr<UAsyncPakBundleDownloader> WeakThis(this);
+	Manager->GetBandwidthLimiter()->StartWhenAvailable(this, RequestSize, [WeakThis]()
+	{
+		UAsyncPakBundleDownloader* This = WeakThis.Get();
+		if (This && This->bWaitingForBandwidth)
+		{
+			This->bWaitingForBandwidth = false;
+			This->SendRequest();
+		}
+	});
+}
+
+void UAsyncPakBundleDownloader::SendRequest()
+{
+#if ENGINE_MINOR_VERSION <= 25 && ENGINE_MAJOR_VERSION == 4
+	TSharedRef<IHttpRequest> Request = FHttpModule::Get().CreateRequest();
+#else
+	auto Request = FHttpModule::Get().CreateRequest();
+#endif
+
+	Request->SetURL(DownloadURL);
+	Request->SetVerb(TEXT("GET"));
+	Request->OnProcessRequestComplete().BindUObject(this, &UAsyncPakBundleDownloader::HandleDownloadComplete);
+#if ENGINE_MINOR_VERSION >= 4 && ENGINE_MAJOR_VERSION == 5
+	Request->OnRequestProgress64().BindUObject(this, &UAsyncPakBundleDownloader::HandleDownloadProgress);
+#else
+	Request->OnRequestProgress().BindUObject(this, &UAsyncPakBundleDownloader::HandleDownloadProgress);
+#endif
+
+	if (RequestSize > 0)
+	{
+		Request->SetHeader(TEXT("Range"), FString::Printf(TEXT("bytes=%lld-%lld"), ArchiveOffset, ArchiveOffset + RequestSize - 1));
+
+		// The archive must not change between ranges, the extractor can't start over.
+		if (ArchiveOffset > 0 && !RangeValidator.IsEmpty())
+		{
+			Request->SetHeader(TEXT("If-Range"), RangeValidator);
+		}
+	}
+
+#if ENGINE_MINOR_VERSION >= 4 && ENGINE_MAJOR_VERSION == 5
+	// Only the first range may be answered with the whole archive, e.g. by servers that ignore ranges.
+	TWeakPtr<IHttpRequest, ESPMode::ThreadSafe> WeakRequest = Request;
+	const int64 RequestedOffset = ArchiveOffset;
+	Extractor->SetResponseCheck([WeakRequest, RequestedOffset]()
+	{
+		FHttpRequestPtr PinnedRequest = WeakRequest.Pin();
+		FHttpResponsePtr Response = PinnedRequest.IsValid() ? PinnedRequest->GetResponse() : nullptr;
+		return UAsyncPakDownloader::GetBodyWriteOffset(Response, RequestedOffset, RequestedOffset == 0) == RequestedOffset;
+	});
+
+	// Members are extracted on the HTTP thread as the archive arrives.
+	Request->SetResponseBodyReceiveStream(Extractor);
+#endif
+
+	HttpRequest = Request;
+	HttpRequest->ProcessRequest();
+}
+
+void UAsyncPakBundleDownloader::Cancel()
+{
+	if (bFinished)
+	{
+		return;
+	}
+
+	// Still queued or waiting for the bandwidth limit, there is no request to cancel.
+	if (!HttpRequest.IsValid())
+	{
+		bWaitingForBandwidth = false;
+		FinishDownload(DownloadURL, 0, false);
+		return;
+	}
+
+	if (HttpRequest.IsValid())
+	{
+		// Completes the request as failed.
+		HttpRequest->CancelRequest();
+	}
+}
+
+void UAsyncPakBundleDownloader::HandleDownloadComplete(FHttpRequestPtr InRequest, FHttpResponsePtr HttpResponse, bool bSucceeded)
+{
+	const int32 HttpResponseCode = HttpResponse.IsValid() ? HttpResponse->GetResponseCode() : 0;
+	const bool bResponseOk = bSucceeded && UAsyncPakDownloader::GetBodyWriteOffset(HttpResponse, ArchiveOffset, ArchiveOffset == 0) == ArchiveOffset;
+
+#if !(ENGINE_MINOR_VERSION >= 4 && ENGINE_MAJOR_VERSION == 5)
+	// Older engine versions can't stream the body, extract the received archive in one go.
+	if (bResponseOk)
+	{
+		Extractor->Serialize(const_cast<uint8*>(HttpResponse->GetContent().GetData()), HttpResponse->GetContent().Num());
+	}
+#endif
+
+	HttpRequest.Reset();
+
+	// Continue with the next range of a paced download.
+	int64 RangeStart = 0, RangeEnd = 0, RangeTotal = 0;
+	if (bResponseOk && HttpResponseCode == EHttpResponseCodes::PartialContent && !Extractor->IsError() &&
+		UAsyncPakDownloader::ParseContentRange(HttpResponse->GetHeader(TEXT("Content-Range")), RangeStart, RangeEnd, RangeTotal) &&
+		RangeEnd + 1 < RangeTotal)
+	{
+		if (ArchiveOffset == 0)
+		{
+			FPakDownloadResumeState State;
+			State.ETag = HttpResponse->GetHeader(TEXT("ETag"));
+			State.LastModified = HttpResponse->GetHeader(TEXT("Last-Modified"));
+			RangeValidator = State.GetRangeValidator();
+		}
+
+		ArchiveOffset = RangeEnd + 1;
+		QueueRequest();
+		return;
+	}
+
+	FinishDownload(InRequest->GetURL(), HttpResponseCode, bResponseOk);
+}
+
+void UAsyncPakBundleDownloader::FinishDownload(const FString& URL, int32 HttpResponseCode, bool bResponseOk)
+{
+	if (bFinished)
+	{
+		return;
+	}
+
+	bFinished = true;
+
+	UPakDownloadManager* Manager = UPakDownloadManager::Get();
+
+	if (Manager)
+	{
+		Manager->GetBandwidthLimiter()->CancelDeferredStarts(this);
+	}
+
+	// A download cancelled while it was queued never created the extractor.
+	if (!bResponseOk || !Extractor.IsValid())
+	{
+		CompleteDownload(URL, HttpResponseCode, false);
+		return;
+	}
+
+	// Finish waits for the last members to be written, the download stays rooted until CompleteDownload.
+	TSharedPtr<FPakBundleExtractor, ESPMode::ThreadSafe> FinishedExtractor = Extractor;
+	Async(EAsyncExecution::ThreadPool, [this, FinishedExtractor, URL, HttpResponseCode]()
+	{
+		const bool bExtracted = FinishedExtractor->Finish();
+
+		AsyncTask(ENamedThreads::GameThread, [this, URL, HttpResponseCode, bExtracted]()
+		{
+			CompleteDownload(URL, HttpResponseCode, bExtracted);
+		});
+	});
+}
+
+void UAsyncPakBundleDownloader::CompleteDownload(const FString& URL, int32 HttpResponseCode, bool bExtracted)
+{
+	UPakDownloadManager* Manager = UPakDownloadManager::Get();
+
+	if (!bExtracted && Extractor.IsValid())
+	{
+		Extractor->Abort();
+	}
+
+	if (TakeHeldBackProgress())
+	{
+		OnProgress.Broadcast(BytesReceived, TotalBytes);
+	}
+
+	TArray<FString> Files = Extractor.IsValid() ? Extractor->GetExtractedFiles() : TArray<FString>();
+
+	Extractor.Reset();
+	RemoveFromRoot();
+
+	if (!bExtracted)
+	{
+		PAKLOADER_LOG(LL_ERROR, TEXT("Bundle download of %s failed (%d), %d files were extracted"),
+			*URL, HttpResponseCode, Files.Num());
+
+		if (Manager)
+		{
+			Manager->NotifyDownloadFinished(this, false);
+		}
+
+		OnFail.Broadcast(HttpResponseCode, Files);
+		return;
+	}
+
+	PAKLOADER_LOG(LL_LOG, TEXT("Extracted %d files from %s"), Files.Num(), *URL);
+
+	bool bMounted = true;
+	if (bMountPaks)
+	{
+		// Siblings like .utoc and .ucas are complete too, the pak mounts with them.
+		for (const FString& File : Files)
+		{
+			if (FPaths::GetExtension(File) == TEXT("pak") && !FPakLoader::Get()->MountPakFileEasy(File))
+			{
+				PAKLOADER_LOG(LL_ERROR, TEXT("Extracted pak %s could not be mounted"), *File);
+				bMounted = false;
+			}
+		}
+	}
+
+	if (Manager)
+	{
+		Manager->NotifyDownloadFinished(this, bMounted);
+	}
+
+	if (bMounted)
+	{
+		OnSuccess.Broadcast(HttpResponseCode, Files);
+	}
+	else
+	{
+		OnFail.Broadcast(HttpResponseCode, Files);
+	}
+}
+
+#if ENGINE_MINOR_VERSION >= 4 && ENGINE_MAJOR_VERSION == 5
+void UAsyncPakBundleDownloader::HandleDownloadProgress(FHttpRequestPtr InRequest, uint64 BytesSent, uint64 InBytesReceived)
+#else
+void UAsyncPakBundleDownloader::HandleDownloadProgress(FHttpRequestPtr InRequest, int32 BytesSent, int32 InBytesReceived)
+#endif
+{
+	if (!InRequest.IsValid())
+	{
+		return;
+	}
+
+	BytesReceived = ArchiveOffset + static_cast<int64>(InBytesReceived);
+	TotalBytes = UAsyncPakDownloader::GetResponseTotalSize(InRequest->GetResponse());
+
+	if (ShouldBroadcastProgress(DefaultProgressInterval))
+	{
+		OnProgress.Broadcast(BytesReceived, TotalBytes);
+	}
+}
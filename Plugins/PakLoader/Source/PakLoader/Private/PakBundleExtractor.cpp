@@ -0,0 +1,414 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#include "PakBundleExtractor.h"
+#include "PakDownloadFileWriter.h"
+#include "LogHelper.h"
+#include "Async/Async.h"
+#include "Misc/Paths.h"
+#include "Misc/ScopeLock.h"
+
+namespace PakBundleExtractor
+{
+	// Long names and pax headers are small, anything larger is not a sane archive.
+	static constexpr int64 MaxMetadataSize = 64 * 1024;
+}
+
+FPakBundleExtractor::FPakBundleExtractor(const FString& InDirectory)
+	: Directory(FPaths::ConvertRelativePathToFull(InDirectory))
+{
+	SetIsSaving(true);
+	FMemory::Memzero(Header);
+}
+
+FPakBundleExtractor::~FPakBundleExtractor()
+{
+	Abort();
+
+	// The workers add to ExtractedFiles.
+	for (TFuture<bool>& Member : PendingMembers)
+	{
+		Member.Wait();
+	}
+}
+
+bool FPakBundleExtractor::Finish()
+{
+	bool bMembersWritten = true;
+	for (TFuture<bool>& Member : PendingMembers)
+	{
+		bMembersWritten &= Member.Get();
+	}
+
+	PendingMembers.Empty();
+
+	if (!bEnded && !IsError())
+	{
+		Fail(TEXT("Archive is truncated"));
+	}
+
+	return bEnded && !IsError() && bMembersWritten;
+}
+
+void FPakBundleExtractor::Abort()
+{
+	if (MemberWriter.IsValid())
+	{
+		MemberStream.Reset();
+		MemberWriter->Abort(false);
+		MemberWriter.Reset();
+	}
+}
+
+TArray<FString> FPakBundleExtractor::GetExtractedFiles() const
+{
+	FScopeLock Lock(&ExtractedFilesLock);
+	return ExtractedFiles;
+}
+
+void FPakBundleExtractor::Serialize(void* Data, int64 Num)
+{
+	if (IsError())
+	{
+		return;
+	}
+
+	if (!bResponseChecked && Num > 0)
+	{
+		bResponseChecked = true;
+
+		// Error pages are not archives.
+		if (ResponseCheck && !ResponseCheck())
+		{
+			SetError();
+			return;
+		}
+	}
+
+	const uint8* Src = static_cast<const uint8*>(Data);
+
+	while (Num > 0 && !bEnded)
+	{
+		if (bInMember && MemberRemaining > 0)
+		{
+			const int64 Size = FMath::Min(Num, MemberRemaining);
+			if (!WriteContent(Src, Size))
+			{
+				return;
+			}
+
+			Src += Size;
+			Num -= Size;
+			MemberRemaining -= Size;
+		}
+		else if (bInMember && PaddingRemaining > 0)
+		{
+			const int64 Size = FMath::Min(Num, PaddingRemaining);
+
+			Src += Size;
+			Num -= Size;
+			PaddingRemaining -= Size;
+		}
+		else if (bInMember)
+		{
+			if (!EndMember())
+			{
+				return;
+			}
+		}
+		else
+		{
+			const int64 Size = FMath::Min(Num, RecordSize - HeaderBytes);
+			FMemory::Memcpy(Header + HeaderBytes, Src, Size);
+
+			Src += Size;
+			Num -= Size;
+			HeaderBytes += Size;
+
+			if (HeaderBytes == RecordSize)
+			{
+				HeaderBytes = 0;
+				if (!ParseHeader())
+				{
+					return;
+				}
+			}
+		}
+	}
+
+	// Members without content end without further bytes.
+	if (bInMember && MemberRemaining == 0 && PaddingRemaining == 0)
+	{
+		EndMember();
+	}
+}
+
+bool FPakBundleExtractor::ParseHeader()
+{
+	bool bZero = true;
+	for (int64 Index = 0; Index < RecordSize && bZero; ++Index)
+	{
+		bZero = Header[Index] == 0;
+	}
+
+	// Two zero records end the archive.
+	if (bZero)
+	{
+		bEnded = ++ZeroRecords >= 2;
+		return true;
+	}
+
+	ZeroRecords = 0;
+
+	// The checksum is computed with its own field filled with spaces.
+	int64 Checksum = 0;
+	for (int64 Index = 0; Index < RecordSize; ++Index)
+	{
+		Checksum += (Index >= 148 && Index < 156) ? ' ' : Header[Index];
+	}
+
+	if (Checksum != ParseOctal(Header + 148, 8))
+	{
+		Fail(TEXT("Header checksum mismatch"));
+		return false;
+	}
+
+	const int64 Size = ParseOctal(Header + 124, 12);
+	const uint8 TypeFlag = Header[156];
+
+	FString Name = ParseString(Header, 100);
+	if (FMemory::Memcmp(Header + 257, "ustar", 5) == 0)
+	{
+		const FString Prefix = ParseString(Header + 345, 155);
+		if (!Prefix.IsEmpty())
+		{
+			Name = Prefix / Name;
+		}
+	}
+
+	if (!PendingName.IsEmpty())
+	{
+		Name = PendingName;
+		PendingName.Empty();
+	}
+
+	bInMember = true;
+	MemberRemaining = Size;
+	PaddingRemaining = (RecordSize - Size % RecordSize) % RecordSize;
+
+	switch (TypeFlag)
+	{
+	case '0':
+	case '\0':
+	case '7':
+		MemberType = EMemberType::File;
+		return BeginMember(Name);
+
+	case 'L':
+	case 'x':
+		if (Size > PakBundleExtractor::MaxMetadataSize)
+		{
+			Fail(FString::Printf(TEXT("Header extension of %lld bytes"), Size));
+			return false;
+		}
+
+		MemberType = TypeFlag == 'L' ? EMemberType::LongName : EMemberType::PaxHeader;
+		MetadataBuffer.Reset(Size);
+		return true;
+
+	default:
+		// Directories are created with their files, links and global pax headers are not needed for paks.
+		MemberType = EMemberType::Skip;
+		return true;
+	}
+}
+
+bool FPakBundleExtractor::BeginMember(const FString& Name)
+{
+	MemberFilename = GetMemberFilename(Name);
+	if (MemberFilename.IsEmpty())
+	{
+		Fail(FString::Printf(TEXT("Member %s is outside of the target directory"), *Name));
+		return false;
+	}
+
+	// Most members are small, a buffer the size of the member is enough.
+	const int64 BufferSize = FMath::Min(MemberRemaining, FPakDownloadFileWriter::DefaultBufferSize);
+
+	MemberWriter = MakeShared<FPakDownloadFileWriter, ESPMode::ThreadSafe>(MemberFilename, BufferSize);
+	if (!MemberWriter->Start(false))
+	{
+		MemberWriter.Reset();
+		Fail(FString::Printf(TEXT("Unable to write %s"), *MemberFilename));
+		return false;
+	}
+
+	// Reserves the space and creates empty members, which have no content to write.
+	MemberWriter->Preallocate(MemberRemaining);
+	MemberStream = MemberWriter->CreateStream(0);
+
+	return true;
+}
+
+bool FPakBundleExtractor::WriteContent(const uint8* Data, int64 Size)
+{
+	switch (MemberType)
+	{
+	case EMemberType::File:
+		MemberStream->Serialize(const_cast<uint8*>(Data), Size);
+		if (MemberStream->IsError())
+		{
+			Fail(FString::Printf(TEXT("Writing %s failed"), *MemberFilename));
+			return false;
+		}
+		return true;
+
+	case EMemberType::LongName:
+	case EMemberType::PaxHeader:
+		MetadataBuffer.Append(Data, Size);
+		return true;
+
+	default:
+		return true;
+	}
+}
+
+bool FPakBundleExtractor::EndMember()
+{
+	bInMember = false;
+
+	switch (MemberType)
+	{
+	case EMemberType::File:
+	{
+		MemberStream->Close();
+		MemberStream.Reset();
+
+		TSharedRef<FPakDownloadFileWriter, ESPMode::ThreadSafe> Writer = MemberWriter.ToSharedRef();
+		MemberWriter.Reset();
+
+		// Finish waits until the writer flushed the member, the next member is received meanwhile.
+		const FString Filename = MemberFilename;
+		PendingMembers.Add(Async(EAsyncExecution::ThreadPool, [this, Writer, Filename]()
+		{
+			if (!Writer->Finish() || !Writer->Commit())
+			{
+				PAKLOADER_LOG(LL_ERROR, TEXT("Extracting bundle to %s failed: Writing %s failed"), *Directory, *Filename);
+				Writer->Abort(false);
+				return false;
+			}
+
+			PAKLOADER_LOG(LL_VERBOSE, TEXT("Extracted %s"), *Filename);
+
+			FScopeLock Lock(&ExtractedFilesLock);
+			ExtractedFiles.Add(Filename);
+			return true;
+		}));
+
+		return true;
+	}
+
+	case EMemberType::LongName:
+		PendingName = ParseString(MetadataBuffer.GetData(), MetadataBuffer.Num());
+		return true;
+
+	case EMemberType::PaxHeader:
+		PendingName = ParsePaxPath(MetadataBuffer);
+		return true;
+
+	default:
+		return true;
+	}
+}
+
+FString FPakBundleExtractor::GetMemberFilename(const FString& Name) const
+{
+	FString RelativeName = Name;
+	FPaths::NormalizeFilename(RelativeName);
+
+	if (RelativeName.IsEmpty() || RelativeName.StartsWith(TEXT("/")) || RelativeName.Contains(TEXT(":")) || RelativeName.EndsWith(TEXT("/")))
+	{
+		return FString();
+	}
+
+	TArray<FString> Parts;
+	RelativeName.ParseIntoArray(Parts, TEXT("/"));
+	if (Parts.Contains(TEXT("..")))
+	{
+		return FString();
+	}
+
+	return Directory / RelativeName;
+}
+
+int64 FPakBundleExtractor::ParseOctal(const uint8* Field, int32 Length)
+{
+	int64 Value = 0;
+	int32 Index = 0;
+
+	while (Index < Length && (Field[Index] == ' ' || Field[Index] == 0))
+	{
+		++Index;
+	}
+
+	for (; Index < Length && Field[Index] >= '0' && Field[Index] <= '7'; ++Index)
+	{
+		Value = Value * 8 + (Field[Index] - '0');
+	}
+
+	return Value;
+}
+
+FString FPakBundleExtractor::ParseString(const uint8* Field, int32 Length)
+{
+	int32 End = 0;
+	while (End < Length && Field[End] != 0)
+	{
+		++End;
+	}
+
+	FUTF8ToTCHAR Converted(reinterpret_cast<const ANSICHAR*>(Field), End);
+	return FString(Converted.Length(), Converted.Get());
+}
+
+FString FPakBundleExtractor::ParsePaxPath(const TArray<uint8>& Records)
+{
+	// Records are "<length> <key>=<value>\n", the length counts the whole record.
+	int32 Offset = 0;
+	while (Offset < Records.Num())
+	{
+		int32 Length = 0;
+		int32 Index = Offset;
+		while (Index < Records.Num() && Records[Index] >= '0' && Records[Index] <= '9')
+		{
+			Length = Length * 10 + (Records[Index] - '0');
+			++Index;
+		}
+
+		if (Length <= 0 || Offset + Length > Records.Num() || Index + 2 > Offset + Length)
+		{
+			break;
+		}
+
+		const FString Record = ParseString(Records.GetData() + Index + 1, Offset + Length - Index - 2);
+
+		FString Key, Value;
+		if (Record.Split(TEXT("="), &Key, &Value) && Key == TEXT("path"))
+		{
+			return Value;
+		}
+
+		Offset += Length;
+	}
+
+	return FString();
+}
+
+void FPakBundleExtractor::Fail(const FString& Reason)
+{
+	PAKLOADER_LOG(LL_ERROR, TEXT("Extracting bundle to %s failed: %s"), *Directory, *Reason);
+
+	Abort();
+
+	// Lets the HTTP layer cancel the request instead of streaming into nowhere.
+	SetError();
+}
@@ -0,0 +1,546 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#include "PakDownloadFileWriter.h"
+#include "PakLoaderModule.h"
+#include "LogHelper.h"
+#include "HAL/PlatformFileManager.h"
+#include "HAL/RunnableThread.h"
+#include "HAL/Event.h"
+#include "Misc/Paths.h"
+#include "Misc/ScopeLock.h"
+#include "HAL/FileManager.h"
+
+#if PLATFORM_LINUX || PLATFORM_ANDROID
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+FPakDownloadFileWriter::FPakDownloadFileWriter(const FString& InTargetFilename, int64 InBufferSize, bool bWriteInPlace)
+	: TargetFilename(InTargetFilename)
+	, TempFilename(bWriteInPlace ? InTargetFilename : InTargetFilename + TEXT(".part"))
+{
+	const int32 NumBlocks = FMath::Max<int32>(static_cast<int32>(InBufferSize / BlockSize), 2);
+
+	for (int32 Index = 0; Index < NumBlocks; ++Index)
+	{
+		FBlock* Block = Blocks.Add_GetRef(MakeUnique<FBlock>()).Get();
+		Block->Data.SetNumUninitialized(BlockSize);
+		FreeBlocks.Add(Block);
+	}
+
+	MaxExtraBlocks = NumBlocks;
+
+	BlockSubmittedEvent = FPlatformProcess::GetSynchEventFromPool(false);
+	BlockFreedEvent = FPlatformProcess::GetSynchEventFromPool(false);
+}
+
+FPakDownloadFileWriter::~FPakDownloadFileWriter()
+{
+	StopThread();
+
+	// Blocks the writer didn't get to, pooled ones are owned by Blocks.
+	FBlock* Block = nullptr;
+	while (PendingBlocks.Dequeue(Block))
+	{
+		if (!Block->bPooled)
+		{
+			delete Block;
+		}
+	}
+
+	if (FileHandle)
+	{
+		delete FileHandle;
+		FileHandle = nullptr;
+	}
+
+	FPlatformProcess::ReturnSynchEventToPool(BlockSubmittedEvent);
+	FPlatformProcess::ReturnSynchEventToPool(BlockFreedEvent);
+}
+
+bool FPakDownloadFileWriter::Start(bool bInKeepExistingContent, int64 InExistingContentSize)
+{
+	if (Thread)
+	{
+		return true;
+	}
+
+	bKeepExistingContent = bInKeepExistingContent;
+	ExistingContentSize = InExistingContentSize;
+
+	Thread = FRunnableThread::Create(this, TEXT("PakDownloadFileWriter"), 0, TPri_BelowNormal);
+	return Thread != nullptr;
+}
+
+TSharedRef<FPakDownloadStream, ESPMode::ThreadSafe> FPakDownloadFileWriter::CreateStream(int64 Offset, bool bWaitForBlocks)
+{
+	return MakeShared<FPakDownloadStream, ESPMode::ThreadSafe>(AsShared(), Offset, bWaitForBlocks);
+}
+
+void FPakDownloadFileWriter::Preallocate(int64 FileSize)
+{
+	// Size requests are rare and carry no data. Each gets its own block outside the pool, a queued one is never overwritten.
+	FBlock* Block = new FBlock();
+	Block->Offset = FileSize;
+	Block->bSetFileSize = true;
+	Block->bPooled = false;
+	SubmitBlock(Block);
+}
+
+bool FPakDownloadFileWriter::Finish(int64 FinalSize)
+{
+	bFinishRequested = true;
+	BlockSubmittedEvent->Trigger();
+
+	StopThread();
+
+	if (FileHandle)
+	{
+		if (FinalSize != INDEX_NONE && FileHandle->Size() != FinalSize && !FileHandle->Truncate(FinalSize))
+		{
+			bWriteFailed = true;
+		}
+
+		// Bytes past a truncation were hashed too, the hash is only usable if it covers exactly the file.
+		bContentHashValid = !bWriteFailed && bHashContiguous && HashedBytes == FileHandle->Size();
+		if (bContentHashValid)
+		{
+			ContentSha.Final();
+			ContentSha.GetHash(ContentHash.Hash);
+		}
+
+		FileHandle->Flush();
+		delete FileHandle;
+		FileHandle = nullptr;
+	}
+
+	return !bWriteFailed;
+}
+
+bool FPakDownloadFileWriter::GetContentHash(FSHAHash& OutHash) const
+{
+	if (!bContentHashValid)
+	{
+		return false;
+	}
+
+	OutHash = ContentHash;
+	return true;
+}
+
+bool FPakDownloadFileWriter::GetTail(TArray<uint8>& OutTail) const
+{
+	if (!bContentHashValid)
+	{
+		return false;
+	}
+
+	OutTail = Tail;
+	return true;
+}
+
+bool FPakDownloadFileWriter::Commit()
+{
+	if (TempFilename == TargetFilename)
+	{
+		return true;
+	}
+
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+
+	// Rename replaces the target atomically on POSIX platforms, other platforms refuse to move onto an existing file.
+	if (!PlatformFile.MoveFile(*TargetFilename, *TempFilename))
+	{
+		PlatformFile.DeleteFile(*TargetFilename);
+
+		if (!PlatformFile.MoveFile(*TargetFilename, *TempFilename))
+		{
+			PAKLOADER_LOG(LL_ERROR, TEXT("Unable to move downloaded file %s to %s"), *TempFilename, *TargetFilename);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void FPakDownloadFileWriter::Abort(bool bKeepPartialFile)
+{
+	bStopRequested = true;
+
+	StopThread();
+
+	if (FileHandle)
+	{
+		delete FileHandle;
+		FileHandle = nullptr;
+	}
+
+	if (!bKeepPartialFile)
+	{
+		FPlatformFileManager::Get().GetPlatformFile().DeleteFile(*TempFilename);
+	}
+}
+
+FPakDownloadFileWriter::FBlock* FPakDownloadFileWriter::AcquireBlock(bool bWait)
+{
+	while (!HasFailed())
+	{
+		{
+			FScopeLock Lock(&FreeBlocksLock);
+			if (FreeBlocks.Num() > 0)
+			{
+				return FreeBlocks.Pop(false);
+			}
+		}
+
+		// The network outran the disk. Keep receiving, the extra memory is returned as soon as the writer caught up.
+		if (!bWait)
+		{
+			// A disk that doesn't catch up must not let the download grow into memory, the caller stops the request instead.
+			if (NumExtraBlocks.fetch_add(1) >= MaxExtraBlocks)
+			{
+				NumExtraBlocks.fetch_sub(1);
+				PAKLOADER_LOG(LL_WARNING, TEXT("Writing %s can't keep up with the download, stopping the request"), *TempFilename);
+				return nullptr;
+			}
+
+			FBlock* Block = new FBlock();
+			Block->Data.SetNumUninitialized(BlockSize);
+			Block->bPooled = false;
+			return Block;
+		}
+
+		// Several streams may wait for the same event, wake up periodically instead of relying on one trigger each.
+		BlockFreedEvent->Wait(10);
+	}
+
+	return nullptr;
+}
+
+void FPakDownloadFileWriter::SubmitBlock(FBlock* Block)
+{
+	PendingBlocks.Enqueue(Block);
+	BlockSubmittedEvent->Trigger();
+}
+
+void FPakDownloadFileWriter::ReleaseBlock(FBlock* Block)
+{
+	if (!Block->bPooled)
+	{
+		if (!Block->bSetFileSize)
+		{
+			NumExtraBlocks.fetch_sub(1);
+		}
+
+		delete Block;
+		return;
+	}
+
+	Block->Size = 0;
+
+	{
+		FScopeLock Lock(&FreeBlocksLock);
+		FreeBlocks.Add(Block);
+	}
+
+	BlockFreedEvent->Trigger();
+}
+
+bool FPakDownloadFileWriter::OpenFile()
+{
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+
+	PlatformFile.CreateDirectoryTree(*FPaths::GetPath(TempFilename));
+
+	// Shared for reading, a streaming mount reads the file while it is written.
+	FileHandle = PlatformFile.OpenWrite(*TempFilename, bKeepExistingContent, true);
+	FilePosition = FileHandle ? FileHandle->Tell() : 0;
+
+	if (!FileHandle)
+	{
+		PAKLOADER_LOG(LL_ERROR, TEXT("Unable to open %s for writing"), *TempFilename);
+		return false;
+	}
+
+	// A preallocated partial file is larger than what was received.
+	const int64 ExistingSize = ExistingContentSize != INDEX_NONE ? FMath::Min(ExistingContentSize, FilePosition) : FilePosition;
+
+	if (ExistingSize > 0 && !HashExistingContent(ExistingSize))
+	{
+		bHashContiguous = false;
+	}
+
+	return true;
+}
+
+bool FPakDownloadFileWriter::HashExistingContent(int64 Size)
+{
+	TUniquePtr<IFileHandle> ReadHandle(FPlatformFileManager::Get().GetPlatformFile().OpenRead(*TempFilename, true));
+
+	if (!ReadHandle)
+	{
+		return false;
+	}
+
+	TArray<uint8> Chunk;
+	Chunk.SetNumUninitialized(BlockSize);
+
+	for (int64 Offset = 0; Offset < Size; Offset += Chunk.Num())
+	{
+		const int64 ToRead = FMath::Min<int64>(Chunk.Num(), Size - Offset);
+		if (!ReadHandle->Read(Chunk.GetData(), ToRead))
+		{
+			return false;
+		}
+
+		UpdateContentHash(Chunk.GetData(), Offset, ToRead);
+	}
+
+	return true;
+}
+
+void FPakDownloadFileWriter::UpdateContentHash(const uint8* Data, int64 Offset, int64 Size)
+{
+	if (!bHashContiguous)
+	{
+		return;
+	}
+
+	if (Offset != HashedBytes)
+	{
+		bHashContiguous = false;
+		return;
+	}
+
+	ContentSha.Update(Data, Size);
+	HashedBytes += Size;
+
+	// Keep the last TailSize bytes, the pak footer is checked from there without reading the file again.
+	const int64 Keep = FMath::Min<int64>(Size, TailSize);
+	const int64 Drop = FMath::Max<int64>(Tail.Num() + Keep - TailSize, 0);
+
+	if (Drop > 0)
+	{
+		Tail.RemoveAt(0, Drop, false);
+	}
+
+	Tail.Append(Data + Size - Keep, Keep);
+}
+
+bool FPakDownloadFileWriter::WriteBlock(const FBlock& Block)
+{
+	// The file is opened lazily so bodies that never arrive leave no file behind.
+	if (!FileHandle && !OpenFile())
+	{
+		return false;
+	}
+
+	if (Block.bSetFileSize)
+	{
+		return SetFileSize(Block.Offset);
+	}
+
+	if (FilePosition != Block.Offset && !FileHandle->Seek(Block.Offset))
+	{
+		PAKLOADER_LOG(LL_ERROR, TEXT("Unable to seek to %lld in %s"), Block.Offset, *TempFilename);
+		return false;
+	}
+
+	if (!FileHandle->Write(Block.Data.GetData(), Block.Size))
+	{
+		PAKLOADER_LOG(LL_ERROR, TEXT("Writing to %s failed"), *TempFilename);
+		return false;
+	}
+
+	UpdateContentHash(Block.Data.GetData(), Block.Offset, Block.Size);
+
+	FilePosition = Block.Offset + Block.Size;
+	BytesWritten += Block.Size;
+	WrittenEnd = FilePosition;
+
+	if (BlockWrittenCallback)
+	{
+		BlockWrittenCallback(Block.Offset, Block.Size);
+	}
+	return true;
+}
+
+bool FPakDownloadFileWriter::SetFileSize(int64 Size)
+{
+#if PLATFORM_LINUX || PLATFORM_ANDROID
+	// Truncate only makes the file sparse, allocating the blocks lets the file system keep them together.
+	if (Size > FileHandle->Size())
+	{
+		const FString AbsolutePath = IFileManager::Get().ConvertToAbsolutePathForExternalAppForWrite(*TempFilename);
+		const int Fd = open(TCHAR_TO_UTF8(*AbsolutePath), O_WRONLY);
+
+		if (Fd >= 0)
+		{
+			const int Result = posix_fallocate(Fd, 0, Size);
+			close(Fd);
+
+			if (Result == 0)
+			{
+				return true;
+			}
+
+			if (Result == ENOSPC)
+			{
+				PAKLOADER_LOG(LL_ERROR, TEXT("Not enough disk space to allocate %lld bytes for %s"), Size, *TempFilename);
+				return false;
+			}
+		}
+
+		// Not every file system supports it, a sparse file works too.
+	}
+#endif
+
+	// Extending the file allocates its clusters on NTFS.
+	return FileHandle->Truncate(Size);
+}
+
+uint32 FPakDownloadFileWriter::Run()
+{
+	while (!bStopRequested)
+	{
+		FBlock* Block = nullptr;
+
+		if (!PendingBlocks.Dequeue(Block))
+		{
+			if (bFinishRequested)
+			{
+				break;
+			}
+
+			BlockSubmittedEvent->Wait();
+			continue;
+		}
+
+		const bool bWritten = WriteBlock(*Block);
+		ReleaseBlock(Block);
+
+		if (!bWritten)
+		{
+			bWriteFailed = true;
+			BlockFreedEvent->Trigger();
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+void FPakDownloadFileWriter::Stop()
+{
+	bStopRequested = true;
+	BlockSubmittedEvent->Trigger();
+	BlockFreedEvent->Trigger();
+}
+
+void FPakDownloadFileWriter::StopThread()
+{
+	if (Thread)
+	{
+		if (!bFinishRequested)
+		{
+			Stop();
+		}
+
+		Thread->WaitForCompletion();
+		delete Thread;
+		Thread = nullptr;
+	}
+}
+
+FPakDownloadStream::FPakDownloadStream(const TSharedRef<FPakDownloadFileWriter, ESPMode::ThreadSafe>& InWriter, int64 InOffset, bool bInWaitForBlocks)
+	: Writer(InWriter)
+	, bWaitForBlocks(bInWaitForBlocks)
+	, StartOffset(InOffset)
+{
+	SetIsSaving(true);
+	SetIsPersistent(true);
+}
+
+FPakDownloadStream::~FPakDownloadStream()
+{
+	if (CurrentBlock)
+	{
+		Writer->ReleaseBlock(CurrentBlock);
+		CurrentBlock = nullptr;
+	}
+}
+
+void FPakDownloadStream::Close()
+{
+	if (CurrentBlock)
+	{
+		if (CurrentBlock->Size > 0 && !Writer->HasFailed())
+		{
+			Writer->SubmitBlock(CurrentBlock);
+		}
+		else
+		{
+			Writer->ReleaseBlock(CurrentBlock);
+		}
+
+		CurrentBlock = nullptr;
+	}
+}
+
+void FPakDownloadStream::Serialize(void* Data, int64 Num)
+{
+	const uint8* Src = static_cast<const uint8*>(Data);
+
+	if (!bStartOffsetResolved && Num > 0)
+	{
+		if (StartOffsetResolver)
+		{
+			StartOffset = StartOffsetResolver();
+		}
+
+		bStartOffsetResolved = true;
+	}
+
+	if (StartOffset == INDEX_NONE)
+	{
+		// Lets the HTTP layer cancel the request instead of streaming into nowhere.
+		SetError();
+		return;
+	}
+
+	while (Num > 0)
+	{
+		if (!CurrentBlock)
+		{
+			CurrentBlock = Writer->AcquireBlock(bWaitForBlocks);
+
+			if (!CurrentBlock)
+			{
+				SetError();
+				return;
+			}
+
+			CurrentBlock->Offset = StartOffset + BytesReceived;
+		}
+
+		const int64 Chunk = FMath::Min(Num, FPakDownloadFileWriter::BlockSize - CurrentBlock->Size);
+		FMemory::Memcpy(CurrentBlock->Data.GetData() + CurrentBlock->Size, Src, Chunk);
+
+		CurrentBlock->Size += Chunk;
+		BytesReceived += Chunk;
+		Src += Chunk;
+		Num -= Chunk;
+
+		if (CurrentBlock->Size == FPakDownloadFileWriter::BlockSize)
+		{
+			Writer->SubmitBlock(CurrentBlock);
+			CurrentBlock = nullptr;
+		}
+	}
+}
+
+FString FPakDownloadStream::GetArchiveName() const
+{
+	return Writer->GetTempFilename();
+}
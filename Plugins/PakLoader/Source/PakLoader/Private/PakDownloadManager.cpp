@@ -0,0 +1,172 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#include "PakDownloadManager.h"
+#include "PakDownloadTask.h"
+#include "PakBandwidthLimiter.h"
+#include "Engine/Engine.h"
+
+void UPakDownloadManager::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	BandwidthLimiter = MakeShared<FPakBandwidthLimiter, ESPMode::ThreadSafe>();
+
+#if ENGINE_MAJOR_VERSION == 5
+	TickerHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateUObject(this, &UPakDownloadManager::TickBandwidthLimiter));
+#else
+	TickerHandle = FTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateUObject(this, &UPakDownloadManager::TickBandwidthLimiter));
+#endif
+}
+
+void UPakDownloadManager::Deinitialize()
+{
+	CancelAllDownloads();
+
+#if ENGINE_MAJOR_VERSION == 5
+	FTSTicker::GetCoreTicker().RemoveTicker(TickerHandle);
+#else
+	FTicker::GetCoreTicker().RemoveTicker(TickerHandle);
+#endif
+	TickerHandle.Reset();
+
+	Super::Deinitialize();
+}
+
+UPakDownloadManager* UPakDownloadManager::Get()
+{
+	return GEngine ? GEngine->GetEngineSubsystem<UPakDownloadManager>() : nullptr;
+}
+
+void UPakDownloadManager::SetMaxConcurrentDownloads(int32 InMaxConcurrentDownloads)
+{
+	MaxConcurrentDownloads = FMath::Max(InMaxConcurrentDownloads, 1);
+
+	// Lowering the limit lets running downloads finish, raising it starts queued ones right away.
+	StartQueuedDownloads();
+}
+
+void UPakDownloadManager::SetBandwidthLimit(int64 BytesPerSecond)
+{
+	BandwidthLimiter->SetLimit(BytesPerSecond);
+}
+
+int64 UPakDownloadManager::GetBandwidthLimit() const
+{
+	return BandwidthLimiter->GetLimit();
+}
+
+void UPakDownloadManager::SetDownloadPriority(UPakDownloadTask* Download, int32 Priority)
+{
+	if (!Download)
+	{
+		return;
+	}
+
+	Download->SetPriority(Priority);
+
+	if (QueuedDownloads.Contains(Download))
+	{
+		SortQueue();
+	}
+}
+
+void UPakDownloadManager::CancelDownload(UPakDownloadTask* Download)
+{
+	if (Download)
+	{
+		Download->Cancel();
+	}
+}
+
+void UPakDownloadManager::CancelAllDownloads()
+{
+	// Cancel queued downloads first, otherwise cancelling running ones would start them.
+	TArray<UPakDownloadTask*> Downloads = QueuedDownloads;
+	Downloads.Append(ActiveDownloads);
+
+	for (UPakDownloadTask* Download : Downloads)
+	{
+		Download->Cancel();
+	}
+}
+
+FPakDownloadManagerProgress UPakDownloadManager::GetAggregateProgress() const
+{
+	FPakDownloadManagerProgress Progress;
+	Progress.NumQueued = QueuedDownloads.Num();
+	Progress.NumActive = ActiveDownloads.Num();
+	Progress.NumSucceeded = NumSucceeded;
+	Progress.NumFailed = NumFailed;
+
+	for (const UPakDownloadTask* Download : ActiveDownloads)
+	{
+		Progress.BytesReceived += Download->GetBytesReceived();
+		Progress.TotalBytes += Download->GetTotalBytes();
+	}
+
+	return Progress;
+}
+
+void UPakDownloadManager::QueueDownload(UPakDownloadTask* Download)
+{
+	Download->QueueSequence = NextQueueSequence++;
+
+	QueuedDownloads.Add(Download);
+	SortQueue();
+
+	StartQueuedDownloads();
+}
+
+void UPakDownloadManager::NotifyDownloadFinished(UPakDownloadTask* Download, bool bSuccess)
+{
+	const bool bWasKnown = ActiveDownloads.Remove(Download) > 0 || QueuedDownloads.Remove(Download) > 0;
+
+	if (!bWasKnown)
+	{
+		return;
+	}
+
+	if (bSuccess)
+	{
+		++NumSucceeded;
+	}
+	else
+	{
+		++NumFailed;
+	}
+
+	OnDownloadFinished.Broadcast(Download, bSuccess);
+
+	StartQueuedDownloads();
+}
+
+void UPakDownloadManager::SortQueue()
+{
+	QueuedDownloads.StableSort([](const UPakDownloadTask& A, const UPakDownloadTask& B)
+	{
+		if (A.GetPriority() != B.GetPriority())
+		{
+			return A.GetPriority() > B.GetPriority();
+		}
+
+		return A.QueueSequence < B.QueueSequence;
+	});
+}
+
+bool UPakDownloadManager::TickBandwidthLimiter(float DeltaTime)
+{
+	BandwidthLimiter->Tick();
+	return true;
+}
+
+void UPakDownloadManager::StartQueuedDownloads()
+{
+	while (ActiveDownloads.Num() < MaxConcurrentDownloads && QueuedDownloads.Num() > 0)
+	{
+		UPakDownloadTask* Download = QueuedDownloads[0];
+		QueuedDownloads.RemoveAt(0);
+
+		ActiveDownloads.Add(Download);
+		Download->StartDownload();
+	}
+}
@@ -0,0 +1,38 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#include "PakDownloadState.h"
+#include "JsonObjectConverter.h"
+#include "Misc/FileHelper.h"
+
+FString FPakDownloadResumeState::GetRangeValidator() const
+{
+	// Weak ETags (W/"...") are not allowed in If-Range.
+	if (!ETag.IsEmpty() && !ETag.StartsWith(TEXT("W/")))
+	{
+		return ETag;
+	}
+
+	return LastModified;
+}
+
+bool FPakDownloadResumeState::LoadFromFile(const FString& Filename)
+{
+	FString JsonString;
+	if (!FFileHelper::LoadFileToString(JsonString, *Filename))
+	{
+		return false;
+	}
+
+	return FJsonObjectConverter::JsonObjectStringToUStruct(JsonString, this, 0, 0);
+}
+
+bool FPakDownloadResumeState::SaveToFile(const FString& Filename) const
+{
+	FString JsonString;
+	if (!FJsonObjectConverter::UStructToJsonObjectString(*this, JsonString))
+	{
+		return false;
+	}
+
+	return FFileHelper::SaveStringToFile(JsonString, *Filename);
+}
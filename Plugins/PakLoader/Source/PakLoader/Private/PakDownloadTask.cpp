@@ -0,0 +1,35 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#include "PakDownloadTask.h"
+
+bool UPakDownloadTask::ShouldBroadcastProgress(float Interval)
+{
+	const double Now = FPlatformTime::Seconds();
+	if (Now - LastProgressBroadcastTime < Interval)
+	{
+		bProgressPending = true;
+		return false;
+	}
+
+	LastProgressBroadcastTime = Now;
+	bProgressPending = false;
+	return true;
+}
+
+bool UPakDownloadTask::TakeHeldBackProgress()
+{
+	if (!bProgressPending)
+	{
+		return false;
+	}
+
+	bProgressPending = false;
+	LastProgressBroadcastTime = FPlatformTime::Seconds();
+	return true;
+}
+
+bool UPakDownloadTask::IsHttpUrl(const FString& URL)
+{
+	const FString Lower = URL.ToLower();
+	return Lower.StartsWith("http://") || Lower.StartsWith("https://");
+}
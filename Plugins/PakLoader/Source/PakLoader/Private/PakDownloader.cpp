@@ -1,9 +1,43 @@
 // Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
 
 #include "PakDownloader.h"
+#include "PakDownloadFileWriter.h"
+#include "PakDownloadManager.h"
+#include "PakBandwidthLimiter.h"
+#include "PakBlockManifest.h"
+#include "PakLoader.h"
+#include "LogHelper.h"
+#include "PakTraceRecorder.h"
 #include "HttpModule.h"
-#include "Misc/FileHelper.h"
+#include "HAL/PlatformFileManager.h"
 #include "Misc/Paths.h"
+#include "Misc/SecureHash.h"
+#include "Async/Async.h"
+
+namespace PakDownloader
+{
+	// A segment is fetched again this often before the whole download fails.
+	static constexpr int32 MaxSegmentRetries = 3;
+
+	// Seconds of transfer the connection count is measured over before it is adjusted.
+	static constexpr double SegmentAdaptInterval = 1.0;
+
+	// Seconds between two throughput samples and weight of the newest sample in the smoothed rate.
+	static constexpr double ThroughputSampleInterval = 0.25;
+	static constexpr double ThroughputSmoothing = 0.3;
+
+	// Seconds between updates of the resume sidecar while a download is running.
+	static constexpr double ResumeStateSaveInterval = 1.0;
+
+	// Bytes requested from every mirror to measure it, small enough to not waste bandwidth on the slower ones.
+	static constexpr int64 MirrorProbeSize = 64 * 1024;
+
+	static TSharedPtr<FPakBandwidthLimiter, ESPMode::ThreadSafe> GetBandwidthLimiter()
+	{
+		UPakDownloadManager* Manager = UPakDownloadManager::Get();
+		return Manager ? Manager->GetBandwidthLimiter() : nullptr;
+	}
+}
 
 UAsyncPakDownloader::UAsyncPakDownloader(const FObjectInitializer& ObjectInitializer)
 	: Super(ObjectInitializer)
@@ -15,19 +49,78 @@ UAsyncPakDownloader::UAsyncPakDownloader(const FObjectInitializer& ObjectInitial
 }
 
 UAsyncPakDownloader* UAsyncPakDownloader::DownloadPak(const FString &URL, const FString &SavePath)
+{
+	return DownloadPakWithOptions(URL, SavePath, FPakDownloadOptions());
+}
+
+UAsyncPakDownloader* UAsyncPakDownloader::DownloadPakWithOptions(const FString &URL, const FString &SavePath, const FPakDownloadOptions &Options)
 {
 	checkf(IsHttpUrl(URL), TEXT("Url passed to DownloadPak does not start with http:// or https://. Since UE 5.3 this is required."));
 
 	UAsyncPakDownloader* DownloadTask = NewObject<UAsyncPakDownloader>();
-	DownloadTask->StartDownload(URL, SavePath);
+	DownloadTask->Options = Options;
+	DownloadTask->DownloadURL = URL;
+	DownloadTask->SaveFilePath = SavePath;
+
+	UPakDownloadManager* Manager = UPakDownloadManager::Get();
+	if (Manager)
+	{
+		Manager->QueueDownload(DownloadTask);
+	}
+	else
+	{
+		DownloadTask->StartDownload();
+	}
+
+	return DownloadTask;
+}
+
+UAsyncPakDownloader* UAsyncPakDownloader::DownloadPakFromMirrors(const TArray<FString> &URLs, const FString &SavePath, const FPakDownloadOptions &Options)
+{
+	checkf(URLs.Num() > 0, TEXT("DownloadPakFromMirrors requires at least one URL."));
+
+	if (URLs.Num() == 1)
+	{
+		return DownloadPakWithOptions(URLs[0], SavePath, Options);
+	}
+
+	UAsyncPakDownloader* DownloadTask = NewObject<UAsyncPakDownloader>();
+	DownloadTask->Options = Options;
+	DownloadTask->DownloadURL = URLs[0];
+	DownloadTask->SaveFilePath = SavePath;
+
+	for (const FString& URL : URLs)
+	{
+		checkf(IsHttpUrl(URL), TEXT("Url passed to DownloadPakFromMirrors does not start with http:// or https://. Since UE 5.3 this is required."));
+
+		FMirror& Mirror = DownloadTask->Mirrors.AddDefaulted_GetRef();
+		Mirror.URL = URL;
+	}
+
+	UPakDownloadManager* Manager = UPakDownloadManager::Get();
+	if (Manager)
+	{
+		Manager->QueueDownload(DownloadTask);
+	}
+	else
+	{
+		DownloadTask->StartDownload();
+	}
 
 	return DownloadTask;
 }
 
-void UAsyncPakDownloader::StartDownload(const FString &URL, const FString &SavePath)
+void UAsyncPakDownloader::StartDownload()
 {
-	SaveFilePath = SavePath;
-	
+	// The download starts again once the first mirror answered its probe.
+	if (Mirrors.Num() > 0 && ActiveMirror == INDEX_NONE)
+	{
+		ProbeMirrors();
+		return;
+	}
+
+	const FString URL = DownloadURL;
+
 	// If the user did not specify a filename, try to extract it from the download URL.
 	const FString SaveFilePathCleanFilename = FPaths::GetCleanFilename(SaveFilePath);
 	if (SaveFilePath.Len() > 1 && (SaveFilePathCleanFilename.Len() == 0 || !SaveFilePathCleanFilename.Contains(".")))
@@ -40,12 +133,93 @@ void UAsyncPakDownloader::StartDownload(const FString &URL, const FString &SaveP
 		}
 	}
 
-	// Create the Http request and add to pending request list
-#if ENGINE_MINOR_VERSION <= 25 && ENGINE_MAJOR_VERSION == 4
-	TSharedRef<IHttpRequest> HttpRequest = FHttpModule::Get().CreateRequest();
-#else
-	auto HttpRequest = FHttpModule::Get().CreateRequest();
-#endif
+	FileWriter = MakeShared<FPakDownloadFileWriter, ESPMode::ThreadSafe>(SaveFilePath);
+	DownloadStartTime = FPlatformTime::Seconds();
+
+	ResponseState.URL = URL;
+	ResumeOffset = GetResumeOffset(URL);
+	ProgressStartBytes = ResumeOffset;
+
+	// A partial download of the new file is closer to completion than the old file, continue that instead.
+	if (Options.bDeltaUpdate && ResumeOffset == 0 && FPlatformFileManager::Get().GetPlatformFile().FileExists(*SaveFilePath))
+	{
+		StartDeltaUpdate();
+		return;
+	}
+
+	StartMainRequest();
+}
+
+void UAsyncPakDownloader::StartMainRequest()
+{
+	// A partial file is continued with a single request, the segments of a new download start after the first one.
+	bSegmented = Options.MaxSegments > 1 && ResumeOffset == 0;
+
+	FileWriter->Start(ResumeOffset > 0, ResumeOffset);
+	QueueMainRequest();
+}
+
+void UAsyncPakDownloader::QueueMainRequest()
+{
+	TSharedPtr<FPakBandwidthLimiter, ESPMode::ThreadSafe> Limiter = PakDownloader::GetBandwidthLimiter();
+	MainRequestSize = Limiter.IsValid() ? Limiter->GetRequestSize() : 0;
+
+	if (MainRequestSize <= 0)
+	{
+		SendMainRequest();
+		return;
+	}
+
+	bWaitingForBandwidth = true;
+
+	TWeakObjectPtr<UAsyncPakDownloader> WeakThis(this);
+	Limiter->StartWhenAvailable(this, MainRequestSize, [WeakThis]()
+	{
+		UAsyncPakDownloader* This = WeakThis.Get();
+		if (This && This->bWaitingForBandwidth && !This->bFinished)
+		{
+			This->bWaitingForBandwidth = false;
+			This->SendMainRequest();
+		}
+	});
+}
+
+void UAsyncPakDownloader::SendMainRequest()
+{
+	const FString& URL = GetActiveURL();
+
+	// Updated by the headers of the new response.
+	ContentRangeStart = 0;
+
+	// Under a bandwidth limit the file is fetched in ranges of MainRequestSize, HandleDownloadComplete continues behind each one.
+	const int64 RangeEnd = MainRequestSize > 0 ? ResumeOffset + MainRequestSize - 1 : INDEX_NONE;
+
+	FHttpRequestPtr HttpRequest;
+	if (ResumeOffset > 0)
+	{
+		// If-Range makes the server send the whole file with 200 instead of a range when the file changed in between.
+		// Validators of one mirror mean nothing to another, the size check in AttachStream protects those ranges.
+		HttpRequest = CreateHttpRequest(ResumeOffset, RangeEnd, MirrorFailovers == 0 ? ResponseState.GetRangeValidator() : FString());
+
+		// Ranges of a paced download follow each other, only the first one resumes a partial file.
+		if (!MainStream.IsValid())
+		{
+			PAKLOADER_LOG(LL_LOG, TEXT("Resuming download of %s at %lld bytes"), *URL, ResumeOffset);
+		}
+	}
+	else if (bSegmented)
+	{
+		HttpRequest = CreateHttpRequest(0, (MainRequestSize > 0 ? FMath::Min(MainRequestSize, Options.SegmentSize) : Options.SegmentSize) - 1, FString());
+	}
+	else
+	{
+		HttpRequest = CreateHttpRequest(0, RangeEnd, FString());
+	}
+
+	if (ResumeOffset == 0)
+	{
+		AddRevalidationHeaders(HttpRequest);
+	}
 
 	HttpRequest->OnHeaderReceived().BindUObject(this, &UAsyncPakDownloader::HandleHeaderReceived);
 	HttpRequest->OnProcessRequestComplete().BindUObject(this, &UAsyncPakDownloader::HandleDownloadComplete);
@@ -54,60 +228,1365 @@ void UAsyncPakDownloader::StartDownload(const FString &URL, const FString &SaveP
 #else
 	HttpRequest->OnRequestProgress().BindUObject(this, &UAsyncPakDownloader::HandleDownloadProgress);
 #endif
-	HttpRequest->SetURL(URL);
+
+	MainStream = AttachStream(HttpRequest, ResumeOffset, true);
+
+	MainRequest = HttpRequest;
+	HttpRequest->ProcessRequest();
+}
+
+void UAsyncPakDownloader::Cancel()
+{
+	if (bFinished)
+	{
+		return;
+	}
+
+	bCancelRequested = true;
+
+	// Waiting for the bandwidth limit, there is no request to cancel.
+	if (bWaitingForBandwidth)
+	{
+		bWaitingForBandwidth = false;
+		FinishDownload(false, 0);
+		return;
+	}
+
+	// Still queued or probing mirrors, nothing to clean up.
+	if (!FileWriter.IsValid())
+	{
+		CancelProbes();
+
+		bFinished = true;
+		RemoveFromRoot();
+
+		if (UPakDownloadManager* Manager = UPakDownloadManager::Get())
+		{
+			Manager->NotifyDownloadFinished(this, false);
+		}
+
+		OnFail.Broadcast(0, 0, TEXT(""), 0);
+		return;
+	}
+
+	if (bSegmentsStarted)
+	{
+		CancelSegments();
+		FinishDownload(false, 0);
+	}
+	else if (bDeltaUpdate)
+	{
+		// The manifest request must not fall back to a full download, a running comparison is ignored once it is done.
+		if (MainRequest.IsValid())
+		{
+			MainRequest->OnProcessRequestComplete().Unbind();
+			MainRequest->CancelRequest();
+		}
+
+		FinishDownload(false, 0);
+	}
+	else if (MainRequest.IsValid())
+	{
+		// Completes the request as failed, HandleDownloadComplete keeps the partial file.
+		MainRequest->CancelRequest();
+	}
+}
+
+void UAsyncPakDownloader::StartDeltaUpdate()
+{
+	bDeltaUpdate = true;
+
+	const FString ManifestURL = Options.BlockManifestURL.IsEmpty() ? GetActiveURL() + TEXT(".blockmap") : Options.BlockManifestURL;
+
+#if ENGINE_MINOR_VERSION <= 25 && ENGINE_MAJOR_VERSION == 4
+	TSharedRef<IHttpRequest> HttpRequest = FHttpModule::Get().CreateRequest();
+#else
+	auto HttpRequest = FHttpModule::Get().CreateRequest();
+#endif
+
+	HttpRequest->SetURL(ManifestURL);
 	HttpRequest->SetVerb(TEXT("GET"));
+	HttpRequest->OnProcessRequestComplete().BindUObject(this, &UAsyncPakDownloader::HandleBlockManifestComplete);
+
+	MainRequest = HttpRequest;
 	HttpRequest->ProcessRequest();
 }
 
-void UAsyncPakDownloader::HandleHeaderReceived(FHttpRequestPtr InSourceHttpRequest, const FString& InHeaderName, const FString& InHeaderValue)
+void UAsyncPakDownloader::HandleBlockManifestComplete(FHttpRequestPtr HttpRequest, FHttpResponsePtr HttpResponse, bool bSucceeded)
 {
-	if (InHeaderName == "Content-Length")
+	MainRequest.Reset();
+
+	TSharedPtr<FPakBlockManifest, ESPMode::ThreadSafe> Manifest = MakeShared<FPakBlockManifest, ESPMode::ThreadSafe>();
+
+	if (!bSucceeded || !HttpResponse.IsValid() || !EHttpResponseCodes::IsOk(HttpResponse->GetResponseCode()) ||
+		!Manifest->LoadFromMemory(HttpResponse->GetContent()))
 	{
-		HeaderContentLength = FCString::Atoi64(*InHeaderValue);
+		PAKLOADER_LOG(LL_LOG, TEXT("No usable block manifest for %s, downloading the whole file"), *DownloadURL);
+
+		bDeltaUpdate = false;
+		StartMainRequest();
+		return;
+	}
+
+	BlockManifest = Manifest;
+
+	if (!ReserveDiskSpace(Manifest->FileSize, false))
+	{
+		FinishDownload(false, 0);
+		return;
+	}
+
+	// The manifest's hash confirms the reconstructed file.
+	if (Options.ExpectedSHA1.IsEmpty())
+	{
+		Options.ExpectedSHA1 = Manifest->FileHash.ToString();
 	}
+
+	FileWriter->Start(false);
+
+	// Hashing the local file takes a while for large paks, keep it off the game thread.
+	TSharedRef<FPakDownloadFileWriter, ESPMode::ThreadSafe> Writer = FileWriter.ToSharedRef();
+	const FString LocalFilename = SaveFilePath;
+	TWeakObjectPtr<UAsyncPakDownloader> WeakThis(this);
+
+	Async(EAsyncExecution::ThreadPool, [WeakThis, Manifest, Writer, LocalFilename]()
+	{
+		TSharedPtr<FPakDeltaPlan, ESPMode::ThreadSafe> Plan = MakeShared<FPakDeltaPlan, ESPMode::ThreadSafe>();
+		bool bPlanOk = Manifest->ComputeDeltaPlan(LocalFilename, *Plan);
+
+		if (bPlanOk)
+		{
+			Writer->Preallocate(Manifest->FileSize);
+			bPlanOk = CopyLocalBlocks(*Manifest, *Plan, LocalFilename, Writer);
+		}
+
+		AsyncTask(ENamedThreads::GameThread, [WeakThis, Plan, bPlanOk]()
+		{
+			if (UAsyncPakDownloader* This = WeakThis.Get())
+			{
+				This->HandleDeltaPlanReady(bPlanOk, Plan);
+			}
+		});
+	});
 }
 
-void UAsyncPakDownloader::HandleDownloadComplete(FHttpRequestPtr HttpRequest, FHttpResponsePtr HttpResponse, bool bSucceeded)
+void UAsyncPakDownloader::HandleDeltaPlanReady(bool bPlanOk, TSharedPtr<FPakDeltaPlan, ESPMode::ThreadSafe> Plan)
 {
-	RemoveFromRoot();
+	// Cancelled while the local file was compared.
+	if (bFinished)
+	{
+		return;
+	}
 
-	int32 HttpResponseCode = 0;
+	if (!bPlanOk)
+	{
+		PAKLOADER_LOG(LL_ERROR, TEXT("Unable to reuse %s for the update, downloading the whole file"), *SaveFilePath);
 
-	if (HttpResponse.IsValid())
+		FileWriter->Abort(false);
+		FileWriter = MakeShared<FPakDownloadFileWriter, ESPMode::ThreadSafe>(SaveFilePath);
+
+		bDeltaUpdate = false;
+		StartMainRequest();
+		return;
+	}
+
+	PAKLOADER_LOG(LL_LOG, TEXT("Delta update of %s: reusing %lld bytes, downloading %lld bytes"),
+		*SaveFilePath, Plan->ReusedBytes, Plan->MissingBytes);
+
+	ProgressStartBytes = Plan->ReusedBytes;
+
+	// Neighbouring missing blocks are fetched with one request, split like the segments of a full download.
+	TArray<FSegment> Segments;
+	for (int32 Index = 0; Index < Plan->LocalOffsets.Num(); ++Index)
 	{
-		HttpResponseCode = HttpResponse->GetResponseCode();
+		if (Plan->LocalOffsets[Index] != INDEX_NONE)
+		{
+			continue;
+		}
+
+		const int64 Start = static_cast<int64>(Index) * BlockManifest->BlockSize;
+		const int64 End = Start + BlockManifest->GetBlockLength(Index) - 1;
+
+		if (Segments.Num() > 0 && Segments.Last().End + 1 == Start && End - Segments.Last().Start < Options.SegmentSize)
+		{
+			Segments.Last().End = End;
+		}
+		else
+		{
+			FSegment& Segment = Segments.AddDefaulted_GetRef();
+			Segment.Start = Start;
+			Segment.End = End;
+		}
+	}
+
+	StartSegments(MoveTemp(Segments), BlockManifest->FileSize, Plan->ReusedBytes);
+}
+
+bool UAsyncPakDownloader::CopyLocalBlocks(const FPakBlockManifest& Manifest, const FPakDeltaPlan& Plan, const FString& LocalFilename,
+	const TSharedRef<FPakDownloadFileWriter, ESPMode::ThreadSafe>& Writer)
+{
+	TUniquePtr<IFileHandle> FileHandle(FPlatformFileManager::Get().GetPlatformFile().OpenRead(*LocalFilename));
+
+	if (!FileHandle)
+	{
+		return false;
 	}
 
-	if (bSucceeded && HttpResponse.IsValid() && HttpResponse->GetContentLength() > 0)
+	TArray<uint8> Chunk;
+	Chunk.SetNumUninitialized(1024 * 1024);
+
+	int32 Index = 0;
+	while (Index < Plan.LocalOffsets.Num())
 	{
-		if (FFileHelper::SaveArrayToFile(HttpResponse->GetContent(), *SaveFilePath))
+		if (Plan.LocalOffsets[Index] == INDEX_NONE)
 		{
-			OnSuccess.Broadcast(HttpResponseCode, HttpResponse->GetContentLength(), *SaveFilePath, 0);
-			return;
+			++Index;
+			continue;
+		}
+
+		// Unchanged regions usually span many blocks, copy them as one run.
+		const int64 TargetOffset = static_cast<int64>(Index) * Manifest.BlockSize;
+		const int64 SourceOffset = Plan.LocalOffsets[Index];
+		int64 Length = Manifest.GetBlockLength(Index);
+
+		while (++Index < Plan.LocalOffsets.Num() && Plan.LocalOffsets[Index] == SourceOffset + Length)
+		{
+			Length += Manifest.GetBlockLength(Index);
+		}
+
+		if (!FileHandle->Seek(SourceOffset))
+		{
+			return false;
+		}
+
+		// Reading the local file outpaces the writer, wait for blocks instead of buffering the whole file.
+		TSharedRef<FPakDownloadStream, ESPMode::ThreadSafe> Stream = Writer->CreateStream(TargetOffset, true);
+
+		while (Length > 0)
+		{
+			const int64 ToRead = FMath::Min<int64>(Length, Chunk.Num());
+			if (!FileHandle->Read(Chunk.GetData(), ToRead))
+			{
+				return false;
+			}
+
+			Stream->Serialize(Chunk.GetData(), ToRead);
+			if (Stream->IsError())
+			{
+				return false;
+			}
+
+			Length -= ToRead;
 		}
+
+		Stream->Close();
 	}
 
-	OnFail.Broadcast(HttpResponseCode, 0, TEXT(""), 0);
+	return true;
 }
 
-#if ENGINE_MINOR_VERSION >= 4 && ENGINE_MAJOR_VERSION == 5
-void UAsyncPakDownloader::HandleDownloadProgress(FHttpRequestPtr InRequest, uint64 BytesSent, uint64 BytesReceived)
+FHttpRequestPtr UAsyncPakDownloader::CreateHttpRequest(int64 RangeStart, int64 RangeEnd, const FString& RangeValidator) const
+{
+	// Create the Http request and add to pending request list
+#if ENGINE_MINOR_VERSION <= 25 && ENGINE_MAJOR_VERSION == 4
+	TSharedRef<IHttpRequest> HttpRequest = FHttpModule::Get().CreateRequest();
 #else
-void UAsyncPakDownloader::HandleDownloadProgress(FHttpRequestPtr InRequest, int32 BytesSent, int32 BytesReceived)
+	auto HttpRequest = FHttpModule::Get().CreateRequest();
 #endif
-{
-	if (InRequest.IsValid())
+
+	HttpRequest->SetURL(GetActiveURL());
+	HttpRequest->SetVerb(TEXT("GET"));
+
+	if (RangeEnd != INDEX_NONE)
+	{
+		HttpRequest->SetHeader(TEXT("Range"), FString::Printf(TEXT("bytes=%lld-%lld"), RangeStart, RangeEnd));
+	}
+	else if (RangeStart > 0)
+	{
+		HttpRequest->SetHeader(TEXT("Range"), FString::Printf(TEXT("bytes=%lld-"), RangeStart));
+	}
+
+	if (!RangeValidator.IsEmpty())
 	{
+		HttpRequest->SetHeader(TEXT("If-Range"), RangeValidator);
+	}
+
+	return HttpRequest;
+}
+
+TSharedRef<FPakDownloadStream, ESPMode::ThreadSafe> UAsyncPakDownloader::AttachStream(FHttpRequestPtr HttpRequest, int64 Offset, bool bAllowFullBody)
+{
+	TSharedRef<FPakDownloadStream, ESPMode::ThreadSafe> Stream = FileWriter->CreateStream(Offset);
+
 #if ENGINE_MINOR_VERSION >= 4 && ENGINE_MAJOR_VERSION == 5
-		OnProgress.Broadcast(0, HeaderContentLength, TEXT(""), static_cast<int64>(BytesReceived));
-#else
-		OnProgress.Broadcast(0, HeaderContentLength, TEXT(""), BytesReceived);
+	// The body arrives before the game thread sees the response, the HTTP thread decides where it goes.
+	TWeakPtr<IHttpRequest, ESPMode::ThreadSafe> WeakRequest = HttpRequest;
+	const int64 ExpectedTotalSize = MirrorTotalSize;
+	Stream->SetStartOffsetResolver([WeakRequest, Offset, bAllowFullBody, ExpectedTotalSize]()
+	{
+		FHttpRequestPtr Request = WeakRequest.Pin();
+		FHttpResponsePtr Response = Request.IsValid() ? Request->GetResponse() : nullptr;
+
+		// A mirror serving a different file must not write into this one.
+		const int64 TotalSize = GetResponseTotalSize(Response);
+		if (ExpectedTotalSize > 0 && TotalSize > 0 && TotalSize != ExpectedTotalSize)
+		{
+			return static_cast<int64>(INDEX_NONE);
+		}
+
+		return GetBodyWriteOffset(Response, Offset, bAllowFullBody);
+	});
+
+	// Let the HTTP thread write the body into the stream instead of accumulating it in the response.
+	HttpRequest->SetResponseBodyReceiveStream(Stream);
 #endif
+
+	return Stream;
+}
+
+void UAsyncPakDownloader::HandleHeaderReceived(FHttpRequestPtr InSourceHttpRequest, const FString& InHeaderName, const FString& InHeaderValue)
+{
+	if (InHeaderName == "Content-Length")
+	{
+		HeaderContentLength = FCString::Atoi64(*InHeaderValue);
+	}
+	else if (InHeaderName == "Content-Range")
+	{
+		int64 RangeEnd = 0;
+		ParseContentRange(InHeaderValue, ContentRangeStart, RangeEnd, ContentRangeTotal);
+	}
+	else if (InHeaderName == "ETag")
+	{
+		ResponseState.ETag = InHeaderValue;
+	}
+	else if (InHeaderName == "Last-Modified")
+	{
+		ResponseState.LastModified = InHeaderValue;
 	}
 }
 
-bool UAsyncPakDownloader::IsHttpUrl(const FString& URL)
+void UAsyncPakDownloader::HandleDownloadComplete(FHttpRequestPtr HttpRequest, FHttpResponsePtr HttpResponse, bool bSucceeded)
 {
-	const FString Lower = URL.ToLower();
-	return Lower.StartsWith("http://") || Lower.StartsWith("https://");
+	int32 HttpResponseCode = 0;
+
+	if (HttpResponse.IsValid())
+	{
+		HttpResponseCode = HttpResponse->GetResponseCode();
+	}
+
+	const bool bResponseOk = bSucceeded && HttpResponse.IsValid() && EHttpResponseCodes::IsOk(HttpResponseCode);
+
+#if !(ENGINE_MINOR_VERSION >= 4 && ENGINE_MAJOR_VERSION == 5)
+	// Older engine versions can't stream the body, hand the received content to the stream in one go.
+	if (HttpResponse.IsValid() && HttpResponse->GetContent().Num() > 0)
+	{
+		const int64 RequestedOffset = ResumeOffset;
+		MainStream->SetStartOffsetResolver([HttpResponse, RequestedOffset]() { return GetBodyWriteOffset(HttpResponse, RequestedOffset, true); });
+		MainStream->Serialize(const_cast<uint8*>(HttpResponse->GetContent().GetData()), HttpResponse->GetContent().Num());
+	}
+#endif
+
+	MainStream->Close();
+
+	if (HttpResponseCode == EHttpResponseCodes::NotModified && bSucceeded)
+	{
+		FinishNotModified();
+		return;
+	}
+
+	// The server answered the first range, fetch the rest in parallel.
+	if (bSegmented && bResponseOk && HttpResponseCode == EHttpResponseCodes::PartialContent &&
+		MainStream->GetStartOffset() == 0 && MainStream->GetEndOffset() < ContentRangeTotal)
+	{
+		BeginSegments();
+		return;
+	}
+
+	// A paced download continues with the next range.
+	if (!bSegmented && MainRequestSize > 0 && bResponseOk && HttpResponseCode == EHttpResponseCodes::PartialContent &&
+		MainStream->GetStartOffset() != INDEX_NONE && MainStream->GetEndOffset() < ContentRangeTotal)
+	{
+		ResumeOffset = MainStream->GetEndOffset();
+		QueueMainRequest();
+		return;
+	}
+
+	// Continue on another mirror. A segmented download fetches its first range again, a single request continues behind the received bytes.
+	const bool bBodyWritten = MainStream->GetStartOffset() != INDEX_NONE;
+	if ((!bResponseOk || !bBodyWritten) && FailOverToNextMirror(ActiveMirror))
+	{
+		if (!bSegmented && bBodyWritten)
+		{
+			ResumeOffset = MainStream->GetEndOffset();
+		}
+
+		QueueMainRequest();
+		return;
+	}
+
+	FinishDownload(bResponseOk, HttpResponseCode);
+}
+
+void UAsyncPakDownloader::FinishDownload(bool bResponseOk, int32 HttpResponseCode)
+{
+	if (bFinished)
+	{
+		return;
+	}
+
+	bFinished = true;
+	RemoveFromRoot();
+	FlushProgress();
+
+	UPakDownloadManager* Manager = UPakDownloadManager::Get();
+
+	if (Manager)
+	{
+		Manager->GetBandwidthLimiter()->CancelDeferredStarts(this);
+	}
+
+	// Segments are written out of order, only the complete file has a meaningful size.
+	int64 FinalSize = INDEX_NONE;
+	if (bSegmentsStarted)
+	{
+		FinalSize = SegmentedTotalSize;
+	}
+	else if (MainStream.IsValid() && MainStream->GetStartOffset() != INDEX_NONE)
+	{
+		FinalSize = MainStream->GetEndOffset();
+	}
+
+	// Finish also on failure so everything received so far is on disk and can be resumed.
+	const bool bWriterOk = FileWriter->Finish(bResponseOk ? FinalSize : INDEX_NONE);
+
+	if (FPakTraceRecorder::IsRecording())
+	{
+		FPakTraceRecorder::AddEvent(bResponseOk && bWriterOk ? TEXT("Download") : TEXT("DownloadFailed"), TEXT("Download"),
+			DownloadStartTime, FPlatformTime::Seconds() - DownloadStartTime, FileWriter->GetBytesWritten(), GetActiveURL());
+	}
+
+	if (bResponseOk && bWriterOk && FileWriter->GetBytesWritten() > 0)
+	{
+		if (VerifyDownloadedFile(FinalSize) && (!BeforeCommit || BeforeCommit(SaveFilePath)) && FileWriter->Commit())
+		{
+			FileWriter.Reset();
+			MainStream.Reset();
+			MainRequest.Reset();
+			DeleteResumeState();
+
+			// Remember the validators of the new file for the next revalidation, files without them are always fetched again.
+			if (ResponseState.HasValidator() && !bDeltaUpdate)
+			{
+				FPakDownloadResumeState CachedState = ResponseState;
+				CachedState.TotalSize = FinalSize;
+				CachedState.SaveToFile(GetCachedStateFilename());
+			}
+			else
+			{
+				FPlatformFileManager::Get().GetPlatformFile().DeleteFile(*GetCachedStateFilename());
+			}
+
+			if (Manager)
+			{
+				Manager->NotifyDownloadFinished(this, true);
+			}
+
+			OnSuccess.Broadcast(HttpResponseCode, FinalSize, *SaveFilePath, 0);
+			return;
+		}
+
+		// The complete file is broken or was refused, resuming it would never succeed.
+		FileWriter->Abort(false);
+		DeleteResumeState();
+	}
+	else if (!Options.bResume || bSegmentsStarted || bDeltaUpdate)
+	{
+		FileWriter->Abort(false);
+		DeleteResumeState();
+	}
+	else if (FileWriter->GetBytesWritten() > 0)
+	{
+		// This response replaced or extended the partial file, it is only resumable with its validators.
+		if (ResponseState.GetRangeValidator().IsEmpty())
+		{
+			FileWriter->Abort(false);
+			DeleteResumeState();
+		}
+		else
+		{
+			// Only what reached the file is resumable, bytes that were received but not written, e.g. because the disk is full, are fetched again.
+			// The writer is kept across mirrors, so the bytes written in this session don't tell where the file ends.
+			FileWriter->Abort(true);
+			ResponseState.TotalSize = ContentRangeTotal > 0 ? ContentRangeTotal : HeaderContentLength;
+			ResponseState.CommittedBytes = FileWriter->GetWrittenEnd();
+			ResponseState.SaveToFile(GetResumeStateFilename());
+		}
+	}
+	else
+	{
+		// Nothing was written, the partial file and its state from an earlier session stay untouched.
+		FileWriter->Abort(true);
+	}
+
+	FileWriter.Reset();
+	MainStream.Reset();
+	MainRequest.Reset();
+
+	if (Manager)
+	{
+		Manager->NotifyDownloadFinished(this, false);
+	}
+
+	OnFail.Broadcast(HttpResponseCode, 0, TEXT(""), 0);
+}
+
+void UAsyncPakDownloader::AddRevalidationHeaders(FHttpRequestPtr HttpRequest) const
+{
+	if (!Options.bRevalidate)
+	{
+		return;
+	}
+
+	FPakDownloadResumeState CachedState;
+	if (!CachedState.LoadFromFile(GetCachedStateFilename()) || CachedState.URL != DownloadURL || !CachedState.HasValidator())
+	{
+		return;
+	}
+
+	// A missing or truncated file must be downloaded again whatever the server thinks.
+	const int64 LocalSize = FPlatformFileManager::Get().GetPlatformFile().FileSize(*SaveFilePath);
+	if (LocalSize <= 0 || (CachedState.TotalSize > 0 && LocalSize != CachedState.TotalSize))
+	{
+		return;
+	}
+
+	if (!CachedState.ETag.IsEmpty())
+	{
+		HttpRequest->SetHeader(TEXT("If-None-Match"), CachedState.ETag);
+	}
+
+	if (!CachedState.LastModified.IsEmpty())
+	{
+		HttpRequest->SetHeader(TEXT("If-Modified-Since"), CachedState.LastModified);
+	}
+}
+
+void UAsyncPakDownloader::FinishNotModified()
+{
+	if (bFinished)
+	{
+		return;
+	}
+
+	bFinished = true;
+	RemoveFromRoot();
+
+	if (FPakTraceRecorder::IsRecording())
+	{
+		FPakTraceRecorder::AddEvent(TEXT("DownloadNotModified"), TEXT("Download"), DownloadStartTime, FPlatformTime::Seconds() - DownloadStartTime, 0, GetActiveURL());
+	}
+
+	// Nothing was written, a partial file from an earlier session stays untouched.
+	FileWriter->Abort(true);
+	FileWriter.Reset();
+	MainStream.Reset();
+	MainRequest.Reset();
+
+	const int64 LocalSize = FPlatformFileManager::Get().GetPlatformFile().FileSize(*SaveFilePath);
+
+	FString Hash;
+	const bool bHashOk = Options.ExpectedSHA1.IsEmpty() ||
+		(ComputeFileSHA1(SaveFilePath, Hash) && Hash.Equals(Options.ExpectedSHA1, ESearchCase::IgnoreCase));
+
+	UPakDownloadManager* Manager = UPakDownloadManager::Get();
+
+	if (!bHashOk)
+	{
+		// The server still has the old file, drop the validators so the next attempt isn't conditional.
+		PAKLOADER_LOG(LL_ERROR, TEXT("%s is not modified on the server but does not match checksum %s"), *SaveFilePath, *Options.ExpectedSHA1);
+		FPlatformFileManager::Get().GetPlatformFile().DeleteFile(*GetCachedStateFilename());
+
+		if (Manager)
+		{
+			Manager->NotifyDownloadFinished(this, false);
+		}
+
+		OnFail.Broadcast(EHttpResponseCodes::NotModified, 0, TEXT(""), 0);
+		return;
+	}
+
+	PAKLOADER_LOG(LL_LOG, TEXT("%s is up to date"), *SaveFilePath);
+
+	BroadcastProgress(LocalSize, LocalSize);
+	FlushProgress();
+
+	if (Manager)
+	{
+		Manager->NotifyDownloadFinished(this, true);
+	}
+
+	OnSuccess.Broadcast(EHttpResponseCodes::NotModified, LocalSize, *SaveFilePath, 0);
+}
+
+void UAsyncPakDownloader::BeginSegments()
+{
+	SegmentRangeValidator = ResponseState.GetRangeValidator();
+
+	// Not resumable anyway, so there is nothing to lose by failing before fetching the rest.
+	if (!ReserveDiskSpace(ContentRangeTotal, false))
+	{
+		FinishDownload(false, EHttpResponseCodes::PartialContent);
+		return;
+	}
+
+	FileWriter->Preallocate(ContentRangeTotal);
+
+	TArray<FSegment> Segments;
+	for (int64 Offset = MainStream->GetEndOffset(); Offset < ContentRangeTotal; Offset += Options.SegmentSize)
+	{
+		FSegment& Segment = Segments.AddDefaulted_GetRef();
+		Segment.Start = Offset;
+		Segment.End = FMath::Min(Offset + Options.SegmentSize, ContentRangeTotal) - 1;
+	}
+
+	StartSegments(MoveTemp(Segments), ContentRangeTotal, MainStream->GetEndOffset());
+}
+
+void UAsyncPakDownloader::StartSegments(TArray<FSegment>&& Segments, int64 TotalSize, int64 CompletedBytes)
+{
+	bSegmentsStarted = true;
+	SegmentedTotalSize = TotalSize;
+	PendingSegments = MoveTemp(Segments);
+	CompletedSegmentBytes = CompletedBytes;
+
+	if (PendingSegments.Num() == 0)
+	{
+		FinishDownload(true, EHttpResponseCodes::Ok);
+		return;
+	}
+
+	TargetConnections = FMath::Clamp(Options.MaxSegments, 1, 2);
+	AdaptWindowStartTime = FPlatformTime::Seconds();
+	AdaptWindowStartBytes = CompletedSegmentBytes;
+
+	StartPendingSegments();
+}
+
+void UAsyncPakDownloader::StartPendingSegments()
+{
+	TSharedPtr<FPakBandwidthLimiter, ESPMode::ThreadSafe> Limiter = PakDownloader::GetBandwidthLimiter();
+	const int64 RequestSize = Limiter.IsValid() ? Limiter->GetRequestSize() : 0;
+
+	while (ActiveSegments.Num() + NumDeferredSegments < TargetConnections && PendingSegments.Num() > 0)
+	{
+		// Lowest offsets first, the file fills up front to back.
+		FSegment Segment = PendingSegments[0];
+
+		// Under a bandwidth limit a segment is fetched in ranges that each wait for the limit.
+		if (RequestSize > 0 && Segment.End - Segment.Start + 1 > RequestSize)
+		{
+			Segment.End = Segment.Start + RequestSize - 1;
+			PendingSegments[0].Start += RequestSize;
+		}
+		else
+		{
+			PendingSegments.RemoveAt(0);
+		}
+
+		if (RequestSize <= 0)
+		{
+			StartSegment(Segment);
+			continue;
+		}
+
+		++NumDeferredSegments;
+
+		TWeakObjectPtr<UAsyncPakDownloader> WeakThis(this);
+		Limiter->StartWhenAvailable(this, Segment.End - Segment.Start + 1, [WeakThis, Segment]()
+		{
+			UAsyncPakDownloader* This = WeakThis.Get();
+			if (This && !This->bFinished)
+			{
+				--This->NumDeferredSegments;
+				This->StartSegment(Segment);
+			}
+		});
+	}
+}
+
+void UAsyncPakDownloader::StartSegment(const FSegment& Segment)
+{
+	FHttpRequestPtr HttpRequest = CreateHttpRequest(Segment.Start, Segment.End, SegmentRangeValidator);
+	HttpRequest->OnProcessRequestComplete().BindUObject(this, &UAsyncPakDownloader::HandleSegmentComplete);
+#if ENGINE_MINOR_VERSION >= 4 && ENGINE_MAJOR_VERSION == 5
+	HttpRequest->OnRequestProgress64().BindUObject(this, &UAsyncPakDownloader::HandleSegmentProgress);
+#else
+	HttpRequest->OnRequestProgress().BindUObject(this, &UAsyncPakDownloader::HandleSegmentProgress);
+#endif
+
+	FActiveSegment& Active = ActiveSegments.Add(HttpRequest.Get());
+	Active.Segment = Segment;
+	Active.HttpRequest = HttpRequest;
+	Active.Stream = AttachStream(HttpRequest, Segment.Start, false);
+	Active.StartTime = FPlatformTime::Seconds();
+	Active.Mirror = ActiveMirror;
+
+	HttpRequest->ProcessRequest();
+}
+
+void UAsyncPakDownloader::CancelSegments()
+{
+	for (TPair<IHttpRequest*, FActiveSegment>& Pair : ActiveSegments)
+	{
+		Pair.Value.HttpRequest->OnProcessRequestComplete().Unbind();
+		Pair.Value.HttpRequest->CancelRequest();
+	}
+
+	ActiveSegments.Empty();
+	PendingSegments.Empty();
+
+	if (TSharedPtr<FPakBandwidthLimiter, ESPMode::ThreadSafe> Limiter = PakDownloader::GetBandwidthLimiter())
+	{
+		Limiter->CancelDeferredStarts(this);
+	}
+
+	NumDeferredSegments = 0;
+}
+
+void UAsyncPakDownloader::HandleSegmentComplete(FHttpRequestPtr HttpRequest, FHttpResponsePtr HttpResponse, bool bSucceeded)
+{
+	FActiveSegment Active;
+	if (!HttpRequest.IsValid() || !ActiveSegments.RemoveAndCopyValue(HttpRequest.Get(), Active))
+	{
+		return;
+	}
+
+	const int32 HttpResponseCode = HttpResponse.IsValid() ? HttpResponse->GetResponseCode() : 0;
+
+#if !(ENGINE_MINOR_VERSION >= 4 && ENGINE_MAJOR_VERSION == 5)
+	if (HttpResponse.IsValid() && HttpResponse->GetContent().Num() > 0)
+	{
+		const int64 RequestedOffset = Active.Segment.Start;
+		Active.Stream->SetStartOffsetResolver([HttpResponse, RequestedOffset]() { return GetBodyWriteOffset(HttpResponse, RequestedOffset, false); });
+		Active.Stream->Serialize(const_cast<uint8*>(HttpResponse->GetContent().GetData()), HttpResponse->GetContent().Num());
+	}
+#endif
+
+	Active.Stream->Close();
+
+	const int64 SegmentSize = Active.Segment.End - Active.Segment.Start + 1;
+
+	if (bSucceeded && HttpResponseCode == EHttpResponseCodes::PartialContent &&
+		Active.Stream->GetStartOffset() == Active.Segment.Start && Active.Stream->GetBytesReceived() == SegmentSize)
+	{
+		CompletedSegmentBytes += SegmentSize;
+		AdaptSegmentCount();
+	}
+	else
+	{
+		// A 200 means the file changed since the first segment or the mirror ignores ranges, refetching them there won't help.
+		const bool bFailedOver = FailOverToNextMirror(Active.Mirror);
+		if (FileWriter->HasFailed() || (HttpResponseCode == EHttpResponseCodes::Ok && !bFailedOver) || ++Active.Segment.Retries > PakDownloader::MaxSegmentRetries)
+		{
+			PAKLOADER_LOG(LL_ERROR, TEXT("Segment %lld-%lld of %s failed with response code %d"),
+				Active.Segment.Start, Active.Segment.End, *DownloadURL, HttpResponseCode);
+
+			CancelSegments();
+			FinishDownload(false, HttpResponseCode);
+			return;
+		}
+
+		// Bytes of the failed attempt are overwritten, the whole range is fetched again.
+		++SegmentRetries;
+		PendingSegments.Insert(Active.Segment, 0);
+	}
+
+	if (PendingSegments.Num() == 0 && ActiveSegments.Num() == 0 && NumDeferredSegments == 0)
+	{
+		FinishDownload(true, EHttpResponseCodes::Ok);
+		return;
+	}
+
+	StartPendingSegments();
+}
+
+void UAsyncPakDownloader::AdaptSegmentCount()
+{
+	const double Now = FPlatformTime::Seconds();
+	const double Elapsed = Now - AdaptWindowStartTime;
+
+	if (Elapsed < PakDownloader::SegmentAdaptInterval)
+	{
+		return;
+	}
+
+	const double Throughput = (CompletedSegmentBytes - AdaptWindowStartBytes) / Elapsed;
+
+	// Keep adding connections while each one still improves throughput noticeably, back off when it drops.
+	if (Throughput > LastWindowThroughput * 1.1 && TargetConnections < Options.MaxSegments)
+	{
+		++TargetConnections;
+	}
+	else if (Throughput < LastWindowThroughput * 0.9 && TargetConnections > 1)
+	{
+		--TargetConnections;
+	}
+
+	PAKLOADER_LOG(LL_VERBOSE, TEXT("Segmented download of %s: %.0f bytes/s, using %d connections"), *DownloadURL, Throughput, TargetConnections);
+
+	LastWindowThroughput = Throughput;
+	AdaptWindowStartTime = Now;
+	AdaptWindowStartBytes = CompletedSegmentBytes;
+}
+
+#if ENGINE_MINOR_VERSION >= 4 && ENGINE_MAJOR_VERSION == 5
+void UAsyncPakDownloader::HandleDownloadProgress(FHttpRequestPtr InRequest, uint64 BytesSent, uint64 BytesReceived)
+#else
+void UAsyncPakDownloader::HandleDownloadProgress(FHttpRequestPtr InRequest, int32 BytesSent, int32 BytesReceived)
+#endif
+{
+	if (InRequest.IsValid())
+	{
+		FHttpResponsePtr Response = InRequest->GetResponse();
+
+		const bool bResponseOk = Response.IsValid() && EHttpResponseCodes::IsOk(Response->GetResponseCode());
+
+		// Partial responses report the bytes of the range only, show the progress of the whole file.
+		const int64 TotalSize = ContentRangeTotal > 0 ? ContentRangeTotal : HeaderContentLength;
+
+		// Fail before the disk runs full. A segmented download reserves its space once the first segment is in.
+		if (!bDiskSpaceReserved && bResponseOk && TotalSize > 0 && (!bSegmented || Response->GetResponseCode() == EHttpResponseCodes::Ok))
+		{
+			bDiskSpaceReserved = true;
+
+			if (!ReserveDiskSpace(TotalSize, true))
+			{
+				InRequest->CancelRequest();
+				return;
+			}
+		}
+
+		// Save the sidecar as soon as the body is flowing so a crash doesn't lose the partial file either.
+		// It is updated while the download runs, a preallocated partial file doesn't tell how much of it was received.
+		const double Now = FPlatformTime::Seconds();
+		if (Options.bResume && !bSegmented && bResponseOk && !ResponseState.GetRangeValidator().IsEmpty() &&
+			(!bResponseStateSaved || Now - LastResponseStateSaveTime >= PakDownloader::ResumeStateSaveInterval))
+		{
+			const int64 BodyStart = Response->GetResponseCode() == EHttpResponseCodes::PartialContent ? ResumeOffset : 0;
+			const int64 WrittenEnd = FileWriter->GetWrittenEnd();
+
+			ResponseState.TotalSize = TotalSize;
+			ResponseState.CommittedBytes = WrittenEnd != INDEX_NONE ? WrittenEnd : BodyStart;
+			bResponseStateSaved = ResponseState.SaveToFile(GetResumeStateFilename());
+			LastResponseStateSaveTime = Now;
+		}
+
+		BroadcastProgress(TotalSize, ContentRangeStart + static_cast<int64>(BytesReceived));
+	}
+}
+
+#if ENGINE_MINOR_VERSION >= 4 && ENGINE_MAJOR_VERSION == 5
+void UAsyncPakDownloader::HandleSegmentProgress(FHttpRequestPtr InRequest, uint64 BytesSent, uint64 BytesReceived)
+#else
+void UAsyncPakDownloader::HandleSegmentProgress(FHttpRequestPtr InRequest, int32 BytesSent, int32 BytesReceived)
+#endif
+{
+	if (InRequest.IsValid())
+	{
+		if (FActiveSegment* Active = ActiveSegments.Find(InRequest.Get()))
+		{
+			Active->BytesReceived = static_cast<int64>(BytesReceived);
+			BroadcastSegmentProgress();
+		}
+	}
+}
+
+void UAsyncPakDownloader::BroadcastSegmentProgress()
+{
+	int64 BytesReceived = CompletedSegmentBytes;
+
+	for (const TPair<IHttpRequest*, FActiveSegment>& Pair : ActiveSegments)
+	{
+		BytesReceived += Pair.Value.BytesReceived;
+	}
+
+	BroadcastProgress(SegmentedTotalSize, BytesReceived);
+}
+
+void UAsyncPakDownloader::BroadcastProgress(int64 TotalSize, int64 BytesReceived)
+{
+	ProgressTotalBytes = TotalSize;
+	ProgressBytesReceived = BytesReceived;
+
+	UpdateThroughput(FPlatformTime::Seconds());
+
+	if (!ShouldBroadcastProgress(Options.ProgressInterval))
+	{
+		return;
+	}
+
+	OnProgress.Broadcast(0, TotalSize, TEXT(""), BytesReceived);
+}
+
+void UAsyncPakDownloader::FlushProgress()
+{
+	if (TakeHeldBackProgress())
+	{
+		OnProgress.Broadcast(0, ProgressTotalBytes, TEXT(""), ProgressBytesReceived);
+	}
+}
+
+void UAsyncPakDownloader::UpdateThroughput(double Now)
+{
+	if (ThroughputSampleTime == 0.0)
+	{
+		ThroughputSampleTime = Now;
+		ThroughputSampleBytes = ProgressBytesReceived;
+		return;
+	}
+
+	const double Elapsed = Now - ThroughputSampleTime;
+	if (Elapsed < PakDownloader::ThroughputSampleInterval)
+	{
+		return;
+	}
+
+	// A restarted download can move progress backwards, that is not negative throughput.
+	const double Rate = FMath::Max<int64>(ProgressBytesReceived - ThroughputSampleBytes, 0) / Elapsed;
+	InstantaneousThroughput = InstantaneousThroughput > 0.0 ? FMath::Lerp(InstantaneousThroughput, Rate, PakDownloader::ThroughputSmoothing) : Rate;
+
+	ThroughputSampleTime = Now;
+	ThroughputSampleBytes = ProgressBytesReceived;
+}
+
+FPakDownloadTelemetry UAsyncPakDownloader::GetTelemetry() const
+{
+	FPakDownloadTelemetry Telemetry;
+	Telemetry.BytesReceived = ProgressBytesReceived;
+	Telemetry.TotalBytes = ProgressTotalBytes;
+	Telemetry.Retries = SegmentRetries;
+	Telemetry.URL = GetActiveURL();
+	Telemetry.MirrorFailovers = MirrorFailovers;
+
+	if (DownloadStartTime == 0.0)
+	{
+		return Telemetry;
+	}
+
+	const double Now = FPlatformTime::Seconds();
+	Telemetry.ElapsedSeconds = Now - DownloadStartTime;
+	Telemetry.InstantaneousBytesPerSecond = InstantaneousThroughput;
+
+	if (Telemetry.ElapsedSeconds > 0.0f)
+	{
+		Telemetry.AverageBytesPerSecond = FMath::Max<int64>(ProgressBytesReceived - ProgressStartBytes, 0) / Telemetry.ElapsedSeconds;
+	}
+
+	const double Rate = InstantaneousThroughput > 0.0 ? InstantaneousThroughput : Telemetry.AverageBytesPerSecond;
+	if (ProgressTotalBytes > 0 && Rate > 0.0)
+	{
+		Telemetry.EstimatedSecondsRemaining = FMath::Max<int64>(ProgressTotalBytes - ProgressBytesReceived, 0) / Rate;
+	}
+
+	if (bSegmentsStarted)
+	{
+		for (const TPair<IHttpRequest*, FActiveSegment>& Pair : ActiveSegments)
+		{
+			FPakDownloadConnectionStats& Stats = Telemetry.Connections.AddDefaulted_GetRef();
+			Stats.RangeStart = Pair.Value.Segment.Start;
+			Stats.RangeEnd = Pair.Value.Segment.End;
+			Stats.BytesReceived = Pair.Value.BytesReceived;
+
+			const double SegmentElapsed = Now - Pair.Value.StartTime;
+			Stats.BytesPerSecond = SegmentElapsed > 0.0 ? Pair.Value.BytesReceived / SegmentElapsed : 0.0;
+		}
+	}
+	else if (MainRequest.IsValid() && !bFinished)
+	{
+		FPakDownloadConnectionStats& Stats = Telemetry.Connections.AddDefaulted_GetRef();
+		Stats.RangeStart = ResumeOffset;
+		Stats.BytesReceived = FMath::Max<int64>(ProgressBytesReceived - ResumeOffset, 0);
+		Stats.BytesPerSecond = Telemetry.AverageBytesPerSecond;
+	}
+
+	return Telemetry;
+}
+
+void UAsyncPakDownloader::ProbeMirrors()
+{
+	ProbeStartTime = FPlatformTime::Seconds();
+
+	for (FMirror& Mirror : Mirrors)
+	{
+#if ENGINE_MINOR_VERSION <= 25 && ENGINE_MAJOR_VERSION == 4
+		TSharedRef<IHttpRequest> HttpRequest = FHttpModule::Get().CreateRequest();
+#else
+		auto HttpRequest = FHttpModule::Get().CreateRequest();
+#endif
+
+		// Time to a small range covers latency and a first impression of throughput, and tells whether ranges work at all.
+		HttpRequest->SetURL(Mirror.URL);
+		HttpRequest->SetVerb(TEXT("GET"));
+		HttpRequest->SetHeader(TEXT("Range"), FString::Printf(TEXT("bytes=0-%lld"), PakDownloader::MirrorProbeSize - 1));
+		HttpRequest->OnProcessRequestComplete().BindUObject(this, &UAsyncPakDownloader::HandleProbeComplete);
+
+		Mirror.ProbeRequest = HttpRequest;
+		HttpRequest->ProcessRequest();
+	}
+}
+
+void UAsyncPakDownloader::HandleProbeComplete(FHttpRequestPtr HttpRequest, FHttpResponsePtr HttpResponse, bool bSucceeded)
+{
+	const int32 Index = Mirrors.IndexOfByPredicate([&HttpRequest](const FMirror& Mirror) { return Mirror.ProbeRequest == HttpRequest; });
+	if (Index == INDEX_NONE || bFinished)
+	{
+		return;
+	}
+
+	FMirror& Mirror = Mirrors[Index];
+	Mirror.ProbeRequest.Reset();
+
+	const int64 TotalSize = GetResponseTotalSize(HttpResponse);
+
+	// Only mirrors that answer ranges can take over a running download.
+	if (bSucceeded && HttpResponse.IsValid() && HttpResponse->GetResponseCode() == EHttpResponseCodes::PartialContent &&
+		TotalSize > 0 && (MirrorTotalSize == 0 || TotalSize == MirrorTotalSize))
+	{
+		Mirror.ProbeSeconds = FPlatformTime::Seconds() - ProbeStartTime;
+		PAKLOADER_LOG(LL_VERBOSE, TEXT("Mirror %s answered in %.3f seconds"), *Mirror.URL, Mirror.ProbeSeconds);
+	}
+	else
+	{
+		Mirror.bProbeFailed = true;
+		PAKLOADER_LOG(LL_LOG, TEXT("Mirror %s failed its probe (%d)"), *Mirror.URL, HttpResponse.IsValid() ? HttpResponse->GetResponseCode() : 0);
+	}
+
+	if (ActiveMirror != INDEX_NONE)
+	{
+		return;
+	}
+
+	// The first mirror to answer wins the race, the others only matter for failover.
+	if (!Mirror.bProbeFailed)
+	{
+		ActiveMirror = Index;
+		MirrorTotalSize = TotalSize;
+
+		PAKLOADER_LOG(LL_LOG, TEXT("Downloading %s from mirror %s"), *DownloadURL, *Mirror.URL);
+		StartDownload();
+		return;
+	}
+
+	// No mirror passed, let the download itself report why.
+	if (!Mirrors.ContainsByPredicate([](const FMirror& Other) { return Other.ProbeRequest.IsValid(); }))
+	{
+		ActiveMirror = 0;
+		StartDownload();
+	}
+}
+
+void UAsyncPakDownloader::CancelProbes()
+{
+	for (FMirror& Mirror : Mirrors)
+	{
+		if (Mirror.ProbeRequest.IsValid())
+		{
+			Mirror.ProbeRequest->OnProcessRequestComplete().Unbind();
+			Mirror.ProbeRequest->CancelRequest();
+			Mirror.ProbeRequest.Reset();
+		}
+	}
+}
+
+bool UAsyncPakDownloader::FailOverToNextMirror(int32 FailedMirror)
+{
+	if (bCancelRequested || !Mirrors.IsValidIndex(FailedMirror))
+	{
+		return false;
+	}
+
+	Mirrors[FailedMirror].bFailed = true;
+
+	// Parallel segments of the failed mirror fail one by one, the first one already switched.
+	if (FailedMirror != ActiveMirror)
+	{
+		return !Mirrors[ActiveMirror].bFailed;
+	}
+
+	// Fastest probe first, then mirrors that are still probing, mirrors that failed their probe last.
+	auto GetRank = [](const FMirror& Mirror)
+	{
+		return Mirror.ProbeSeconds >= 0.0 ? Mirror.ProbeSeconds : (Mirror.bProbeFailed ? 2.0 : 1.0) * 1.0e6;
+	};
+
+	int32 NextMirror = INDEX_NONE;
+	for (int32 Index = 0; Index < Mirrors.Num(); ++Index)
+	{
+		if (!Mirrors[Index].bFailed && (NextMirror == INDEX_NONE || GetRank(Mirrors[Index]) < GetRank(Mirrors[NextMirror])))
+		{
+			NextMirror = Index;
+		}
+	}
+
+	if (NextMirror == INDEX_NONE)
+	{
+		return false;
+	}
+
+	PAKLOADER_LOG(LL_LOG, TEXT("Mirror %s failed, continuing %s on %s"), *Mirrors[ActiveMirror].URL, *DownloadURL, *Mirrors[NextMirror].URL);
+
+	ActiveMirror = NextMirror;
+	++MirrorFailovers;
+
+	// Validators are per server, the other mirror would answer every If-Range with the whole file.
+	SegmentRangeValidator.Empty();
+
+	return true;
+}
+
+const FString& UAsyncPakDownloader::GetActiveURL() const
+{
+	return Mirrors.IsValidIndex(ActiveMirror) ? Mirrors[ActiveMirror].URL : DownloadURL;
+}
+
+bool UAsyncPakDownloader::ParseContentRange(const FString& Value, int64& OutStart, int64& OutEnd, int64& OutTotal)
+{
+	FString Unit, Range, Total, Start, End;
+
+	if (!Value.TrimStartAndEnd().Split(TEXT(" "), &Unit, &Range) || Unit != TEXT("bytes"))
+	{
+		return false;
+	}
+
+	if (!Range.Split(TEXT("/"), &Range, &Total) || !Range.Split(TEXT("-"), &Start, &End))
+	{
+		return false;
+	}
+
+	OutStart = FCString::Atoi64(*Start);
+	OutEnd = FCString::Atoi64(*End);
+	OutTotal = Total == TEXT("*") ? 0 : FCString::Atoi64(*Total);
+	return true;
+}
+
+int64 UAsyncPakDownloader::GetBodyWriteOffset(FHttpResponsePtr HttpResponse, int64 RequestedOffset, bool bAllowFullBody)
+{
+	if (!HttpResponse.IsValid())
+	{
+		return INDEX_NONE;
+	}
+
+	const int32 HttpResponseCode = HttpResponse->GetResponseCode();
+
+	if (HttpResponseCode == EHttpResponseCodes::PartialContent)
+	{
+		int64 Start = 0, End = 0, Total = 0;
+		if (ParseContentRange(HttpResponse->GetHeader(TEXT("Content-Range")), Start, End, Total) && Start == RequestedOffset)
+		{
+			return RequestedOffset;
+		}
+
+		return INDEX_NONE;
+	}
+
+	// A full body either because nothing was requested, the server ignores ranges or the file changed.
+	if (bAllowFullBody && EHttpResponseCodes::IsOk(HttpResponseCode))
+	{
+		return 0;
+	}
+
+	// Error pages must neither end up in nor truncate the partial file.
+	return INDEX_NONE;
+}
+
+int64 UAsyncPakDownloader::GetResponseTotalSize(FHttpResponsePtr HttpResponse)
+{
+	if (!HttpResponse.IsValid())
+	{
+		return 0;
+	}
+
+	if (HttpResponse->GetResponseCode() == EHttpResponseCodes::PartialContent)
+	{
+		int64 Start = 0, End = 0, Total = 0;
+		return ParseContentRange(HttpResponse->GetHeader(TEXT("Content-Range")), Start, End, Total) ? Total : 0;
+	}
+
+	if (EHttpResponseCodes::IsOk(HttpResponse->GetResponseCode()))
+	{
+		return FCString::Atoi64(*HttpResponse->GetHeader(TEXT("Content-Length")));
+	}
+
+	return 0;
+}
+
+int64 UAsyncPakDownloader::GetResumeOffset(const FString& URL)
+{
+	if (!Options.bResume)
+	{
+		return 0;
+	}
+
+	int64 PartialSize = FPlatformFileManager::Get().GetPlatformFile().FileSize(*FileWriter->GetTempFilename());
+	if (PartialSize <= 0)
+	{
+		return 0;
+	}
+
+	FPakDownloadResumeState State;
+	if (!State.LoadFromFile(GetResumeStateFilename()) || State.URL != URL || State.GetRangeValidator().IsEmpty())
+	{
+		return 0;
+	}
+
+	if (State.CommittedBytes >= 0)
+	{
+		PartialSize = FMath::Min(PartialSize, State.CommittedBytes);
+	}
+
+	if (PartialSize <= 0)
+	{
+		return 0;
+	}
+
+	// A partial file as large as the whole file was never committed, the server would answer the range with 416.
+	if (State.TotalSize > 0 && PartialSize >= State.TotalSize)
+	{
+		return 0;
+	}
+
+	ResponseState = State;
+	return PartialSize;
+}
+
+FString UAsyncPakDownloader::GetResumeStateFilename() const
+{
+	return SaveFilePath + TEXT(".part.json");
+}
+
+FString UAsyncPakDownloader::GetCachedStateFilename() const
+{
+	return SaveFilePath + TEXT(".meta");
+}
+
+void UAsyncPakDownloader::DeleteResumeState() const
+{
+	FPlatformFileManager::Get().GetPlatformFile().DeleteFile(*GetResumeStateFilename());
+}
+
+bool UAsyncPakDownloader::ReserveDiskSpace(int64 FileSize, bool bPreallocate)
+{
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+
+	// A partial or preallocated file already occupies its part of the space.
+	const int64 ExistingSize = FMath::Max<int64>(PlatformFile.FileSize(*FileWriter->GetTempFilename()), 0);
+	const int64 RequiredBytes = FileSize - ExistingSize;
+
+	// The target directory may not exist yet, ask for the closest existing parent.
+	FString Directory = FPaths::GetPath(FPaths::ConvertRelativePathToFull(SaveFilePath));
+	while (!Directory.IsEmpty() && !PlatformFile.DirectoryExists(*Directory))
+	{
+		Directory = FPaths::GetPath(Directory);
+	}
+
+	uint64 TotalDiskBytes = 0;
+	uint64 FreeDiskBytes = 0;
+	if (RequiredBytes > 0 && FPlatformMisc::GetDiskTotalAndFreeSpace(Directory, TotalDiskBytes, FreeDiskBytes) &&
+		FreeDiskBytes < static_cast<uint64>(RequiredBytes))
+	{
+		PAKLOADER_LOG(LL_ERROR, TEXT("Not enough disk space for %s, %lld bytes needed but only %llu bytes free"),
+			*SaveFilePath, RequiredBytes, FreeDiskBytes);
+		return false;
+	}
+
+	if (bPreallocate && Options.bPreallocate)
+	{
+		FileWriter->Preallocate(FileSize);
+	}
+
+	return true;
+}
+
+bool UAsyncPakDownloader::VerifyDownloadedFile(int64 FileSize) const
+{
+	if (!Options.ExpectedSHA1.IsEmpty())
+	{
+		// The writer hashed the bytes on their way to disk, only files written out of order are read again.
+		FString Hash;
+		FSHAHash ContentHash;
+		if (FileWriter->GetContentHash(ContentHash))
+		{
+			Hash = ContentHash.ToString();
+		}
+		else
+		{
+			ComputeFileSHA1(FileWriter->GetTempFilename(), Hash);
+		}
+
+		if (!Hash.Equals(Options.ExpectedSHA1, ESearchCase::IgnoreCase))
+		{
+			PAKLOADER_LOG(LL_ERROR, TEXT("Checksum mismatch for %s, expected %s got %s"), *SaveFilePath, *Options.ExpectedSHA1, *Hash);
+			return false;
+		}
+	}
+
+	if (Options.bValidatePak)
+	{
+		TArray<uint8> Tail;
+		if (!FileWriter->GetTail(Tail))
+		{
+			TUniquePtr<IFileHandle> FileHandle(FPlatformFileManager::Get().GetPlatformFile().OpenRead(*FileWriter->GetTempFilename()));
+			const int64 TailSize = FMath::Min<int64>(FPakDownloadFileWriter::TailSize, FileSize);
+
+			Tail.SetNumUninitialized(TailSize);
+			if (!FileHandle || !FileHandle->Seek(FileSize - TailSize) || !FileHandle->Read(Tail.GetData(), TailSize))
+			{
+				Tail.Reset();
+			}
+		}
+
+		if (!FPakLoader::IsValidPakFooter(Tail, FileSize))
+		{
+			PAKLOADER_LOG(LL_ERROR, TEXT("Downloaded file %s is not a valid pak file"), *SaveFilePath);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool UAsyncPakDownloader::ComputeFileSHA1(const FString& Filename, FString& OutHash)
+{
+	TUniquePtr<IFileHandle> FileHandle(FPlatformFileManager::Get().GetPlatformFile().OpenRead(*Filename));
+
+	if (!FileHandle)
+	{
+		return false;
+	}
+
+	// Hash in chunks, the file may be several gigabytes large.
+	TArray<uint8> Chunk;
+	Chunk.SetNumUninitialized(1024 * 1024);
+
+	FSHA1 Sha;
+	int64 Remaining = FileHandle->Size();
+
+	while (Remaining > 0)
+	{
+		const int64 ToRead = FMath::Min<int64>(Remaining, Chunk.Num());
+		if (!FileHandle->Read(Chunk.GetData(), ToRead))
+		{
+			return false;
+		}
+
+		Sha.Update(Chunk.GetData(), ToRead);
+		Remaining -= ToRead;
+	}
+
+	Sha.Final();
+
+	FSHAHash ShaHash;
+	Sha.GetHash(ShaHash.Hash);
+	OutHash = ShaHash.ToString();
+	return true;
 }
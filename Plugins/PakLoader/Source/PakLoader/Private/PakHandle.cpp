@@ -0,0 +1,15 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#include "PakHandle.h"
+#include "PakLoader.h"
+
+FPakHandle::FPakHandle(const FString& InPakFilename, const FString& InRootPath)
+	: PakFilename(InPakFilename)
+	, RootPath(InRootPath)
+{
+}
+
+FPakHandle::~FPakHandle()
+{
+	FPakLoader::Get()->ReleasePak(PakFilename);
+}
@@ -0,0 +1,96 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#include "PakInstaller.h"
+#include "PakLoader.h"
+#include "LogHelper.h"
+#include "Interfaces/IHttpResponse.h"
+
+UAsyncPakInstaller::UAsyncPakInstaller(const FObjectInitializer& ObjectInitializer)
+	: Super(ObjectInitializer)
+{
+	if (HasAnyFlags(RF_ClassDefaultObject) == false)
+	{
+		AddToRoot();
+	}
+}
+
+UAsyncPakInstaller* UAsyncPakInstaller::DownloadAndMountPak(const FString &URL, const FString &SavePath, const FPakDownloadOptions &Options)
+{
+	UAsyncPakInstaller* InstallTask = NewObject<UAsyncPakInstaller>();
+
+	FPakDownloadOptions InstallOptions = Options;
+	InstallOptions.bValidatePak = true;
+
+	InstallTask->Download = UAsyncPakDownloader::DownloadPakWithOptions(URL, SavePath, InstallOptions);
+	InstallTask->Download->OnSuccess.AddDynamic(InstallTask, &UAsyncPakInstaller::HandleDownloadSuccess);
+	InstallTask->Download->OnFail.AddDynamic(InstallTask, &UAsyncPakInstaller::HandleDownloadFail);
+	InstallTask->Download->OnProgress.AddDynamic(InstallTask, &UAsyncPakInstaller::HandleDownloadProgress);
+	InstallTask->Download->SetBeforeCommit(&UAsyncPakInstaller::UnmountReplacedPak);
+
+	return InstallTask;
+}
+
+void UAsyncPakInstaller::Cancel()
+{
+	if (Download)
+	{
+		Download->Cancel();
+	}
+}
+
+void UAsyncPakInstaller::HandleDownloadSuccess(int32 HttpResponseCode, int64 ContentLength, const FString SavePath, int64 BytesReceived)
+{
+	// An unchanged pak may already be mounted from an earlier run. A changed one was unmounted before it was replaced.
+	if (HttpResponseCode == EHttpResponseCodes::NotModified && FPakLoader::Get()->GetMountedPakFilenames().Contains(SavePath))
+	{
+		Complete(true, SavePath, HttpResponseCode);
+		return;
+	}
+
+	// The download was checked against its footer and checksum while it was written, mount right away.
+	const bool bMounted = FPakLoader::Get()->MountPakFileEasy(SavePath);
+	if (!bMounted)
+	{
+		PAKLOADER_LOG(LL_ERROR, TEXT("Downloaded pak %s could not be mounted"), *SavePath);
+	}
+
+	Complete(bMounted, SavePath, HttpResponseCode);
+}
+
+bool UAsyncPakInstaller::UnmountReplacedPak(const FString& PakFilename)
+{
+	FPakLoader* PakLoader = FPakLoader::Get();
+
+	if (!PakLoader->GetMountedPakFilenames().Contains(PakFilename))
+	{
+		return true;
+	}
+
+	// The mounted index describes the old file, reading the new file through it returns wrong data.
+	if (PakLoader->IsPakAcquired(PakFilename) || !PakLoader->UnmountPakFile(PakFilename))
+	{
+		PAKLOADER_LOG(LL_ERROR, TEXT("Pak %s changed but is still in use, it can't be replaced"), *PakFilename);
+		return false;
+	}
+
+	PAKLOADER_LOG(LL_LOG, TEXT("Unmounted %s to replace it with the downloaded version"), *PakFilename);
+	return true;
+}
+
+void UAsyncPakInstaller::HandleDownloadFail(int32 HttpResponseCode, int64 ContentLength, const FString SavePath, int64 BytesReceived)
+{
+	Complete(false, SavePath, HttpResponseCode);
+}
+
+void UAsyncPakInstaller::HandleDownloadProgress(int32 HttpResponseCode, int64 ContentLength, const FString SavePath, int64 BytesReceived)
+{
+	OnProgress.Broadcast(BytesReceived, ContentLength);
+}
+
+void UAsyncPakInstaller::Complete(bool bSuccess, const FString& PakFilename, int32 HttpResponseCode)
+{
+	Download = nullptr;
+	RemoveFromRoot();
+
+	OnCompleted.Broadcast(bSuccess, PakFilename, HttpResponseCode);
+}
@@ -0,0 +1,748 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#include "PakIoUringPlatformFile.h"
+#include "LogHelper.h"
+#include "Async/AsyncFileHandle.h"
+#include "HAL/Event.h"
+#include "HAL/FileManager.h"
+#include "HAL/Runnable.h"
+#include "HAL/RunnableThread.h"
+#include "Misc/Paths.h"
+#include "Misc/ScopeLock.h"
+#include "Runtime/Launch/Resources/Version.h"
+#include <atomic>
+
+#if PLATFORM_LINUX && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define PAKLOADER_WITH_IO_URING 1
+#endif
+#endif
+
+#ifndef PAKLOADER_WITH_IO_URING
+#define PAKLOADER_WITH_IO_URING 0
+#endif
+
+#if PAKLOADER_WITH_IO_URING
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+// Same numbers on all architectures, older C libraries don't define them.
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+#ifndef __NR_io_uring_register
+#define __NR_io_uring_register 427
+#endif
+
+namespace PakIoUring
+{
+	static constexpr uint32 QueueDepth = 256;
+	static constexpr int32 NumFixedBuffers = 64;
+	static constexpr int64 FixedBufferSize = 256 * 1024;
+
+	// Completions with this user data belong to the wake up read of the event file descriptor.
+	static constexpr uint64 WakeUpUserData = 0;
+
+	static int Setup(uint32 Entries, io_uring_params* Params)
+	{
+		return (int)syscall(__NR_io_uring_setup, Entries, Params);
+	}
+
+	static int Enter(int RingFd, uint32 ToSubmit, uint32 MinComplete, uint32 Flags)
+	{
+		return (int)syscall(__NR_io_uring_enter, RingFd, ToSubmit, MinComplete, Flags, nullptr, 0);
+	}
+
+	static int Register(int RingFd, uint32 Opcode, const void* Args, uint32 NumArgs)
+	{
+		return (int)syscall(__NR_io_uring_register, RingFd, Opcode, Args, NumArgs);
+	}
+}
+
+class FPakIoUringReadRequest;
+
+/* The ring shared by all handles and the thread that submits and reaps its reads. */
+class FPakIoUring : public FRunnable
+{
+public:
+	~FPakIoUring();
+
+	/* Creates the ring and starts the thread. Returns false if the kernel doesn't support io_uring. */
+	bool Setup();
+
+	/* Queues a read, it is submitted with the next batch. Any thread. */
+	void Enqueue(FPakIoUringReadRequest* Request);
+
+	// FRunnable interface
+	virtual uint32 Run() override;
+	virtual void Stop() override;
+
+private:
+	friend class FPakIoUringReadRequest;
+
+	/* Moves queued reads into the submission queue. */
+	void PrepareQueued();
+
+	/* Submission entries left for queued reads, one is kept for the wake up read. */
+	int32 GetNumFreeEntries() const { return (int32)PakIoUring::QueueDepth - (int32)NumInFlight - Retries.Num() - 1; }
+
+	void PrepareRead(FPakIoUringReadRequest* Request);
+	void PrepareWakeUpRead();
+
+	io_uring_sqe* NextSqe();
+
+	void ReapCompletions();
+	void HandleCompletion(FPakIoUringReadRequest* Request, int32 Result);
+
+	/* Wakes the thread up if it waits for completions. */
+	void WakeUp();
+
+	void Teardown();
+
+	int RingFd = -1;
+	int EventFd = -1;
+
+	void* SqRing = nullptr;
+	size_t SqRingSize = 0;
+	void* CqRing = nullptr;
+	size_t CqRingSize = 0;
+	io_uring_sqe* Sqes = nullptr;
+	size_t SqesSize = 0;
+
+	uint32* SqHead = nullptr;
+	uint32* SqTail = nullptr;
+	uint32 SqMask = 0;
+	uint32* SqArray = nullptr;
+
+	uint32* CqHead = nullptr;
+	uint32* CqTail = nullptr;
+	uint32 CqMask = 0;
+	io_uring_cqe* Cqes = nullptr;
+
+	// Registered buffers, only used by the ring thread.
+	uint8* FixedBuffers = nullptr;
+	TArray<int32> FreeFixedBuffers;
+
+	// Reads the ring thread submitted and didn't reap yet.
+	uint32 NumInFlight = 0;
+
+	uint64 WakeUpValue = 0;
+	iovec WakeUpIovec;
+	bool bWakeUpArmed = false;
+
+	TArray<FPakIoUringReadRequest*> Queued;
+	FCriticalSection QueuedLock;
+
+	// Short reads continue with their remaining bytes, only used by the ring thread.
+	TArray<FPakIoUringReadRequest*> Retries;
+
+	std::atomic<bool> bWaiting{false};
+	std::atomic<bool> bStopping{false};
+
+	FRunnableThread* Thread = nullptr;
+};
+
+/* Read of a pak through the ring. */
+class FPakIoUringReadRequest : public IAsyncReadRequest
+{
+public:
+	FPakIoUringReadRequest(int InFd, int64 InOffset, int64 InBytesToRead, FAsyncFileCallBack* CompleteCallback, uint8* UserSuppliedMemory)
+		: IAsyncReadRequest(CompleteCallback, false, UserSuppliedMemory)
+		, Fd(InFd)
+		, Offset(InOffset)
+		, BytesToRead(InBytesToRead)
+	{
+		if (!Memory)
+		{
+			Memory = (uint8*)FMemory::Malloc(BytesToRead);
+		}
+
+		CompletionEvent = FPlatformProcess::GetSynchEventFromPool(true);
+	}
+
+	virtual ~FPakIoUringReadRequest()
+	{
+		// Requests are deleted once complete, the ring thread may still be about to let go of it.
+		while (!bReleasedByRing.load())
+		{
+			FPlatformProcess::Yield();
+		}
+
+		FPlatformProcess::ReturnSynchEventToPool(CompletionEvent);
+
+		if (Memory && !bUserSuppliedMemory)
+		{
+			FMemory::Free(Memory);
+		}
+
+		Memory = nullptr;
+	}
+
+protected:
+	virtual void WaitCompletionImpl(float TimeLimitSeconds) override
+	{
+		if (TimeLimitSeconds <= 0.0f)
+		{
+			CompletionEvent->Wait();
+		}
+		else
+		{
+			CompletionEvent->Wait((uint32)FMath::Max(TimeLimitSeconds * 1000.0f, 1.0f));
+		}
+	}
+
+	// Submitted reads can't be taken back, the request completes as canceled once the read finished.
+	virtual void CancelImpl() override
+	{
+	}
+
+#if ENGINE_MAJOR_VERSION == 5
+	virtual void ReleaseMemoryOwnershipImpl() override
+	{
+	}
+#endif
+
+private:
+	friend class FPakIoUring;
+
+	/* Called by the ring thread, the request must not be touched afterwards. */
+	void Finish(bool bSuccess)
+	{
+		if (!bSuccess && !bUserSuppliedMemory)
+		{
+			FMemory::Free(Memory);
+			Memory = nullptr;
+		}
+
+		SetComplete();
+		CompletionEvent->Trigger();
+
+		bReleasedByRing = true;
+	}
+
+	const int Fd;
+	const int64 Offset;
+	const int64 BytesToRead;
+	int64 BytesDone = 0;
+
+	int32 FixedBufferIndex = INDEX_NONE;
+	iovec Iovec;
+
+	FEvent* CompletionEvent = nullptr;
+	std::atomic<bool> bReleasedByRing{false};
+};
+
+/* The size is known when the handle is opened, completes right away. */
+class FPakIoUringSizeRequest : public IAsyncReadRequest
+{
+public:
+	FPakIoUringSizeRequest(int64 FileSize, FAsyncFileCallBack* CompleteCallback)
+		: IAsyncReadRequest(CompleteCallback, true, nullptr)
+	{
+		Size = FileSize;
+		SetComplete();
+	}
+
+protected:
+	virtual void WaitCompletionImpl(float TimeLimitSeconds) override
+	{
+	}
+
+	virtual void CancelImpl() override
+	{
+	}
+
+#if ENGINE_MAJOR_VERSION == 5
+	virtual void ReleaseMemoryOwnershipImpl() override
+	{
+	}
+#endif
+};
+
+class FPakIoUringAsyncReadFileHandle : public IAsyncReadFileHandle
+{
+public:
+	FPakIoUringAsyncReadFileHandle(FPakIoUring& InRing, int InFd, int64 InFileSize)
+		: Ring(InRing)
+		, Fd(InFd)
+		, FileSize(InFileSize)
+	{
+	}
+
+	// All requests are complete before a handle is deleted.
+	virtual ~FPakIoUringAsyncReadFileHandle()
+	{
+		close(Fd);
+	}
+
+	virtual IAsyncReadRequest* SizeRequest(FAsyncFileCallBack* CompleteCallback = nullptr) override
+	{
+		return new FPakIoUringSizeRequest(FileSize, CompleteCallback);
+	}
+
+	virtual IAsyncReadRequest* ReadRequest(int64 Offset, int64 BytesToRead, EAsyncIOPriorityAndFlags PriorityAndFlags = AIOP_Normal, FAsyncFileCallBack* CompleteCallback = nullptr, uint8* UserSuppliedMemory = nullptr) override
+	{
+		FPakIoUringReadRequest* Request = new FPakIoUringReadRequest(Fd, Offset, BytesToRead, CompleteCallback, UserSuppliedMemory);
+		Ring.Enqueue(Request);
+		return Request;
+	}
+
+private:
+	FPakIoUring& Ring;
+	const int Fd;
+	const int64 FileSize;
+};
+
+FPakIoUring::~FPakIoUring()
+{
+	if (Thread)
+	{
+		Stop();
+		Thread->WaitForCompletion();
+		delete Thread;
+		Thread = nullptr;
+	}
+
+	Teardown();
+}
+
+bool FPakIoUring::Setup()
+{
+	io_uring_params Params;
+	FMemory::Memzero(Params);
+
+	RingFd = PakIoUring::Setup(PakIoUring::QueueDepth, &Params);
+	if (RingFd < 0)
+	{
+		PAKLOADER_LOG(LL_WARNING, TEXT("io_uring is not available (%d), pak reads use the default async IO"), errno);
+		return false;
+	}
+
+	SqRingSize = Params.sq_off.array + Params.sq_entries * sizeof(uint32);
+	CqRingSize = Params.cq_off.cqes + Params.cq_entries * sizeof(io_uring_cqe);
+
+	// Since 5.4 both rings share one mapping.
+#ifdef IORING_FEAT_SINGLE_MMAP
+	const bool bSingleMap = (Params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+#else
+	const bool bSingleMap = false;
+#endif
+	if (bSingleMap)
+	{
+		SqRingSize = CqRingSize = FMath::Max(SqRingSize, CqRingSize);
+	}
+
+	SqRing = mmap(nullptr, SqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, RingFd, IORING_OFF_SQ_RING);
+	CqRing = bSingleMap ? SqRing : mmap(nullptr, CqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, RingFd, IORING_OFF_CQ_RING);
+
+	SqesSize = Params.sq_entries * sizeof(io_uring_sqe);
+	Sqes = (io_uring_sqe*)mmap(nullptr, SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, RingFd, IORING_OFF_SQES);
+
+	if (SqRing == MAP_FAILED || CqRing == MAP_FAILED || Sqes == MAP_FAILED)
+	{
+		PAKLOADER_LOG(LL_WARNING, TEXT("Mapping the io_uring failed (%d)"), errno);
+		Teardown();
+		return false;
+	}
+
+	uint8* Sq = (uint8*)SqRing;
+	SqHead = (uint32*)(Sq + Params.sq_off.head);
+	SqTail = (uint32*)(Sq + Params.sq_off.tail);
+	SqMask = *(uint32*)(Sq + Params.sq_off.ring_mask);
+	SqArray = (uint32*)(Sq + Params.sq_off.array);
+
+	uint8* Cq = (uint8*)CqRing;
+	CqHead = (uint32*)(Cq + Params.cq_off.head);
+	CqTail = (uint32*)(Cq + Params.cq_off.tail);
+	CqMask = *(uint32*)(Cq + Params.cq_off.ring_mask);
+	Cqes = (io_uring_cqe*)(Cq + Params.cq_off.cqes);
+
+	EventFd = eventfd(0, EFD_CLOEXEC);
+	if (EventFd < 0)
+	{
+		Teardown();
+		return false;
+	}
+
+	// Registering pins the buffers once, the memory lock limit may not allow it. Reads work without.
+	const int64 FixedBuffersSize = PakIoUring::NumFixedBuffers * PakIoUring::FixedBufferSize;
+	FixedBuffers = (uint8*)FMemory::Malloc(FixedBuffersSize, 4096);
+
+	TArray<iovec> Iovecs;
+	for (int32 Index = 0; Index < PakIoUring::NumFixedBuffers; Index++)
+	{
+		iovec& Iovec = Iovecs.AddDefaulted_GetRef();
+		Iovec.iov_base = FixedBuffers + Index * PakIoUring::FixedBufferSize;
+		Iovec.iov_len = PakIoUring::FixedBufferSize;
+	}
+
+	if (PakIoUring::Register(RingFd, IORING_REGISTER_BUFFERS, Iovecs.GetData(), Iovecs.Num()) == 0)
+	{
+		for (int32 Index = PakIoUring::NumFixedBuffers - 1; Index >= 0; Index--)
+		{
+			FreeFixedBuffers.Add(Index);
+		}
+	}
+	else
+	{
+		PAKLOADER_LOG(LL_VERBOSE, TEXT("Registering io_uring buffers failed (%d), reading without"), errno);
+		FMemory::Free(FixedBuffers);
+		FixedBuffers = nullptr;
+	}
+
+	Thread = FRunnableThread::Create(this, TEXT("PakIoUring"), 0, TPri_AboveNormal);
+	if (!Thread)
+	{
+		Teardown();
+		return false;
+	}
+
+	PAKLOADER_LOG(LL_LOG, TEXT("Pak async reads use io_uring with %u entries"), Params.sq_entries);
+	return true;
+}
+
+void FPakIoUring::Teardown()
+{
+	if (Sqes && Sqes != MAP_FAILED)
+	{
+		munmap(Sqes, SqesSize);
+	}
+
+	if (CqRing && CqRing != MAP_FAILED && CqRing != SqRing)
+	{
+		munmap(CqRing, CqRingSize);
+	}
+
+	if (SqRing && SqRing != MAP_FAILED)
+	{
+		munmap(SqRing, SqRingSize);
+	}
+
+	Sqes = nullptr;
+	CqRing = nullptr;
+	SqRing = nullptr;
+
+	// Closing the ring unregisters the buffers.
+	if (RingFd >= 0)
+	{
+		close(RingFd);
+		RingFd = -1;
+	}
+
+	if (EventFd >= 0)
+	{
+		close(EventFd);
+		EventFd = -1;
+	}
+
+	if (FixedBuffers)
+	{
+		FMemory::Free(FixedBuffers);
+		FixedBuffers = nullptr;
+	}
+}
+
+void FPakIoUring::Enqueue(FPakIoUringReadRequest* Request)
+{
+	{
+		FScopeLock ScopeLock(&QueuedLock);
+		Queued.Add(Request);
+	}
+
+	// Requests that arrive while the thread is busy go with its next batch without a system call.
+	if (bWaiting.exchange(false))
+	{
+		WakeUp();
+	}
+}
+
+void FPakIoUring::WakeUp()
+{
+	const uint64 Value = 1;
+	const ssize_t Written = write(EventFd, &Value, sizeof(Value));
+	(void)Written;
+}
+
+void FPakIoUring::Stop()
+{
+	bStopping = true;
+	WakeUp();
+}
+
+uint32 FPakIoUring::Run()
+{
+	while (true)
+	{
+		PrepareQueued();
+
+		// Entries the kernel didn't take with the last call are submitted again.
+		const uint32 ToSubmit = *SqTail - __atomic_load_n(SqHead, __ATOMIC_ACQUIRE);
+
+		// Waits for a completion unless there is more to submit, the wake up read completes when reads are queued.
+		bool bWait = false;
+		if (NumInFlight > 0 || bWakeUpArmed)
+		{
+			bWaiting = true;
+
+			FScopeLock ScopeLock(&QueuedLock);
+			bWait = Queued.Num() == 0 || GetNumFreeEntries() <= 0;
+
+			if (!bWait)
+			{
+				bWaiting = false;
+			}
+		}
+
+		if (ToSubmit > 0 || bWait)
+		{
+			const int Result = PakIoUring::Enter(RingFd, ToSubmit, bWait ? 1 : 0, bWait ? IORING_ENTER_GETEVENTS : 0);
+
+			if (Result < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+			{
+				PAKLOADER_LOG(LL_ERROR, TEXT("io_uring_enter failed (%d)"), errno);
+			}
+		}
+
+		bWaiting = false;
+
+		ReapCompletions();
+
+		// Reads queued until the stop are still served, their owners wait for them.
+		if (bStopping && NumInFlight == 0 && !bWakeUpArmed && Retries.Num() == 0)
+		{
+			FScopeLock ScopeLock(&QueuedLock);
+			if (Queued.Num() == 0)
+			{
+				break;
+			}
+		}
+	}
+
+	return 0;
+}
+
+void FPakIoUring::PrepareQueued()
+{
+	if (!bWakeUpArmed && !bStopping)
+	{
+		PrepareWakeUpRead();
+	}
+
+	TArray<FPakIoUringReadRequest*> Batch;
+	{
+		FScopeLock ScopeLock(&QueuedLock);
+
+		// The completion queue holds twice the submission entries, staying below the queue depth never overflows it.
+		const int32 NumTaken = FMath::Clamp(GetNumFreeEntries(), 0, Queued.Num());
+
+		Batch.Append(Queued.GetData(), NumTaken);
+		Queued.RemoveAt(0, NumTaken, false);
+	}
+
+	// Continued reads go first, they were requested earlier.
+	Batch.Insert(Retries, 0);
+	Retries.Reset();
+
+	for (FPakIoUringReadRequest* Request : Batch)
+	{
+		PrepareRead(Request);
+	}
+}
+
+io_uring_sqe* FPakIoUring::NextSqe()
+{
+	// Only this thread writes the tail, the kernel reads it.
+	const uint32 Tail = *SqTail;
+	const uint32 Index = Tail & SqMask;
+
+	io_uring_sqe* Sqe = &Sqes[Index];
+	FMemory::Memzero(*Sqe);
+
+	SqArray[Index] = Index;
+	__atomic_store_n(SqTail, Tail + 1, __ATOMIC_RELEASE);
+
+	return Sqe;
+}
+
+void FPakIoUring::PrepareWakeUpRead()
+{
+	WakeUpIovec.iov_base = &WakeUpValue;
+	WakeUpIovec.iov_len = sizeof(WakeUpValue);
+
+	io_uring_sqe* Sqe = NextSqe();
+	Sqe->opcode = IORING_OP_READV;
+	Sqe->fd = EventFd;
+	Sqe->addr = (uint64)&WakeUpIovec;
+	Sqe->len = 1;
+	Sqe->user_data = PakIoUring::WakeUpUserData;
+
+	bWakeUpArmed = true;
+}
+
+void FPakIoUring::PrepareRead(FPakIoUringReadRequest* Request)
+{
+	const int64 Remaining = Request->BytesToRead - Request->BytesDone;
+
+	if (Request->FixedBufferIndex == INDEX_NONE && Request->BytesDone == 0 && Request->BytesToRead <= PakIoUring::FixedBufferSize && FreeFixedBuffers.Num() > 0)
+	{
+		Request->FixedBufferIndex = FreeFixedBuffers.Pop(false);
+	}
+
+	io_uring_sqe* Sqe = NextSqe();
+	Sqe->fd = Request->Fd;
+	Sqe->off = Request->Offset + Request->BytesDone;
+	Sqe->user_data = (uint64)Request;
+
+	if (Request->FixedBufferIndex != INDEX_NONE)
+	{
+		Sqe->opcode = IORING_OP_READ_FIXED;
+		Sqe->addr = (uint64)(FixedBuffers + Request->FixedBufferIndex * PakIoUring::FixedBufferSize + Request->BytesDone);
+		Sqe->len = (uint32)Remaining;
+		Sqe->buf_index = (uint16)Request->FixedBufferIndex;
+	}
+	else
+	{
+		Request->Iovec.iov_base = Request->Memory + Request->BytesDone;
+		Request->Iovec.iov_len = Remaining;
+
+		Sqe->opcode = IORING_OP_READV;
+		Sqe->addr = (uint64)&Request->Iovec;
+		Sqe->len = 1;
+	}
+
+	NumInFlight++;
+}
+
+void FPakIoUring::ReapCompletions()
+{
+	uint32 Head = *CqHead;
+	const uint32 Tail = __atomic_load_n(CqTail, __ATOMIC_ACQUIRE);
+
+	while (Head != Tail)
+	{
+		const io_uring_cqe& Cqe = Cqes[Head & CqMask];
+		const uint64 UserData = Cqe.user_data;
+		const int32 Result = Cqe.res;
+		Head++;
+
+		if (UserData == PakIoUring::WakeUpUserData)
+		{
+			bWakeUpArmed = false;
+			continue;
+		}
+
+		NumInFlight--;
+		HandleCompletion((FPakIoUringReadRequest*)UserData, Result);
+	}
+
+	__atomic_store_n(CqHead, Head, __ATOMIC_RELEASE);
+}
+
+void FPakIoUring::HandleCompletion(FPakIoUringReadRequest* Request, int32 Result)
+{
+	if (Result > 0)
+	{
+		Request->BytesDone += Result;
+
+		if (Request->BytesDone < Request->BytesToRead)
+		{
+			Retries.Add(Request);
+			return;
+		}
+	}
+	else
+	{
+		PAKLOADER_LOG(LL_ERROR, TEXT("io_uring read at %lld failed (%d)"), Request->Offset + Request->BytesDone, -Result);
+	}
+
+	const bool bSuccess = Request->BytesDone == Request->BytesToRead;
+
+	if (Request->FixedBufferIndex != INDEX_NONE)
+	{
+		if (bSuccess)
+		{
+			FMemory::Memcpy(Request->Memory, FixedBuffers + Request->FixedBufferIndex * PakIoUring::FixedBufferSize, Request->BytesToRead);
+		}
+
+		FreeFixedBuffers.Add(Request->FixedBufferIndex);
+		Request->FixedBufferIndex = INDEX_NONE;
+	}
+
+	Request->Finish(bSuccess);
+}
+#else
+class FPakIoUring
+{
+};
+#endif
+
+FPakIoUringPlatformFile::FPakIoUringPlatformFile()
+{
+}
+
+FPakIoUringPlatformFile::~FPakIoUringPlatformFile()
+{
+}
+
+bool FPakIoUringPlatformFile::IsSupported()
+{
+	return PAKLOADER_WITH_IO_URING != 0;
+}
+
+bool FPakIoUringPlatformFile::Initialize(IPlatformFile* Inner, const TCHAR* CmdLine)
+{
+	if (!FPakPlatformFileLayer::Initialize(Inner, CmdLine))
+	{
+		return false;
+	}
+
+#if PAKLOADER_WITH_IO_URING
+	Ring = MakeUnique<FPakIoUring>();
+	if (!Ring->Setup())
+	{
+		Ring.Reset();
+		return false;
+	}
+
+	return true;
+#else
+	FLogHelper::Log(LL_WARNING, TEXT("io_uring pak reads are only supported on Linux"));
+	return false;
+#endif
+}
+
+IAsyncReadFileHandle* FPakIoUringPlatformFile::OpenAsyncRead(const TCHAR* Filename)
+{
+#if PAKLOADER_WITH_IO_URING
+	if (Ring.IsValid() && FPaths::GetExtension(Filename) == TEXT("pak") && !(PassThroughFilter && PassThroughFilter(Filename)))
+	{
+		const FString AbsolutePath = LowerLevel->ConvertToAbsolutePathForExternalAppForRead(Filename);
+		const int Fd = open(TCHAR_TO_UTF8(*AbsolutePath), O_RDONLY | O_CLOEXEC);
+
+		struct stat Stat;
+		if (Fd >= 0 && fstat(Fd, &Stat) == 0)
+		{
+			return new FPakIoUringAsyncReadFileHandle(*Ring, Fd, Stat.st_size);
+		}
+
+		if (Fd >= 0)
+		{
+			close(Fd);
+		}
+
+		// E.g. paks served from memory by a layer below, they don't exist on disk.
+	}
+#endif
+
+	return LowerLevel->OpenAsyncRead(Filename);
+}
@@ -3,14 +3,228 @@
 #include "PakLoader.h"
 #include "PakLoaderModule.h"
 #include "Serialization/ArrayReader.h"
+#include "Serialization/MemoryReader.h"
 #include "AssetRegistry/AssetRegistryModule.h"
 #include "AssetRegistry/AssetRegistryState.h"
 #include "Misc/App.h"
+#include "Misc/EngineVersion.h"
+#include "Misc/SecureHash.h"
+#include "HAL/FileManager.h"
 #include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
 #include "Misc/ConfigCacheIni.h" // for GConfig
 #include "GenericPlatform/GenericPlatformProperties.h" // for FPlatformProperties::IsServerOnly
 #include "ShaderCodeLibrary.h" // for FShaderCodeLibrary::OpenLibrary
 #include "LogHelper.h"
+#include "PakPlatformFileLayer.h"
+#include "PakStreamingPlatformFile.h"
+#include "PakMemoryPlatformFile.h"
+#include "PakAccessOrderPlatformFile.h"
+#include "PakIoUringPlatformFile.h"
+#include "Misc/CommandLine.h"
+#include "PakTraceRecorder.h"
+#include "PakHandle.h"
+#include "UObject/UObjectIterator.h"
+#include "UObject/UObjectHash.h"
+#include "UObject/UObjectGlobals.h"
+#include "Engine/Engine.h"
+
+struct FPakAssetRegistryData
+{
+	FArrayReader SerializedAssetData;
+
+#if ENGINE_MINOR_VERSION >= 27 || ENGINE_MAJOR_VERSION == 5
+	TUniquePtr<FAssetRegistryState> State;
+#endif
+};
+
+#if ENGINE_MINOR_VERSION >= 27 || ENGINE_MAJOR_VERSION == 5
+namespace PakAssetRegistry
+{
+	static bool MatchesPackagePath(const FAssetData& AssetData, const TArray<FString>& PackagePaths)
+	{
+		const FString PackagePath = AssetData.PackagePath.ToString();
+
+		for (FString Path : PackagePaths)
+		{
+			Path.RemoveFromEnd(TEXT("/"));
+
+			// Whole path components only, /MyDLC/Map doesn't keep /MyDLC/Maps.
+			if (PackagePath.StartsWith(Path) && (PackagePath.Len() == Path.Len() || PackagePath[Path.Len()] == TEXT('/')))
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	static bool MatchesClass(const FAssetData& AssetData, const TArray<FString>& ClassNames)
+	{
+#if ENGINE_MINOR_VERSION >= 1 && ENGINE_MAJOR_VERSION == 5
+		const FString ClassPath = AssetData.AssetClassPath.ToString();
+		const FString ClassName = AssetData.AssetClassPath.GetAssetName().ToString();
+#else
+		const FString ClassName = AssetData.AssetClass.ToString();
+		const FString& ClassPath = ClassName;
+#endif
+
+		for (const FString& Name : ClassNames)
+		{
+			if (Name.Equals(ClassName, ESearchCase::IgnoreCase) || Name.Equals(ClassPath, ESearchCase::IgnoreCase))
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	/* Removes packages that don't match the paths and classes of Options. */
+	static void FilterPackages(FAssetRegistryState& State, const FPakAssetRegistryLoadOptions& Options, int32& OutNumKept, int32& OutNumRemoved)
+	{
+		TArray<FAssetData> Assets;
+		State.GetAllAssets(TSet<FName>(), Assets);
+
+		// A package is kept if any of its assets matches.
+		TSet<FName> KeptPackages;
+		for (const FAssetData& AssetData : Assets)
+		{
+			if ((Options.PackagePaths.Num() == 0 || MatchesPackagePath(AssetData, Options.PackagePaths)) &&
+				(Options.ClassNames.Num() == 0 || MatchesClass(AssetData, Options.ClassNames)))
+			{
+				KeptPackages.Add(AssetData.PackageName);
+			}
+		}
+
+		TSet<FName> RemovedPackages;
+		for (const FAssetData& AssetData : Assets)
+		{
+			if (KeptPackages.Contains(AssetData.PackageName))
+			{
+				++OutNumKept;
+			}
+			else
+			{
+				RemovedPackages.Add(AssetData.PackageName);
+				++OutNumRemoved;
+			}
+		}
+
+		if (RemovedPackages.Num() > 0)
+		{
+			State.PruneAssetData(TSet<FName>(), RemovedPackages, FAssetRegistrySerializationOptions());
+		}
+	}
+
+	/* Copies State without the tags, dependencies and package data that Options strips. */
+	static TUniquePtr<FAssetRegistryState> StripState(const FAssetRegistryState& State, const FPakAssetRegistryLoadOptions& Options)
+	{
+		FAssetRegistrySerializationOptions SerializationOptions;
+		SerializationOptions.bSerializeAssetRegistry = true;
+		SerializationOptions.bSerializeDependencies = !Options.bStripDependencies;
+		SerializationOptions.bSerializeSearchableNameDependencies = !Options.bStripDependencies;
+		SerializationOptions.bSerializeManageDependencies = !Options.bStripDependencies;
+		SerializationOptions.bSerializePackageData = !Options.bStripPackageData;
+
+		if (Options.KeepTags.Num() > 0 || Options.StripTags.Num() > 0)
+		{
+			// The engine's cook filter, a list for the wildcard class applies to every class.
+			const TSet<FName> Tags(Options.KeepTags.Num() > 0 ? Options.KeepTags : Options.StripTags);
+
+#if ENGINE_MINOR_VERSION >= 1 && ENGINE_MAJOR_VERSION == 5
+			SerializationOptions.CookFilterlistTagsByClass.Add(UE::AssetRegistry::WildcardPathName, Tags);
+#else
+			SerializationOptions.CookFilterlistTagsByClass.Add(FName(TEXT("*")), Tags);
+#endif
+
+#if ENGINE_MAJOR_VERSION == 5
+			SerializationOptions.bUseAssetRegistryTagsAllowListInsteadOfDenyList = Options.KeepTags.Num() > 0;
+#else
+			SerializationOptions.bUseAssetRegistryTagsWhitelistInsteadOfBlacklist = Options.KeepTags.Num() > 0;
+#endif
+		}
+
+		TUniquePtr<FAssetRegistryState> Stripped = MakeUnique<FAssetRegistryState>();
+		Stripped->InitializeFromExisting(State, SerializationOptions);
+		return Stripped;
+	}
+
+	static constexpr uint32 CacheMagic = 0x52414B50;
+	static constexpr int32 CacheVersion = 1;
+
+	/* Options that keep everything, for merging and saving already filtered states. */
+	static FAssetRegistrySerializationOptions MakeFullSerializationOptions()
+	{
+		FAssetRegistrySerializationOptions Options;
+		Options.bSerializeAssetRegistry = true;
+		Options.bSerializeDependencies = true;
+		Options.bSerializeSearchableNameDependencies = true;
+		Options.bSerializeManageDependencies = true;
+		Options.bSerializePackageData = true;
+		return Options;
+	}
+
+	static bool LoadCache(const FString& CacheFilename, const FString& Key, FAssetRegistryState& OutState)
+	{
+		TUniquePtr<FArchive> Reader(IFileManager::Get().CreateFileReader(*CacheFilename));
+		if (!Reader)
+		{
+			return false;
+		}
+
+		uint32 Magic = 0;
+		int32 Version = 0;
+		FString CachedKey;
+		*Reader << Magic;
+		*Reader << Version;
+
+		if (Magic != CacheMagic || Version != CacheVersion)
+		{
+			return false;
+		}
+
+		*Reader << CachedKey;
+		if (CachedKey != Key)
+		{
+			return false;
+		}
+
+		OutState.Load(*Reader);
+		return !Reader->IsError();
+	}
+
+	static bool SaveCache(const FString& CacheFilename, const FString& Key, FAssetRegistryState& State)
+	{
+		// Written next to the cache and moved over it, a crash never leaves a torn cache behind.
+		const FString TempFilename = CacheFilename + TEXT(".tmp");
+		{
+			TUniquePtr<FArchive> Writer(IFileManager::Get().CreateFileWriter(*TempFilename));
+			if (!Writer)
+			{
+				return false;
+			}
+
+			uint32 Magic = CacheMagic;
+			int32 Version = CacheVersion;
+			FString CacheKey = Key;
+			*Writer << Magic;
+			*Writer << Version;
+			*Writer << CacheKey;
+
+			State.Save(*Writer, MakeFullSerializationOptions());
+
+			if (!Writer->Close())
+			{
+				IFileManager::Get().Delete(*TempFilename);
+				return false;
+			}
+		}
+
+		return IFileManager::Get().Move(*CacheFilename, *TempFilename, true);
+	}
+}
+#endif
 
 FPakLoader *FPakLoader::Instance = nullptr;
 
@@ -23,6 +237,11 @@ FPakLoader::~FPakLoader()
 {
 	UE_LOG(LogPakLoader, Log, TEXT("FPakLoader::FPakLoader()"));
 
+	if (PostGarbageCollectHandle.IsValid())
+	{
+		FCoreUObjectDelegates::GetPostGarbageCollect().Remove(PostGarbageCollectHandle);
+	}
+
 	ResetPlatformFile();
 }
 
@@ -73,6 +292,12 @@ FPakPlatformFile *FPakLoader::GetPakPlatformFile()
 				FLogHelper::Log(LL_VERBOSE, TEXT("Failed to initialize PakPlatformFile"));
 			}
 		}
+
+		// Installed before any pak is mounted, so every pak reads through it.
+		if (FParse::Param(FCommandLine::Get(), TEXT("PakIoUring")))
+		{
+			GetIoUringPlatformFile();
+		}
 	}
 
 	ensure(PakPlatformFile != nullptr);
@@ -95,6 +320,104 @@ void FPakLoader::ResetPlatformFile()
 #endif
 }
 
+bool FPakLoader::InsertPlatformFileLayer(FPakPlatformFileLayer* Layer)
+{
+	FPakPlatformFile* PakFile = GetPakPlatformFile();
+
+	if (!Layer->Initialize(PakFile->GetLowerLevel(), TEXT("")))
+	{
+		PAKLOADER_LOG(LL_ERROR, TEXT("Failed to initialize platform file layer %s"), Layer->GetName());
+		return false;
+	}
+
+	// Pak readers opened before keep using the previous lower level, new ones read through the layer.
+	PakFile->SetLowerLevel(Layer);
+	return true;
+}
+
+FPakStreamingPlatformFile *FPakLoader::GetStreamingPlatformFile()
+{
+	if (!StreamingPlatformFile)
+	{
+		StreamingPlatformFile = new FPakStreamingPlatformFile();
+
+		if (!InsertPlatformFileLayer(StreamingPlatformFile))
+		{
+			delete StreamingPlatformFile;
+			StreamingPlatformFile = nullptr;
+		}
+	}
+
+	return StreamingPlatformFile;
+}
+
+FPakMemoryPlatformFile *FPakLoader::GetMemoryPlatformFile()
+{
+	if (!MemoryPlatformFile)
+	{
+		MemoryPlatformFile = new FPakMemoryPlatformFile();
+
+		if (!InsertPlatformFileLayer(MemoryPlatformFile))
+		{
+			delete MemoryPlatformFile;
+			MemoryPlatformFile = nullptr;
+		}
+	}
+
+	return MemoryPlatformFile;
+}
+
+FPakAccessOrderPlatformFile *FPakLoader::GetAccessOrderPlatformFile()
+{
+	if (!AccessOrderPlatformFile)
+	{
+		AccessOrderPlatformFile = new FPakAccessOrderPlatformFile();
+
+		if (!InsertPlatformFileLayer(AccessOrderPlatformFile))
+		{
+			delete AccessOrderPlatformFile;
+			AccessOrderPlatformFile = nullptr;
+		}
+	}
+
+	return AccessOrderPlatformFile;
+}
+
+FPakIoUringPlatformFile *FPakLoader::GetIoUringPlatformFile()
+{
+	// A kernel without io_uring won't get it later, don't try again on every call.
+	if (!IoUringPlatformFile && !bIoUringUnavailable)
+	{
+		IoUringPlatformFile = new FPakIoUringPlatformFile();
+
+		// Paks of other layers are not plain files on disk, or not completely yet.
+		IoUringPlatformFile->SetPassThroughFilter([this](const TCHAR* Filename)
+		{
+			return (StreamingPlatformFile && StreamingPlatformFile->IsRegistered(Filename)) || (MemoryPlatformFile && MemoryPlatformFile->IsRegistered(Filename));
+		});
+
+		if (!InsertPlatformFileLayer(IoUringPlatformFile))
+		{
+			delete IoUringPlatformFile;
+			IoUringPlatformFile = nullptr;
+			bIoUringUnavailable = true;
+		}
+	}
+
+	return IoUringPlatformFile;
+}
+
+void FPakLoader::SetAccessOrderPrefetchEnabled(bool bEnabled)
+{
+	// Installed right away, pak readers opened before the layer exists never read through it.
+	if (bEnabled && !GetAccessOrderPlatformFile())
+	{
+		return;
+	}
+
+	bAccessOrderPrefetchEnabled = bEnabled;
+}
+
 TArray<FString> FPakLoader::GetMountedPakFilenames()
 {
 	TArray<FString> MountedPakFilenames;
@@ -135,6 +458,39 @@ bool FPakLoader::IsValidPakFile(const FString &PakFilename, int64 &OutPakSize, b
 	return true;
 }
 
+bool FPakLoader::IsValidPakFooter(const TArray<uint8>& Tail, int64 FileSize)
+{
+	FPakInfo Info;
+	return ReadPakFooter(Tail, FileSize, Info);
+}
+
+bool FPakLoader::ReadPakFooter(const TArray<uint8>& Tail, int64 FileSize, FPakInfo& OutInfo)
+{
+	// Same search as FPakFile, the footer size depends on the pak version.
+	for (int32 Version = FPakInfo::PakFile_Version_Latest; Version > FPakInfo::PakFile_Version_Initial; --Version)
+	{
+		OutInfo = FPakInfo();
+		const int64 FooterSize = OutInfo.GetSerializedSize(Version);
+
+		if (FooterSize > Tail.Num() || FooterSize > FileSize)
+		{
+			continue;
+		}
+
+		FMemoryReader Reader(Tail);
+		Reader.Seek(Tail.Num() - FooterSize);
+		OutInfo.Serialize(Reader, Version);
+
+		if (!Reader.IsError() && OutInfo.Magic == FPakInfo::PakFile_Magic)
+		{
+			return OutInfo.Version <= FPakInfo::PakFile_Version_Latest && OutInfo.IndexOffset >= 0 && OutInfo.IndexSize > 0 &&
+				OutInfo.IndexOffset + OutInfo.IndexSize <= FileSize - FooterSize;
+		}
+	}
+
+	return false;
+}
+
 int32 FPakLoader::GetPakOrderFromPakFilename(const FString& PakFilePath)
 {
 	if (PakFilePath.StartsWith(FString::Printf(TEXT("%sPaks/%s-"), *FPaths::ProjectContentDir(), FApp::GetProjectName())))
@@ -158,6 +514,33 @@ int32 FPakLoader::GetPakOrderFromPakFilename(const FString& PakFilePath)
 }
 
 bool FPakLoader::MountPakFileEasy(const FString& PakFilename)
+{
+	FPakLoaderMountDetails Details;
+	return MountPakFileEasy(PakFilename, Details);
+}
+
+bool FPakLoader::MountPakFileEasy(const FString& PakFilename, FPakLoaderMountDetails& OutDetails)
+{
+	FPakTraceScope TraceScope(TEXT("MountPakFileEasy"), TEXT("Mount"), PakFilename);
+	const double StartTime = FPlatformTime::Seconds();
+
+	FString AssetRegistryFile;
+	if (!MountPakFileAndFindContent(PakFilename, OutDetails, AssetRegistryFile))
+	{
+		return false;
+	}
+
+	RegisterMountPoint(OutDetails.RootPath, OutDetails.ContentPath);
+	LoadAssetRegistryFile(AssetRegistryFile);
+	OpenShaderLibrary(OutDetails.ContentPath);
+
+	OutDetails.MountSeconds = FPlatformTime::Seconds() - StartTime;
+	NotifyPakMounted(OutDetails);
+
+	return true;
+}
+
+bool FPakLoader::MountPakFileAndFindContent(const FString& PakFilename, FPakLoaderMountDetails& OutDetails, FString& OutAssetRegistryFile)
 {
 	FPakFile* Pak = nullptr;
 
@@ -174,7 +557,7 @@ bool FPakLoader::MountPakFileEasy(const FString& PakFilename)
 #if ENGINE_MINOR_VERSION >= 27 || ENGINE_MAJOR_VERSION == 5
 		PakFile.SafeRelease();
 #endif
-		FLogHelper::Log(ELogHelperLogLevel::LL_ERROR, FString::Printf(TEXT("Pak file not valid: %s"), *PakFilename));
+		PAKLOADER_LOG(LL_ERROR, TEXT("Pak file not valid: %s"), *PakFilename);
 		return false;
 	}
 
@@ -184,24 +567,29 @@ bool FPakLoader::MountPakFileEasy(const FString& PakFilename)
 #if ENGINE_MINOR_VERSION >= 27 || ENGINE_MAJOR_VERSION == 5
 		PakFile.SafeRelease();
 #endif
-		FLogHelper::Log(ELogHelperLogLevel::LL_ERROR, FString::Printf(TEXT("Unable to automatically detect root and content "
+		PAKLOADER_LOG(LL_ERROR, TEXT("Unable to automatically detect root and content "
 			"path for pak file %s. This happens when there is no AssetRegistry.bin in the pak file. Make sure that your pak "
-			"file has one or use MountPakFile and RegisterMountPoint to specifiy them yourself."), *PakFilename));
+			"file has one or use MountPakFile and RegisterMountPoint to specifiy them yourself."), *PakFilename);
 		return false;
 	}
 
-	FString EmptyMP;
-	if (!MountPakFile(PakFilename, INDEX_NONE, EmptyMP))
+	OutDetails.PakFilename = PakFilename;
+	OutDetails.MountPoint = Pak->GetMountPoint();
+	OutDetails.RootPath = RootPath;
+	OutDetails.ContentPath = ContentPath;
+	OutDetails.PakOrder = GetPakOrderFromPakFilename(PakFilename);
+	OutDetails.NumFiles = Pak->GetNumFiles();
+	OutDetails.Size = Pak->TotalSize();
+
+	if (!MountPakFileInternal(PakFilename, OutDetails.PakOrder, FString()))
 	{
 #if ENGINE_MINOR_VERSION >= 27 || ENGINE_MAJOR_VERSION == 5
 		PakFile.SafeRelease();
 #endif
-		FLogHelper::Log(ELogHelperLogLevel::LL_ERROR, FString::Printf(TEXT("Mounting of pak file failed %s"), *PakFilename));
+		PAKLOADER_LOG(LL_ERROR, TEXT("Mounting of pak file failed %s"), *PakFilename);
 		return false;
 	}
 
-	RegisterMountPoint(RootPath, ContentPath);
-
 	TArray<FString> Files;
 #if ENGINE_MINOR_VERSION <= 25 && ENGINE_MAJOR_VERSION <= 4
 	Pak->FindFilesAtPath(Files, *Pak->GetMountPoint(), true, false, true);
@@ -211,73 +599,683 @@ bool FPakLoader::MountPakFileEasy(const FString& PakFilename)
 	Pak->FindPrunedFilesAtPath(Files, *Pak->GetMountPoint(), true, false, true);
 #endif
 
-	FString AssetRegistryFile;
+	OutAssetRegistryFile.Empty();
 	for (const FString& File : Files)
 	{
 		if (File.EndsWith("/AssetRegistry.bin", ESearchCase::CaseSensitive))
 		{
-			AssetRegistryFile = File;
+			OutAssetRegistryFile = File;
 			break;
 		}
 	}
-	
-	LoadAssetRegistryFile(AssetRegistryFile);
 
 #if ENGINE_MINOR_VERSION >= 27 || ENGINE_MAJOR_VERSION == 5
 	PakFile.SafeRelease();
 #endif
 
-	bool bArchive = false;
-	GConfig->GetBool(TEXT("/Script/UnrealEd.ProjectPackagingSettings"), TEXT("bShareMaterialShaderCode"), bArchive, GGameIni);
+	return true;
+}
 
-	bool bEnable = !FPlatformProperties::IsServerOnly() && FApp::CanEverRender() && bArchive;
+int32 FPakLoader::MountPakFilesWithRegistryCache(const TArray<FString>& PakFilenames, const FString& InCacheFilename)
+{
+	const FString CacheFilename = InCacheFilename.IsEmpty() ? FPaths::ProjectSavedDir() / TEXT("PakLoader") / TEXT("AssetRegistryCache.bin") : InCacheFilename;
+	FPakTraceScope TraceScope(TEXT("MountPakFilesWithRegistryCache"), TEXT("Mount"), CacheFilename);
+	const double StartTime = FPlatformTime::Seconds();
 
-	if (bEnable)
+	TArray<FPakLoaderMountDetails> MountedPaks;
+	TArray<FString> AssetRegistryFiles;
+
+	for (const FString& PakFilename : PakFilenames)
 	{
-		FShaderCodeLibrary::OpenLibrary(FApp::GetProjectName(), ContentPath);
+		FPakLoaderMountDetails Details;
+		FString AssetRegistryFile;
+
+		if (!MountPakFileAndFindContent(PakFilename, Details, AssetRegistryFile))
+		{
+			continue;
+		}
+
+		RegisterMountPoint(Details.RootPath, Details.ContentPath);
+		MountedPaks.Add(Details);
+		AssetRegistryFiles.Add(AssetRegistryFile);
 	}
-	return true;
-}
 
-bool FPakLoader::MountPakFile(const FString &PakFilename, int32 PakOrder, const FString &MountPath)
-{
-	if (PakOrder == INDEX_NONE)
+#if ENGINE_MINOR_VERSION >= 27 || ENGINE_MAJOR_VERSION == 5
+	// A snapshot of a different set of paks would publish assets of paks that are not mounted.
+	const bool bAllMounted = MountedPaks.Num() == PakFilenames.Num();
+	const FString Key = bAllMounted ? GetAssetRegistryCacheKey(PakFilenames) : FString();
+
+	FAssetRegistryState MergedState;
+	bool bFromCache = false;
+
+	if (bAllMounted)
 	{
-		PakOrder = GetPakOrderFromPakFilename(PakFilename);
+		FPakTraceScope CacheScope(TEXT("LoadAssetRegistryCache"), TEXT("AssetRegistry"), CacheFilename);
+		bFromCache = PakAssetRegistry::LoadCache(CacheFilename, Key, MergedState);
 	}
 
-	bool bResult = false;
-	if (MountPath.Len() > 0)
+	if (!bFromCache)
 	{
-		bResult = GetPakPlatformFile()->Mount(*PakFilename, PakOrder, *MountPath);
+		MergedState.Reset();
+
+		const FAssetRegistrySerializationOptions MergeOptions = PakAssetRegistry::MakeFullSerializationOptions();
+
+		for (const FString& AssetRegistryFile : AssetRegistryFiles)
+		{
+			TSharedPtr<FPakAssetRegistryData, ESPMode::ThreadSafe> Data = ReadAssetRegistryFile(AssetRegistryFile);
+			if (Data.IsValid())
+			{
+				MergedState.InitializeFromExisting(*Data->State, MergeOptions, FAssetRegistryState::EInitializationMode::Append);
+			}
+		}
+
+		if (bAllMounted)
+		{
+			FPakTraceScope CacheScope(TEXT("SaveAssetRegistryCache"), TEXT("AssetRegistry"), CacheFilename);
+
+			if (!PakAssetRegistry::SaveCache(CacheFilename, Key, MergedState))
+			{
+				PAKLOADER_LOG(LL_WARNING, TEXT("Unable to write asset registry cache %s"), *CacheFilename);
+			}
+		}
 	}
-	else
+
 	{
-		// NULL will make the mount to use the pak's mount point
-		bResult = GetPakPlatformFile()->Mount(*PakFilename, PakOrder, NULL);
+		FPakTraceScope AppendScope(TEXT("AppendAssetRegistry"), TEXT("AssetRegistry"));
+
+		IAssetRegistry& AssetRegistry = FModuleManager::LoadModuleChecked<FAssetRegistryModule>(AssetRegistryConstants::ModuleName).Get();
+		AssetRegistry.AppendState(MergedState);
 	}
-	return bResult;
-}
 
-bool FPakLoader::UnmountPakFile(const FString &PakFilename)
-{
-	return GetPakPlatformFile()->Unmount(*PakFilename);
-}
+	PAKLOADER_LOG(LL_LOG, TEXT("Asset registry of %d paks %s"), MountedPaks.Num(), bFromCache ? TEXT("loaded from cache") : TEXT("merged and cached"));
+#else
+	FLogHelper::Log(LL_WARNING, TEXT("Asset registry caching requires Unreal Engine 4.27 or newer"));
 
-void FPakLoader::RegisterMountPoint(const FString& RootPath, const FString& ContentPath)
-{
-	FPackageName::RegisterMountPoint(RootPath, ContentPath);
+	for (const FString& AssetRegistryFile : AssetRegistryFiles)
+	{
+		LoadAssetRegistryFile(AssetRegistryFile);
+	}
+#endif
+
+	const double MountSeconds = (FPlatformTime::Seconds() - StartTime) / FMath::Max(MountedPaks.Num(), 1);
+
+	for (FPakLoaderMountDetails& Details : MountedPaks)
+	{
+		OpenShaderLibrary(Details.ContentPath);
+
+		// The paks were mounted together, each gets its share.
+		Details.MountSeconds = MountSeconds;
+		NotifyPakMounted(Details);
+	}
+
+	return MountedPaks.Num();
 }
 
-void FPakLoader::UnRegisterMountPoint(const FString& RootPath, const FString& ContentPath)
+FString FPakLoader::GetAssetRegistryCacheKey(const TArray<FString>& PakFilenames)
 {
-	FPackageName::UnRegisterMountPoint(RootPath, ContentPath);
+	TArray<FString> SortedFilenames = PakFilenames;
+	SortedFilenames.Sort();
+
+	// The cache holds filtered states, other options need another snapshot.
+	const FPakAssetRegistryLoadOptions Options = GetAssetRegistryLoadOptions();
+
+	FString KeySource = FEngineVersion::Current().ToString();
+	KeySource += FString::Printf(TEXT("|%s|%s|%s|%s|%d|%d"),
+		*FString::Join(Options.PackagePaths, TEXT(",")),
+		*FString::Join(Options.ClassNames, TEXT(",")),
+		*FString::JoinBy(Options.KeepTags, TEXT(","), [](const FName& Tag) { return Tag.ToString(); }),
+		*FString::JoinBy(Options.StripTags, TEXT(","), [](const FName& Tag) { return Tag.ToString(); }),
+		Options.bStripDependencies ? 1 : 0,
+		Options.bStripPackageData ? 1 : 0);
+
+	// Size and time stamp change whenever a pak is replaced, hashing the content would cost more than the cache saves.
+	IPlatformFile* PlatformFile = GetPakPlatformFile()->GetLowerLevel();
+	for (const FString& PakFilename : SortedFilenames)
+	{
+		KeySource += FString::Printf(TEXT("|%s|%lld|%s"), *PakFilename, PlatformFile->FileSize(*PakFilename), *PlatformFile->GetTimeStamp(*PakFilename).ToString());
+	}
+
+	FTCHARToUTF8 Utf8(*KeySource);
+	FSHAHash Hash;
+	FSHA1::HashBuffer(Utf8.Get(), Utf8.Length(), Hash.Hash);
+	return Hash.ToString();
 }
 
-bool FPakLoader::GetRootPathAndContentPathForPak(const FPakFile& PakFile, FString& OutRootPath, FString& OutContentPath)
+void FPakLoader::OpenShaderLibrary(const FString& ContentPath)
 {
-	if (!PakFile.IsValid())
-		return false;
+	bool bArchive = false;
+	GConfig->GetBool(TEXT("/Script/UnrealEd.ProjectPackagingSettings"), TEXT("bShareMaterialShaderCode"), bArchive, GGameIni);
+
+	bool bEnable = !FPlatformProperties::IsServerOnly() && FApp::CanEverRender() && bArchive;
+
+	if (bEnable)
+	{
+		FShaderCodeLibrary::OpenLibrary(FApp::GetProjectName(), ContentPath);
+	}
+}
+
+void FPakLoader::NotifyPakMounted(const FPakLoaderMountDetails& Details)
+{
+	if (AccessOrderPlatformFile && !Details.RootPath.IsEmpty())
+	{
+		AccessOrderPlatformFile->SetContentRoot(Details.PakFilename, Details.RootPath, bAccessOrderPrefetchEnabled);
+	}
+
+	PakMountedDelegate.Broadcast(Details);
+}
+
+bool FPakLoader::MountPakFile(const FString &PakFilename, int32 PakOrder, const FString &MountPath)
+{
+	FPakReadaheadOptions NoReadahead;
+	NoReadahead.bIndex = false;
+
+	return MountPakFile(PakFilename, PakOrder, MountPath, NoReadahead);
+}
+
+bool FPakLoader::MountPakFile(const FString &PakFilename, int32 PakOrder, const FString &MountPath, const FPakReadaheadOptions &Readahead)
+{
+	FPakTraceScope TraceScope(TEXT("MountPakFile"), TEXT("Mount"), PakFilename);
+	const double StartTime = FPlatformTime::Seconds();
+
+	if (PakOrder == INDEX_NONE)
+	{
+		PakOrder = GetPakOrderFromPakFilename(PakFilename);
+	}
+
+	// Hinted before mounting, the disk fetches the index while the mount reads the footer.
+	const bool bHinted = Readahead.IsEnabled() && HintReadahead(PakFilename, Readahead);
+
+	if (!MountPakFileInternal(PakFilename, PakOrder, MountPath))
+	{
+		if (bHinted)
+		{
+			FPakReadahead::DontNeed(PakFilename);
+		}
+
+		return false;
+	}
+
+	if (bHinted)
+	{
+		FScopeLock ScopeLock(&ReadaheadPaksLock);
+		ReadaheadPaks.Add(PakFilename);
+	}
+
+	FPakLoaderMountDetails Details;
+	Details.PakFilename = PakFilename;
+	Details.MountPoint = MountPath;
+	Details.PakOrder = PakOrder;
+	Details.Size = GetPakPlatformFile()->GetLowerLevel()->FileSize(*PakFilename);
+	Details.MountSeconds = FPlatformTime::Seconds() - StartTime;
+	PakMountedDelegate.Broadcast(Details);
+
+	return true;
+}
+
+bool FPakLoader::HintReadahead(const FString& PakFilename, const FPakReadaheadOptions& Options)
+{
+	if (!FPakReadahead::IsSupported())
+	{
+		FLogHelper::Log(LL_VERBOSE, TEXT("Readahead hints are only supported on Linux and Android"));
+		return false;
+	}
+
+	FPakTraceScope TraceScope(TEXT("HintReadahead"), TEXT("IO"), PakFilename);
+
+	TArray<FPakReadaheadRegion> Regions;
+
+	if (Options.bWholePak)
+	{
+		Regions.AddDefaulted();
+	}
+	else
+	{
+		if (Options.bIndex)
+		{
+			IPlatformFile* PlatformFile = GetPakPlatformFile()->GetLowerLevel();
+			const int64 FileSize = PlatformFile->FileSize(*PakFilename);
+
+			// Larger than any footer version.
+			const int64 TailSize = FMath::Min<int64>(FileSize, 1024);
+
+			TArray<uint8> Tail;
+			Tail.SetNumUninitialized(TailSize);
+
+			TUniquePtr<IFileHandle> Handle(PlatformFile->OpenRead(*PakFilename));
+			FPakInfo Info;
+
+			if (Handle && TailSize > 0 && Handle->Seek(FileSize - TailSize) && Handle->Read(Tail.GetData(), TailSize) && ReadPakFooter(Tail, FileSize, Info))
+			{
+				// The secondary indices of newer pak versions and the footer follow the primary index.
+				FPakReadaheadRegion& Region = Regions.AddDefaulted_GetRef();
+				Region.Offset = Info.IndexOffset;
+			}
+		}
+
+		Regions.Append(Options.Regions);
+	}
+
+	if (Regions.Num() == 0)
+	{
+		return false;
+	}
+
+	return FPakReadahead::WillNeed(PakFilename, Regions);
+}
+
+bool FPakLoader::MountPakFileInternal(const FString& PakFilename, int32 PakOrder, const FString& MountPath)
+{
+	// Registered before mounting, the pak platform file keeps the readers it opens while mounting.
+	if (bAccessOrderPrefetchEnabled)
+	{
+		AccessOrderPlatformFile->RegisterFile(PakFilename);
+	}
+
+	bool bResult = false;
+	if (MountPath.Len() > 0)
+	{
+		bResult = GetPakPlatformFile()->Mount(*PakFilename, PakOrder, *MountPath);
+	}
+	else
+	{
+		// NULL will make the mount to use the pak's mount point
+		bResult = GetPakPlatformFile()->Mount(*PakFilename, PakOrder, NULL);
+	}
+
+	if (!bResult && bAccessOrderPrefetchEnabled)
+	{
+		AccessOrderPlatformFile->UnregisterFile(PakFilename, false);
+	}
+
+	return bResult;
+}
+
+bool FPakLoader::MountPakFileFromMemory(const FString& PakFilename, const uint8* Data, int64 Size)
+{
+	FPakMemoryPlatformFile* MemoryFile = GetMemoryPlatformFile();
+	if (!MemoryFile)
+	{
+		return false;
+	}
+
+	MemoryFile->RegisterFile(PakFilename, Data, Size);
+
+	if (!MountPakFileEasy(PakFilename))
+	{
+		MemoryFile->UnregisterFile(PakFilename);
+		return false;
+	}
+
+	return true;
+}
+
+bool FPakLoader::MountPakFileFromMemory(const FString& PakFilename, const TSharedRef<const TArray<uint8>, ESPMode::ThreadSafe>& Data)
+{
+	FPakMemoryPlatformFile* MemoryFile = GetMemoryPlatformFile();
+	if (!MemoryFile)
+	{
+		return false;
+	}
+
+	MemoryFile->RegisterFile(PakFilename, Data->GetData(), Data->Num(), Data);
+
+	if (!MountPakFileEasy(PakFilename))
+	{
+		MemoryFile->UnregisterFile(PakFilename);
+		return false;
+	}
+
+	return true;
+}
+
+bool FPakLoader::UnmountPakFile(const FString &PakFilename)
+{
+	FPakTraceScope TraceScope(TEXT("UnmountPakFile"), TEXT("Mount"), PakFilename);
+
+	const bool bResult = GetPakPlatformFile()->Unmount(*PakFilename);
+
+	// Readers of the pak still hold the buffer if it is owned, a caller owned buffer may go away after this.
+	if (bResult && MemoryPlatformFile)
+	{
+		MemoryPlatformFile->UnregisterFile(PakFilename);
+	}
+
+	if (bResult && AccessOrderPlatformFile)
+	{
+		AccessOrderPlatformFile->UnregisterFile(PakFilename);
+	}
+
+	bool bHinted = false;
+	if (bResult)
+	{
+		FScopeLock ScopeLock(&ReadaheadPaksLock);
+		bHinted = ReadaheadPaks.Remove(PakFilename) > 0;
+	}
+
+	if (bHinted)
+	{
+		FPakReadahead::DontNeed(PakFilename);
+	}
+
+	if (bResult)
+	{
+		PakUnmountedDelegate.Broadcast(PakFilename);
+	}
+
+	return bResult;
+}
+
+TSharedPtr<FPakHandle, ESPMode::ThreadSafe> FPakLoader::AcquirePak(const FString& PakFilename)
+{
+	check(IsInGameThread());
+
+	{
+		FScopeLock ScopeLock(&AcquiredPaksLock);
+
+		if (FAcquiredPak* Acquired = AcquiredPaks.Find(PakFilename))
+		{
+			++Acquired->NumHandles;
+			return TSharedPtr<FPakHandle, ESPMode::ThreadSafe>(new FPakHandle(PakFilename, Acquired->RootPath));
+		}
+	}
+
+	FAcquiredPak Acquired;
+	Acquired.NumHandles = 1;
+
+	if (!GetMountedPakFilenames().Contains(PakFilename))
+	{
+		FPakLoaderMountDetails Details;
+		if (!MountPakFileEasy(PakFilename, Details))
+		{
+			return nullptr;
+		}
+
+		Acquired.bMountedByHandles = true;
+		Acquired.RootPath = Details.RootPath;
+		Acquired.ContentPath = Details.ContentPath;
+	}
+
+	{
+		FScopeLock ScopeLock(&AcquiredPaksLock);
+		AcquiredPaks.Add(PakFilename, Acquired);
+	}
+
+	if (!IdleTickerHandle.IsValid())
+	{
+#if ENGINE_MAJOR_VERSION == 5
+		IdleTickerHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(this, &FPakLoader::TickIdlePaks), 1.0f);
+#else
+		IdleTickerHandle = FTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(this, &FPakLoader::TickIdlePaks), 1.0f);
+#endif
+	}
+
+	return TSharedPtr<FPakHandle, ESPMode::ThreadSafe>(new FPakHandle(PakFilename, Acquired.RootPath));
+}
+
+bool FPakLoader::IsPakAcquired(const FString& PakFilename)
+{
+	FScopeLock ScopeLock(&AcquiredPaksLock);
+	return AcquiredPaks.Contains(PakFilename);
+}
+
+void FPakLoader::ReleasePak(const FString& PakFilename)
+{
+	FScopeLock ScopeLock(&AcquiredPaksLock);
+
+	FAcquiredPak* Acquired = AcquiredPaks.Find(PakFilename);
+	if (Acquired && --Acquired->NumHandles == 0)
+	{
+		Acquired->IdleSinceSeconds = FPlatformTime::Seconds();
+	}
+}
+
+bool FPakLoader::TickIdlePaks(float DeltaTime)
+{
+	// Objects can't be released safely in the middle of loading or collecting.
+	if (IsGarbageCollecting() || IsAsyncLoading())
+	{
+		return true;
+	}
+
+	if (bIdlePaksCollected)
+	{
+		FinishIdleUnmounts();
+	}
+
+	const double Now = FPlatformTime::Seconds();
+
+	// Paks that became idle while others wait for their collection are taken with the next tick.
+	if (PendingIdlePaks.Num() == 0)
+	{
+		TArray<TPair<FString, FAcquiredPak>> IdlePaks;
+		{
+			FScopeLock ScopeLock(&AcquiredPaksLock);
+
+			for (auto It = AcquiredPaks.CreateIterator(); It; ++It)
+			{
+				if (It.Value().NumHandles == 0 && Now - It.Value().IdleSinceSeconds >= IdleUnmountDelay)
+				{
+					IdlePaks.Emplace(It.Key(), It.Value());
+					It.RemoveCurrent();
+				}
+			}
+		}
+
+		bool bUnloadedContent = false;
+		for (TPair<FString, FAcquiredPak>& Pair : IdlePaks)
+		{
+			if (!Pair.Value.bMountedByHandles)
+			{
+				continue;
+			}
+
+			if (!Pair.Value.RootPath.IsEmpty())
+			{
+				UnloadContent(Pair.Value.RootPath, false);
+				bUnloadedContent = true;
+			}
+
+			PendingIdlePaks.Add(MoveTemp(Pair));
+		}
+
+		// Collecting right away would stall the frame, the engine collects at the end of the next one. Same as the memory budget eviction.
+		if (bUnloadedContent && GEngine)
+		{
+			if (!PostGarbageCollectHandle.IsValid())
+			{
+				PostGarbageCollectHandle = FCoreUObjectDelegates::GetPostGarbageCollect().AddRaw(this, &FPakLoader::HandlePostGarbageCollect);
+			}
+
+			bIdlePaksCollected = false;
+			GEngine->ForceGarbageCollection(true);
+		}
+		else if (PendingIdlePaks.Num() > 0)
+		{
+			FinishIdleUnmounts();
+		}
+	}
+
+	if (PendingIdlePaks.Num() > 0)
+	{
+		return true;
+	}
+
+	FScopeLock ScopeLock(&AcquiredPaksLock);
+	if (AcquiredPaks.Num() > 0)
+	{
+		return true;
+	}
+
+	// Returning false removes the ticker, AcquirePak adds it again.
+	IdleTickerHandle.Reset();
+	return false;
+}
+
+void FPakLoader::HandlePostGarbageCollect()
+{
+	if (PendingIdlePaks.Num() > 0)
+	{
+		bIdlePaksCollected = true;
+	}
+}
+
+void FPakLoader::FinishIdleUnmounts()
+{
+	TArray<TPair<FString, FAcquiredPak>> IdlePaks = MoveTemp(PendingIdlePaks);
+	bIdlePaksCollected = false;
+
+	const double Now = FPlatformTime::Seconds();
+
+	for (const TPair<FString, FAcquiredPak>& Pair : IdlePaks)
+	{
+		{
+			FScopeLock ScopeLock(&AcquiredPaksLock);
+
+			// Acquired again while waiting, the new handles found it mounted. They own the mount now.
+			if (FAcquiredPak* Acquired = AcquiredPaks.Find(Pair.Key))
+			{
+				Acquired->bMountedByHandles = true;
+				Acquired->RootPath = Pair.Value.RootPath;
+				Acquired->ContentPath = Pair.Value.ContentPath;
+				continue;
+			}
+		}
+
+		const int32 NumRemaining = GetLoadedPackagesInRoot(Pair.Value.RootPath).Num();
+		if (NumRemaining > 0)
+		{
+			// Unmounting would break objects that still read from the pak, try again after the next idle delay.
+			PAKLOADER_LOG(LL_WARNING, TEXT("Not unmounting idle pak %s, %d packages are still referenced"), *Pair.Key, NumRemaining);
+
+			FAcquiredPak Requeued = Pair.Value;
+			Requeued.IdleSinceSeconds = Now;
+
+			FScopeLock ScopeLock(&AcquiredPaksLock);
+			AcquiredPaks.Add(Pair.Key, Requeued);
+			continue;
+		}
+
+		UnRegisterMountPoint(Pair.Value.RootPath, Pair.Value.ContentPath);
+		UnmountPakFile(Pair.Key);
+
+		PAKLOADER_LOG(LL_LOG, TEXT("Unmounted idle pak %s"), *Pair.Key);
+	}
+}
+
+TArray<UPackage*> FPakLoader::GetLoadedPackagesInRoot(const FString& RootPath)
+{
+	TArray<UPackage*> Packages;
+
+	// An empty root would match every package.
+	if (RootPath.IsEmpty())
+	{
+		return Packages;
+	}
+
+	for (TObjectIterator<UPackage> It; It; ++It)
+	{
+		if (It->GetName().StartsWith(RootPath))
+		{
+			Packages.Add(*It);
+		}
+	}
+
+	return Packages;
+}
+
+int32 FPakLoader::UnloadContent(const FString& RootPath, bool bCollectGarbage)
+{
+	const TArray<UPackage*> Packages = GetLoadedPackagesInRoot(RootPath);
+	if (Packages.Num() == 0)
+	{
+		return 0;
+	}
+
+	// Loaded assets are standalone, they would survive garbage collection without any reference.
+	TArray<UObject*> Objects;
+	for (UPackage* Package : Packages)
+	{
+		Objects.Reset();
+		GetObjectsWithOuter(Package, Objects, true);
+
+		for (UObject* Object : Objects)
+		{
+			Object->ClearFlags(RF_Standalone);
+		}
+
+		Package->ClearFlags(RF_Standalone);
+	}
+
+	if (!bCollectGarbage)
+	{
+		return Packages.Num();
+	}
+
+	CollectGarbage(GARBAGE_COLLECTION_KEEPFLAGS);
+
+	return GetLoadedPackagesInRoot(RootPath).Num();
+}
+
+TArray<FName> FPakLoader::GetPackageDependencyClosure(const FString& PackageName)
+{
+	FPakTraceScope TraceScope(TEXT("GetPackageDependencyClosure"), TEXT("Load"), PackageName);
+
+	IAssetRegistry& AssetRegistry = FModuleManager::LoadModuleChecked<FAssetRegistryModule>(AssetRegistryConstants::ModuleName).Get();
+
+	TArray<FName> Closure;
+	TSet<FName> Visited;
+	TArray<FName> Dependencies;
+
+	const FName RootPackage(*PackageName);
+	Closure.Add(RootPackage);
+	Visited.Add(RootPackage);
+
+	// Breadth first, Closure doubles as the queue.
+	for (int32 Index = 0; Index < Closure.Num(); Index++)
+	{
+		Dependencies.Reset();
+
+#if ENGINE_MINOR_VERSION >= 26 || ENGINE_MAJOR_VERSION == 5
+		AssetRegistry.GetDependencies(Closure[Index], Dependencies, UE::AssetRegistry::EDependencyCategory::Package, UE::AssetRegistry::EDependencyQuery::Hard);
+#else
+		AssetRegistry.GetDependencies(Closure[Index], Dependencies, EAssetRegistryDependencyType::Hard);
+#endif
+
+		for (const FName& Dependency : Dependencies)
+		{
+			// Native packages are always loaded, they are not part of any pak.
+			if (Dependency.ToString().StartsWith(TEXT("/Script/")))
+			{
+				continue;
+			}
+
+			bool bAlreadyVisited = false;
+			Visited.Add(Dependency, &bAlreadyVisited);
+
+			if (!bAlreadyVisited)
+			{
+				Closure.Add(Dependency);
+			}
+		}
+	}
+
+	return Closure;
+}
+
+void FPakLoader::RegisterMountPoint(const FString& RootPath, const FString& ContentPath)
+{
+	FPackageName::RegisterMountPoint(RootPath, ContentPath);
+}
+
+void FPakLoader::UnRegisterMountPoint(const FString& RootPath, const FString& ContentPath)
+{
+	FPackageName::UnRegisterMountPoint(RootPath, ContentPath);
+}
+
+bool FPakLoader::GetRootPathAndContentPathForPak(const FPakFile& PakFile, FString& OutRootPath, FString& OutContentPath)
+{
+	if (!PakFile.IsValid())
+		return false;
 
 	TArray<FString> Files;
 
@@ -376,25 +1374,122 @@ TArray<FString> FPakLoader::GetFilesInPak(const FString &PakFilename, bool bUAss
 
 void FPakLoader::LoadAssetRegistryFile(const FString &AssetRegistryFile)
 {
-	if (DoesFileExist(AssetRegistryFile))
+	AppendAssetRegistry(ReadAssetRegistryFile(AssetRegistryFile));
+}
+
+TSharedPtr<FPakAssetRegistryData, ESPMode::ThreadSafe> FPakLoader::ReadAssetRegistryFile(const FString& AssetRegistryFile)
+{
+	if (!DoesFileExist(AssetRegistryFile))
 	{
-		FArrayReader SerializedAssetData;
+		return nullptr;
+	}
 
-		if (FFileHelper::LoadFileToArray(SerializedAssetData, *AssetRegistryFile))
-		{
-			SerializedAssetData.Seek(0);
+	FPakTraceScope TraceScope(TEXT("ReadAssetRegistryFile"), TEXT("AssetRegistry"), AssetRegistryFile);
+	TSharedPtr<FPakAssetRegistryData, ESPMode::ThreadSafe> Data = MakeShared<FPakAssetRegistryData, ESPMode::ThreadSafe>();
+
+	if (!FFileHelper::LoadFileToArray(Data->SerializedAssetData, *AssetRegistryFile))
+	{
+		return nullptr;
+	}
 
-			IAssetRegistry& AssetRegistry = FModuleManager::LoadModuleChecked<FAssetRegistryModule>(AssetRegistryConstants::ModuleName).Get();
+	TraceScope.SetBytes(Data->SerializedAssetData.Num());
+	Data->SerializedAssetData.Seek(0);
+
+	FPakAssetRegistryLoadOptions Options;
+	{
+		FScopeLock ScopeLock(&AssetRegistryOptionsLock);
+		Options = AssetRegistryLoadOptions;
+	}
 
 #if ENGINE_MINOR_VERSION >= 27 || ENGINE_MAJOR_VERSION == 5
-			FAssetRegistryState PakState;
-			PakState.Load(SerializedAssetData);
-			AssetRegistry.AppendState(PakState);
+	// Deserializing is the expensive part, it doesn't need the game thread.
+	Data->State = MakeUnique<FAssetRegistryState>();
+	Data->State->Load(Data->SerializedAssetData);
+	Data->SerializedAssetData.Empty();
+
+	const int64 BytesBefore = Data->State->GetAllocatedSize();
+	int32 NumKept = Data->State->GetNumAssets();
+	int32 NumRemoved = 0;
+
+	if (Options.IsFiltering())
+	{
+		if (Options.PackagePaths.Num() > 0 || Options.ClassNames.Num() > 0)
+		{
+			NumKept = 0;
+			PakAssetRegistry::FilterPackages(*Data->State, Options, NumKept, NumRemoved);
+		}
+
+		if (Options.KeepTags.Num() > 0 || Options.StripTags.Num() > 0 || Options.bStripDependencies || Options.bStripPackageData)
+		{
+			Data->State = PakAssetRegistry::StripState(*Data->State, Options);
+		}
+	}
+
+	const int64 BytesAfter = Data->State->GetAllocatedSize();
+
+	{
+		FScopeLock ScopeLock(&AssetRegistryOptionsLock);
+		AssetRegistryLoadReport.NumRegistries++;
+		AssetRegistryLoadReport.NumAssetsKept += NumKept;
+		AssetRegistryLoadReport.NumAssetsRemoved += NumRemoved;
+		AssetRegistryLoadReport.BytesBeforeFiltering += BytesBefore;
+		AssetRegistryLoadReport.BytesAfterFiltering += BytesAfter;
+	}
+
+	if (Options.IsFiltering())
+	{
+		PAKLOADER_LOG(LL_VERBOSE, TEXT("Filtered %s: kept %d assets, removed %d, %lld bytes instead of %lld"), *AssetRegistryFile, NumKept, NumRemoved, BytesAfter, BytesBefore);
+	}
 #else
-			AssetRegistry.Serialize(SerializedAssetData);
+	if (Options.IsFiltering())
+	{
+		FLogHelper::Log(LL_WARNING, TEXT("Asset registry load options require Unreal Engine 4.27 or newer, loading the full registry"));
+	}
 #endif
-		}
+
+	return Data;
+}
+
+void FPakLoader::SetAssetRegistryLoadOptions(const FPakAssetRegistryLoadOptions& Options)
+{
+	FScopeLock ScopeLock(&AssetRegistryOptionsLock);
+	AssetRegistryLoadOptions = Options;
+}
+
+FPakAssetRegistryLoadOptions FPakLoader::GetAssetRegistryLoadOptions()
+{
+	FScopeLock ScopeLock(&AssetRegistryOptionsLock);
+	return AssetRegistryLoadOptions;
+}
+
+FPakAssetRegistryLoadReport FPakLoader::GetAssetRegistryLoadReport()
+{
+	FScopeLock ScopeLock(&AssetRegistryOptionsLock);
+	return AssetRegistryLoadReport;
+}
+
+void FPakLoader::ResetAssetRegistryLoadReport()
+{
+	FScopeLock ScopeLock(&AssetRegistryOptionsLock);
+	AssetRegistryLoadReport = FPakAssetRegistryLoadReport();
+}
+
+void FPakLoader::AppendAssetRegistry(const TSharedPtr<FPakAssetRegistryData, ESPMode::ThreadSafe>& Data)
+{
+	if (!Data.IsValid())
+	{
+		return;
 	}
+
+	FPakTraceScope TraceScope(TEXT("AppendAssetRegistry"), TEXT("AssetRegistry"));
+
+	IAssetRegistry& AssetRegistry = FModuleManager::LoadModuleChecked<FAssetRegistryModule>(AssetRegistryConstants::ModuleName).Get();
+
+#if ENGINE_MINOR_VERSION >= 27 || ENGINE_MAJOR_VERSION == 5
+	AssetRegistry.AppendState(*Data->State);
+#else
+	AssetRegistry.Serialize(Data->SerializedAssetData);
+#endif
 }
 
 bool FPakLoader::DoesDirectoryExist(const FString &Directory)
@@ -410,6 +1505,7 @@ bool FPakLoader::DoesFileExist(const FString &Filename)
 UClass *FPakLoader::LoadClassFromPak(const FString &Filename)
 {
 	const FString Name = Filename + TEXT(".") + FPackageName::GetShortName(Filename) + TEXT("_C");
+	FPakTraceScope TraceScope(TEXT("LoadClassFromPak"), TEXT("Load"), Name);
 	return StaticLoadClass(UObject::StaticClass(), nullptr, *Name);
 }
 
@@ -2,7 +2,10 @@
 
 #include "PakLoaderLibrary.h"
 #include "PakLoader.h"
+#include "PakBlockManifest.h"
 #include "LogHelper.h"
+#include "PakTraceRecorder.h"
+#include "PakHandle.h"
 #include "Misc/FileHelper.h"
 #include "Misc/CoreDelegates.h"
 #include "Misc/SecureHash.h" // FSHAHash
@@ -57,6 +60,21 @@ void UPakLoaderLibrary::RuntimeLog(const FString &Text)
 	FLogHelper::Log(LL_LOG, Text);
 }
 
+void UPakLoaderLibrary::StartPakTrace()
+{
+	FPakTraceRecorder::Start();
+}
+
+void UPakLoaderLibrary::StopPakTrace()
+{
+	FPakTraceRecorder::Stop();
+}
+
+bool UPakLoaderLibrary::ExportPakTrace(const FString &Filename)
+{
+	return FPakTraceRecorder::Export(Filename);
+}
+
 FString UPakLoaderLibrary::GetProjectName()
 {
 	return FApp::GetProjectName();
@@ -82,6 +100,19 @@ FString UPakLoaderLibrary::SHA1SUM(const FString &Filename)
 	return ShaHash.ToString();
 }
 
+bool UPakLoaderLibrary::CreatePakBlockManifest(const FString &PakFilename, const FString &ManifestFilename, int32 BlockSize)
+{
+	FPakBlockManifest Manifest;
+
+	if (!FPakBlockManifest::Generate(PakFilename, BlockSize, Manifest) || !Manifest.SaveToFile(ManifestFilename))
+	{
+		PAKLOADER_LOG(LL_ERROR, TEXT("Unable to create block manifest %s for %s"), *ManifestFilename, *PakFilename);
+		return false;
+	}
+
+	return true;
+}
+
 bool UPakLoaderLibrary::TryConvertFilenameToLongPackageName(const FString &Filename, FString &PackageName)
 {
 	return FPackageName::TryConvertFilenameToLongPackageName(Filename, PackageName);
@@ -112,11 +143,54 @@ bool UPakLoaderLibrary::MountPakFile(const FString &PakFilename, const FString &
 	return FPakLoader::Get()->MountPakFile(PakFilename, INDEX_NONE, MountPath);
 }
 
+bool UPakLoaderLibrary::MountPakFileWithReadahead(const FString &PakFilename, const FString &MountPath, const FPakReadaheadOptions &Readahead)
+{
+	return FPakLoader::Get()->MountPakFile(PakFilename, INDEX_NONE, MountPath, Readahead);
+}
+
+bool UPakLoaderLibrary::MountPakFileFromMemory(const FString &PakFilename, const TArray<uint8> &Data)
+{
+	return FPakLoader::Get()->MountPakFileFromMemory(PakFilename, MakeShared<const TArray<uint8>, ESPMode::ThreadSafe>(Data));
+}
+
+int32 UPakLoaderLibrary::MountPakFilesWithRegistryCache(const TArray<FString> &PakFilenames, const FString &CacheFilename)
+{
+	return FPakLoader::Get()->MountPakFilesWithRegistryCache(PakFilenames, CacheFilename);
+}
+
 bool UPakLoaderLibrary::UnmountPakFile(const FString &PakFilename)
 {
 	return FPakLoader::Get()->UnmountPakFile(PakFilename);
 }
 
+UPakHandle *UPakLoaderLibrary::AcquirePakFile(const FString &PakFilename)
+{
+	TSharedPtr<FPakHandle, ESPMode::ThreadSafe> Handle = FPakLoader::Get()->AcquirePak(PakFilename);
+	if (!Handle.IsValid())
+	{
+		return nullptr;
+	}
+
+	UPakHandle *HandleObject = NewObject<UPakHandle>();
+	HandleObject->Handle = Handle;
+	return HandleObject;
+}
+
+void UPakLoaderLibrary::SetPakIdleUnmountDelay(float Seconds)
+{
+	FPakLoader::Get()->SetIdleUnmountDelay(Seconds);
+}
+
+void UPakLoaderLibrary::SetPakAccessOrderPrefetchEnabled(bool bEnabled)
+{
+	FPakLoader::Get()->SetAccessOrderPrefetchEnabled(bEnabled);
+}
+
+bool UPakLoaderLibrary::EnablePakIoUring()
+{
+	return FPakLoader::Get()->GetIoUringPlatformFile() != nullptr;
+}
+
 void UPakLoaderLibrary::RegisterMountPoint(const FString &RootPath, const FString &ContentPath)
 {
 	FPakLoader::Get()->RegisterMountPoint(RootPath, ContentPath);
@@ -132,6 +206,16 @@ void UPakLoaderLibrary::LoadPakAssetRegistryFile(const FString &AssetRegistryFil
 	FPakLoader::Get()->LoadAssetRegistryFile(AssetRegistryFile);
 }
 
+void UPakLoaderLibrary::SetPakAssetRegistryLoadOptions(const FPakAssetRegistryLoadOptions &Options)
+{
+	FPakLoader::Get()->SetAssetRegistryLoadOptions(Options);
+}
+
+FPakAssetRegistryLoadReport UPakLoaderLibrary::GetPakAssetRegistryLoadReport()
+{
+	return FPakLoader::Get()->GetAssetRegistryLoadReport();
+}
+
 bool UPakLoaderLibrary::RegisterEncryptionKey(const FString &Guid, const FString &AesKey)
 {
 	if (AesKey.IsEmpty())
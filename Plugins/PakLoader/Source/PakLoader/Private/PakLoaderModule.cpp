@@ -2,6 +2,7 @@
 
 #include "PakLoaderModule.h"
 #include "Modules/ModuleManager.h"
+#include "LogHelper.h"
 
 DEFINE_LOG_CATEGORY(LogPakLoader);
 
@@ -23,4 +24,6 @@ void FPakLoaderModule::StartupModule()
 void FPakLoaderModule::ShutdownModule()
 {
 	UE_LOG(LogPakLoader, Log, TEXT("FPakLoaderModule::ShutdownModule()"));
+
+	FLogHelper::Shutdown();
 }
@@ -1,9 +1,42 @@
 // Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
 
 #include "PakLoaderSubsystem.h"
+#include "PakLoader.h"
 #include "Runtime/Launch/Resources/Version.h"
 #include "Misc/PackageName.h"
 #include "Misc/CoreDelegates.h"
+#include "Async/Async.h"
+#include "Engine/Engine.h"
+#include "PakTraceRecorder.h"
+#include "LogHelper.h"
+#include <atomic>
+
+struct UPakLoaderSubsystem::FTimeSlicedMount
+{
+	enum class EStep
+	{
+		Preparing,
+		RegisterMountPoint,
+		AppendAssetRegistry,
+		OpenShaderLibrary,
+		Notify,
+		Done
+	};
+
+	FString PakFilename;
+	TFunction<void(bool)> OnComplete;
+	double StartSeconds = 0.0;
+
+	// Written by the worker thread until bPrepared is set.
+	FPakLoaderMountDetails Details;
+	TSharedPtr<FPakAssetRegistryData, ESPMode::ThreadSafe> AssetRegistry;
+	bool bPrepareSucceeded = false;
+	std::atomic<bool> bPrepared{false};
+	TFuture<void> PrepareTask;
+
+	EStep Step = EStep::Preparing;
+	bool bSucceeded = false;
+};
 
 void UPakLoaderSubsystem::Initialize(FSubsystemCollectionBase& Collection)
 {
@@ -18,6 +51,219 @@ void UPakLoaderSubsystem::Initialize(FSubsystemCollectionBase& Collection)
 #else
 	FCoreDelegates::OnPakFileMounted2.AddUObject(this, &UPakLoaderSubsystem::Native_OnPakFileMounted2);
 #endif
+
+	PakMountedHandle = FPakLoader::Get()->OnPakMounted().AddUObject(this, &UPakLoaderSubsystem::HandlePakLoaderMounted);
+	PakUnmountedHandle = FPakLoader::Get()->OnPakUnmounted().AddUObject(this, &UPakLoaderSubsystem::HandlePakLoaderUnmounted);
+
+	AddAlreadyMountedPaks();
+}
+
+void UPakLoaderSubsystem::Deinitialize()
+{
+	if (MountTickerHandle.IsValid())
+	{
+#if ENGINE_MAJOR_VERSION == 5
+		FTSTicker::GetCoreTicker().RemoveTicker(MountTickerHandle);
+#else
+		FTicker::GetCoreTicker().RemoveTicker(MountTickerHandle);
+#endif
+		MountTickerHandle.Reset();
+	}
+
+	FPakLoader::Get()->OnPakMounted().Remove(PakMountedHandle);
+	FPakLoader::Get()->OnPakUnmounted().Remove(PakUnmountedHandle);
+
+	CancelPendingMounts();
+
+	Super::Deinitialize();
+}
+
+UPakLoaderSubsystem* UPakLoaderSubsystem::Get()
+{
+	return GEngine ? GEngine->GetEngineSubsystem<UPakLoaderSubsystem>() : nullptr;
+}
+
+TArray<FPakMountInfo> UPakLoaderSubsystem::GetMountedPaks() const
+{
+	TArray<FPakMountInfo> Result;
+	MountedPaks.GenerateValueArray(Result);
+	return Result;
+}
+
+bool UPakLoaderSubsystem::GetMountedPakInfo(const FString& PakFilename, FPakMountInfo& OutInfo) const
+{
+	if (const FPakMountInfo* Info = MountedPaks.Find(PakFilename))
+	{
+		OutInfo = *Info;
+		return true;
+	}
+
+	return false;
+}
+
+void UPakLoaderSubsystem::MountPakFileTimeSliced(const FString& PakFilename, TFunction<void(bool bSuccess)>&& OnComplete)
+{
+	check(IsInGameThread());
+
+	TSharedRef<FTimeSlicedMount, ESPMode::ThreadSafe> Mount = MakeShared<FTimeSlicedMount, ESPMode::ThreadSafe>();
+	Mount->PakFilename = PakFilename;
+	Mount->OnComplete = MoveTemp(OnComplete);
+	Mount->StartSeconds = FPlatformTime::Seconds();
+
+	// The pak platform file is created on first use, that must not happen on a worker thread.
+	FPakLoader::Get()->GetPakPlatformFile();
+
+	Mount->PrepareTask = Async(EAsyncExecution::ThreadPool, [Mount]()
+	{
+		FPakLoader* PakLoader = FPakLoader::Get();
+
+		FString AssetRegistryFile;
+		Mount->bPrepareSucceeded = PakLoader->MountPakFileAndFindContent(Mount->PakFilename, Mount->Details, AssetRegistryFile);
+
+		if (Mount->bPrepareSucceeded)
+		{
+			Mount->AssetRegistry = PakLoader->ReadAssetRegistryFile(AssetRegistryFile);
+		}
+
+		Mount->bPrepared = true;
+	});
+
+	PendingMounts.Add(Mount);
+
+	if (!MountTickerHandle.IsValid())
+	{
+#if ENGINE_MAJOR_VERSION == 5
+		MountTickerHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateUObject(this, &UPakLoaderSubsystem::TickPendingMounts));
+#else
+		MountTickerHandle = FTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateUObject(this, &UPakLoaderSubsystem::TickPendingMounts));
+#endif
+	}
+}
+
+void UPakLoaderSubsystem::K2_MountPakFileTimeSliced(const FString& PakFilename, FPakLoaderOnTimeSlicedMount OnComplete)
+{
+	MountPakFileTimeSliced(PakFilename, [OnComplete, PakFilename](bool bSuccess)
+	{
+		OnComplete.ExecuteIfBound(PakFilename, bSuccess);
+	});
+}
+
+bool UPakLoaderSubsystem::TickPendingMounts(float DeltaTime)
+{
+	const double Deadline = FPlatformTime::Seconds() + MountFrameBudgetMs / 1000.0;
+	bool bRanStep = false;
+
+	// Mounts are published in request order, a mount that is still preparing holds back the ones behind it.
+	while (PendingMounts.Num() > 0)
+	{
+		if (bRanStep && FPlatformTime::Seconds() >= Deadline)
+		{
+			break;
+		}
+
+		TSharedRef<FTimeSlicedMount, ESPMode::ThreadSafe> Mount = PendingMounts[0];
+		if (!RunMountStep(*Mount))
+		{
+			break;
+		}
+
+		bRanStep = true;
+
+		if (Mount->Step == FTimeSlicedMount::EStep::Done)
+		{
+			PendingMounts.RemoveAt(0);
+
+			if (Mount->OnComplete)
+			{
+				Mount->OnComplete(Mount->bSucceeded);
+			}
+		}
+	}
+
+	if (PendingMounts.Num() > 0)
+	{
+		return true;
+	}
+
+	// Returning false removes the ticker, the next mount adds it again.
+	MountTickerHandle.Reset();
+	return false;
+}
+
+bool UPakLoaderSubsystem::RunMountStep(FTimeSlicedMount& Mount)
+{
+	if (Mount.Step == FTimeSlicedMount::EStep::Preparing && !Mount.bPrepared)
+	{
+		return false;
+	}
+
+	FPakTraceScope TraceScope(TEXT("TimeSlicedMountStep"), TEXT("Mount"), Mount.PakFilename);
+	FPakLoader* PakLoader = FPakLoader::Get();
+
+	switch (Mount.Step)
+	{
+	case FTimeSlicedMount::EStep::Preparing:
+		Mount.Step = Mount.bPrepareSucceeded ? FTimeSlicedMount::EStep::RegisterMountPoint : FTimeSlicedMount::EStep::Done;
+		break;
+
+	case FTimeSlicedMount::EStep::RegisterMountPoint:
+		PakLoader->RegisterMountPoint(Mount.Details.RootPath, Mount.Details.ContentPath);
+		Mount.Step = FTimeSlicedMount::EStep::AppendAssetRegistry;
+		break;
+
+	case FTimeSlicedMount::EStep::AppendAssetRegistry:
+		PakLoader->AppendAssetRegistry(Mount.AssetRegistry);
+		Mount.AssetRegistry.Reset();
+		Mount.Step = FTimeSlicedMount::EStep::OpenShaderLibrary;
+		break;
+
+	case FTimeSlicedMount::EStep::OpenShaderLibrary:
+		PakLoader->OpenShaderLibrary(Mount.Details.ContentPath);
+		Mount.Step = FTimeSlicedMount::EStep::Notify;
+		break;
+
+	case FTimeSlicedMount::EStep::Notify:
+		Mount.Details.MountSeconds = FPlatformTime::Seconds() - Mount.StartSeconds;
+		PakLoader->NotifyPakMounted(Mount.Details);
+		Mount.bSucceeded = true;
+		Mount.Step = FTimeSlicedMount::EStep::Done;
+		break;
+
+	default:
+		break;
+	}
+
+	return true;
+}
+
+void UPakLoaderSubsystem::CancelPendingMounts()
+{
+	FPakLoader* PakLoader = FPakLoader::Get();
+
+	TArray<TSharedRef<FTimeSlicedMount, ESPMode::ThreadSafe>> Mounts = MoveTemp(PendingMounts);
+
+	for (const TSharedRef<FTimeSlicedMount, ESPMode::ThreadSafe>& Mount : Mounts)
+	{
+		// The worker may be about to mount the pak, it must not stay mounted without being published.
+		Mount->PrepareTask.Wait();
+
+		if (Mount->bPrepareSucceeded)
+		{
+			if (Mount->Step > FTimeSlicedMount::EStep::RegisterMountPoint)
+			{
+				PakLoader->UnRegisterMountPoint(Mount->Details.RootPath, Mount->Details.ContentPath);
+			}
+
+			PakLoader->UnmountPakFile(Mount->PakFilename);
+
+			PAKLOADER_LOG(LL_LOG, TEXT("Unmounted %s, its time sliced mount did not complete before shutdown"), *Mount->PakFilename);
+		}
+
+		if (Mount->OnComplete)
+		{
+			Mount->OnComplete(false);
+		}
+	}
 }
 
 void UPakLoaderSubsystem::Native_OnContentPathMounted(const FString& AssetPath, const FString& ContentPath)
@@ -33,11 +279,163 @@ void UPakLoaderSubsystem::Native_OnContentPathDismounted(const FString& AssetPat
 #if ENGINE_MINOR_VERSION <= 25 && ENGINE_MAJOR_VERSION == 4
 void UPakLoaderSubsystem::Native_OnPakFileMounted(const TCHAR* PakFilename, const int32)
 {
-	OnPakFileMounted2.Broadcast(PakFilename, "", 0);
+	FPakMountInfo Info;
+	Info.PakFilename = PakFilename;
+	Info.MountTime = FDateTime::UtcNow();
+
+	RunOnGameThread([this, Info]()
+	{
+		UpdateMountedPak(Info);
+		OnPakFileMounted2.Broadcast(Info.PakFilename, "", 0);
+	});
 }
 #else
 void UPakLoaderSubsystem::Native_OnPakFileMounted2(const IPakFile& PakFile)
 {
-	OnPakFileMounted2.Broadcast(PakFile.PakGetPakFilename(), PakFile.PakGetMountPoint(), PakFile.GetNumFiles());
+	// Mounts of the engine and of other code only pass through here.
+	FPakMountInfo Info;
+	Info.PakFilename = PakFile.PakGetPakFilename();
+	Info.MountPoint = PakFile.PakGetMountPoint();
+	Info.NumFiles = PakFile.GetNumFiles();
+	Info.MountTime = FDateTime::UtcNow();
+
+	RunOnGameThread([this, Info]()
+	{
+		UpdateMountedPak(Info);
+		OnPakFileMounted2.Broadcast(Info.PakFilename, Info.MountPoint, Info.NumFiles);
+	});
 }
 #endif
+
+void UPakLoaderSubsystem::HandlePakLoaderMounted(const FPakLoaderMountDetails& Details)
+{
+	FPakMountInfo Info;
+	Info.PakFilename = Details.PakFilename;
+	Info.MountPoint = Details.MountPoint;
+	Info.RootPath = Details.RootPath;
+	Info.ContentPath = Details.ContentPath;
+	Info.NumFiles = Details.NumFiles;
+	Info.Size = Details.Size;
+	Info.PakOrder = Details.PakOrder;
+	Info.MountTime = FDateTime::UtcNow() - FTimespan::FromSeconds(Details.MountSeconds);
+	Info.MountSeconds = Details.MountSeconds;
+
+	RunOnGameThread([this, Info]()
+	{
+		UpdateMountedPak(Info);
+	});
+}
+
+void UPakLoaderSubsystem::HandlePakLoaderUnmounted(const FString& PakFilename)
+{
+	RunOnGameThread([this, PakFilename]()
+	{
+		RemoveMountedPak(PakFilename);
+	});
+}
+
+void UPakLoaderSubsystem::UpdateMountedPak(const FPakMountInfo& Info)
+{
+	FPakMountInfo* Existing = MountedPaks.Find(Info.PakFilename);
+	if (!Existing)
+	{
+		MountedPaks.Add(Info.PakFilename, Info);
+		MarkMountedPaksChanged();
+		return;
+	}
+
+	// The engine delegate and the plugin both report mounts done by the plugin, merge what each of them knows.
+	bool bChanged = false;
+
+	auto MergeString = [&bChanged](FString& Target, const FString& Value)
+	{
+		if (!Value.IsEmpty() && Target != Value)
+		{
+			Target = Value;
+			bChanged = true;
+		}
+	};
+
+	MergeString(Existing->MountPoint, Info.MountPoint);
+	MergeString(Existing->RootPath, Info.RootPath);
+	MergeString(Existing->ContentPath, Info.ContentPath);
+
+	if (Info.NumFiles > 0 && Existing->NumFiles != Info.NumFiles)
+	{
+		Existing->NumFiles = Info.NumFiles;
+		bChanged = true;
+	}
+
+	if (Info.Size > 0 && Existing->Size != Info.Size)
+	{
+		Existing->Size = Info.Size;
+		bChanged = true;
+	}
+
+	if (Info.MountSeconds > 0.0f)
+	{
+		Existing->PakOrder = Info.PakOrder;
+		Existing->MountTime = Info.MountTime;
+		Existing->MountSeconds = Info.MountSeconds;
+		bChanged = true;
+	}
+
+	if (bChanged)
+	{
+		MarkMountedPaksChanged();
+	}
+}
+
+void UPakLoaderSubsystem::RemoveMountedPak(const FString& PakFilename)
+{
+	if (MountedPaks.Remove(PakFilename) > 0)
+	{
+		MarkMountedPaksChanged();
+	}
+}
+
+void UPakLoaderSubsystem::AddAlreadyMountedPaks()
+{
+	// Don't create a pak platform file just to find out nothing is mounted.
+	IPlatformFile* PlatformFile = FPlatformFileManager::Get().FindPlatformFile(TEXT("PakFile"));
+	if (!PlatformFile)
+	{
+		return;
+	}
+
+	TArray<FString> PakFilenames;
+	static_cast<FPakPlatformFile*>(PlatformFile)->GetMountedPakFilenames(PakFilenames);
+
+	for (const FString& PakFilename : PakFilenames)
+	{
+		FPakMountInfo Info;
+		Info.PakFilename = PakFilename;
+		Info.Size = PlatformFile->GetLowerLevel()->FileSize(*PakFilename);
+		Info.MountTime = FDateTime::UtcNow();
+		UpdateMountedPak(Info);
+	}
+}
+
+void UPakLoaderSubsystem::MarkMountedPaksChanged()
+{
+	++MountedPaksGeneration;
+	OnMountedPaksChanged.Broadcast(MountedPaksGeneration);
+}
+
+void UPakLoaderSubsystem::RunOnGameThread(TFunction<void()>&& Function)
+{
+	if (IsInGameThread())
+	{
+		Function();
+		return;
+	}
+
+	TWeakObjectPtr<UPakLoaderSubsystem> WeakThis(this);
+	AsyncTask(ENamedThreads::GameThread, [WeakThis, Function = MoveTemp(Function)]()
+	{
+		if (WeakThis.IsValid())
+		{
+			Function();
+		}
+	});
+}
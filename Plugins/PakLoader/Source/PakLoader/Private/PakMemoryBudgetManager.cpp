@@ -0,0 +1,507 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#include "PakMemoryBudgetManager.h"
+#include "PakLoader.h"
+#include "PakLoaderSubsystem.h"
+#include "LogHelper.h"
+#include "Engine/Engine.h"
+#include "UObject/UObjectIterator.h"
+#include "UObject/UObjectHash.h"
+#include "UObject/UObjectGlobals.h"
+
+namespace PakMemoryBudget
+{
+	// Game thread time a measurement may take per frame.
+	static constexpr double MeasureSliceSeconds = 0.001;
+}
+
+void UPakMemoryBudgetManager::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Collection.InitializeDependency(UPakLoaderSubsystem::StaticClass());
+
+	Super::Initialize(Collection);
+
+	PostGarbageCollectHandle = FCoreUObjectDelegates::GetPostGarbageCollect().AddUObject(this, &UPakMemoryBudgetManager::HandlePostGarbageCollect);
+}
+
+void UPakMemoryBudgetManager::Deinitialize()
+{
+	StopTicker();
+
+	FCoreUObjectDelegates::GetPostGarbageCollect().Remove(PostGarbageCollectHandle);
+
+	Super::Deinitialize();
+}
+
+UPakMemoryBudgetManager* UPakMemoryBudgetManager::Get()
+{
+	return GEngine ? GEngine->GetEngineSubsystem<UPakMemoryBudgetManager>() : nullptr;
+}
+
+void UPakMemoryBudgetManager::SetMemoryBudget(int64 Bytes)
+{
+	MemoryBudget = FMath::Max<int64>(Bytes, 0);
+
+	// Measuring costs time, it only runs while there is a budget to enforce.
+	if (MemoryBudget > 0)
+	{
+		StartTicker();
+	}
+	else
+	{
+		StopTicker();
+	}
+}
+
+void UPakMemoryBudgetManager::SetMeasureInterval(float Seconds)
+{
+	MeasureInterval = FMath::Max(Seconds, 0.1f);
+	NextMeasureTime = FMath::Min(NextMeasureTime, FPlatformTime::Seconds() + MeasureInterval);
+}
+
+void UPakMemoryBudgetManager::MarkPakAccessed(const FString& PakFilename)
+{
+	SyncWithMountedPaks();
+
+	if (FPakState* State = Paks.Find(PakFilename))
+	{
+		State->LastAccessSeconds = FPlatformTime::Seconds();
+	}
+}
+
+void UPakMemoryBudgetManager::SetPakPinned(const FString& PakFilename, bool bPinned)
+{
+	if (bPinned)
+	{
+		PinnedPaks.Add(PakFilename);
+	}
+	else
+	{
+		PinnedPaks.Remove(PakFilename);
+	}
+
+	if (FPakState* State = Paks.Find(PakFilename))
+	{
+		State->bPinned = bPinned;
+	}
+}
+
+void UPakMemoryBudgetManager::UpdateMemoryUsage()
+{
+	if (bEvictionsCollected)
+	{
+		FinishEvictions();
+	}
+
+	if (!bMeasureInProgress)
+	{
+		BeginMeasure();
+	}
+
+	ContinueMeasure(TNumericLimits<double>::Max());
+	EndMeasure();
+
+	NextMeasureTime = FPlatformTime::Seconds() + MeasureInterval;
+
+	EnforceBudget();
+}
+
+TArray<FPakMemoryUsage> UPakMemoryBudgetManager::GetPakMemoryUsage() const
+{
+	const double Now = FPlatformTime::Seconds();
+
+	TArray<FPakMemoryUsage> Result;
+	Result.Reserve(Paks.Num());
+
+	for (const TPair<FString, FPakState>& Pair : Paks)
+	{
+		FPakMemoryUsage& Usage = Result.AddDefaulted_GetRef();
+		Usage.PakFilename = Pair.Key;
+		Usage.RootPath = Pair.Value.RootPath;
+		Usage.ResidentBytes = Pair.Value.ResidentBytes;
+		Usage.NumLoadedPackages = Pair.Value.NumLoadedPackages;
+		Usage.SecondsSinceLastAccess = Now - Pair.Value.LastAccessSeconds;
+		Usage.bPinned = Pair.Value.bPinned;
+	}
+
+	return Result;
+}
+
+int64 UPakMemoryBudgetManager::GetTotalResidentBytes() const
+{
+	int64 Total = 0;
+	for (const TPair<FString, FPakState>& Pair : Paks)
+	{
+		Total += Pair.Value.ResidentBytes;
+	}
+
+	return Total;
+}
+
+bool UPakMemoryBudgetManager::Tick(float DeltaTime)
+{
+	// Objects can't be measured or released safely in the middle of loading or collecting.
+	if (IsGarbageCollecting() || IsAsyncLoading())
+	{
+		return true;
+	}
+
+	if (bEvictionsCollected)
+	{
+		FinishEvictions();
+	}
+
+	const double Now = FPlatformTime::Seconds();
+
+	if (!bMeasureInProgress)
+	{
+		// Measuring again before the evicted paks are gone would evict more.
+		if (Now < NextMeasureTime || PendingEvictions.Num() > 0)
+		{
+			return true;
+		}
+
+		BeginMeasure();
+	}
+
+	if (ContinueMeasure(Now + PakMemoryBudget::MeasureSliceSeconds))
+	{
+		EndMeasure();
+
+		NextMeasureTime = FPlatformTime::Seconds() + MeasureInterval;
+
+		EnforceBudget();
+	}
+
+	return true;
+}
+
+void UPakMemoryBudgetManager::SyncWithMountedPaks()
+{
+	UPakLoaderSubsystem* Subsystem = UPakLoaderSubsystem::Get();
+	if (!Subsystem || Subsystem->GetMountedPaksGeneration() == SyncedGeneration)
+	{
+		return;
+	}
+
+	SyncedGeneration = Subsystem->GetMountedPaksGeneration();
+
+	const TMap<FString, FPakMountInfo>& MountedPaks = Subsystem->GetMountedPakMap();
+
+	TMap<FString, int32> NumPaksByRoot;
+	for (const TPair<FString, FPakMountInfo>& Pair : MountedPaks)
+	{
+		NumPaksByRoot.FindOrAdd(Pair.Value.RootPath)++;
+	}
+
+	// Content of a shared root can't be told apart, and its mount point must stay while any of the paks is mounted.
+	auto IsTrackable = [&NumPaksByRoot](const FPakMountInfo& MountInfo)
+	{
+		return !MountInfo.RootPath.IsEmpty() && NumPaksByRoot[MountInfo.RootPath] == 1;
+	};
+
+	for (auto It = Paks.CreateIterator(); It; ++It)
+	{
+		const FPakMountInfo* MountInfo = MountedPaks.Find(It.Key());
+		if (!MountInfo || !IsTrackable(*MountInfo))
+		{
+			It.RemoveCurrent();
+		}
+	}
+
+	for (const TPair<FString, FPakMountInfo>& Pair : MountedPaks)
+	{
+		if (!IsTrackable(Pair.Value))
+		{
+			if (!Pair.Value.RootPath.IsEmpty() && !Paks.Contains(Pair.Key))
+			{
+				PAKLOADER_LOG(LL_VERBOSE, TEXT("Not tracking the memory of %s, its root %s is shared with another pak"), *Pair.Key, *Pair.Value.RootPath);
+			}
+			continue;
+		}
+
+		FPakState* State = Paks.Find(Pair.Key);
+		if (!State)
+		{
+			State = &Paks.Add(Pair.Key);
+			State->LastAccessSeconds = FPlatformTime::Seconds();
+			State->bPinned = PinnedPaks.Contains(Pair.Key);
+		}
+
+		State->RootPath = Pair.Value.RootPath;
+		State->ContentPath = Pair.Value.ContentPath;
+	}
+}
+
+void UPakMemoryBudgetManager::BeginMeasure()
+{
+	SyncWithMountedPaks();
+
+	bMeasureInProgress = true;
+	MeasuredPackages.Reset();
+	NextMeasuredPackage = 0;
+
+	if (Paks.Num() == 0)
+	{
+		return;
+	}
+
+	// Package names start with their root, e.g. /MyDLC/Maps/Level. Roots of tracked paks are unique.
+	TMap<FString, const FString*> PaksByRoot;
+	for (TPair<FString, FPakState>& Pair : Paks)
+	{
+		PaksByRoot.Add(Pair.Value.RootPath, &Pair.Key);
+
+		Pair.Value.MeasuringBytes = 0;
+		Pair.Value.MeasuringPackages = 0;
+		Pair.Value.bMeasuring = true;
+	}
+
+	for (auto It = PackageSizes.CreateIterator(); It; ++It)
+	{
+		if (!It.Key().IsValid())
+		{
+			It.RemoveCurrent();
+		}
+	}
+
+	// Only looks at the names, the objects are measured by ContinueMeasure.
+	for (TObjectIterator<UPackage> It; It; ++It)
+	{
+		const FString PackageName = It->GetName();
+
+		int32 RootEnd = INDEX_NONE;
+		if (!PackageName.StartsWith(TEXT("/")) || (RootEnd = PackageName.Find(TEXT("/"), ESearchCase::CaseSensitive, ESearchDir::FromStart, 1)) == INDEX_NONE)
+		{
+			continue;
+		}
+
+		const FString* const* PakFilename = PaksByRoot.Find(PackageName.Left(RootEnd + 1));
+		if (PakFilename)
+		{
+			MeasuredPackages.Add({ *It, **PakFilename });
+		}
+	}
+}
+
+bool UPakMemoryBudgetManager::ContinueMeasure(double EndTime)
+{
+	for (; NextMeasuredPackage < MeasuredPackages.Num(); ++NextMeasuredPackage)
+	{
+		if (FPlatformTime::Seconds() >= EndTime)
+		{
+			return false;
+		}
+
+		// Packages may have been collected and paks unmounted since BeginMeasure.
+		const FMeasuredPackage& Entry = MeasuredPackages[NextMeasuredPackage];
+		UPackage* Package = Entry.Package.Get();
+		FPakState* State = Paks.Find(Entry.PakFilename);
+		if (!Package || !State || !State->bMeasuring)
+		{
+			continue;
+		}
+
+		int64* Bytes = PackageSizes.Find(Entry.Package);
+		if (!Bytes)
+		{
+			Bytes = &PackageSizes.Add(Entry.Package, MeasurePackage(Package));
+		}
+
+		State->MeasuringBytes += *Bytes;
+		State->MeasuringPackages++;
+	}
+
+	return true;
+}
+
+void UPakMemoryBudgetManager::EndMeasure()
+{
+	const double Now = FPlatformTime::Seconds();
+
+	for (TPair<FString, FPakState>& Pair : Paks)
+	{
+		FPakState& State = Pair.Value;
+		if (!State.bMeasuring)
+		{
+			continue;
+		}
+
+		// Newly loaded packages mean the content is in use.
+		if (State.MeasuringPackages > State.NumLoadedPackages)
+		{
+			State.LastAccessSeconds = Now;
+		}
+
+		State.ResidentBytes = State.MeasuringBytes;
+		State.NumLoadedPackages = State.MeasuringPackages;
+		State.bMeasuring = false;
+	}
+
+	MeasuredPackages.Empty();
+	NextMeasuredPackage = 0;
+	bMeasureInProgress = false;
+}
+
+int64 UPakMemoryBudgetManager::MeasurePackage(UPackage* Package)
+{
+	TArray<UObject*> Objects;
+	GetObjectsWithOuter(Package, Objects, true);
+
+	int64 Bytes = 0;
+	for (UObject* Object : Objects)
+	{
+		Bytes += Object->GetClass()->GetStructureSize() + Object->GetResourceSizeBytes(EResourceSizeMode::Exclusive);
+	}
+
+	return Bytes;
+}
+
+void UPakMemoryBudgetManager::EnforceBudget()
+{
+	const int64 ResidentBytes = GetTotalResidentBytes();
+	if (MemoryBudget <= 0 || ResidentBytes <= MemoryBudget || PendingEvictions.Num() > 0)
+	{
+		return;
+	}
+
+	OnBudgetExceeded.Broadcast(ResidentBytes, MemoryBudget);
+
+	FPakLoader* PakLoader = FPakLoader::Get();
+
+	// Paks with a live handle are in use whatever their last access was.
+	TArray<FString> Candidates;
+	for (const TPair<FString, FPakState>& Pair : Paks)
+	{
+		if (!Pair.Value.bPinned && Pair.Value.ResidentBytes > 0 && !PakLoader->IsPakAcquired(Pair.Key))
+		{
+			Candidates.Add(Pair.Key);
+		}
+	}
+
+	Candidates.Sort([this](const FString& A, const FString& B)
+	{
+		return Paks[A].LastAccessSeconds < Paks[B].LastAccessSeconds;
+	});
+
+	// Evict least recently accessed paks until the rest fits.
+	TArray<FString> Evicted;
+	int64 RemainingBytes = ResidentBytes;
+	for (const FString& PakFilename : Candidates)
+	{
+		if (RemainingBytes <= MemoryBudget)
+		{
+			break;
+		}
+
+		RemainingBytes -= Paks[PakFilename].ResidentBytes;
+		Evicted.Add(PakFilename);
+	}
+
+	if (Evicted.Num() == 0)
+	{
+		return;
+	}
+
+	for (const FString& PakFilename : Evicted)
+	{
+		// A listener may have unmounted the pak already.
+		if (const FPakState* State = Paks.Find(PakFilename))
+		{
+			OnPakEvicting.Broadcast(PakFilename, State->ResidentBytes);
+		}
+
+		if (const FPakState* State = Paks.Find(PakFilename))
+		{
+			PakLoader->UnloadContent(State->RootPath, false);
+		}
+	}
+
+	// Collecting right away would stall the frame, the engine collects at the end of the next one.
+	PendingEvictions = MoveTemp(Evicted);
+	bEvictionsCollected = false;
+	GEngine->ForceGarbageCollection(true);
+}
+
+void UPakMemoryBudgetManager::HandlePostGarbageCollect()
+{
+	if (PendingEvictions.Num() > 0)
+	{
+		bEvictionsCollected = true;
+	}
+}
+
+void UPakMemoryBudgetManager::FinishEvictions()
+{
+	TArray<FString> Evicted = MoveTemp(PendingEvictions);
+	bEvictionsCollected = false;
+
+	// Paks mounted since may share the root of an evicted pak now, those are no longer tracked.
+	SyncWithMountedPaks();
+
+	FPakLoader* PakLoader = FPakLoader::Get();
+
+	for (const FString& PakFilename : Evicted)
+	{
+		FPakState* State = Paks.Find(PakFilename);
+		if (!State)
+		{
+			continue;
+		}
+
+		const FString RootPath = State->RootPath;
+		const FString ContentPath = State->ContentPath;
+
+		const int32 NumRemaining = PakLoader->GetLoadedPackagesInRoot(RootPath).Num();
+		if (NumRemaining > 0)
+		{
+			// Unmounting would break objects that still read from the pak, try again once it wasn't used for a while.
+			PAKLOADER_LOG(LL_WARNING, TEXT("Not evicting %s, %d packages are still referenced"), *PakFilename, NumRemaining);
+			State->LastAccessSeconds = FPlatformTime::Seconds();
+
+			OnPakEvicted.Broadcast(PakFilename, false);
+			continue;
+		}
+
+		PakLoader->UnRegisterMountPoint(RootPath, ContentPath);
+		const bool bUnmounted = PakLoader->UnmountPakFile(PakFilename);
+
+		PAKLOADER_LOG(LL_LOG, TEXT("Evicted %s to stay within the pak memory budget"), *PakFilename);
+		OnPakEvicted.Broadcast(PakFilename, bUnmounted);
+	}
+
+	// The registry changed, pick up the new state with the next measurement.
+	SyncWithMountedPaks();
+}
+
+void UPakMemoryBudgetManager::StartTicker()
+{
+	if (TickerHandle.IsValid())
+	{
+		return;
+	}
+
+	NextMeasureTime = FPlatformTime::Seconds() + MeasureInterval;
+
+	// Ticks every frame, a measurement spreads over several of them.
+#if ENGINE_MAJOR_VERSION == 5
+	TickerHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateUObject(this, &UPakMemoryBudgetManager::Tick));
+#else
+	TickerHandle = FTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateUObject(this, &UPakMemoryBudgetManager::Tick));
+#endif
+}
+
+void UPakMemoryBudgetManager::StopTicker()
+{
+	if (!TickerHandle.IsValid())
+	{
+		return;
+	}
+
+#if ENGINE_MAJOR_VERSION == 5
+	FTSTicker::GetCoreTicker().RemoveTicker(TickerHandle);
+#else
+	FTicker::GetCoreTicker().RemoveTicker(TickerHandle);
+#endif
+	TickerHandle.Reset();
+}
@@ -0,0 +1,201 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#include "PakMemoryPlatformFile.h"
+#include "Misc/Paths.h"
+
+/* Read handle over a memory buffer. */
+class FPakMemoryFileHandle : public IFileHandle
+{
+public:
+	FPakMemoryFileHandle(const uint8* InData, int64 InSize, const TSharedPtr<const TArray<uint8>, ESPMode::ThreadSafe>& InOwner)
+		: Data(InData)
+		, DataSize(InSize)
+		, Owner(InOwner)
+	{
+	}
+
+	virtual int64 Tell() override { return Position; }
+	virtual int64 Size() override { return DataSize; }
+	virtual bool Write(const uint8* Source, int64 BytesToWrite) override { return false; }
+	virtual bool Flush(const bool bFullFlush = false) override { return false; }
+	virtual bool Truncate(int64 NewSize) override { return false; }
+
+	virtual bool Seek(int64 NewPosition) override
+	{
+		if (NewPosition < 0 || NewPosition > DataSize)
+		{
+			return false;
+		}
+
+		Position = NewPosition;
+		return true;
+	}
+
+	virtual bool SeekFromEnd(int64 NewPositionRelativeToEnd = 0) override
+	{
+		return Seek(DataSize + NewPositionRelativeToEnd);
+	}
+
+	virtual bool Read(uint8* Destination, int64 BytesToRead) override
+	{
+		if (BytesToRead < 0 || Position + BytesToRead > DataSize)
+		{
+			return false;
+		}
+
+		FMemory::Memcpy(Destination, Data + Position, BytesToRead);
+		Position += BytesToRead;
+		return true;
+	}
+
+private:
+	const uint8* Data;
+	int64 DataSize;
+	int64 Position = 0;
+	TSharedPtr<const TArray<uint8>, ESPMode::ThreadSafe> Owner;
+};
+
+void FPakMemoryPlatformFile::RegisterFile(const FString& Filename, const uint8* Data, int64 Size, const TSharedPtr<const TArray<uint8>, ESPMode::ThreadSafe>& Owner)
+{
+	FMemoryFile File;
+	File.Data = Data;
+	File.Size = Size;
+	File.Timestamp = FDateTime::UtcNow();
+	File.Owner = Owner;
+
+	FWriteScopeLock Lock(FilesLock);
+
+	Files.Add(GetKey(*Filename), MoveTemp(File));
+	NumFiles = Files.Num();
+}
+
+void FPakMemoryPlatformFile::UnregisterFile(const FString& Filename)
+{
+	FWriteScopeLock Lock(FilesLock);
+
+	Files.Remove(GetKey(*Filename));
+	NumFiles = Files.Num();
+}
+
+bool FPakMemoryPlatformFile::IsRegistered(const FString& Filename) const
+{
+	FMemoryFile File;
+	return FindFile(*Filename, File);
+}
+
+bool FPakMemoryPlatformFile::FileExists(const TCHAR* Filename)
+{
+	FMemoryFile File;
+	return FindFile(Filename, File) || LowerLevel->FileExists(Filename);
+}
+
+int64 FPakMemoryPlatformFile::FileSize(const TCHAR* Filename)
+{
+	FMemoryFile File;
+	return FindFile(Filename, File) ? File.Size : LowerLevel->FileSize(Filename);
+}
+
+bool FPakMemoryPlatformFile::IsReadOnly(const TCHAR* Filename)
+{
+	FMemoryFile File;
+	return FindFile(Filename, File) || LowerLevel->IsReadOnly(Filename);
+}
+
+FDateTime FPakMemoryPlatformFile::GetTimeStamp(const TCHAR* Filename)
+{
+	FMemoryFile File;
+	return FindFile(Filename, File) ? File.Timestamp : LowerLevel->GetTimeStamp(Filename);
+}
+
+FDateTime FPakMemoryPlatformFile::GetAccessTimeStamp(const TCHAR* Filename)
+{
+	FMemoryFile File;
+	return FindFile(Filename, File) ? File.Timestamp : LowerLevel->GetAccessTimeStamp(Filename);
+}
+
+FFileStatData FPakMemoryPlatformFile::GetStatData(const TCHAR* FilenameOrDirectory)
+{
+	FMemoryFile File;
+	if (FindFile(FilenameOrDirectory, File))
+	{
+		return FFileStatData(File.Timestamp, File.Timestamp, File.Timestamp, File.Size, false, true);
+	}
+
+	return LowerLevel->GetStatData(FilenameOrDirectory);
+}
+
+IFileHandle* FPakMemoryPlatformFile::OpenRead(const TCHAR* Filename, bool bAllowWrite)
+{
+	FMemoryFile File;
+	if (FindFile(Filename, File))
+	{
+		return new FPakMemoryFileHandle(File.Data, File.Size, File.Owner);
+	}
+
+	return LowerLevel->OpenRead(Filename, bAllowWrite);
+}
+
+IAsyncReadFileHandle* FPakMemoryPlatformFile::OpenAsyncRead(const TCHAR* Filename)
+{
+	// The lower level doesn't know the file, the generic handle reads through OpenRead.
+	FMemoryFile File;
+	if (FindFile(Filename, File))
+	{
+		return OpenGenericAsyncRead(Filename);
+	}
+
+	return LowerLevel->OpenAsyncRead(Filename);
+}
+
+// The file only exists in memory, there is nothing the lower level could map.
+#if ENGINE_MINOR_VERSION >= 3 && ENGINE_MAJOR_VERSION == 5
+FOpenMappedResult FPakMemoryPlatformFile::OpenMappedEx(const TCHAR* Filename, EOpenReadFlags OpenOptions, int64 MaximumSize)
+{
+	FMemoryFile File;
+	if (FindFile(Filename, File))
+	{
+		return OpenGenericMapped(Filename, OpenOptions, MaximumSize);
+	}
+
+	return LowerLevel->OpenMappedEx(Filename, OpenOptions, MaximumSize);
+}
+#else
+IMappedFileHandle* FPakMemoryPlatformFile::OpenMapped(const TCHAR* Filename)
+{
+	FMemoryFile File;
+	if (FindFile(Filename, File))
+	{
+		return OpenGenericMapped(Filename);
+	}
+
+	return LowerLevel->OpenMapped(Filename);
+}
+#endif
+
+bool FPakMemoryPlatformFile::FindFile(const TCHAR* Filename, FMemoryFile& OutFile) const
+{
+	if (NumFiles.load() == 0)
+	{
+		return false;
+	}
+
+	const FString Key = GetKey(Filename);
+
+	FReadScopeLock Lock(FilesLock);
+
+	const FMemoryFile* File = Files.Find(Key);
+	if (!File)
+	{
+		return false;
+	}
+
+	OutFile = *File;
+	return true;
+}
+
+FString FPakMemoryPlatformFile::GetKey(const TCHAR* Filename)
+{
+	FString Key = FPaths::ConvertRelativePathToFull(Filename);
+	FPaths::NormalizeFilename(Key);
+	return Key;
+}
@@ -0,0 +1,9 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#include "PakPlatformFileLayer.h"
+
+bool FPakPlatformFileLayer::Initialize(IPlatformFile* Inner, const TCHAR* CmdLine)
+{
+	LowerLevel = Inner;
+	return LowerLevel != nullptr;
+}
@@ -0,0 +1,118 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#include "PakPreloader.h"
+#include "PakLoader.h"
+#include "PakTraceRecorder.h"
+#include "LogHelper.h"
+#include "Async/Async.h"
+#include "UObject/Package.h"
+
+UAsyncPakPreloader::UAsyncPakPreloader(const FObjectInitializer& ObjectInitializer)
+	: Super(ObjectInitializer)
+{
+	if (HasAnyFlags(RF_ClassDefaultObject) == false)
+	{
+		AddToRoot();
+	}
+}
+
+UAsyncPakPreloader* UAsyncPakPreloader::PreloadPakAsset(const FString &Filename)
+{
+	UAsyncPakPreloader* PreloadTask = NewObject<UAsyncPakPreloader>();
+	PreloadTask->Start(Filename);
+
+	return PreloadTask;
+}
+
+void UAsyncPakPreloader::Start(const FString& Filename)
+{
+	PackageName = Filename;
+	StartSeconds = FPlatformTime::Seconds();
+
+	const TArray<FName> Closure = FPakLoader::Get()->GetPackageDependencyClosure(PackageName);
+	NumPackages = Closure.Num();
+
+	PAKLOADER_LOG(LL_VERBOSE, TEXT("Preloading %s with %d packages"), *PackageName, NumPackages);
+
+	TArray<FName> PackagesToLoad;
+	for (const FName& Name : Closure)
+	{
+		UPackage* Package = FindPackage(nullptr, *Name.ToString());
+		if (Package && Package->IsFullyLoaded())
+		{
+			LoadedPackages.Add(Package);
+			NumFinished++;
+		}
+		else
+		{
+			PackagesToLoad.Add(Name);
+		}
+	}
+
+	if (PackagesToLoad.Num() == 0)
+	{
+		// Delegates are bound after this returns, complete on the next frame.
+		TWeakObjectPtr<UAsyncPakPreloader> WeakThis = this;
+		AsyncTask(ENamedThreads::GameThread, [WeakThis]()
+		{
+			if (WeakThis.IsValid())
+			{
+				WeakThis->Complete();
+			}
+		});
+		return;
+	}
+
+	// All requests are issued before any finishes, deepest dependencies first so they don't wait behind the asset.
+	for (int32 Index = PackagesToLoad.Num() - 1; Index >= 0; Index--)
+	{
+		LoadPackageAsync(PackagesToLoad[Index].ToString(), FLoadPackageAsyncDelegate::CreateUObject(this, &UAsyncPakPreloader::HandlePackageLoaded));
+	}
+}
+
+void UAsyncPakPreloader::HandlePackageLoaded(const FName& LoadedPackageName, UPackage* Package, EAsyncLoadingResult::Type Result)
+{
+	NumFinished++;
+
+	if (Result == EAsyncLoadingResult::Succeeded && Package)
+	{
+		LoadedPackages.Add(Package);
+	}
+	else
+	{
+		NumFailed++;
+		PAKLOADER_LOG(LL_WARNING, TEXT("Preloading %s failed to load %s"), *PackageName, *LoadedPackageName.ToString());
+	}
+
+	OnProgress.Broadcast(NumFinished, NumPackages);
+
+	if (NumFinished == NumPackages)
+	{
+		Complete();
+	}
+}
+
+void UAsyncPakPreloader::Complete()
+{
+	UObject* Asset = nullptr;
+	UClass* Class = nullptr;
+
+	if (UPackage* Package = FindPackage(nullptr, *PackageName))
+	{
+		const FString ShortName = FPackageName::GetShortName(PackageName);
+		Asset = FindObject<UObject>(Package, *ShortName);
+		Class = FindObject<UClass>(Package, *(ShortName + TEXT("_C")));
+	}
+
+	if (FPakTraceRecorder::IsRecording())
+	{
+		FPakTraceRecorder::AddEvent(TEXT("PreloadPakAsset"), TEXT("Load"), StartSeconds, FPlatformTime::Seconds() - StartSeconds, -1, PackageName);
+	}
+
+	PAKLOADER_LOG(LL_LOG, TEXT("Preloaded %s, %d packages in %.3f seconds, %d failed"), *PackageName, NumPackages, FPlatformTime::Seconds() - StartSeconds, NumFailed);
+
+	LoadedPackages.Empty();
+	RemoveFromRoot();
+
+	OnCompleted.Broadcast(Asset != nullptr || Class != nullptr, Asset, Class);
+}
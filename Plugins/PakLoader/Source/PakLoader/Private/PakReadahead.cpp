@@ -0,0 +1,71 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#include "PakReadahead.h"
+#include "LogHelper.h"
+#include "HAL/FileManager.h"
+
+#if PLATFORM_LINUX || PLATFORM_ANDROID
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+bool FPakReadahead::IsSupported()
+{
+#if PLATFORM_LINUX || PLATFORM_ANDROID
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool FPakReadahead::WillNeed(const FString& Filename, const TArray<FPakReadaheadRegion>& Regions)
+{
+#if PLATFORM_LINUX || PLATFORM_ANDROID
+	const FString AbsolutePath = IFileManager::Get().ConvertToAbsolutePathForExternalAppForRead(*Filename);
+	const int Fd = open(TCHAR_TO_UTF8(*AbsolutePath), O_RDONLY);
+
+	// Paks served from memory or still downloading have no file to hint.
+	if (Fd < 0)
+	{
+		return false;
+	}
+
+	// The hints belong to the cached pages of the file, not to the descriptor, they outlive it.
+	bool bResult = true;
+	for (const FPakReadaheadRegion& Region : Regions)
+	{
+		const int Result = posix_fadvise(Fd, Region.Offset, FMath::Max<int64>(Region.Size, 0), POSIX_FADV_WILLNEED);
+
+		if (Result != 0)
+		{
+			PAKLOADER_LOG(LL_VERBOSE, TEXT("Readahead hint for %s at %lld failed with %d"), *Filename, Region.Offset, Result);
+			bResult = false;
+		}
+	}
+
+	close(Fd);
+	return bResult;
+#else
+	return false;
+#endif
+}
+
+bool FPakReadahead::DontNeed(const FString& Filename)
+{
+#if PLATFORM_LINUX || PLATFORM_ANDROID
+	const FString AbsolutePath = IFileManager::Get().ConvertToAbsolutePathForExternalAppForRead(*Filename);
+	const int Fd = open(TCHAR_TO_UTF8(*AbsolutePath), O_RDONLY);
+
+	if (Fd < 0)
+	{
+		return false;
+	}
+
+	const int Result = posix_fadvise(Fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(Fd);
+
+	return Result == 0;
+#else
+	return false;
+#endif
+}
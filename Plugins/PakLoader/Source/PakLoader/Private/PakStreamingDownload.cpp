@@ -0,0 +1,444 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#include "PakStreamingDownload.h"
+
+#if ENGINE_MINOR_VERSION >= 4 && ENGINE_MAJOR_VERSION == 5
+
+#include "PakDownloader.h"
+#include "PakDownloadFileWriter.h"
+#include "PakDownloadManager.h"
+#include "PakBandwidthLimiter.h"
+#include "PakStreamingPlatformFile.h"
+#include "PakLoader.h"
+#include "LogHelper.h"
+#include "HttpModule.h"
+#include "Misc/ScopeLock.h"
+
+namespace PakStreamingDownload
+{
+	// Fetched first, holds the footer and for most paks the whole index.
+	static constexpr int64 TailSize = 64 * 1024;
+
+	// Granularity of requests, small enough that a read waiting for a piece isn't stuck behind a large transfer.
+	static constexpr int64 PieceSize = 2 * 1024 * 1024;
+
+	static constexpr int32 MaxPieceRetries = 3;
+
+	// Pieces a read waits for may open this many connections beyond the limit.
+	static constexpr int32 MaxPriorityConnections = 2;
+}
+
+FPakStreamingDownload::FPakStreamingDownload(const FString& InURL, const FString& InFilename, int32 InMaxConnections)
+	: URL(InURL)
+	, Filename(InFilename)
+	, MaxConnections(FMath::Max(InMaxConnections, 1))
+	, Writer(MakeShared<FPakDownloadFileWriter, ESPMode::ThreadSafe>(InFilename, FPakDownloadFileWriter::DefaultBufferSize, true))
+{
+	if (UPakDownloadManager* Manager = UPakDownloadManager::Get())
+	{
+		BandwidthLimiter = Manager->GetBandwidthLimiter();
+	}
+}
+
+void FPakStreamingDownload::Start()
+{
+	FHttpRequestPtr HttpRequest = CreateHttpRequest(FString::Printf(TEXT("bytes=-%lld"), PakStreamingDownload::TailSize));
+	HttpRequest->OnProcessRequestComplete().BindThreadSafeSP(AsShared(), &FPakStreamingDownload::HandleTailComplete);
+
+	{
+		FScopeLock ScopeLock(&Lock);
+		TailRequest = HttpRequest;
+	}
+
+	HttpRequest->ProcessRequest();
+}
+
+void FPakStreamingDownload::Cancel()
+{
+	Fail(TEXT("Cancelled"));
+}
+
+bool FPakStreamingDownload::Finalize()
+{
+	if (!Writer->Finish(FileSize))
+	{
+		Fail(TEXT("Writing the file failed"));
+		return false;
+	}
+
+	StreamingFile->MarkComplete();
+	return true;
+}
+
+void FPakStreamingDownload::DeleteFile()
+{
+	Writer->Abort(false);
+}
+
+FHttpRequestPtr FPakStreamingDownload::CreateHttpRequest(const FString& Range) const
+{
+	auto HttpRequest = FHttpModule::Get().CreateRequest();
+
+	HttpRequest->SetURL(URL);
+	HttpRequest->SetVerb(TEXT("GET"));
+	HttpRequest->SetHeader(TEXT("Range"), Range);
+
+	// Reads of the mounted pak may block the game thread until a piece arrives, completion must not depend on it.
+	HttpRequest->SetDelegateThreadPolicy(EHttpRequestDelegateThreadPolicy::CompleteOnHttpThread);
+
+	return HttpRequest;
+}
+
+void FPakStreamingDownload::HandleTailComplete(FHttpRequestPtr HttpRequest, FHttpResponsePtr HttpResponse, bool bSucceeded)
+{
+	int64 TailStart = 0, TailEnd = 0, Total = 0;
+
+	// Mounting before the download is complete only works with range requests.
+	if (!bSucceeded || !HttpResponse.IsValid() || HttpResponse->GetResponseCode() != EHttpResponseCodes::PartialContent ||
+		!UAsyncPakDownloader::ParseContentRange(HttpResponse->GetHeader(TEXT("Content-Range")), TailStart, TailEnd, Total) || Total <= 0)
+	{
+		Fail(FString::Printf(TEXT("No range response for the end of %s (%d)"), *URL, HttpResponse.IsValid() ? HttpResponse->GetResponseCode() : 0));
+		return;
+	}
+
+	const TArray<uint8>& Content = HttpResponse->GetContent();
+
+	FPakInfo Info;
+	if (TailEnd != Total - 1 || Content.Num() != TailEnd - TailStart + 1 || !FPakLoader::ReadPakFooter(Content, Total, Info))
+	{
+		Fail(FString::Printf(TEXT("%s does not end with a valid pak footer"), *URL));
+		return;
+	}
+
+	FileSize = Total;
+
+	TSharedRef<FPakStreamingFile, ESPMode::ThreadSafe> File = MakeShared<FPakStreamingFile, ESPMode::ThreadSafe>(Total);
+	{
+		FScopeLock ScopeLock(&Lock);
+		StreamingFile = File;
+	}
+
+	TWeakPtr<FPakStreamingFile, ESPMode::ThreadSafe> WeakFile = File;
+	Writer->SetBlockWrittenCallback([WeakFile](int64 Offset, int64 Size)
+	{
+		if (TSharedPtr<FPakStreamingFile, ESPMode::ThreadSafe> PinnedFile = WeakFile.Pin())
+		{
+			PinnedFile->MarkAvailable(Offset, Size);
+		}
+	});
+
+	TWeakPtr<FPakStreamingDownload, ESPMode::ThreadSafe> WeakThis = AsShared();
+	File->SetRangeRequestHandler([WeakThis](int64 Offset, int64 Size)
+	{
+		if (TSharedPtr<FPakStreamingDownload, ESPMode::ThreadSafe> This = WeakThis.Pin())
+		{
+			This->Prioritize(Offset, Size);
+		}
+	});
+
+	Writer->Start(false);
+	Writer->Preallocate(Total);
+
+	TSharedRef<FPakDownloadStream, ESPMode::ThreadSafe> TailStream = Writer->CreateStream(TailStart);
+	TailStream->Serialize(const_cast<uint8*>(Content.GetData()), Content.Num());
+	TailStream->Close();
+
+	BytesReceived += Content.Num();
+
+	TArray<FHttpRequestPtr> Requests;
+	{
+		FScopeLock ScopeLock(&Lock);
+		TailRequest.Reset();
+
+		if (State == EPakStreamingState::Failed)
+		{
+			return;
+		}
+
+		for (int64 Offset = 0; Offset < TailStart; Offset += PakStreamingDownload::PieceSize)
+		{
+			FPiece& Piece = Pieces.AddDefaulted_GetRef();
+			Piece.Start = Offset;
+			Piece.End = FMath::Min(Offset + PakStreamingDownload::PieceSize, TailStart) - 1;
+
+			// Everything from the index on is needed to mount, that includes the secondary indexes of newer pak versions.
+			if (Piece.End >= Info.IndexOffset)
+			{
+				Piece.bIndex = true;
+				PriorityPieces.Add(Pieces.Num() - 1);
+				++NumIndexPiecesLeft;
+			}
+		}
+
+		if (Pieces.Num() == 0)
+		{
+			State = EPakStreamingState::Downloaded;
+		}
+		else if (NumIndexPiecesLeft == 0)
+		{
+			State = EPakStreamingState::Mountable;
+		}
+
+		Requests = StartPieces_Locked();
+	}
+
+	ProcessRequests(Requests);
+}
+
+void FPakStreamingDownload::HandlePieceComplete(FHttpRequestPtr HttpRequest, FHttpResponsePtr HttpResponse, bool bSucceeded, int32 PieceIndex)
+{
+	FActivePiece Active;
+	{
+		FScopeLock ScopeLock(&Lock);
+		if (!ActivePieces.RemoveAndCopyValue(PieceIndex, Active))
+		{
+			return;
+		}
+	}
+
+	Active.Stream->Close();
+
+	TArray<FHttpRequestPtr> Requests;
+	{
+		FScopeLock ScopeLock(&Lock);
+
+		if (State == EPakStreamingState::Failed)
+		{
+			return;
+		}
+
+		FPiece& Piece = Pieces[PieceIndex];
+		const int64 Size = Piece.End - Piece.Start + 1;
+
+		if (bSucceeded && HttpResponse.IsValid() && HttpResponse->GetResponseCode() == EHttpResponseCodes::PartialContent &&
+			Active.Stream->GetStartOffset() == Piece.Start && Active.Stream->GetBytesReceived() == Size)
+		{
+			Piece.State = EPieceState::Done;
+			BytesReceived += Size;
+			++NumPiecesDone;
+
+			if (Piece.bIndex && --NumIndexPiecesLeft == 0 && State == EPakStreamingState::FetchingIndex)
+			{
+				State = EPakStreamingState::Mountable;
+			}
+
+			if (NumPiecesDone == Pieces.Num())
+			{
+				State = EPakStreamingState::Downloaded;
+			}
+		}
+		else if (Writer->HasFailed() || ++Piece.Retries > PakStreamingDownload::MaxPieceRetries)
+		{
+			const int32 HttpResponseCode = HttpResponse.IsValid() ? HttpResponse->GetResponseCode() : 0;
+			Fail(FString::Printf(TEXT("Range %lld-%lld of %s failed with response code %d"), Piece.Start, Piece.End, *URL, HttpResponseCode));
+			return;
+		}
+		else
+		{
+			Piece.State = EPieceState::Pending;
+			NextPiece = FMath::Min(NextPiece, PieceIndex);
+		}
+
+		Requests = StartPieces_Locked();
+	}
+
+	ProcessRequests(Requests);
+}
+
+void FPakStreamingDownload::Prioritize(int64 Offset, int64 Size)
+{
+	TArray<FHttpRequestPtr> Requests;
+	{
+		FScopeLock ScopeLock(&Lock);
+
+		if (State == EPakStreamingState::Failed || Pieces.Num() == 0)
+		{
+			return;
+		}
+
+		const int32 First = FMath::Clamp<int32>(Offset / PakStreamingDownload::PieceSize, 0, Pieces.Num() - 1);
+		const int32 Last = FMath::Clamp<int32>((Offset + Size - 1) / PakStreamingDownload::PieceSize, 0, Pieces.Num() - 1);
+
+		// The piece after the range too, reads of a pak are mostly sequential.
+		for (int32 Index = First; Index <= FMath::Min(Last + 1, Pieces.Num() - 1); ++Index)
+		{
+			if (Pieces[Index].State == EPieceState::Pending)
+			{
+				PriorityPieces.AddUnique(Index);
+			}
+		}
+
+		Requests = StartPieces_Locked();
+	}
+
+	ProcessRequests(Requests);
+}
+
+TArray<FHttpRequestPtr> FPakStreamingDownload::StartPieces_Locked()
+{
+	TArray<FHttpRequestPtr> Requests;
+
+	while (PriorityPieces.Num() > 0 && ActivePieces.Num() < MaxConnections + PakStreamingDownload::MaxPriorityConnections)
+	{
+		const int32 PieceIndex = PriorityPieces[0];
+		PriorityPieces.RemoveAt(0);
+
+		if (Pieces[PieceIndex].State == EPieceState::Pending)
+		{
+			// A read is waiting for it, the bandwidth limit must not hold it back. It still counts against the limit.
+			if (BandwidthLimiter.IsValid())
+			{
+				BandwidthLimiter->Consume(Pieces[PieceIndex].End - Pieces[PieceIndex].Start + 1);
+			}
+
+			Requests.Add(StartPiece_Locked(PieceIndex));
+		}
+	}
+
+	while (ActivePieces.Num() + NumDeferredPieces < MaxConnections && NextPiece < Pieces.Num())
+	{
+		if (Pieces[NextPiece].State != EPieceState::Pending)
+		{
+			++NextPiece;
+			continue;
+		}
+
+		// Background pieces wait for the bandwidth limit. Deferred starts run on the game thread, which may be
+		// blocked by a read, but those reads only wait for priority pieces.
+		if (BandwidthLimiter.IsValid() && !BandwidthLimiter->TryReserve(PakStreamingDownload::PieceSize))
+		{
+			++NumDeferredPieces;
+
+			TWeakPtr<FPakStreamingDownload, ESPMode::ThreadSafe> WeakThis = AsShared();
+			BandwidthLimiter->Defer(this, PakStreamingDownload::PieceSize, [WeakThis]()
+			{
+				if (TSharedPtr<FPakStreamingDownload, ESPMode::ThreadSafe> This = WeakThis.Pin())
+				{
+					This->StartDeferredPiece();
+				}
+			});
+			continue;
+		}
+
+		Requests.Add(StartPiece_Locked(NextPiece));
+		++NextPiece;
+	}
+
+	return Requests;
+}
+
+void FPakStreamingDownload::StartDeferredPiece()
+{
+	TArray<FHttpRequestPtr> Requests;
+	{
+		FScopeLock ScopeLock(&Lock);
+
+		if (State == EPakStreamingState::Failed)
+		{
+			return;
+		}
+
+		--NumDeferredPieces;
+
+		// The range was reserved for whichever piece is next, a priority request may have taken the one it was deferred for.
+		while (NextPiece < Pieces.Num() && Pieces[NextPiece].State != EPieceState::Pending)
+		{
+			++NextPiece;
+		}
+
+		if (NextPiece < Pieces.Num())
+		{
+			Requests.Add(StartPiece_Locked(NextPiece));
+			++NextPiece;
+		}
+	}
+
+	ProcessRequests(Requests);
+}
+
+FHttpRequestPtr FPakStreamingDownload::StartPiece_Locked(int32 PieceIndex)
+{
+	FPiece& Piece = Pieces[PieceIndex];
+	Piece.State = EPieceState::Active;
+
+	FHttpRequestPtr HttpRequest = CreateHttpRequest(FString::Printf(TEXT("bytes=%lld-%lld"), Piece.Start, Piece.End));
+	HttpRequest->OnProcessRequestComplete().BindThreadSafeSP(AsShared(), &FPakStreamingDownload::HandlePieceComplete, PieceIndex);
+
+	TSharedRef<FPakDownloadStream, ESPMode::ThreadSafe> Stream = Writer->CreateStream(Piece.Start);
+
+	TWeakPtr<IHttpRequest, ESPMode::ThreadSafe> WeakRequest = HttpRequest;
+	const int64 RequestedOffset = Piece.Start;
+	Stream->SetStartOffsetResolver([WeakRequest, RequestedOffset]()
+	{
+		FHttpRequestPtr Request = WeakRequest.Pin();
+		return UAsyncPakDownloader::GetBodyWriteOffset(Request.IsValid() ? Request->GetResponse() : nullptr, RequestedOffset, false);
+	});
+
+	HttpRequest->SetResponseBodyReceiveStream(Stream);
+
+	FActivePiece& Active = ActivePieces.Add(PieceIndex);
+	Active.HttpRequest = HttpRequest;
+	Active.Stream = Stream;
+
+	return HttpRequest;
+}
+
+void FPakStreamingDownload::ProcessRequests(const TArray<FHttpRequestPtr>& Requests)
+{
+	for (const FHttpRequestPtr& HttpRequest : Requests)
+	{
+		HttpRequest->ProcessRequest();
+	}
+}
+
+void FPakStreamingDownload::Fail(const FString& Reason)
+{
+	TArray<FHttpRequestPtr> Requests;
+	TSharedPtr<FPakStreamingFile, ESPMode::ThreadSafe> File;
+	{
+		FScopeLock ScopeLock(&Lock);
+
+		if (State == EPakStreamingState::Failed)
+		{
+			return;
+		}
+
+		State = EPakStreamingState::Failed;
+		File = StreamingFile;
+
+		if (TailRequest.IsValid())
+		{
+			Requests.Add(TailRequest);
+			TailRequest.Reset();
+		}
+
+		for (TPair<int32, FActivePiece>& Pair : ActivePieces)
+		{
+			Requests.Add(Pair.Value.HttpRequest);
+		}
+
+		ActivePieces.Empty();
+		PriorityPieces.Empty();
+		NumDeferredPieces = 0;
+	}
+
+	if (BandwidthLimiter.IsValid())
+	{
+		BandwidthLimiter->CancelDeferredStarts(this);
+	}
+
+	PAKLOADER_LOG(LL_ERROR, TEXT("Streaming download of %s stopped: %s"), *Filename, *Reason);
+
+	for (const FHttpRequestPtr& HttpRequest : Requests)
+	{
+		HttpRequest->OnProcessRequestComplete().Unbind();
+		HttpRequest->CancelRequest();
+	}
+
+	if (File.IsValid())
+	{
+		File->MarkFailed();
+	}
+}
+
+#endif
@@ -0,0 +1,193 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#include "PakStreamingMount.h"
+#include "PakStreamingDownload.h"
+#include "PakStreamingPlatformFile.h"
+#include "PakLoader.h"
+#include "LogHelper.h"
+#include "Async/Async.h"
+#include "Misc/Paths.h"
+
+namespace PakStreamingMount
+{
+	static constexpr float PollInterval = 0.05f;
+}
+
+UAsyncPakStreamingMount::UAsyncPakStreamingMount(const FObjectInitializer& ObjectInitializer)
+	: Super(ObjectInitializer)
+{
+	if (HasAnyFlags(RF_ClassDefaultObject) == false)
+	{
+		AddToRoot();
+	}
+}
+
+UAsyncPakStreamingMount* UAsyncPakStreamingMount::StreamAndMountPak(const FString &URL, const FString &SavePath, int32 MaxConnections)
+{
+	UAsyncPakStreamingMount* MountTask = NewObject<UAsyncPakStreamingMount>();
+
+	// If the user did not specify a filename, try to extract it from the download URL.
+	MountTask->PakFilename = SavePath;
+	const FString SaveCleanFilename = FPaths::GetCleanFilename(SavePath);
+	if (SavePath.Len() > 1 && (SaveCleanFilename.Len() == 0 || !SaveCleanFilename.Contains(".")))
+	{
+		MountTask->PakFilename = FPaths::Combine(SavePath, FPaths::GetCleanFilename(URL));
+	}
+
+	MountTask->Start(URL, MaxConnections);
+
+	return MountTask;
+}
+
+void UAsyncPakStreamingMount::Start(const FString& URL, int32 MaxConnections)
+{
+#if ENGINE_MINOR_VERSION >= 4 && ENGINE_MAJOR_VERSION == 5
+	if (FPakLoader::Get()->GetStreamingPlatformFile() == nullptr)
+	{
+		FLogHelper::Log(LL_ERROR, TEXT("Streaming mount failed, the streaming platform file could not be installed"));
+	}
+	else
+	{
+		Download = MakeShared<FPakStreamingDownload, ESPMode::ThreadSafe>(URL, PakFilename, MaxConnections);
+		Download->Start();
+
+		TickerHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateUObject(this, &UAsyncPakStreamingMount::Tick), PakStreamingMount::PollInterval);
+		return;
+	}
+#else
+	FLogHelper::Log(LL_ERROR, TEXT("Streaming mount requires Unreal Engine 5.4 or newer"));
+#endif
+
+	// Delegates are bound after this returns, fail on the next frame.
+	TWeakObjectPtr<UAsyncPakStreamingMount> WeakThis = this;
+	AsyncTask(ENamedThreads::GameThread, [WeakThis]()
+	{
+		if (WeakThis.IsValid())
+		{
+			WeakThis->Fail();
+		}
+	});
+}
+
+void UAsyncPakStreamingMount::Cancel()
+{
+	if (!bFinished)
+	{
+		Fail();
+	}
+}
+
+#if ENGINE_MINOR_VERSION >= 4 && ENGINE_MAJOR_VERSION == 5
+bool UAsyncPakStreamingMount::Tick(float DeltaTime)
+{
+	const EPakStreamingState State = Download->GetState();
+
+	if (State == EPakStreamingState::Failed)
+	{
+		Fail();
+		return false;
+	}
+
+	if (!bMounted && (State == EPakStreamingState::Mountable || State == EPakStreamingState::Downloaded))
+	{
+		if (!Mount())
+		{
+			Fail();
+			return false;
+		}
+	}
+
+	const int64 BytesReceived = Download->GetBytesReceived();
+	if (BytesReceived != LastBytesReceived)
+	{
+		LastBytesReceived = BytesReceived;
+		OnProgress.Broadcast(BytesReceived, Download->GetTotalBytes());
+	}
+
+	if (State == EPakStreamingState::Downloaded)
+	{
+		if (Download->Finalize())
+		{
+			Complete();
+		}
+		else
+		{
+			Fail();
+		}
+
+		return false;
+	}
+
+	return true;
+}
+#endif
+
+bool UAsyncPakStreamingMount::Mount()
+{
+#if ENGINE_MINOR_VERSION >= 4 && ENGINE_MAJOR_VERSION == 5
+	// Registered before mounting, the pak platform file opens the pak while it is mounted.
+	FPakLoader::Get()->GetStreamingPlatformFile()->RegisterFile(PakFilename, Download->GetStreamingFile().ToSharedRef());
+
+	if (!FPakLoader::Get()->MountPakFileEasy(PakFilename))
+	{
+		PAKLOADER_LOG(LL_ERROR, TEXT("Streaming pak %s could not be mounted"), *PakFilename);
+		return false;
+	}
+
+	bMounted = true;
+	OnMounted.Broadcast(PakFilename);
+	return true;
+#else
+	return false;
+#endif
+}
+
+void UAsyncPakStreamingMount::Complete()
+{
+	bFinished = true;
+
+#if ENGINE_MINOR_VERSION >= 4 && ENGINE_MAJOR_VERSION == 5
+	// Open handles keep the streaming file, it is complete and no longer makes reads wait.
+	FPakLoader::Get()->GetStreamingPlatformFile()->UnregisterFile(PakFilename);
+	Download.Reset();
+#endif
+
+	RemoveFromRoot();
+	OnCompleted.Broadcast(PakFilename);
+}
+
+void UAsyncPakStreamingMount::Fail()
+{
+	if (bFinished)
+	{
+		return;
+	}
+
+	bFinished = true;
+
+#if ENGINE_MINOR_VERSION >= 4 && ENGINE_MAJOR_VERSION == 5
+	FTSTicker::GetCoreTicker().RemoveTicker(TickerHandle);
+
+	if (Download.IsValid())
+	{
+		// Wakes up reads waiting for missing ranges before the pak is unmounted.
+		Download->Cancel();
+
+		if (bMounted)
+		{
+			FPakLoader::Get()->UnmountPakFile(PakFilename);
+		}
+
+		if (FPakStreamingPlatformFile* StreamingPlatformFile = FPakLoader::Get()->GetStreamingPlatformFile())
+		{
+			StreamingPlatformFile->UnregisterFile(PakFilename);
+		}
+
+		Download->DeleteFile();
+		Download.Reset();
+	}
+#endif
+
+	RemoveFromRoot();
+	OnFail.Broadcast(PakFilename);
+}
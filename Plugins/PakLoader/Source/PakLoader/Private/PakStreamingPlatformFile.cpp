@@ -0,0 +1,257 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#include "PakStreamingPlatformFile.h"
+#include "LogHelper.h"
+#include "HAL/Event.h"
+#include "Misc/Paths.h"
+#include "Misc/ScopeLock.h"
+#include "Algo/BinarySearch.h"
+
+namespace PakStreamingPlatformFile
+{
+	// Reads wake up this often to ask for their range again and to notice a failed download.
+	static constexpr uint32 WaitIntervalMs = 50;
+}
+
+/* Read handle that waits for the bytes it reads to be downloaded. */
+class FPakStreamingFileHandle : public IFileHandle
+{
+public:
+	FPakStreamingFileHandle(IFileHandle* InInner, const TSharedRef<FPakStreamingFile, ESPMode::ThreadSafe>& InFile)
+		: Inner(InInner)
+		, File(InFile)
+	{
+	}
+
+	virtual int64 Tell() override { return Inner->Tell(); }
+	virtual bool Seek(int64 NewPosition) override { return Inner->Seek(NewPosition); }
+	virtual bool SeekFromEnd(int64 NewPositionRelativeToEnd = 0) override { return Inner->Seek(File->GetFileSize() + NewPositionRelativeToEnd); }
+	virtual int64 Size() override { return File->GetFileSize(); }
+	virtual bool Write(const uint8* Source, int64 BytesToWrite) override { return false; }
+	virtual bool Flush(const bool bFullFlush = false) override { return false; }
+	virtual bool Truncate(int64 NewSize) override { return false; }
+
+	virtual bool Read(uint8* Destination, int64 BytesToRead) override
+	{
+		const int64 Position = Inner->Tell();
+		const int64 Available = FMath::Min(BytesToRead, File->GetFileSize() - Position);
+
+		if (Available > 0 && !File->WaitForRange(Position, Available))
+		{
+			return false;
+		}
+
+		return Inner->Read(Destination, BytesToRead);
+	}
+
+private:
+	TUniquePtr<IFileHandle> Inner;
+	TSharedRef<FPakStreamingFile, ESPMode::ThreadSafe> File;
+};
+
+FPakStreamingFile::FPakStreamingFile(int64 InFileSize)
+	: FileSize(InFileSize)
+{
+	RangeAvailableEvent = FPlatformProcess::GetSynchEventFromPool(true);
+}
+
+FPakStreamingFile::~FPakStreamingFile()
+{
+	FPlatformProcess::ReturnSynchEventToPool(RangeAvailableEvent);
+}
+
+void FPakStreamingFile::MarkAvailable(int64 Offset, int64 Size)
+{
+	if (Size <= 0)
+	{
+		return;
+	}
+
+	{
+		FWriteScopeLock Lock(RangesLock);
+
+		int64 Start = Offset;
+		int64 End = Offset + Size;
+
+		// Merge with every range that overlaps or touches the new one.
+		int32 Index = Algo::LowerBoundBy(Ranges, Start, [](const TPair<int64, int64>& Range) { return Range.Value; });
+		while (Index < Ranges.Num() && Ranges[Index].Key <= End)
+		{
+			Start = FMath::Min(Start, Ranges[Index].Key);
+			End = FMath::Max(End, Ranges[Index].Value);
+			Ranges.RemoveAt(Index, 1, false);
+		}
+
+		Ranges.Insert(TPair<int64, int64>(Start, End), Index);
+	}
+
+	RangeAvailableEvent->Trigger();
+}
+
+void FPakStreamingFile::MarkComplete()
+{
+	bComplete = true;
+	RangeAvailableEvent->Trigger();
+}
+
+void FPakStreamingFile::MarkFailed()
+{
+	bFailed = true;
+	RangeAvailableEvent->Trigger();
+}
+
+bool FPakStreamingFile::IsRangeAvailable(int64 Offset, int64 Size) const
+{
+	if (bComplete)
+	{
+		return true;
+	}
+
+	FReadScopeLock Lock(RangesLock);
+
+	const int32 Index = Algo::UpperBoundBy(Ranges, Offset, [](const TPair<int64, int64>& Range) { return Range.Key; }) - 1;
+	return Ranges.IsValidIndex(Index) && Ranges[Index].Value >= Offset + Size;
+}
+
+bool FPakStreamingFile::WaitForRange(int64 Offset, int64 Size)
+{
+	if (IsRangeAvailable(Offset, Size))
+	{
+		return true;
+	}
+
+	while (!bFailed)
+	{
+		{
+			FScopeLock Lock(&HandlerLock);
+			if (RangeRequestHandler)
+			{
+				RangeRequestHandler(Offset, Size);
+			}
+		}
+
+		// Manual reset, every waiter wakes up on a new range and checks its own.
+		RangeAvailableEvent->Reset();
+
+		if (IsRangeAvailable(Offset, Size))
+		{
+			return true;
+		}
+
+		RangeAvailableEvent->Wait(PakStreamingPlatformFile::WaitIntervalMs);
+
+		if (IsRangeAvailable(Offset, Size))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void FPakStreamingFile::SetRangeRequestHandler(TFunction<void(int64 Offset, int64 Size)>&& InHandler)
+{
+	FScopeLock Lock(&HandlerLock);
+	RangeRequestHandler = MoveTemp(InHandler);
+}
+
+void FPakStreamingPlatformFile::RegisterFile(const FString& Filename, const TSharedRef<FPakStreamingFile, ESPMode::ThreadSafe>& File)
+{
+	FWriteScopeLock Lock(FilesLock);
+
+	Files.Add(GetKey(*Filename), File);
+	NumFiles = Files.Num();
+}
+
+void FPakStreamingPlatformFile::UnregisterFile(const FString& Filename)
+{
+	FWriteScopeLock Lock(FilesLock);
+
+	Files.Remove(GetKey(*Filename));
+	NumFiles = Files.Num();
+}
+
+int64 FPakStreamingPlatformFile::FileSize(const TCHAR* Filename)
+{
+	if (TSharedPtr<FPakStreamingFile, ESPMode::ThreadSafe> File = FindFile(Filename))
+	{
+		return File->GetFileSize();
+	}
+
+	return LowerLevel->FileSize(Filename);
+}
+
+IFileHandle* FPakStreamingPlatformFile::OpenRead(const TCHAR* Filename, bool bAllowWrite)
+{
+	TSharedPtr<FPakStreamingFile, ESPMode::ThreadSafe> File = FindFile(Filename);
+
+	if (!File.IsValid() || File->IsComplete())
+	{
+		return LowerLevel->OpenRead(Filename, bAllowWrite);
+	}
+
+	// The download still writes to the file.
+	IFileHandle* Inner = LowerLevel->OpenRead(Filename, true);
+	if (!Inner)
+	{
+		return nullptr;
+	}
+
+	return new FPakStreamingFileHandle(Inner, File.ToSharedRef());
+}
+
+IAsyncReadFileHandle* FPakStreamingPlatformFile::OpenAsyncRead(const TCHAR* Filename)
+{
+	// The native async handle would read past the waiting handle.
+	if (FindFile(Filename).IsValid())
+	{
+		return OpenGenericAsyncRead(Filename);
+	}
+
+	return LowerLevel->OpenAsyncRead(Filename);
+}
+
+// A mapping of the partial file would read bytes that are not downloaded yet.
+#if ENGINE_MINOR_VERSION >= 3 && ENGINE_MAJOR_VERSION == 5
+FOpenMappedResult FPakStreamingPlatformFile::OpenMappedEx(const TCHAR* Filename, EOpenReadFlags OpenOptions, int64 MaximumSize)
+{
+	if (FindFile(Filename).IsValid())
+	{
+		return OpenGenericMapped(Filename, OpenOptions, MaximumSize);
+	}
+
+	return LowerLevel->OpenMappedEx(Filename, OpenOptions, MaximumSize);
+}
+#else
+IMappedFileHandle* FPakStreamingPlatformFile::OpenMapped(const TCHAR* Filename)
+{
+	if (FindFile(Filename).IsValid())
+	{
+		return OpenGenericMapped(Filename);
+	}
+
+	return LowerLevel->OpenMapped(Filename);
+}
+#endif
+
+TSharedPtr<FPakStreamingFile, ESPMode::ThreadSafe> FPakStreamingPlatformFile::FindFile(const TCHAR* Filename) const
+{
+	if (NumFiles.load() == 0)
+	{
+		return nullptr;
+	}
+
+	const FString Key = GetKey(Filename);
+
+	FReadScopeLock Lock(FilesLock);
+
+	const TSharedRef<FPakStreamingFile, ESPMode::ThreadSafe>* File = Files.Find(Key);
+	return File ? TSharedPtr<FPakStreamingFile, ESPMode::ThreadSafe>(*File) : nullptr;
+}
+
+FString FPakStreamingPlatformFile::GetKey(const TCHAR* Filename)
+{
+	FString Key = FPaths::ConvertRelativePathToFull(Filename);
+	FPaths::NormalizeFilename(Key);
+	return Key;
+}
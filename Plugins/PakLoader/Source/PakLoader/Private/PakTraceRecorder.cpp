@@ -0,0 +1,215 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#include "PakTraceRecorder.h"
+#include "LogHelper.h"
+#include "HAL/PlatformTLS.h"
+#include "HAL/ThreadManager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/ScopeLock.h"
+#include "Policies/CondensedJsonPrintPolicy.h"
+#include "Serialization/JsonWriter.h"
+
+std::atomic<bool> FPakTraceRecorder::bRecording{false};
+
+namespace PakTraceRecorder
+{
+	// Events after this many are dropped, a forgotten recording must not eat all memory.
+	static constexpr int32 MaxEvents = 200000;
+
+	struct FEvent
+	{
+		const TCHAR* Name = nullptr;
+		const TCHAR* Category = nullptr;
+		double StartSeconds = 0.0;
+
+		// Negative for instant events.
+		double DurationSeconds = 0.0;
+
+		int64 Bytes = -1;
+		uint32 ThreadId = 0;
+		FString Detail;
+	};
+
+	static TArray<FEvent> Events;
+	static double StartTime = 0.0;
+	static int32 NumDropped = 0;
+	static FCriticalSection Lock;
+
+	static void Add(FEvent&& Event)
+	{
+		FScopeLock ScopeLock(&Lock);
+
+		if (Events.Num() >= MaxEvents)
+		{
+			++NumDropped;
+			return;
+		}
+
+		Events.Add(MoveTemp(Event));
+	}
+}
+
+void FPakTraceRecorder::Start()
+{
+	FScopeLock ScopeLock(&PakTraceRecorder::Lock);
+
+	PakTraceRecorder::Events.Reset();
+	PakTraceRecorder::NumDropped = 0;
+	PakTraceRecorder::StartTime = FPlatformTime::Seconds();
+
+	bRecording = true;
+}
+
+void FPakTraceRecorder::Stop()
+{
+	bRecording = false;
+}
+
+void FPakTraceRecorder::AddEvent(const TCHAR* Name, const TCHAR* Category, double StartSeconds, double DurationSeconds, int64 Bytes, const FString& Detail)
+{
+	if (!IsRecording())
+	{
+		return;
+	}
+
+	PakTraceRecorder::FEvent Event;
+	Event.Name = Name;
+	Event.Category = Category;
+	Event.StartSeconds = StartSeconds;
+	Event.DurationSeconds = FMath::Max(DurationSeconds, 0.0);
+	Event.Bytes = Bytes;
+	Event.ThreadId = FPlatformTLS::GetCurrentThreadId();
+	Event.Detail = Detail;
+
+	PakTraceRecorder::Add(MoveTemp(Event));
+}
+
+void FPakTraceRecorder::AddInstantEvent(const TCHAR* Name, const TCHAR* Category, int64 Bytes, const FString& Detail)
+{
+	if (!IsRecording())
+	{
+		return;
+	}
+
+	PakTraceRecorder::FEvent Event;
+	Event.Name = Name;
+	Event.Category = Category;
+	Event.StartSeconds = FPlatformTime::Seconds();
+	Event.DurationSeconds = -1.0;
+	Event.Bytes = Bytes;
+	Event.ThreadId = FPlatformTLS::GetCurrentThreadId();
+	Event.Detail = Detail;
+
+	PakTraceRecorder::Add(MoveTemp(Event));
+}
+
+int32 FPakTraceRecorder::GetNumEvents()
+{
+	FScopeLock ScopeLock(&PakTraceRecorder::Lock);
+	return PakTraceRecorder::Events.Num();
+}
+
+bool FPakTraceRecorder::Export(const FString& Filename)
+{
+	TArray<PakTraceRecorder::FEvent> Events;
+	double StartTime = 0.0;
+	int32 NumDropped = 0;
+	{
+		FScopeLock ScopeLock(&PakTraceRecorder::Lock);
+		Events = PakTraceRecorder::Events;
+		StartTime = PakTraceRecorder::StartTime;
+		NumDropped = PakTraceRecorder::NumDropped;
+	}
+
+	FString Json;
+	TSharedRef<TJsonWriter<TCHAR, TCondensedJsonPrintPolicy<TCHAR>>> Writer = TJsonWriterFactory<TCHAR, TCondensedJsonPrintPolicy<TCHAR>>::Create(&Json);
+
+	Writer->WriteObjectStart();
+	Writer->WriteValue(TEXT("displayTimeUnit"), TEXT("ms"));
+	Writer->WriteArrayStart(TEXT("traceEvents"));
+
+	// Name the threads, the viewer otherwise only shows their ids.
+	TSet<uint32> ThreadIds;
+	for (const PakTraceRecorder::FEvent& Event : Events)
+	{
+		ThreadIds.Add(Event.ThreadId);
+	}
+
+	for (uint32 ThreadId : ThreadIds)
+	{
+		const FString ThreadName = FThreadManager::GetThreadName(ThreadId);
+
+		Writer->WriteObjectStart();
+		Writer->WriteValue(TEXT("name"), TEXT("thread_name"));
+		Writer->WriteValue(TEXT("ph"), TEXT("M"));
+		Writer->WriteValue(TEXT("pid"), 1);
+		Writer->WriteValue(TEXT("tid"), static_cast<int64>(ThreadId));
+		Writer->WriteObjectStart(TEXT("args"));
+		Writer->WriteValue(TEXT("name"), ThreadName.IsEmpty() ? FString::Printf(TEXT("Thread %u"), ThreadId) : ThreadName);
+		Writer->WriteObjectEnd();
+		Writer->WriteObjectEnd();
+	}
+
+	for (const PakTraceRecorder::FEvent& Event : Events)
+	{
+		Writer->WriteObjectStart();
+		Writer->WriteValue(TEXT("name"), Event.Name);
+		Writer->WriteValue(TEXT("cat"), Event.Category);
+		Writer->WriteValue(TEXT("pid"), 1);
+		Writer->WriteValue(TEXT("tid"), static_cast<int64>(Event.ThreadId));
+
+		// Microseconds since the recording started.
+		Writer->WriteValue(TEXT("ts"), (Event.StartSeconds - StartTime) * 1000000.0);
+
+		if (Event.DurationSeconds >= 0.0)
+		{
+			Writer->WriteValue(TEXT("ph"), TEXT("X"));
+			Writer->WriteValue(TEXT("dur"), Event.DurationSeconds * 1000000.0);
+		}
+		else
+		{
+			Writer->WriteValue(TEXT("ph"), TEXT("i"));
+			Writer->WriteValue(TEXT("s"), TEXT("t"));
+		}
+
+		if (Event.Bytes >= 0 || !Event.Detail.IsEmpty())
+		{
+			Writer->WriteObjectStart(TEXT("args"));
+
+			if (Event.Bytes >= 0)
+			{
+				Writer->WriteValue(TEXT("bytes"), Event.Bytes);
+			}
+
+			if (!Event.Detail.IsEmpty())
+			{
+				Writer->WriteValue(TEXT("detail"), Event.Detail);
+			}
+
+			Writer->WriteObjectEnd();
+		}
+
+		Writer->WriteObjectEnd();
+	}
+
+	Writer->WriteArrayEnd();
+
+	if (NumDropped > 0)
+	{
+		Writer->WriteObjectStart(TEXT("metadata"));
+		Writer->WriteValue(TEXT("droppedEvents"), NumDropped);
+		Writer->WriteObjectEnd();
+	}
+
+	Writer->WriteObjectEnd();
+	Writer->Close();
+
+	if (!FFileHelper::SaveStringToFile(Json, *Filename, FFileHelper::EEncodingOptions::ForceUTF8WithoutBOM))
+	{
+		PAKLOADER_LOG(LL_ERROR, TEXT("Unable to write pak trace to %s"), *Filename);
+		return false;
+	}
+
+	PAKLOADER_LOG(LL_LOG, TEXT("Wrote %d pak trace events to %s"), Events.Num(), *Filename);
+	return true;
+}
@@ -12,17 +12,46 @@ enum ELogHelperLogLevel
 	LL_ERROR
 };
 
+/*
+	Logs to the console and, once enabled, to a file.
+	Messages are queued in a ring buffer and written in batches by a background thread, logging never waits for the disk.
+	The file is rotated once it exceeds the maximum size. Use PAKLOADER_LOG to skip formatting when the level is disabled.
+*/
 class PAKLOADER_API FLogHelper
 {
 public:
 	static void Log(ELogHelperLogLevel Level, const TCHAR *LogText);
 	static void Log(ELogHelperLogLevel Level, const FString &LogText);
 
+	/* Returns true if messages of Level are logged. Cheap enough to call before formatting a message. */
+	static bool IsEnabled(ELogHelperLogLevel Level) { return bEnableLogging && Level >= MinLevel; }
+
+	/* Writes all queued messages to the file and waits until they are written. */
 	static void Flush();
 
 	static void EnableLogging(bool bEnable);
 	static void SetLogPath(const FString &InLogPath);
 
+	/* Messages below Level are dropped before they are formatted. */
+	static void SetMinLevel(ELogHelperLogLevel Level);
+
+	/* The log file is renamed to <name>.1.<ext> once it grows past MaxBytes, older files move up to MaxBackups. */
+	static void SetRotation(int64 MaxBytes, int32 MaxBackups);
+
+	/* Writes the remaining messages and stops the writer thread for good, later messages only reach the engine log. Called on module shutdown. */
+	static void Shutdown();
+
 	static FString LogPath;
 	static bool bEnableLogging;
+	static ELogHelperLogLevel MinLevel;
 };
+
+/* Logs a formatted message, the arguments are only formatted if the level is enabled. */
+#define PAKLOADER_LOG(Level, Format, ...) \
+	do \
+	{ \
+		if (FLogHelper::IsEnabled(Level)) \
+		{ \
+			FLogHelper::Log(Level, FString::Printf(Format, ##__VA_ARGS__)); \
+		} \
+	} while (0)
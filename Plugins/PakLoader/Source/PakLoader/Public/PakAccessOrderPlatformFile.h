@@ -0,0 +1,105 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PakPlatformFileLayer.h"
+#include "Misc/ScopeRWLock.h"
+#include <atomic>
+
+/*
+	Blocks of one pak in the order they were first read. Shared between the layer, the read handles and the prefetch.
+*/
+class PAKLOADER_API FPakAccessOrder : public TSharedFromThis<FPakAccessOrder, ESPMode::ThreadSafe>
+{
+public:
+	static constexpr int64 BlockSize = 64 * 1024;
+
+	explicit FPakAccessOrder(const FString& InPakFilename) : PakFilename(InPakFilename) {}
+
+	/* Records the blocks of a read that were not read before. */
+	void Record(int64 Offset, int64 Size);
+
+	/* Blocks read since the pak was registered, followed by the blocks of earlier sessions that weren't read yet. */
+	TArray<int32> GetMergedOrder(int32 MaxBlocks) const;
+
+	int32 GetNumRecordedBlocks() const;
+
+	const FString PakFilename;
+
+	// Set once the pak is mounted, the order is saved per content root.
+	FString RootPath;
+
+	// Order saved by earlier sessions.
+	TArray<int32> PreviousOrder;
+
+	std::atomic<bool> bCancelPrefetch{false};
+
+private:
+	TArray<int32> Order;
+	TSet<int32> Seen;
+	mutable FCriticalSection Lock;
+};
+
+/*
+	Platform file layer that records which blocks of registered paks are read, in the order they are first read.
+	The order is saved per content root (Saved/PakLoader/AccessOrder) when the pak is unmounted or the process exits.
+	The next time a pak with that root is mounted, the recorded blocks are read on a background thread in the same
+	order, so the loads that follow find them in the page cache instead of waiting for the disk.
+	Orders of paks that changed in size or time stamp are discarded. Paks without content root are not recorded.
+*/
+class PAKLOADER_API FPakAccessOrderPlatformFile : public FPakPlatformFileLayer
+{
+public:
+	static const TCHAR* GetTypeName() { return TEXT("PakAccessOrderFile"); }
+
+	FPakAccessOrderPlatformFile();
+	virtual ~FPakAccessOrderPlatformFile();
+
+	/* Starts recording the reads of a pak, call before it is mounted to see the reads of the mount. */
+	void RegisterFile(const FString& PakFilename);
+
+	/*
+		Sets the content root of a registered pak once it is known and loads the order of earlier sessions.
+		bPrefetch reads the recorded blocks on a background thread.
+	*/
+	void SetContentRoot(const FString& PakFilename, const FString& RootPath, bool bPrefetch);
+
+	/* Stops recording and the prefetch of a pak. bSave saves the order for its content root. */
+	void UnregisterFile(const FString& PakFilename, bool bSave = true);
+
+	/* Saves the orders of all registered paks. */
+	void SaveAll();
+
+	/* Upper bound of the data prefetched per pak. */
+	void SetMaxPrefetchBytes(int64 Bytes) { MaxPrefetchBytes = FMath::Max<int64>(Bytes, 0); }
+	int64 GetMaxPrefetchBytes() const { return MaxPrefetchBytes; }
+
+	/* File the order of a content root is saved to. */
+	static FString GetOrderFilename(const FString& RootPath);
+
+	// IPlatformFile interface
+	virtual const TCHAR* GetName() const override { return GetTypeName(); }
+	virtual IFileHandle* OpenRead(const TCHAR* Filename, bool bAllowWrite = false) override;
+	virtual IAsyncReadFileHandle* OpenAsyncRead(const TCHAR* Filename) override;
+
+private:
+	TSharedPtr<FPakAccessOrder, ESPMode::ThreadSafe> FindFile(const TCHAR* Filename) const;
+
+	bool LoadOrder(FPakAccessOrder& AccessOrder);
+	bool SaveOrder(const FPakAccessOrder& AccessOrder);
+
+	void StartPrefetch(const TSharedRef<FPakAccessOrder, ESPMode::ThreadSafe>& AccessOrder);
+
+	static FString GetKey(const TCHAR* Filename);
+
+	TMap<FString, TSharedRef<FPakAccessOrder, ESPMode::ThreadSafe>> Files;
+	mutable FRWLock FilesLock;
+
+	// Lets the common case of no registered pak skip the lock and the path normalization.
+	std::atomic<int32> NumFiles{0};
+
+	int64 MaxPrefetchBytes = 256 * 1024 * 1024;
+
+	FDelegateHandle PreExitHandle;
+};
@@ -0,0 +1,66 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PakAssetRegistryOptions.generated.h"
+
+/* Reduces what is kept of the AssetRegistry.bin of each pak, see FPakLoader::SetAssetRegistryLoadOptions. */
+USTRUCT(BlueprintType)
+struct PAKLOADER_API FPakAssetRegistryLoadOptions
+{
+	GENERATED_BODY()
+
+	// Keep only packages below these paths, e.g. /MyDLC/Maps. Empty keeps all packages.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "PakLoader|AssetRegistry")
+	TArray<FString> PackagePaths;
+
+	// Keep only packages with an asset of these classes, e.g. World or /Script/Engine.StaticMesh. Empty keeps all classes.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "PakLoader|AssetRegistry")
+	TArray<FString> ClassNames;
+
+	// Keep only these tags of each asset. Takes precedence over StripTags.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "PakLoader|AssetRegistry")
+	TArray<FName> KeepTags;
+
+	// Remove these tags from each asset.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "PakLoader|AssetRegistry")
+	TArray<FName> StripTags;
+
+	// Drop the dependency graph, queries like GetDependencies return nothing for pak content afterwards.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "PakLoader|AssetRegistry")
+	bool bStripDependencies = false;
+
+	// Drop per package data like hashes and versions, which is only needed by the editor and cooker.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "PakLoader|AssetRegistry")
+	bool bStripPackageData = false;
+
+	bool IsFiltering() const
+	{
+		return PackagePaths.Num() > 0 || ClassNames.Num() > 0 || KeepTags.Num() > 0 || StripTags.Num() > 0 || bStripDependencies || bStripPackageData;
+	}
+};
+
+/* Totals of all asset registries loaded since the last reset. */
+USTRUCT(BlueprintType)
+struct PAKLOADER_API FPakAssetRegistryLoadReport
+{
+	GENERATED_BODY()
+
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader|AssetRegistry")
+	int32 NumRegistries = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader|AssetRegistry")
+	int32 NumAssetsKept = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader|AssetRegistry")
+	int32 NumAssetsRemoved = 0;
+
+	// Memory of the registry states as loaded from the paks.
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader|AssetRegistry")
+	int64 BytesBeforeFiltering = 0;
+
+	// Memory of the registry states after filtering, before they were appended.
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader|AssetRegistry")
+	int64 BytesAfterFiltering = 0;
+};
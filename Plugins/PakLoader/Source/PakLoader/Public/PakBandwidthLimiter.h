@@ -0,0 +1,62 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include <atomic>
+
+/*
+	Token bucket shared by all downloads to cap the total receive rate.
+	Nothing waits for the limit on the HTTP thread, that would stall every request of the HTTP module. Under a limit
+	downloads fetch ranges of GetRequestSize() bytes instead and start each one once the bucket allows it. Starts that
+	don't fit are deferred and run from Tick(), which the UPakDownloadManager calls every frame.
+*/
+class PAKLOADER_API FPakBandwidthLimiter
+{
+public:
+	/* Bytes per second for all downloads together, 0 disables the limit and runs all deferred starts. */
+	void SetLimit(int64 InBytesPerSecond);
+	int64 GetLimit() const { return BytesPerSecond.load(); }
+
+	/* Size of the ranges requested under the limit, a fraction of a second of the rate. 0 without limit. */
+	int64 GetRequestSize() const;
+
+	/* Takes Bytes out of the bucket if it isn't in debt. Always succeeds without limit. Can be called from any thread. */
+	bool TryReserve(int64 Bytes);
+
+	/* Takes Bytes out of the bucket without checking, for requests that must not be held back. */
+	void Consume(int64 Bytes);
+
+	/*
+		Calls Start once Bytes can be reserved, right away if that is possible now and no other start is waiting.
+		Deferred starts run on the game thread in the order they were deferred. Owner identifies them for CancelDeferredStarts().
+	*/
+	void StartWhenAvailable(const void* Owner, int64 Bytes, TFunction<void()>&& Start);
+
+	/* Defers Start without trying to reserve the bytes first. Can be called from any thread. */
+	void Defer(const void* Owner, int64 Bytes, TFunction<void()>&& Start);
+
+	/* Drops the deferred starts of Owner, e.g. when its download is cancelled. */
+	void CancelDeferredStarts(const void* Owner);
+
+	/* Runs the deferred starts the limit allows by now. */
+	void Tick();
+
+private:
+	struct FDeferredStart
+	{
+		const void* Owner = nullptr;
+		int64 Bytes = 0;
+		TFunction<void()> Start;
+	};
+
+	bool TryReserve_Locked(int64 Bytes);
+
+	std::atomic<int64> BytesPerSecond{0};
+
+	FCriticalSection Lock;
+	double Tokens = 0.0;
+	double LastRefillTime = 0.0;
+
+	TArray<FDeferredStart> DeferredStarts;
+};
@@ -0,0 +1,59 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Misc/SecureHash.h"
+
+/*
+	Result of comparing a local file against a block manifest.
+	LocalOffsets holds for every block of the new file where the same bytes are found in the local file,
+	INDEX_NONE for blocks that have to be downloaded.
+*/
+struct PAKLOADER_API FPakDeltaPlan
+{
+	TArray<int64> LocalOffsets;
+
+	int64 ReusedBytes = 0;
+	int64 MissingBytes = 0;
+};
+
+/*
+	Block hash manifest of a file, published next to a pak (MyDLC.pak.blockmap) for delta updates.
+	Every block has a rolling checksum to find it at any offset of an older file (rsync/zsync style)
+	and a SHA1 to confirm the match.
+*/
+class PAKLOADER_API FPakBlockManifest
+{
+public:
+	static constexpr int32 DefaultBlockSize = 64 * 1024;
+
+	struct FBlock
+	{
+		uint32 WeakHash = 0;
+		FSHAHash StrongHash;
+	};
+
+	int32 BlockSize = DefaultBlockSize;
+	int64 FileSize = 0;
+	FSHAHash FileHash;
+	TArray<FBlock> Blocks;
+
+	/* Hashes Filename block by block. */
+	static bool Generate(const FString& Filename, int32 InBlockSize, FPakBlockManifest& OutManifest);
+
+	bool SaveToFile(const FString& Filename) const;
+	bool LoadFromMemory(const TArray<uint8>& Data);
+
+	/* Size of a block, the last block may be shorter. */
+	int64 GetBlockLength(int32 BlockIndex) const;
+
+	/* Finds the blocks of this manifest in LocalFilename. Reads the local file once. */
+	bool ComputeDeltaPlan(const FString& LocalFilename, FPakDeltaPlan& OutPlan) const;
+
+	/* Adler-32 like checksum that can be rolled over a buffer one byte at a time. */
+	static uint32 ComputeWeakHash(const uint8* Data, int64 Length);
+
+private:
+	void Serialize(FArchive& Ar);
+};
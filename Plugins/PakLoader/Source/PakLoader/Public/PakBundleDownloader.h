@@ -0,0 +1,93 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PakDownloadTask.h"
+#include "Interfaces/IHttpRequest.h"
+#include "Interfaces/IHttpResponse.h"
+#include "Runtime/Launch/Resources/Version.h"
+#include "PakBundleDownloader.generated.h"
+
+class FPakBundleExtractor;
+
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FDownloadPakBundleDelegate, int32, HttpResponseCode, const TArray<FString>&, Files);
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FDownloadPakBundleProgressDelegate, int64, BytesReceived, int64, TotalBytes);
+
+UCLASS()
+class PAKLOADER_API UAsyncPakBundleDownloader : public UPakDownloadTask
+{
+	GENERATED_UCLASS_BODY()
+
+public:
+	/*
+		Downloads a tar archive of many files, e.g. small paks with their .utoc, .ucas and .sig files, with one request.
+		Members are extracted to Directory while the archive is received, the archive itself is never stored.
+		The download is queued in the UPakDownloadManager like the downloads of single paks.
+		Directory: Directory the members are extracted to, subdirectories of the archive are kept.
+		bMountPaks: Mounts every extracted .pak with MountPakFileEasy once the archive is complete.
+		Priority: Queued downloads with a higher priority start first.
+		Files: Full paths of the extracted members. On failure the members that were completed before.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "PakLoader|Download", meta = (BlueprintInternalUseOnly = "true"))
+	static UAsyncPakBundleDownloader *DownloadPakBundle(const FString &URL, const FString &Directory, bool bMountPaks = false, int32 Priority = 0);
+
+	UPROPERTY(BlueprintAssignable)
+	FDownloadPakBundleDelegate OnSuccess;
+
+	UPROPERTY(BlueprintAssignable)
+	FDownloadPakBundleDelegate OnFail;
+
+	UPROPERTY(BlueprintAssignable)
+	FDownloadPakBundleProgressDelegate OnProgress;
+
+	/* Cancels the download. OnFail is called, completed members are kept. */
+	virtual void Cancel() override;
+
+	virtual int64 GetBytesReceived() const override { return BytesReceived; }
+	virtual int64 GetTotalBytes() const override { return TotalBytes; }
+
+	virtual int32 GetPriority() const override { return DownloadPriority; }
+	virtual void SetPriority(int32 InPriority) override { DownloadPriority = InPriority; }
+
+protected:
+	virtual void StartDownload() override;
+
+private:
+
+	/* Sends the next request once the bandwidth limit allows it, right away without limit. */
+	void QueueRequest();
+	void SendRequest();
+
+	/* Waits for the extractor on a worker thread, then calls CompleteDownload on the game thread. */
+	void FinishDownload(const FString& URL, int32 HttpResponseCode, bool bResponseOk);
+
+	/* Mounts the extracted paks and reports the result. */
+	void CompleteDownload(const FString& URL, int32 HttpResponseCode, bool bExtracted);
+
+	void HandleDownloadComplete(FHttpRequestPtr HttpRequest, FHttpResponsePtr HttpResponse, bool bSucceeded);
+#if ENGINE_MINOR_VERSION >= 4 && ENGINE_MAJOR_VERSION == 5
+	void HandleDownloadProgress(FHttpRequestPtr InRequest, uint64 BytesSent, uint64 InBytesReceived);
+#else
+	void HandleDownloadProgress(FHttpRequestPtr InRequest, int32 BytesSent, int32 InBytesReceived);
+#endif
+
+	FHttpRequestPtr HttpRequest;
+	TSharedPtr<FPakBundleExtractor, ESPMode::ThreadSafe> Extractor;
+
+	FString DownloadURL;
+	FString ExtractDirectory;
+	int32 DownloadPriority = 0;
+	bool bFinished = false;
+
+	int64 BytesReceived = 0;
+	int64 TotalBytes = 0;
+
+	// Under a bandwidth limit the archive is fetched in ranges of RequestSize, ArchiveOffset is where the next one starts.
+	int64 RequestSize = 0;
+	int64 ArchiveOffset = 0;
+	FString RangeValidator;
+	bool bWaitingForBandwidth = false;
+
+	bool bMountPaks = false;
+};
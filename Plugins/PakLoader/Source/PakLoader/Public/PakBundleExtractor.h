@@ -0,0 +1,104 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Serialization/Archive.h"
+#include "Async/Future.h"
+
+class FPakDownloadFileWriter;
+class FPakDownloadStream;
+
+/*
+	Extracts a tar archive (ustar, GNU long names, pax paths) while it is received, without buffering the archive.
+	Set as response body stream of a request, Serialize is called from the HTTP thread. Every member is handed to a
+	FPakDownloadFileWriter, which writes it to Directory/Name + ".part" on its own thread. Once complete it is flushed
+	and renamed on a worker thread, so a member is either missing or complete and the HTTP thread never waits for the disk.
+	Members with absolute paths or ".." are rejected, links and devices are skipped.
+*/
+class PAKLOADER_API FPakBundleExtractor : public FArchive
+{
+public:
+	explicit FPakBundleExtractor(const FString& InDirectory);
+	virtual ~FPakBundleExtractor();
+
+	FPakBundleExtractor(const FPakBundleExtractor&) = delete;
+	FPakBundleExtractor& operator=(const FPakBundleExtractor&) = delete;
+
+	/*
+		Called once on the receiving thread before the first byte of the next response is parsed, returning false rejects the body.
+		An archive fetched in ranges sets a new check for every request.
+	*/
+	void SetResponseCheck(TFunction<bool()>&& InResponseCheck) { ResponseCheck = MoveTemp(InResponseCheck); bResponseChecked = false; }
+
+	/*
+		Returns true if the archive ended properly and all members were written. Call once the response is complete.
+		Waits for the members that are still written, don't call it on the HTTP thread.
+	*/
+	bool Finish();
+
+	/* Deletes the member that was being written. Members that were completed are kept. */
+	void Abort();
+
+	/* Full paths of the completed members. */
+	TArray<FString> GetExtractedFiles() const;
+
+	// FArchive interface
+	virtual void Serialize(void* Data, int64 Num) override;
+	virtual FString GetArchiveName() const override { return TEXT("PakBundleExtractor"); }
+
+private:
+	static constexpr int64 RecordSize = 512;
+
+	enum class EMemberType : uint8
+	{
+		File,
+		LongName,
+		PaxHeader,
+		Skip
+	};
+
+	bool ParseHeader();
+	bool BeginMember(const FString& Name);
+	bool WriteContent(const uint8* Data, int64 Size);
+	bool EndMember();
+
+	/* Returns the path a member is extracted to, empty if the name would leave Directory. */
+	FString GetMemberFilename(const FString& Name) const;
+
+	static int64 ParseOctal(const uint8* Field, int32 Length);
+	static FString ParseString(const uint8* Field, int32 Length);
+	static FString ParsePaxPath(const TArray<uint8>& Records);
+
+	void Fail(const FString& Reason);
+
+	FString Directory;
+
+	TFunction<bool()> ResponseCheck;
+	bool bResponseChecked = false;
+
+	uint8 Header[RecordSize];
+	int64 HeaderBytes = 0;
+	int32 ZeroRecords = 0;
+	bool bEnded = false;
+
+	// Member whose content is received, bInMember is false while a header is expected.
+	bool bInMember = false;
+	EMemberType MemberType = EMemberType::Skip;
+	int64 MemberRemaining = 0;
+	int64 PaddingRemaining = 0;
+
+	// Name for the next member from a GNU long name or pax header.
+	FString PendingName;
+	TArray<uint8> MetadataBuffer;
+
+	FString MemberFilename;
+	TSharedPtr<FPakDownloadFileWriter, ESPMode::ThreadSafe> MemberWriter;
+	TSharedPtr<FPakDownloadStream, ESPMode::ThreadSafe> MemberStream;
+
+	// Completed members that are flushed and renamed on worker threads.
+	TArray<TFuture<bool>> PendingMembers;
+
+	TArray<FString> ExtractedFiles;
+	mutable FCriticalSection ExtractedFilesLock;
+};
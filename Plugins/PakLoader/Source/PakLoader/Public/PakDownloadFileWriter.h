@@ -0,0 +1,220 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Serialization/Archive.h"
+#include "HAL/Runnable.h"
+#include "HAL/ThreadSafeBool.h"
+#include "Containers/Queue.h"
+#include "Misc/SecureHash.h"
+#include <atomic>
+
+class IFileHandle;
+class FRunnableThread;
+class FEvent;
+class FPakDownloadStream;
+
+/*
+	Writes downloads to disk with bounded memory.
+	Streams created with CreateStream() copy incoming bytes into blocks from a fixed-size pool, a background
+	thread writes the blocks to a temporary file next to the target at their offsets. Several streams can fill
+	different ranges of the same file. Commit() renames the temporary file onto the target so a half written
+	file is never visible under the target name. Streams fed by the HTTP thread never wait for the disk, that would
+	stall all requests: while the pool is exhausted they allocate extra blocks, which are freed once written. At most
+	as many extra blocks as the pool holds exist at a time, so memory stays below twice the buffer size. A stream that
+	would need more fails with SetError, its request is cancelled and the download resumes behind GetWrittenEnd().
+*/
+class PAKLOADER_API FPakDownloadFileWriter : public FRunnable, public TSharedFromThis<FPakDownloadFileWriter, ESPMode::ThreadSafe>
+{
+public:
+	static constexpr int64 DefaultBufferSize = 4 * 1024 * 1024;
+	static constexpr int64 BlockSize = 256 * 1024;
+
+	// Bytes at the end of the file kept in memory, enough for the footer of a pak.
+	static constexpr int64 TailSize = 4096;
+
+	/* bWriteInPlace writes to the target directly, e.g. when the file is read while it is downloading. */
+	FPakDownloadFileWriter(const FString& InTargetFilename, int64 InBufferSize = DefaultBufferSize, bool bWriteInPlace = false);
+	virtual ~FPakDownloadFileWriter();
+
+	FPakDownloadFileWriter(const FPakDownloadFileWriter&) = delete;
+	FPakDownloadFileWriter& operator=(const FPakDownloadFileWriter&) = delete;
+
+	/*
+		Starts the background writer thread. The temporary file is opened by the writer thread.
+		bKeepExistingContent keeps an existing temporary file, e.g. to append to a partial download.
+		ExistingContentSize is the number of valid bytes in it if the file is larger, e.g. because it was preallocated.
+	*/
+	bool Start(bool bKeepExistingContent, int64 ExistingContentSize = INDEX_NONE);
+
+	/* Called on the writer thread after a range was written to the file. Set before Start(). */
+	void SetBlockWrittenCallback(TFunction<void(int64 Offset, int64 Size)>&& InCallback) { BlockWrittenCallback = MoveTemp(InCallback); }
+
+	/*
+		Creates a stream that writes the bytes it receives to the file starting at Offset.
+		bWaitForBlocks makes the stream wait while all blocks are in use, for streams fed by worker threads, e.g. from local files.
+	*/
+	TSharedRef<FPakDownloadStream, ESPMode::ThreadSafe> CreateStream(int64 Offset = 0, bool bWaitForBlocks = false);
+
+	/*
+		Sets the size of the file before segments are written at their offsets, or reserves the space of a download early.
+		The disk blocks are allocated where the platform supports it, so the file doesn't end up sparse and fragmented.
+	*/
+	void Preallocate(int64 FileSize);
+
+	/*
+		Waits until all submitted blocks are written and closes the file. Returns false if any write failed.
+		FinalSize truncates the file, e.g. when a restarted download is shorter than the partial file it replaced.
+	*/
+	bool Finish(int64 FinalSize = INDEX_NONE);
+
+	/* Moves the temporary file onto the target filename. Call after Finish() returned true. */
+	bool Commit();
+
+	/* Stops the writer thread. The temporary file is deleted unless bKeepPartialFile is set. */
+	void Abort(bool bKeepPartialFile = false);
+
+	/*
+		SHA1 of the file, computed while the blocks were written. Valid after Finish() if the file was written front to back,
+		returns false for files written out of order, e.g. by segmented downloads.
+	*/
+	bool GetContentHash(FSHAHash& OutHash) const;
+
+	/* Last bytes of the file, valid after Finish() under the same conditions as GetContentHash(). */
+	bool GetTail(TArray<uint8>& OutTail) const;
+
+	/* Number of bytes that reached the file in this session. */
+	int64 GetBytesWritten() const { return BytesWritten.load(); }
+
+	/* File offset behind the last block that reached the file, INDEX_NONE before the first one. A file written front to back is complete up to it. */
+	int64 GetWrittenEnd() const { return WrittenEnd.load(); }
+
+	bool HasFailed() const { return bWriteFailed || bStopRequested; }
+
+	const FString& GetTargetFilename() const { return TargetFilename; }
+	const FString& GetTempFilename() const { return TempFilename; }
+
+	// FRunnable interface
+	virtual uint32 Run() override;
+	virtual void Stop() override;
+
+private:
+	friend class FPakDownloadStream;
+
+	struct FBlock
+	{
+		TArray<uint8> Data;
+		int64 Offset = 0;
+		int64 Size = 0;
+
+		// Blocks without data resize the file to Offset.
+		bool bSetFileSize = false;
+
+		// Allocated beyond the pool, freed once written.
+		bool bPooled = true;
+	};
+
+	/*
+		Takes a block from the pool. If all blocks are in use bWait waits for one, otherwise an extra block is allocated.
+		Returns nullptr once the writer stopped, or if the extra blocks are used up as well.
+	*/
+	FBlock* AcquireBlock(bool bWait);
+	void SubmitBlock(FBlock* Block);
+	void ReleaseBlock(FBlock* Block);
+
+	void StopThread();
+	bool OpenFile();
+	bool WriteBlock(const FBlock& Block);
+	bool SetFileSize(int64 Size);
+
+	/* Feeds written bytes to the hash and the tail buffer. Only bytes that continue the file front to back count. */
+	void UpdateContentHash(const uint8* Data, int64 Offset, int64 Size);
+
+	/* Hashes the content kept from an earlier session. */
+	bool HashExistingContent(int64 Size);
+
+	FString TargetFilename;
+	FString TempFilename;
+
+	bool bKeepExistingContent = false;
+
+	TFunction<void(int64, int64)> BlockWrittenCallback;
+	int64 ExistingContentSize = INDEX_NONE;
+
+	TArray<TUniquePtr<FBlock>> Blocks;
+	TArray<FBlock*> FreeBlocks;
+	FCriticalSection FreeBlocksLock;
+
+	// Data blocks allocated beyond the pool that are not written yet, limited to the size of the pool.
+	std::atomic<int32> NumExtraBlocks{0};
+	int32 MaxExtraBlocks = 0;
+
+	TQueue<FBlock*, EQueueMode::Mpsc> PendingBlocks;
+
+	FEvent* BlockSubmittedEvent = nullptr;
+	FEvent* BlockFreedEvent = nullptr;
+	FRunnableThread* Thread = nullptr;
+	IFileHandle* FileHandle = nullptr;
+	int64 FilePosition = 0;
+
+	FThreadSafeBool bFinishRequested = false;
+	FThreadSafeBool bStopRequested = false;
+	FThreadSafeBool bWriteFailed = false;
+
+	std::atomic<int64> BytesWritten{0};
+	std::atomic<int64> WrittenEnd{INDEX_NONE};
+
+	// Owned by the writer thread until Finish() returns.
+	FSHA1 ContentSha;
+	int64 HashedBytes = 0;
+	bool bHashContiguous = true;
+	TArray<uint8> Tail;
+
+	bool bContentHashValid = false;
+	FSHAHash ContentHash;
+};
+
+/*
+	Archive that receives one contiguous HTTP response body and hands it to a FPakDownloadFileWriter.
+	Set as response body stream of a request, Serialize is called from the HTTP thread.
+*/
+class PAKLOADER_API FPakDownloadStream : public FArchive
+{
+public:
+	FPakDownloadStream(const TSharedRef<FPakDownloadFileWriter, ESPMode::ThreadSafe>& InWriter, int64 InOffset, bool bInWaitForBlocks = false);
+	virtual ~FPakDownloadStream();
+
+	/*
+		Sets a callback that decides at which file offset the received bytes start. It is called once on the
+		receiving thread before the first byte is buffered. INDEX_NONE rejects the body.
+	*/
+	void SetStartOffsetResolver(TFunction<int64()>&& InResolver) { StartOffsetResolver = MoveTemp(InResolver); }
+
+	/* Submits the partially filled block. Call once the response is complete. */
+	void Close();
+
+	/* File offset of the first byte of this stream, INDEX_NONE if the body was rejected. */
+	int64 GetStartOffset() const { return StartOffset; }
+
+	/* Number of body bytes received by this stream. */
+	int64 GetBytesReceived() const { return BytesReceived; }
+
+	/* File offset behind the last byte of this stream. */
+	int64 GetEndOffset() const { return StartOffset + BytesReceived; }
+
+	// FArchive interface
+	virtual void Serialize(void* Data, int64 Num) override;
+	virtual FString GetArchiveName() const override;
+
+private:
+	TSharedRef<FPakDownloadFileWriter, ESPMode::ThreadSafe> Writer;
+	TFunction<int64()> StartOffsetResolver;
+	bool bWaitForBlocks = false;
+
+	FPakDownloadFileWriter::FBlock* CurrentBlock = nullptr;
+
+	int64 StartOffset = 0;
+	bool bStartOffsetResolved = false;
+	int64 BytesReceived = 0;
+};
@@ -0,0 +1,132 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/EngineSubsystem.h"
+#include "Containers/Ticker.h"
+#include "Runtime/Launch/Resources/Version.h"
+#include "PakDownloadManager.generated.h"
+
+class UPakDownloadTask;
+class FPakBandwidthLimiter;
+
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FPakDownloadManagerOnDownloadFinished, UPakDownloadTask*, Download, bool, bSuccess);
+
+USTRUCT(BlueprintType)
+struct PAKLOADER_API FPakDownloadManagerProgress
+{
+	GENERATED_BODY()
+
+	// Bytes received by running downloads.
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader|Download")
+	int64 BytesReceived = 0;
+
+	// Total size of running downloads, as far as known from their headers.
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader|Download")
+	int64 TotalBytes = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader|Download")
+	int32 NumQueued = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader|Download")
+	int32 NumActive = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader|Download")
+	int32 NumSucceeded = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader|Download")
+	int32 NumFailed = 0;
+};
+
+/**
+ * Schedules all pak and bundle downloads. DownloadPak and DownloadPakBundle queue their download here, at most MaxConcurrentDownloads run at once.
+ * Queued downloads start in order of their priority, downloads with the same priority in order of their request.
+ */
+UCLASS()
+class PAKLOADER_API UPakDownloadManager : public UEngineSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+
+	/* Returns the manager or nullptr if the engine is not initialized yet. */
+	static UPakDownloadManager* Get();
+
+	/* Maximum number of downloads running at the same time. Queued downloads start when a slot becomes free. */
+	UFUNCTION(BlueprintCallable, Category = "PakLoader|Download")
+	void SetMaxConcurrentDownloads(int32 InMaxConcurrentDownloads);
+
+	UFUNCTION(BlueprintPure, Category = "PakLoader|Download")
+	int32 GetMaxConcurrentDownloads() const { return MaxConcurrentDownloads; }
+
+	/*
+		Caps the receive rate of all downloads together. Downloads then fetch their files in small ranges, each one starts
+		once the limit allows it. Servers that ignore range requests send the whole file at full speed.
+
+		@BytesPerSecond: 0 removes the limit.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "PakLoader|Download")
+	void SetBandwidthLimit(int64 BytesPerSecond);
+
+	UFUNCTION(BlueprintPure, Category = "PakLoader|Download")
+	int64 GetBandwidthLimit() const;
+
+	/* Changes the priority of a download. Only affects downloads that are still queued. Higher values start first. */
+	UFUNCTION(BlueprintCallable, Category = "PakLoader|Download")
+	void SetDownloadPriority(UPakDownloadTask* Download, int32 Priority);
+
+	/* Cancels a queued or running download. Its OnFail is called. */
+	UFUNCTION(BlueprintCallable, Category = "PakLoader|Download")
+	void CancelDownload(UPakDownloadTask* Download);
+
+	/* Cancels all queued and running downloads. */
+	UFUNCTION(BlueprintCallable, Category = "PakLoader|Download")
+	void CancelAllDownloads();
+
+	/* Returns the combined progress of all downloads. */
+	UFUNCTION(BlueprintPure, Category = "PakLoader|Download")
+	FPakDownloadManagerProgress GetAggregateProgress() const;
+
+	UPROPERTY(BlueprintAssignable)
+	FPakDownloadManagerOnDownloadFinished OnDownloadFinished;
+
+	/* Queues a download and starts it once a slot is free. */
+	void QueueDownload(UPakDownloadTask* Download);
+
+	/* Called by downloads when they succeeded, failed or were cancelled. */
+	void NotifyDownloadFinished(UPakDownloadTask* Download, bool bSuccess);
+
+	const TSharedPtr<FPakBandwidthLimiter, ESPMode::ThreadSafe>& GetBandwidthLimiter() const { return BandwidthLimiter; }
+
+private:
+	void SortQueue();
+	void StartQueuedDownloads();
+
+	/* Starts the requests the bandwidth limit held back. */
+	bool TickBandwidthLimiter(float DeltaTime);
+
+	UPROPERTY()
+	TArray<UPakDownloadTask*> QueuedDownloads;
+
+	UPROPERTY()
+	TArray<UPakDownloadTask*> ActiveDownloads;
+
+	int32 MaxConcurrentDownloads = 4;
+
+	// Keeps the request order for downloads with equal priority.
+	int64 NextQueueSequence = 0;
+
+	int32 NumSucceeded = 0;
+	int32 NumFailed = 0;
+
+	TSharedPtr<FPakBandwidthLimiter, ESPMode::ThreadSafe> BandwidthLimiter;
+
+#if ENGINE_MAJOR_VERSION == 5
+	FTSTicker::FDelegateHandle TickerHandle;
+#else
+	FDelegateHandle TickerHandle;
+#endif
+};
@@ -0,0 +1,44 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PakDownloadState.generated.h"
+
+/*
+	Sidecar state stored next to a download.
+	Next to a partial download (SavePath + ".part.json") it holds what is needed to continue with a range request,
+	next to a completed download (SavePath + ".meta") what is needed to revalidate the file with a conditional request.
+*/
+USTRUCT()
+struct PAKLOADER_API FPakDownloadResumeState
+{
+	GENERATED_BODY()
+
+	// URL the partial file was downloaded from.
+	UPROPERTY()
+	FString URL;
+
+	// Validators of the response the partial file belongs to. Used as If-Range value.
+	UPROPERTY()
+	FString ETag;
+
+	UPROPERTY()
+	FString LastModified;
+
+	// Size of the complete file, 0 if unknown.
+	UPROPERTY()
+	int64 TotalSize = 0;
+
+	// Bytes at the start of the partial file that were received, -1 if the whole file was. A preallocated file is larger.
+	UPROPERTY()
+	int64 CommittedBytes = -1;
+
+	bool HasValidator() const { return !ETag.IsEmpty() || !LastModified.IsEmpty(); }
+
+	/* Strong ETags are preferred over the modification date as range validator. */
+	FString GetRangeValidator() const;
+
+	bool LoadFromFile(const FString& Filename);
+	bool SaveToFile(const FString& Filename) const;
+};
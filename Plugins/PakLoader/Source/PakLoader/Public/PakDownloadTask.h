@@ -0,0 +1,57 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Kismet/BlueprintAsyncActionBase.h"
+#include "PakDownloadTask.generated.h"
+
+/*
+	Base of the downloads the UPakDownloadManager schedules, e.g. paks and bundles.
+	The manager calls StartDownload once a download slot is free, the task reports back with NotifyDownloadFinished
+	when it succeeded, failed or was cancelled.
+*/
+UCLASS(Abstract)
+class PAKLOADER_API UPakDownloadTask : public UBlueprintAsyncActionBase
+{
+	GENERATED_BODY()
+
+public:
+	// Minimum seconds between two progress broadcasts if the download doesn't set its own.
+	static constexpr float DefaultProgressInterval = 0.1f;
+
+	/* Cancels the download, queued or running. OnFail is called. */
+	UFUNCTION(BlueprintCallable, Category = "PakLoader|Download")
+	virtual void Cancel() PURE_VIRTUAL(UPakDownloadTask::Cancel, );
+
+	/* Bytes received so far and total size, as far as known. */
+	virtual int64 GetBytesReceived() const { return 0; }
+	virtual int64 GetTotalBytes() const { return 0; }
+
+	/* Queued downloads with a higher priority start first. */
+	virtual int32 GetPriority() const { return 0; }
+	virtual void SetPriority(int32 InPriority) {}
+
+protected:
+	friend class UPakDownloadManager;
+
+	virtual void StartDownload() PURE_VIRTUAL(UPakDownloadTask::StartDownload, );
+
+	/*
+		Progress arrives per received chunk, Blueprint listeners only need a few updates per second.
+		Returns true if an update is due now, otherwise it is held back until TakeHeldBackProgress.
+	*/
+	bool ShouldBroadcastProgress(float Interval);
+
+	/* Returns true once if an update was held back since the last broadcast. Call when the download ends. */
+	bool TakeHeldBackProgress();
+
+	static bool IsHttpUrl(const FString& URL);
+
+	// Order in which the download was queued, keeps downloads of equal priority first come first served.
+	int64 QueueSequence = 0;
+
+private:
+	double LastProgressBroadcastTime = 0.0;
+	bool bProgressPending = false;
+};
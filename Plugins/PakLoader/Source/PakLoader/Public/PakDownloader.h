@@ -3,22 +3,155 @@
 #pragma once
 
 #include "CoreMinimal.h"
-#include "Kismet/BlueprintAsyncActionBase.h"
+#include "PakDownloadTask.h"
 #include "Interfaces/IHttpRequest.h"
 #include "Interfaces/IHttpResponse.h"
 #include "Runtime/Launch/Resources/Version.h"
+#include "PakDownloadState.h"
 #include "PakDownloader.generated.h"
 
+class FPakDownloadFileWriter;
+class FPakDownloadStream;
+class FPakBlockManifest;
+struct FPakDeltaPlan;
+
 DECLARE_DYNAMIC_MULTICAST_DELEGATE_FourParams(FDownloadPakDelegate, int32, HttpResponseCode, int64, ContentLength, const FString, SavePath, int64, BytesReceived);
 
+USTRUCT(BlueprintType)
+struct PAKLOADER_API FPakDownloadOptions
+{
+	GENERATED_BODY()
+
+	// Keep the partial file when a download fails and continue it with a range request on the next download of the same URL.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "PakLoader|Download")
+	bool bResume = true;
+
+	/*
+		Skip the transfer if the file at SavePath is still up to date. Validators of each completed download are saved
+		in SavePath + ".meta" and sent with If-None-Match / If-Modified-Since next time, 304 Not Modified succeeds
+		right away with the existing file.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "PakLoader|Download")
+	bool bRevalidate = true;
+
+	// Reserve the disk space of the whole file as soon as its size is known, keeps large paks contiguous on disk.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "PakLoader|Download")
+	bool bPreallocate = true;
+
+	// Optional SHA1 checksum (hex) of the complete file. On mismatch the download fails and the partial file is discarded.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "PakLoader|Download")
+	FString ExpectedSHA1;
+
+	// Fail the download if the file does not end with a valid pak footer. Checked before the file replaces SavePath.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "PakLoader|Download")
+	bool bValidatePak = false;
+
+	/*
+		Maximum number of parallel range requests for one file, 1 downloads with a single request.
+		The number of connections starts at 2 and is adjusted to the measured throughput.
+		Segmented downloads are not resumable, a failed download discards its partial file.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "PakLoader|Download", meta = (ClampMin = "1"))
+	int32 MaxSegments = 1;
+
+	// Size of the byte ranges a segmented download is split into.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "PakLoader|Download", meta = (ClampMin = "1048576"))
+	int64 SegmentSize = 16 * 1024 * 1024;
+
+	// Minimum seconds between two OnProgress broadcasts, updates in between are merged. 0 broadcasts every update.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "PakLoader|Download", meta = (ClampMin = "0"))
+	float ProgressInterval = UPakDownloadTask::DefaultProgressInterval;
+
+	// Queued downloads with a higher priority start first. See UPakDownloadManager.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "PakLoader|Download")
+	int32 Priority = 0;
+
+	/*
+		Updates an existing file at SavePath by downloading only the blocks that changed.
+		Requires a block manifest next to the pak (see UPakLoaderLibrary::CreatePakBlockManifest) and range request support.
+		Falls back to a full download if there is no local file or no manifest.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "PakLoader|Download")
+	bool bDeltaUpdate = false;
+
+	// URL of the block manifest, empty uses the download URL + ".blockmap".
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "PakLoader|Download")
+	FString BlockManifestURL;
+};
+
+USTRUCT(BlueprintType)
+struct PAKLOADER_API FPakDownloadConnectionStats
+{
+	GENERATED_BODY()
+
+	// Byte range fetched by this connection, RangeEnd is -1 for open ended requests.
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader|Download")
+	int64 RangeStart = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader|Download")
+	int64 RangeEnd = -1;
+
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader|Download")
+	int64 BytesReceived = 0;
+
+	// Average rate since the request started.
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader|Download")
+	float BytesPerSecond = 0.0f;
+};
+
+USTRUCT(BlueprintType)
+struct PAKLOADER_API FPakDownloadTelemetry
+{
+	GENERATED_BODY()
+
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader|Download")
+	int64 BytesReceived = 0;
+
+	// 0 until the size is known.
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader|Download")
+	int64 TotalBytes = 0;
+
+	// Smoothed rate of the last few samples.
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader|Download")
+	float InstantaneousBytesPerSecond = 0.0f;
+
+	// Rate since the download started, bytes resumed or reused from an older file don't count.
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader|Download")
+	float AverageBytesPerSecond = 0.0f;
+
+	// -1 while unknown.
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader|Download")
+	float EstimatedSecondsRemaining = -1.0f;
+
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader|Download")
+	float ElapsedSeconds = 0.0f;
+
+	// Failed segments that were requested again.
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader|Download")
+	int32 Retries = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader|Download")
+	TArray<FPakDownloadConnectionStats> Connections;
+
+	// URL the download currently uses, one of the mirrors for DownloadPakFromMirrors.
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader|Download")
+	FString URL;
+
+	// Number of times the download moved on to another mirror.
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader|Download")
+	int32 MirrorFailovers = 0;
+};
+
 UCLASS()
-class PAKLOADER_API UAsyncPakDownloader : public UBlueprintAsyncActionBase
+class PAKLOADER_API UAsyncPakDownloader : public UPakDownloadTask
 {
 	GENERATED_UCLASS_BODY()
 
 public:
 	/*
 		Downloads a file over HTTP, intended to be used to download .pak files.
+		The download is queued in the UPakDownloadManager and starts once a download slot is free.
+		The response is streamed to SavePath + ".part" and renamed to SavePath once complete.
 		SavePath: Directory or path where to save the file. This is passed in OnSuccess callbacks too.
 		HttpResponseCode: HTTP response code in OnSuccess and OnFail callbacks.
 		ContentLength: Total bytes downloaded in OnSuccess callback.
@@ -27,6 +160,23 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "PakLoader|Download", meta = (BlueprintInternalUseOnly = "true"))
 	static UAsyncPakDownloader *DownloadPak(const FString &URL, const FString &SavePath);
 
+	/*
+		Same as DownloadPak but with additional options.
+		With Options.bResume a failed download keeps SavePath + ".part" and SavePath + ".part.json".
+		The next download of the same URL continues from there if the server supports range requests.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "PakLoader|Download", meta = (BlueprintInternalUseOnly = "true"))
+	static UAsyncPakDownloader *DownloadPakWithOptions(const FString &URL, const FString &SavePath, const FPakDownloadOptions &Options);
+
+	/*
+		Same as DownloadPakWithOptions but with several URLs that serve the same file.
+		Every mirror is probed with a small range request, the download starts on the first one that answers.
+		A failed request continues on the next fastest mirror from where it stopped, mirrors must serve identical files.
+		The first URL identifies the download, e.g. for resuming and revalidation.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "PakLoader|Download", meta = (BlueprintInternalUseOnly = "true"))
+	static UAsyncPakDownloader *DownloadPakFromMirrors(const TArray<FString> &URLs, const FString &SavePath, const FPakDownloadOptions &Options);
+
 	UPROPERTY(BlueprintAssignable)
 	FDownloadPakDelegate OnSuccess;
 
@@ -36,21 +186,248 @@ public:
 	UPROPERTY(BlueprintAssignable)
 	FDownloadPakDelegate OnProgress;
 
+	/* Cancels the download. OnFail is called, a partial file is kept for resuming if enabled. */
+	virtual void Cancel() override;
+
+	virtual int64 GetBytesReceived() const override { return ProgressBytesReceived; }
+	virtual int64 GetTotalBytes() const override { return ProgressTotalBytes; }
+
+	virtual int32 GetPriority() const override { return Options.Priority; }
+	virtual void SetPriority(int32 InPriority) override { Options.Priority = InPriority; }
+
+	/*
+		Called with the save path once the new file is complete and verified, right before it replaces the old one.
+		E.g. to unmount the old pak. Returning false discards the download and fails it.
+	*/
+	void SetBeforeCommit(TFunction<bool(const FString& SavePath)>&& InBeforeCommit) { BeforeCommit = MoveTemp(InBeforeCommit); }
+
+	/* Parses a "bytes Start-End/Total" Content-Range value. Total is 0 if the server sent "*". */
+	static bool ParseContentRange(const FString& Value, int64& OutStart, int64& OutEnd, int64& OutTotal);
+
+	/*
+		Returns the file offset the response body starts at, INDEX_NONE if the body must not be written.
+		bAllowFullBody accepts a 200 response to a range request, the body then starts at offset 0.
+	*/
+	static int64 GetBodyWriteOffset(FHttpResponsePtr HttpResponse, int64 RequestedOffset, bool bAllowFullBody);
+
+	/* Size of the whole file a response belongs to, from Content-Range or Content-Length. 0 if unknown. */
+	static int64 GetResponseTotalSize(FHttpResponsePtr HttpResponse);
+
+	/* Returns throughput, ETA and per connection statistics of the running download. */
+	UFUNCTION(BlueprintPure, Category = "PakLoader|Download")
+	FPakDownloadTelemetry GetTelemetry() const;
+
 protected:
-	void StartDownload(const FString &URL, const FString &SavePath);
+	virtual void StartDownload() override;
 
 private:
+	struct FSegment
+	{
+		// Inclusive byte range.
+		int64 Start = 0;
+		int64 End = 0;
+		int32 Retries = 0;
+	};
+
+	struct FActiveSegment
+	{
+		FSegment Segment;
+		FHttpRequestPtr HttpRequest;
+		TSharedPtr<FPakDownloadStream, ESPMode::ThreadSafe> Stream;
+		int64 BytesReceived = 0;
+		double StartTime = 0.0;
+
+		// Mirror the segment is requested from, INDEX_NONE without mirrors.
+		int32 Mirror = INDEX_NONE;
+	};
+
+	struct FMirror
+	{
+		FString URL;
+		FHttpRequestPtr ProbeRequest;
+
+		// Seconds until the probe range arrived, -1 while unknown.
+		double ProbeSeconds = -1.0;
+		bool bProbeFailed = false;
+
+		// A download request to this mirror failed, it is not used again.
+		bool bFailed = false;
+	};
+
 	void HandleHeaderReceived(FHttpRequestPtr InSourceHttpRequest, const FString& InHeaderName, const FString& InHeaderValue);
 	void HandleDownloadComplete(FHttpRequestPtr HttpRequest, FHttpResponsePtr HttpResponse, bool bSucceeded);
+	void HandleSegmentComplete(FHttpRequestPtr HttpRequest, FHttpResponsePtr HttpResponse, bool bSucceeded);
+	void HandleBlockManifestComplete(FHttpRequestPtr HttpRequest, FHttpResponsePtr HttpResponse, bool bSucceeded);
 #if ENGINE_MINOR_VERSION >= 4 && ENGINE_MAJOR_VERSION == 5
 	void HandleDownloadProgress(FHttpRequestPtr InRequest, uint64 BytesSent, uint64 BytesReceived);
+	void HandleSegmentProgress(FHttpRequestPtr InRequest, uint64 BytesSent, uint64 BytesReceived);
 #else
 	void HandleDownloadProgress(FHttpRequestPtr InRequest, int32 BytesSent, int32 BytesReceived);
+	void HandleSegmentProgress(FHttpRequestPtr InRequest, int32 BytesSent, int32 BytesReceived);
 #endif
 
-	static bool IsHttpUrl(const FString& URL);
+	/* Starts the writer and sends the request that downloads the whole file, or its first segment. */
+	void StartMainRequest();
+
+	/* Sends the main request once the bandwidth limit allows it, right away without limit. */
+	void QueueMainRequest();
+
+	/* Sends the main request for the file from ResumeOffset on, also to continue on another mirror. */
+	void SendMainRequest();
+
+	/* Sends a small range request to every mirror, the download starts once the first one answered. */
+	void ProbeMirrors();
+	void HandleProbeComplete(FHttpRequestPtr HttpRequest, FHttpResponsePtr HttpResponse, bool bSucceeded);
+	void CancelProbes();
+
+	/*
+		Marks FailedMirror as failed and switches to the fastest remaining one if it is still the active mirror.
+		Returns false if no mirror is left.
+	*/
+	bool FailOverToNextMirror(int32 FailedMirror);
+
+	/* URL requests are sent to, the active mirror or DownloadURL. */
+	const FString& GetActiveURL() const;
+
+	/* Fetches the block manifest, the local file is compared against it once it arrived. */
+	void StartDeltaUpdate();
+	void HandleDeltaPlanReady(bool bPlanOk, TSharedPtr<FPakDeltaPlan, ESPMode::ThreadSafe> Plan);
+
+	/* Copies the blocks of the plan that are found in LocalFilename into the new file. Runs on a worker thread. */
+	static bool CopyLocalBlocks(const FPakBlockManifest& Manifest, const FPakDeltaPlan& Plan, const FString& LocalFilename,
+		const TSharedRef<FPakDownloadFileWriter, ESPMode::ThreadSafe>& Writer);
+
+	/* Adds If-None-Match / If-Modified-Since if the file at SavePath was downloaded from the same URL before. */
+	void AddRevalidationHeaders(FHttpRequestPtr HttpRequest) const;
+
+	/* Completes a download the server answered with 304 Not Modified. */
+	void FinishNotModified();
+
+	/*
+		Fails if the disk doesn't have room for the rest of a file of FileSize bytes.
+		bPreallocate also reserves the space if enabled in the options.
+	*/
+	bool ReserveDiskSpace(int64 FileSize, bool bPreallocate);
+
+	/* Creates a GET request. RangeEnd = INDEX_NONE requests everything from RangeStart on. */
+	FHttpRequestPtr CreateHttpRequest(int64 RangeStart, int64 RangeEnd, const FString& RangeValidator) const;
+
+	/* Attaches a stream that writes the response body at Offset to the file. */
+	TSharedRef<FPakDownloadStream, ESPMode::ThreadSafe> AttachStream(FHttpRequestPtr HttpRequest, int64 Offset, bool bAllowFullBody);
+
+	/* Commits or discards the file and broadcasts OnSuccess or OnFail. */
+	void FinishDownload(bool bResponseOk, int32 HttpResponseCode);
+
+	void BeginSegments();
+
+	/* Fetches Segments into a file of TotalSize bytes, CompletedBytes of it are already written. */
+	void StartSegments(TArray<FSegment>&& Segments, int64 TotalSize, int64 CompletedBytes);
+	void StartPendingSegments();
+	void StartSegment(const FSegment& Segment);
+	void CancelSegments();
+	void AdaptSegmentCount();
+	void BroadcastSegmentProgress();
+	void BroadcastProgress(int64 TotalSize, int64 BytesReceived);
+
+	/* Broadcasts the last progress update if it was held back by ProgressInterval. */
+	void FlushProgress();
+
+	void UpdateThroughput(double Now);
+
+	/* Returns the size of a partial file that can be continued, 0 to start from the beginning. */
+	int64 GetResumeOffset(const FString& URL);
+
+	FString GetResumeStateFilename() const;
+	FString GetCachedStateFilename() const;
+	void DeleteResumeState() const;
+
+	static bool ComputeFileSHA1(const FString& Filename, FString& OutHash);
+
+	/* Checks the downloaded file against ExpectedSHA1 and the pak footer, using what the writer collected while writing. */
+	bool VerifyDownloadedFile(int64 FileSize) const;
+
+	FPakDownloadOptions Options;
+
+	TFunction<bool(const FString&)> BeforeCommit;
 
 	FString SaveFilePath;
+	FString DownloadURL;
+
+	bool bFinished = false;
+
+	// Cancel() was called, failed requests must not move on to another mirror.
+	bool bCancelRequested = false;
+
+	int64 ProgressBytesReceived = 0;
+	int64 ProgressTotalBytes = 0;
+
+	// Throughput telemetry. ProgressStartBytes were on disk before this download started.
+	double DownloadStartTime = 0.0;
+	int64 ProgressStartBytes = 0;
+	double ThroughputSampleTime = 0.0;
+	int64 ThroughputSampleBytes = 0;
+	double InstantaneousThroughput = 0.0;
+
+	// The first request, in a segmented download the one that fetched the first range.
+	FHttpRequestPtr MainRequest;
+	TSharedPtr<FPakDownloadStream, ESPMode::ThreadSafe> MainStream;
+
+	// Size of the range the main request asks for under a bandwidth limit, 0 requests the rest of the file.
+	int64 MainRequestSize = 0;
+
+	// The next main request waits for the bandwidth limit.
+	bool bWaitingForBandwidth = false;
+
+	// Segmented download requested, the server may still answer with the whole file.
+	bool bSegmented = false;
+	bool bSegmentsStarted = false;
+	int64 SegmentedTotalSize = 0;
+	FString SegmentRangeValidator;
+
+	TArray<FSegment> PendingSegments;
+	TMap<IHttpRequest*, FActiveSegment> ActiveSegments;
+	int64 CompletedSegmentBytes = 0;
+	int32 SegmentRetries = 0;
+
+	// Segments that wait for the bandwidth limit, they count as connections.
+	int32 NumDeferredSegments = 0;
+
+	// Number of parallel segments, adjusted to the throughput measured over each window.
+	int32 TargetConnections = 1;
+	double AdaptWindowStartTime = 0.0;
+	int64 AdaptWindowStartBytes = 0;
+	double LastWindowThroughput = 0.0;
+
+	// Set while a delta update fetches the manifest or compares the local file, the missing blocks are then fetched as segments.
+	bool bDeltaUpdate = false;
+	TSharedPtr<FPakBlockManifest, ESPMode::ThreadSafe> BlockManifest;
+
+	// Offset requested with the Range header, 0 for a full download.
+	int64 ResumeOffset = 0;
+
+	// Validators of the current response. Saved as sidecar so an interrupted download can be continued.
+	FPakDownloadResumeState ResponseState;
+	bool bResponseStateSaved = false;
+	double LastResponseStateSaveTime = 0.0;
+
+	// Mirrors of DownloadPakFromMirrors, empty for a single URL. ActiveMirror is INDEX_NONE until a probe answered.
+	TArray<FMirror> Mirrors;
+	int32 ActiveMirror = INDEX_NONE;
+	double ProbeStartTime = 0.0;
+	int32 MirrorFailovers = 0;
+
+	// Size of the file reported by the mirror probes. Responses of other sizes are rejected.
+	int64 MirrorTotalSize = 0;
+
+	// Free space was checked for the size announced by the response.
+	bool bDiskSpaceReserved = false;
+
+	// Start offset and total size from the Content-Range header of a partial response.
+	int64 ContentRangeStart = 0;
+	int64 ContentRangeTotal = 0;
+
+	// Streams the response body to disk. Shared with the HTTP module which writes to it from the HTTP thread.
+	TSharedPtr<FPakDownloadFileWriter, ESPMode::ThreadSafe> FileWriter;
 
 	// Save the content length from header and pass it to on progress delegate.
 	int64 HeaderContentLength = 0;
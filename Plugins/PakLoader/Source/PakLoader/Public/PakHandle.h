@@ -0,0 +1,56 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/Object.h"
+#include "PakHandle.generated.h"
+
+/*
+	Keeps a pak mounted while it is alive, created by FPakLoader::AcquirePak.
+	Once the last handle of a pak is gone the pak is unloaded and unmounted after the idle delay, unless it was
+	mounted by other means than AcquirePak. Handles can be released on any thread.
+*/
+class PAKLOADER_API FPakHandle
+{
+public:
+	~FPakHandle();
+
+	FPakHandle(const FPakHandle&) = delete;
+	FPakHandle& operator=(const FPakHandle&) = delete;
+
+	const FString& GetPakFilename() const { return PakFilename; }
+
+	/* Root path (e.g. /MyDLC/) the content of the pak is registered with. */
+	const FString& GetRootPath() const { return RootPath; }
+
+private:
+	friend class FPakLoader;
+
+	FPakHandle(const FString& InPakFilename, const FString& InRootPath);
+
+	FString PakFilename;
+	FString RootPath;
+};
+
+/* Blueprint wrapper of FPakHandle. The pak is released when the object is garbage collected or Release is called. */
+UCLASS(BlueprintType)
+class PAKLOADER_API UPakHandle : public UObject
+{
+	GENERATED_BODY()
+
+public:
+	UFUNCTION(BlueprintCallable, Category = "PakLoader")
+	void Release() { Handle.Reset(); }
+
+	UFUNCTION(BlueprintPure, Category = "PakLoader")
+	bool IsAcquired() const { return Handle.IsValid(); }
+
+	UFUNCTION(BlueprintPure, Category = "PakLoader")
+	FString GetPakFilename() const { return Handle.IsValid() ? Handle->GetPakFilename() : FString(); }
+
+	UFUNCTION(BlueprintPure, Category = "PakLoader")
+	FString GetRootPath() const { return Handle.IsValid() ? Handle->GetRootPath() : FString(); }
+
+	TSharedPtr<FPakHandle, ESPMode::ThreadSafe> Handle;
+};
@@ -0,0 +1,58 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Kismet/BlueprintAsyncActionBase.h"
+#include "PakDownloader.h"
+#include "PakInstaller.generated.h"
+
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_ThreeParams(FInstallPakDelegate, bool, bSuccess, const FString, PakFilename, int32, HttpResponseCode);
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FInstallPakProgressDelegate, int64, BytesReceived, int64, TotalBytes);
+
+UCLASS()
+class PAKLOADER_API UAsyncPakInstaller : public UBlueprintAsyncActionBase
+{
+	GENERATED_UCLASS_BODY()
+
+public:
+	/*
+		Downloads a pak and mounts it with MountPakFileEasy, OnCompleted is called once at the end.
+		The pak is hashed and its footer is checked while it is written, a valid download is mounted without reading it again.
+		A mounted pak that is unchanged (304) stays mounted. A changed one is unmounted before the new file replaces it and
+		mounted again, the install fails if a handle (AcquirePak) keeps it mounted.
+		SavePath: Directory or path where to save the pak.
+		Options: Download options, bValidatePak is always enabled.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "PakLoader|Download", meta = (BlueprintInternalUseOnly = "true"))
+	static UAsyncPakInstaller *DownloadAndMountPak(const FString &URL, const FString &SavePath, const FPakDownloadOptions &Options);
+
+	/* Called once the pak is downloaded and mounted, or when any step failed. */
+	UPROPERTY(BlueprintAssignable)
+	FInstallPakDelegate OnCompleted;
+
+	UPROPERTY(BlueprintAssignable)
+	FInstallPakProgressDelegate OnProgress;
+
+	/* Cancels the download. OnCompleted is called with bSuccess = false. */
+	UFUNCTION(BlueprintCallable, Category = "PakLoader|Download")
+	void Cancel();
+
+private:
+	UFUNCTION()
+	void HandleDownloadSuccess(int32 HttpResponseCode, int64 ContentLength, const FString SavePath, int64 BytesReceived);
+
+	UFUNCTION()
+	void HandleDownloadFail(int32 HttpResponseCode, int64 ContentLength, const FString SavePath, int64 BytesReceived);
+
+	UFUNCTION()
+	void HandleDownloadProgress(int32 HttpResponseCode, int64 ContentLength, const FString SavePath, int64 BytesReceived);
+
+	void Complete(bool bSuccess, const FString& PakFilename, int32 HttpResponseCode);
+
+	/* Unmounts the old pak before the download replaces it. */
+	static bool UnmountReplacedPak(const FString& PakFilename);
+
+	UPROPERTY()
+	UAsyncPakDownloader* Download = nullptr;
+};
@@ -0,0 +1,40 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PakPlatformFileLayer.h"
+
+class FPakIoUring;
+
+/*
+	Platform file layer that serves the async reads of paks with io_uring on Linux.
+	Reads of all handles are queued to one thread, which submits everything queued with a single system call and
+	reaps the completions, instead of one blocking read per request on the thread pool. Reads that fit are done into
+	registered buffers, so the kernel doesn't map the destination pages per read.
+	Sync reads and files other than paks pass through unchanged. Requires a kernel with io_uring (5.1 or newer),
+	Initialize fails if it is not available.
+*/
+class PAKLOADER_API FPakIoUringPlatformFile : public FPakPlatformFileLayer
+{
+public:
+	static const TCHAR* GetTypeName() { return TEXT("PakIoUringFile"); }
+
+	FPakIoUringPlatformFile();
+	virtual ~FPakIoUringPlatformFile();
+
+	/* Whether io_uring support was compiled in. The kernel may still lack it. */
+	static bool IsSupported();
+
+	/* Files the filter returns true for keep the async reads of the lower level, e.g. paks that are still downloading. */
+	void SetPassThroughFilter(TFunction<bool(const TCHAR* Filename)>&& InFilter) { PassThroughFilter = MoveTemp(InFilter); }
+
+	// IPlatformFile interface
+	virtual const TCHAR* GetName() const override { return GetTypeName(); }
+	virtual bool Initialize(IPlatformFile* Inner, const TCHAR* CmdLine) override;
+	virtual IAsyncReadFileHandle* OpenAsyncRead(const TCHAR* Filename) override;
+
+private:
+	TUniquePtr<FPakIoUring> Ring;
+	TFunction<bool(const TCHAR*)> PassThroughFilter;
+};
@@ -7,6 +7,45 @@
 #include "HAL/PlatformFileManager.h"
 #include "Runtime/Launch/Resources/Version.h"
 #include "Misc/PackageName.h"
+#include "Containers/Ticker.h"
+#include "PakTraceRecorder.h"
+#include "PakAssetRegistryOptions.h"
+#include "PakReadahead.h"
+#include <atomic>
+
+class FPakPlatformFileLayer;
+class FPakStreamingPlatformFile;
+class FPakMemoryPlatformFile;
+class FPakAccessOrderPlatformFile;
+class FPakIoUringPlatformFile;
+class FPakHandle;
+struct FPakAssetRegistryData;
+
+/* Describes a pak mounted by FPakLoader. */
+struct FPakLoaderMountDetails
+{
+	FString PakFilename;
+
+	// Empty if MountPakFile was called without mount path, the pak's own mount point is used then.
+	FString MountPoint;
+
+	// Root path (e.g. /MyDLC/) and content path registered for the pak, only set by MountPakFileEasy.
+	FString RootPath;
+	FString ContentPath;
+
+	int32 PakOrder = 0;
+
+	// 0 if unknown, MountPakFile doesn't open the pak itself.
+	int32 NumFiles = 0;
+
+	int64 Size = 0;
+
+	// Time spent mounting, for MountPakFileEasy including the asset registry and shader library.
+	double MountSeconds = 0.0;
+};
+
+DECLARE_MULTICAST_DELEGATE_OneParam(FOnPakLoaderPakMounted, const FPakLoaderMountDetails&);
+DECLARE_MULTICAST_DELEGATE_OneParam(FOnPakLoaderPakUnmounted, const FString&);
 
 class PAKLOADER_API FPakLoaderFileVisitor : public IPlatformFile::FDirectoryVisitor
 {
@@ -41,24 +80,144 @@ public:
 	/* Resets the platform file to it's original. Only useful for editor (non shipping builds). */
 	void ResetPlatformFile();
 
+	/*
+		Inserts a layer directly below the pak platform file, it sees all reads of mounted paks.
+		Layers stay alive for the lifetime of the process. Returns false if the layer could not be initialized.
+	*/
+	bool InsertPlatformFileLayer(FPakPlatformFileLayer* Layer);
+
+	/* Layer that serves paks which are still downloading, created on first use. */
+	FPakStreamingPlatformFile *GetStreamingPlatformFile();
+
+	/* Layer that serves paks from memory, created on first use. */
+	FPakMemoryPlatformFile *GetMemoryPlatformFile();
+
+	/* Layer that records and prefetches the read order of paks, created on first use. */
+	FPakAccessOrderPlatformFile *GetAccessOrderPlatformFile();
+
+	/*
+		Layer that serves async pak reads with io_uring, created on first use. Returns nullptr if io_uring is not
+		available, e.g. on other platforms than Linux. Paks mounted before keep their async IO. Installed with the pak
+		platform file when the command line contains -PakIoUring.
+	*/
+	FPakIoUringPlatformFile *GetIoUringPlatformFile();
+
+	/*
+		Records the order in which the blocks of mounted paks are read, saved per content root, and reads the recorded
+		blocks on a background thread the next time a pak with that root is mounted, ahead of the loads that need them.
+		Affects paks mounted afterwards, see FPakAccessOrderPlatformFile.
+	*/
+	void SetAccessOrderPrefetchEnabled(bool bEnabled);
+	bool IsAccessOrderPrefetchEnabled() const { return bAccessOrderPrefetchEnabled; }
+
 	/* Gets an array of all mounted pak files. */
 	TArray<FString> GetMountedPakFilenames();
 
 	/* Checks if the file exists and file is a valid pak file format. */
 	bool IsValidPakFile(const FString &PakFilename, int64 &OutPakSize, bool bSigned = false);
 
+	/*
+		Checks the pak footer (FPakInfo) at the end of a file without opening it, e.g. from the last bytes of a download.
+		Tail holds the last bytes of a file of FileSize bytes.
+	*/
+	static bool IsValidPakFooter(const TArray<uint8>& Tail, int64 FileSize);
+
+	/* Same as IsValidPakFooter, also returns the footer, e.g. to find the index. */
+	static bool ReadPakFooter(const TArray<uint8>& Tail, int64 FileSize, FPakInfo& OutInfo);
+
 	/* Returns search pak order acoording to how the path starts. */
 	int32 GetPakOrderFromPakFilename(const FString& PakFilePath);
 
 	/* Mounts a pak file and registers mount point automatically. */
 	bool MountPakFileEasy(const FString& PakFilename);
 
+	/* Same as above, also returns what was mounted. */
+	bool MountPakFileEasy(const FString& PakFilename, FPakLoaderMountDetails& OutDetails);
+
+	/*
+		Mounts paks like MountPakFileEasy and appends their asset registries as one merged state. The merged state is
+		saved to CacheFilename, the next call with the same paks, unchanged in size and time stamp, and the same asset
+		registry load options loads that one file instead of every AssetRegistry.bin. Requires UE 4.27 or newer for the
+		cache. Returns the number of mounted paks.
+
+		@CacheFilename: Empty uses Saved/PakLoader/AssetRegistryCache.bin.
+	*/
+	int32 MountPakFilesWithRegistryCache(const TArray<FString>& PakFilenames, const FString& CacheFilename);
+
+	/* Fingerprint of a set of paks and the current asset registry load options. */
+	FString GetAssetRegistryCacheKey(const TArray<FString>& PakFilenames);
+
+	/*
+		Steps of MountPakFileEasy, e.g. to spread a mount over several frames.
+		MountPakFileAndFindContent validates and mounts the pak and finds its root, content path and AssetRegistry.bin,
+		it may run on any thread. RegisterMountPoint, AppendAssetRegistry, OpenShaderLibrary and NotifyPakMounted
+		follow on the game thread.
+	*/
+	bool MountPakFileAndFindContent(const FString& PakFilename, FPakLoaderMountDetails& OutDetails, FString& OutAssetRegistryFile);
+	void OpenShaderLibrary(const FString& ContentPath);
+	void NotifyPakMounted(const FPakLoaderMountDetails& Details);
+
 	/* Mounts a pak file. Set PakOrder = INDEX_NONE if unsure. Leave mount path empty to use the mount path found in the pak file. */
 	bool MountPakFile(const FString &PakFilename, int32 PakOrder, const FString &MountPath);
 
+	/*
+		Same as above, also asks the OS to read parts of the pak into the page cache in the background, so the first
+		loads don't wait for random reads from a cold disk. The pages are released again when the pak is unmounted.
+		Only has an effect on Linux and Android, see FPakReadahead.
+	*/
+	bool MountPakFile(const FString &PakFilename, int32 PakOrder, const FString &MountPath, const FPakReadaheadOptions &Readahead);
+
+	/*
+		Mounts a pak from a memory buffer like MountPakFileEasy, e.g. a small pak that was generated or downloaded into memory.
+		Nothing is written to disk. PakFilename is a virtual path that identifies the pak, pass it to UnmountPakFile.
+		Data must stay valid until the pak is unmounted.
+	*/
+	bool MountPakFileFromMemory(const FString& PakFilename, const uint8* Data, int64 Size);
+
+	/* Same as above, the pak keeps Data alive until it is unmounted. */
+	bool MountPakFileFromMemory(const FString& PakFilename, const TSharedRef<const TArray<uint8>, ESPMode::ThreadSafe>& Data);
+
 	/* Unmounts a pak file. */
 	bool UnmountPakFile(const FString &PakFilename);
 
+	/*
+		Mounts a pak with MountPakFileEasy unless it is mounted already and returns a handle that keeps it mounted.
+		The pak is unloaded once no handle was alive for the idle delay and unmounted after the next garbage collection.
+		Paks that were mounted before the first handle was acquired stay mounted. Call on the game thread. Returns
+		nullptr if mounting failed.
+	*/
+	TSharedPtr<FPakHandle, ESPMode::ThreadSafe> AcquirePak(const FString& PakFilename);
+
+	/* True while a handle of the pak is alive or it is waiting for its idle delay. */
+	bool IsPakAcquired(const FString& PakFilename);
+
+	/* Seconds a pak without handles stays mounted, e.g. to avoid remounting content that is needed again soon. */
+	void SetIdleUnmountDelay(float Seconds) { IdleUnmountDelay = FMath::Max(Seconds, 0.0f); }
+	float GetIdleUnmountDelay() const { return IdleUnmountDelay; }
+
+	/* Returns the loaded packages below a content root, e.g. /MyDLC/. */
+	TArray<UPackage*> GetLoadedPackagesInRoot(const FString& RootPath);
+
+	/*
+		Lets the garbage collector reclaim the packages loaded from a content root, e.g. before its pak is unmounted.
+		Objects that are still referenced stay loaded. bCollectGarbage collects right away, otherwise the packages
+		go with the next garbage collection. Returns the number of packages of the root that are still loaded.
+	*/
+	int32 UnloadContent(const FString& RootPath, bool bCollectGarbage = true);
+
+	/*
+		Returns the package and all packages it hard depends on, directly or through other packages, as known to the
+		asset registry, e.g. /MyDLC/Blueprints/BP_Test and the meshes and materials it references. Dependencies
+		stripped with bStripDependencies are not found. Call on the game thread.
+	*/
+	TArray<FName> GetPackageDependencyClosure(const FString& PackageName);
+
+	/* Called after a pak was mounted by this class, on the thread that mounted it. */
+	FOnPakLoaderPakMounted& OnPakMounted() { return PakMountedDelegate; }
+
+	/* Called after a pak was unmounted by this class, on the thread that unmounted it. */
+	FOnPakLoaderPakUnmounted& OnPakUnmounted() { return PakUnmountedDelegate; }
+
 	/*
 		Filename to packagename. Returns a path starting with a valid root like /Game/, /MyDLC/ etc.
 		Requires that the path is registered within Unreal. (RegisterMountPoint)
@@ -80,6 +239,23 @@ public:
 	/* Load the AssetRegistry.bin to publish files to Unreal's asset registry. */
 	void LoadAssetRegistryFile(const FString &AssetRegistryFile);
 
+	/* Reads and deserializes an AssetRegistry.bin, may run on any thread. Returns nullptr if the file can't be read. */
+	TSharedPtr<FPakAssetRegistryData, ESPMode::ThreadSafe> ReadAssetRegistryFile(const FString& AssetRegistryFile);
+
+	/* Publishes an asset registry read by ReadAssetRegistryFile. Call on the game thread. */
+	void AppendAssetRegistry(const TSharedPtr<FPakAssetRegistryData, ESPMode::ThreadSafe>& Data);
+
+	/*
+		Filters the asset registries of paks mounted from now on before they are appended, e.g. to keep only the
+		packages and tags the game queries. Filtering runs in ReadAssetRegistryFile. Requires UE 4.27 or newer.
+	*/
+	void SetAssetRegistryLoadOptions(const FPakAssetRegistryLoadOptions& Options);
+	FPakAssetRegistryLoadOptions GetAssetRegistryLoadOptions();
+
+	/* Assets kept and memory saved by the load options. */
+	FPakAssetRegistryLoadReport GetAssetRegistryLoadReport();
+	void ResetAssetRegistryLoadReport();
+
 	bool DoesDirectoryExist(const FString &Directory);
 	bool DoesFileExist(const FString &Filename);
 
@@ -88,6 +264,7 @@ public:
 	T *LoadObjectFromPak(const FString &Filename)
 	{
 		const FString Name = T::StaticClass()->GetName() + TEXT("'") + Filename + TEXT(".") + FPackageName::GetShortName(Filename) + TEXT("'");
+		FPakTraceScope TraceScope(TEXT("LoadObjectFromPak"), TEXT("Load"), Name);
 		return Cast<T>(StaticLoadObject(T::StaticClass(), nullptr, *Name));
 	}
 
@@ -104,6 +281,70 @@ protected:
 	IPlatformFile *OriginalPlatformFile = nullptr;
 #endif
 
+	FPakStreamingPlatformFile *StreamingPlatformFile = nullptr;
+	FPakMemoryPlatformFile *MemoryPlatformFile = nullptr;
+	FPakAccessOrderPlatformFile *AccessOrderPlatformFile = nullptr;
+	FPakIoUringPlatformFile *IoUringPlatformFile = nullptr;
+	bool bIoUringUnavailable = false;
+
+	std::atomic<bool> bAccessOrderPrefetchEnabled{false};
+
+	FPakAssetRegistryLoadOptions AssetRegistryLoadOptions;
+	FPakAssetRegistryLoadReport AssetRegistryLoadReport;
+	FCriticalSection AssetRegistryOptionsLock;
+
+	FOnPakLoaderPakMounted PakMountedDelegate;
+	FOnPakLoaderPakUnmounted PakUnmountedDelegate;
+
 private:
+	friend class FPakHandle;
+
+	struct FAcquiredPak
+	{
+		int32 NumHandles = 0;
+
+		// Paks that were mounted before they were acquired are not unmounted.
+		bool bMountedByHandles = false;
+
+		FString RootPath;
+		FString ContentPath;
+		double IdleSinceSeconds = 0.0;
+	};
+
+	void ReleasePak(const FString& PakFilename);
+
+	/* Unloads paks whose idle delay passed and requests a garbage collection to unmount them after. */
+	bool TickIdlePaks(float DeltaTime);
+
+	/* Unmounts the idle paks that were released by the garbage collection. */
+	void FinishIdleUnmounts();
+
+	void HandlePostGarbageCollect();
+
+	TMap<FString, FAcquiredPak> AcquiredPaks;
+	FCriticalSection AcquiredPaksLock;
+	float IdleUnmountDelay = 30.0f;
+
+	// Idle paks whose content was unloaded, unmounted once a garbage collection ran.
+	TArray<TPair<FString, FAcquiredPak>> PendingIdlePaks;
+	bool bIdlePaksCollected = false;
+	FDelegateHandle PostGarbageCollectHandle;
+
+#if ENGINE_MAJOR_VERSION == 5
+	FTSTicker::FDelegateHandle IdleTickerHandle;
+#else
+	FDelegateHandle IdleTickerHandle;
+#endif
+
+	/* Passes the regions of the options to FPakReadahead, the index region is found from the pak footer. */
+	bool HintReadahead(const FString& PakFilename, const FPakReadaheadOptions& Options);
+
+	// Paks mounted with readahead hints, their pages are released on unmount.
+	TSet<FString> ReadaheadPaks;
+	FCriticalSection ReadaheadPaksLock;
+
+	/* Mounts without notifying OnPakMounted. */
+	bool MountPakFileInternal(const FString& PakFilename, int32 PakOrder, const FString& MountPath);
+
 	static FPakLoader *Instance;
 };
@@ -5,6 +5,8 @@
 #include "CoreMinimal.h"
 #include "Kismet/BlueprintFunctionLibrary.h"
 #include "Runtime/Launch/Resources/Version.h"
+#include "PakAssetRegistryOptions.h"
+#include "PakReadahead.h"
 #include "PakLoaderLibrary.generated.h"
 
 class UTexture2D;
@@ -14,6 +16,7 @@ class UMaterial;
 class UMaterialInstanceConstant;
 class USkeletalMesh;
 class UAnimSequence;
+class UPakHandle;
 
 /**
  *
@@ -46,6 +49,21 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "PakLoader")
 	static void RuntimeLog(const FString &Text);
 
+	/* Starts recording mount, asset registry, load and download events, events recorded before are discarded. */
+	UFUNCTION(BlueprintCallable, Category = "PakLoader")
+	static void StartPakTrace();
+
+	UFUNCTION(BlueprintCallable, Category = "PakLoader")
+	static void StopPakTrace();
+
+	/*
+		Writes the recorded events as Chrome trace JSON, open it with chrome://tracing or ui.perfetto.dev.
+
+		@Filename: File to write the trace to.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "PakLoader")
+	static bool ExportPakTrace(const FString &Filename);
+
 	/* Returns name of this Unreal project. */
 	UFUNCTION(BlueprintPure, Category = "PakLoader")
 	static FString GetProjectName();
@@ -62,6 +80,18 @@ public:
 	UFUNCTION(BlueprintPure, Category = "PakLoader")
 	static FString SHA1SUM(const FString &Filename);
 
+	/*
+		Writes the block manifest of a pak, needed to update existing copies with FPakDownloadOptions::bDeltaUpdate.
+		Upload the manifest next to the pak, by default as PakURL + ".blockmap".
+		Smaller blocks find more unchanged data but make the manifest larger.
+
+		@PakFilename: .pak file on disk.
+		@ManifestFilename: Where to save the manifest, usually PakFilename + ".blockmap".
+		@BlockSize: Size of the compared blocks in bytes.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "PakLoader")
+	static bool CreatePakBlockManifest(const FString &PakFilename, const FString &ManifestFilename, int32 BlockSize = 65536);
+
 	/*
 		Filename to packagename. Returns a path starting with a valid root like /Game/, /MyDLC/ etc.
 		Requires that the path is registered within Unreal. (RegisterMountPoint)
@@ -116,6 +146,36 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "PakLoader")
 	static bool MountPakFile(const FString &PakFilename, const FString &MountPath);
 
+	/*
+		Mounts a pak file like MountPakFile and asks the OS to read parts of it into the page cache in the background.
+		The cached pages are released when the pak is unmounted. Only has an effect on Linux and Android.
+
+		@PakFilename: .pak file on disk.
+		@MountPath: Where to mount the Pak content. Leave empty if unsure (mount path as specified in the pak file will be used).
+		@Readahead: Parts of the pak to read ahead.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "PakLoader")
+	static bool MountPakFileWithReadahead(const FString &PakFilename, const FString &MountPath, const FPakReadaheadOptions &Readahead);
+
+	/*
+		Mounts a pak from memory like MountPakFileEasy, without writing it to disk. The data is copied.
+
+		@PakFilename: Virtual .pak path that identifies the pak, e.g. for UnmountPakFile. No file is created.
+		@Data: Content of the pak file.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "PakLoader")
+	static bool MountPakFileFromMemory(const FString &PakFilename, const TArray<uint8> &Data);
+
+	/*
+		Mounts several paks like MountPakFileEasy and caches their merged asset registry, later launches with the same
+		unchanged paks load the cache instead of each AssetRegistry.bin. Returns the number of mounted paks.
+
+		@PakFilenames: .pak files on disk.
+		@CacheFilename: Where to keep the cache. Leave empty for Saved/PakLoader/AssetRegistryCache.bin.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "PakLoader")
+	static int32 MountPakFilesWithRegistryCache(const TArray<FString> &PakFilenames, const FString &CacheFilename);
+
 	/*
 		Unmounts a Pak that was previously mounted.
 
@@ -124,6 +184,39 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "PakLoader")
 	static bool UnmountPakFile(const FString &PakFilename);
 
+	/*
+		Mounts a pak like MountPakFileEasy unless it is mounted already and keeps it mounted while the handle is alive.
+		Once all handles of a pak are released or garbage collected it is unloaded and unmounted after the idle delay.
+
+		@PakFilename: .pak file on disk to acquire.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "PakLoader")
+	static UPakHandle *AcquirePakFile(const FString &PakFilename);
+
+	/*
+		Sets how long a pak without handles stays mounted.
+
+		@Seconds: Delay before an idle pak is unmounted.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "PakLoader")
+	static void SetPakIdleUnmountDelay(float Seconds);
+
+	/*
+		Records in which order the content of mounted paks is read and prefetches it in that order the next time the
+		paks are mounted. The order is saved per content root in Saved/PakLoader/AccessOrder. Affects paks mounted afterwards.
+
+		@bEnabled: Record and prefetch.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "PakLoader")
+	static void SetPakAccessOrderPrefetchEnabled(bool bEnabled);
+
+	/*
+		Serves the async reads of paks mounted afterwards with io_uring, one thread submits them in batches.
+		Returns false if io_uring is not available, only Linux supports it. -PakIoUring on the command line enables it at startup.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "PakLoader")
+	static bool EnablePakIoUring();
+
 	/*
 		Creates a link between a root path and a package content path (mount point).
 		This is required to make references between assets work. Should be called after mounting a pak.
@@ -152,6 +245,19 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "PakLoader")
 	static void LoadPakAssetRegistryFile(const FString &AssetRegistryFile);
 
+	/*
+		Filters the AssetRegistry.bin of paks mounted from now on, e.g. to keep only the packages and tags the game
+		queries. Requires Unreal Engine 4.27 or newer.
+
+		@Options: Packages, classes, tags and data to keep.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "PakLoader")
+	static void SetPakAssetRegistryLoadOptions(const FPakAssetRegistryLoadOptions &Options);
+
+	/* Assets kept and memory saved by the asset registry load options so far. */
+	UFUNCTION(BlueprintPure, Category = "PakLoader")
+	static FPakAssetRegistryLoadReport GetPakAssetRegistryLoadReport();
+
 	/*
 		Registers an AES encryption key to the engine.
 
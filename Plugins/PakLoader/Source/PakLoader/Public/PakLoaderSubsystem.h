@@ -4,13 +4,58 @@
 
 #include "CoreMinimal.h"
 #include "Subsystems/EngineSubsystem.h"
+#include "Containers/Ticker.h"
+#include "Runtime/Launch/Resources/Version.h"
 #include "PakLoaderSubsystem.generated.h"
 
 DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FPakLoaderOnContentPathMounted, FString, AssetPath, FString, ContentPath);
 DECLARE_DYNAMIC_MULTICAST_DELEGATE_ThreeParams(FOnPakFileMounted2, FString, PakFilename, FString, MountPoint, int32, NumFiles);
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FPakLoaderOnMountedPaksChanged, int32, Generation);
+DECLARE_DYNAMIC_DELEGATE_TwoParams(FPakLoaderOnTimeSlicedMount, FString, PakFilename, bool, bSuccess);
+
+struct FPakLoaderMountDetails;
+
+USTRUCT(BlueprintType)
+struct PAKLOADER_API FPakMountInfo
+{
+	GENERATED_BODY()
+
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader")
+	FString PakFilename;
+
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader")
+	FString MountPoint;
+
+	// Root path (e.g. /MyDLC/) and content path registered for the pak, empty unless it was mounted with MountPakFileEasy.
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader")
+	FString RootPath;
+
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader")
+	FString ContentPath;
+
+	// 0 if unknown.
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader")
+	int32 NumFiles = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader")
+	int64 Size = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader")
+	int32 PakOrder = 0;
+
+	// UTC time the pak was mounted.
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader")
+	FDateTime MountTime;
+
+	// Time spent mounting, 0 for paks that were not mounted by the plugin.
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader")
+	float MountSeconds = 0.0f;
+};
 
 /**
- * 
+ * Re-broadcasts the engine's mount delegates to Blueprints and keeps a registry of the mounted paks.
+ * The registry changes on the game thread only. Every change increments the generation, callers can keep their copy
+ * of the registry until GetMountedPaksGeneration() returns a different value.
  */
 UCLASS()
 class PAKLOADER_API UPakLoaderSubsystem : public UEngineSubsystem
@@ -19,6 +64,57 @@ class PAKLOADER_API UPakLoaderSubsystem : public UEngineSubsystem
 	
 public:
 	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+
+	/* Returns the subsystem or nullptr if the engine is not initialized yet. */
+	static UPakLoaderSubsystem* Get();
+
+	/* Incremented whenever a pak is mounted, unmounted or its information changes. */
+	UFUNCTION(BlueprintPure, Category = "PakLoader")
+	int32 GetMountedPaksGeneration() const { return MountedPaksGeneration; }
+
+	/* Copies the registry, prefer GetMountedPakMap() in C++. */
+	UFUNCTION(BlueprintPure, Category = "PakLoader")
+	TArray<FPakMountInfo> GetMountedPaks() const;
+
+	UFUNCTION(BlueprintPure, Category = "PakLoader")
+	bool GetMountedPakInfo(const FString& PakFilename, FPakMountInfo& OutInfo) const;
+
+	UFUNCTION(BlueprintPure, Category = "PakLoader")
+	bool IsPakMounted(const FString& PakFilename) const { return MountedPaks.Contains(PakFilename); }
+
+	UFUNCTION(BlueprintPure, Category = "PakLoader")
+	int32 GetNumMountedPaks() const { return MountedPaks.Num(); }
+
+	/* Mounted paks by filename. Only valid on the game thread. */
+	const TMap<FString, FPakMountInfo>& GetMountedPakMap() const { return MountedPaks; }
+
+	// Called after the registry changed, at most once per change.
+	UPROPERTY(BlueprintAssignable)
+	FPakLoaderOnMountedPaksChanged OnMountedPaksChanged;
+
+	/*
+		Mounts a pak like MountPakFileEasy without spiking a frame. The pak is opened, mounted and its asset registry
+		read on a worker thread. Registering the mount point, appending the asset registry and opening the shader
+		library run on the game thread, as many steps per frame as fit into the mount frame budget but at least one.
+		Mounts complete in the order they were requested. OnComplete is called on the game thread.
+		Mounts still pending when the subsystem deinitializes are undone and fail.
+	*/
+	void MountPakFileTimeSliced(const FString& PakFilename, TFunction<void(bool bSuccess)>&& OnComplete = nullptr);
+
+	UFUNCTION(BlueprintCallable, Category = "PakLoader", meta = (DisplayName = "Mount Pak File Time Sliced"))
+	void K2_MountPakFileTimeSliced(const FString& PakFilename, FPakLoaderOnTimeSlicedMount OnComplete);
+
+	/* Game thread time per frame for time sliced mounts. */
+	UFUNCTION(BlueprintCallable, Category = "PakLoader")
+	void SetMountFrameBudget(float Milliseconds) { MountFrameBudgetMs = FMath::Max(Milliseconds, 0.0f); }
+
+	UFUNCTION(BlueprintPure, Category = "PakLoader")
+	float GetMountFrameBudget() const { return MountFrameBudgetMs; }
+
+	/* Number of time sliced mounts that did not complete yet. */
+	UFUNCTION(BlueprintPure, Category = "PakLoader")
+	int32 GetNumPendingMounts() const { return PendingMounts.Num(); }
 
 	// Called by the engine when a new content path is mounted. Native delegate: FPackageName::OnContentPathMounted()
 	UPROPERTY(BlueprintAssignable)
@@ -44,4 +140,45 @@ public:
 #else
 	void Native_OnPakFileMounted2(const IPakFile& PakFile);
 #endif
+
+private:
+	void HandlePakLoaderMounted(const FPakLoaderMountDetails& Details);
+	void HandlePakLoaderUnmounted(const FString& PakFilename);
+
+	/* Adds or updates a registry entry. Values that are unknown (empty or 0) in Info don't replace known ones. */
+	void UpdateMountedPak(const FPakMountInfo& Info);
+	void RemoveMountedPak(const FString& PakFilename);
+
+	/* Adds paks that were mounted before the subsystem existed, e.g. by the engine at startup. */
+	void AddAlreadyMountedPaks();
+
+	void MarkMountedPaksChanged();
+
+	/* Runs Function on the game thread, right away if called from it. */
+	void RunOnGameThread(TFunction<void()>&& Function);
+
+	struct FTimeSlicedMount;
+
+	bool TickPendingMounts(float DeltaTime);
+
+	/* Runs the next game thread step of a mount. Returns false while the mount waits for its worker thread. */
+	bool RunMountStep(FTimeSlicedMount& Mount);
+
+	/* Waits for the workers of the pending mounts and unmounts the paks they mounted, the mounts fail. */
+	void CancelPendingMounts();
+
+	TMap<FString, FPakMountInfo> MountedPaks;
+	int32 MountedPaksGeneration = 0;
+
+	TArray<TSharedRef<FTimeSlicedMount, ESPMode::ThreadSafe>> PendingMounts;
+	float MountFrameBudgetMs = 2.0f;
+
+#if ENGINE_MAJOR_VERSION == 5
+	FTSTicker::FDelegateHandle MountTickerHandle;
+#else
+	FDelegateHandle MountTickerHandle;
+#endif
+
+	FDelegateHandle PakMountedHandle;
+	FDelegateHandle PakUnmountedHandle;
 };
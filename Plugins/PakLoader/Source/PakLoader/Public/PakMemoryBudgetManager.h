@@ -0,0 +1,190 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/EngineSubsystem.h"
+#include "Containers/Ticker.h"
+#include "Runtime/Launch/Resources/Version.h"
+#include "PakMemoryBudgetManager.generated.h"
+
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FPakMemoryBudgetOnPakEvicting, FString, PakFilename, int64, ResidentBytes);
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FPakMemoryBudgetOnPakEvicted, FString, PakFilename, bool, bUnmounted);
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FPakMemoryBudgetOnBudgetExceeded, int64, ResidentBytes, int64, Budget);
+
+USTRUCT(BlueprintType)
+struct PAKLOADER_API FPakMemoryUsage
+{
+	GENERATED_BODY()
+
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader|Memory")
+	FString PakFilename;
+
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader|Memory")
+	FString RootPath;
+
+	// Estimated memory of the objects loaded from the pak's content root, as of the last measurement.
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader|Memory")
+	int64 ResidentBytes = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader|Memory")
+	int32 NumLoadedPackages = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader|Memory")
+	float SecondsSinceLastAccess = 0.0f;
+
+	// Pinned paks are never evicted.
+	UPROPERTY(BlueprintReadOnly, Category = "PakLoader|Memory")
+	bool bPinned = false;
+};
+
+/**
+ * Keeps the memory of content loaded from paks within a budget.
+ * Objects are attributed to a pak by the content root it registered (MountPakFileEasy), paks without root are not
+ * tracked. A pak counts as accessed when packages of its root were loaded since the last measurement or when
+ * MarkPakAccessed is called. While the resident memory exceeds the budget the least recently accessed paks are
+ * unloaded and unmounted after the next garbage collection. Paks whose objects are still referenced then stay mounted.
+ * Paks that share their content root with another mounted pak are not tracked, unmounting one would unregister the
+ * root of the other.
+ *
+ * Measuring runs on the game thread. Every MeasureInterval the loaded packages of the tracked roots are collected,
+ * their objects are then summed up within about a millisecond per frame. The size of a package is kept until it is
+ * unloaded, so after the first measurement only newly loaded packages cost more than a lookup.
+ */
+UCLASS()
+class PAKLOADER_API UPakMemoryBudgetManager : public UEngineSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+
+	/* Returns the manager or nullptr if the engine is not initialized yet. */
+	static UPakMemoryBudgetManager* Get();
+
+	/*
+		Sets the memory budget of all pak content together.
+
+		@Bytes: 0 disables eviction.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "PakLoader|Memory")
+	void SetMemoryBudget(int64 Bytes);
+
+	UFUNCTION(BlueprintPure, Category = "PakLoader|Memory")
+	int64 GetMemoryBudget() const { return MemoryBudget; }
+
+	/* Seconds between measurements while a budget is set. */
+	UFUNCTION(BlueprintCallable, Category = "PakLoader|Memory")
+	void SetMeasureInterval(float Seconds);
+
+	/* Marks a pak as used now, e.g. when gameplay is about to need its content. */
+	UFUNCTION(BlueprintCallable, Category = "PakLoader|Memory")
+	void MarkPakAccessed(const FString& PakFilename);
+
+	/* Pinned paks are never evicted. */
+	UFUNCTION(BlueprintCallable, Category = "PakLoader|Memory")
+	void SetPakPinned(const FString& PakFilename, bool bPinned);
+
+	/* Measures all packages now, in one frame, and evicts paks if the budget is exceeded. */
+	UFUNCTION(BlueprintCallable, Category = "PakLoader|Memory")
+	void UpdateMemoryUsage();
+
+	/* Usage of all tracked paks as of the last measurement. */
+	UFUNCTION(BlueprintPure, Category = "PakLoader|Memory")
+	TArray<FPakMemoryUsage> GetPakMemoryUsage() const;
+
+	UFUNCTION(BlueprintPure, Category = "PakLoader|Memory")
+	int64 GetTotalResidentBytes() const;
+
+	/* Called before a pak is evicted, release references to its content here so it can be unloaded. */
+	UPROPERTY(BlueprintAssignable)
+	FPakMemoryBudgetOnPakEvicting OnPakEvicting;
+
+	/* Called after an eviction. bUnmounted is false if objects of the pak were still referenced. */
+	UPROPERTY(BlueprintAssignable)
+	FPakMemoryBudgetOnPakEvicted OnPakEvicted;
+
+	/* Called when a measurement exceeds the budget, before paks are evicted. */
+	UPROPERTY(BlueprintAssignable)
+	FPakMemoryBudgetOnBudgetExceeded OnBudgetExceeded;
+
+private:
+	struct FPakState
+	{
+		FString RootPath;
+		FString ContentPath;
+		int64 ResidentBytes = 0;
+		int32 NumLoadedPackages = 0;
+		double LastAccessSeconds = 0.0;
+		bool bPinned = false;
+
+		// Sums of the running measurement, the pak was tracked when it started.
+		int64 MeasuringBytes = 0;
+		int32 MeasuringPackages = 0;
+		bool bMeasuring = false;
+	};
+
+	struct FMeasuredPackage
+	{
+		TWeakObjectPtr<UPackage> Package;
+		FString PakFilename;
+	};
+
+	bool Tick(float DeltaTime);
+
+	/* Adds and removes paks to match the mounted paks of UPakLoaderSubsystem. */
+	void SyncWithMountedPaks();
+
+	/* Collects the loaded packages of the tracked paks. */
+	void BeginMeasure();
+
+	/* Measures packages until EndTime, returns true once all are measured. */
+	bool ContinueMeasure(double EndTime);
+
+	/* Publishes the measured sizes. */
+	void EndMeasure();
+
+	static int64 MeasurePackage(UPackage* Package);
+
+	/* Unloads the least recently accessed paks and requests a garbage collection to unmount them after. */
+	void EnforceBudget();
+
+	/* Unmounts the paks of the last eviction that were released by the garbage collection. */
+	void FinishEvictions();
+
+	void HandlePostGarbageCollect();
+
+	void StartTicker();
+	void StopTicker();
+
+	TMap<FString, FPakState> Paks;
+
+	// Pins are kept for paks that are not mounted yet.
+	TSet<FString> PinnedPaks;
+
+	int32 SyncedGeneration = INDEX_NONE;
+
+	int64 MemoryBudget = 0;
+	float MeasureInterval = 5.0f;
+	double NextMeasureTime = 0.0;
+
+	TArray<FMeasuredPackage> MeasuredPackages;
+	int32 NextMeasuredPackage = 0;
+	bool bMeasureInProgress = false;
+
+	// Sizes of packages measured before. Loaded packages don't change, reloading creates a new package.
+	TMap<TWeakObjectPtr<UPackage>, int64> PackageSizes;
+
+	// Paks unloaded by EnforceBudget, unmounted once a garbage collection ran.
+	TArray<FString> PendingEvictions;
+	bool bEvictionsCollected = false;
+
+	FDelegateHandle PostGarbageCollectHandle;
+
+#if ENGINE_MAJOR_VERSION == 5
+	FTSTicker::FDelegateHandle TickerHandle;
+#else
+	FDelegateHandle TickerHandle;
+#endif
+};
@@ -0,0 +1,63 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PakPlatformFileLayer.h"
+#include "Misc/ScopeRWLock.h"
+#include <atomic>
+
+/*
+	Platform file layer that serves files from memory buffers, so paks can be mounted without writing them to disk.
+	Registered files only exist for the pak platform file and its readers, all other files pass through unchanged.
+*/
+class PAKLOADER_API FPakMemoryPlatformFile : public FPakPlatformFileLayer
+{
+public:
+	static const TCHAR* GetTypeName() { return TEXT("PakMemoryFile"); }
+
+	/*
+		Serves Filename from Data until UnregisterFile is called. Filename doesn't have to exist on disk.
+		Owner keeps the buffer alive while handles read from it, without an owner Data must stay valid until all
+		handles are closed, for a pak that is once it is unmounted.
+	*/
+	void RegisterFile(const FString& Filename, const uint8* Data, int64 Size, const TSharedPtr<const TArray<uint8>, ESPMode::ThreadSafe>& Owner = nullptr);
+	void UnregisterFile(const FString& Filename);
+
+	bool IsRegistered(const FString& Filename) const;
+
+	// IPlatformFile interface
+	virtual const TCHAR* GetName() const override { return GetTypeName(); }
+	virtual bool FileExists(const TCHAR* Filename) override;
+	virtual int64 FileSize(const TCHAR* Filename) override;
+	virtual bool IsReadOnly(const TCHAR* Filename) override;
+	virtual FDateTime GetTimeStamp(const TCHAR* Filename) override;
+	virtual FDateTime GetAccessTimeStamp(const TCHAR* Filename) override;
+	virtual FFileStatData GetStatData(const TCHAR* FilenameOrDirectory) override;
+	virtual IFileHandle* OpenRead(const TCHAR* Filename, bool bAllowWrite = false) override;
+	virtual IAsyncReadFileHandle* OpenAsyncRead(const TCHAR* Filename) override;
+#if ENGINE_MINOR_VERSION >= 3 && ENGINE_MAJOR_VERSION == 5
+	virtual FOpenMappedResult OpenMappedEx(const TCHAR* Filename, EOpenReadFlags OpenOptions = EOpenReadFlags::None, int64 MaximumSize = 0) override;
+#else
+	virtual IMappedFileHandle* OpenMapped(const TCHAR* Filename) override;
+#endif
+
+private:
+	struct FMemoryFile
+	{
+		const uint8* Data = nullptr;
+		int64 Size = 0;
+		FDateTime Timestamp;
+		TSharedPtr<const TArray<uint8>, ESPMode::ThreadSafe> Owner;
+	};
+
+	bool FindFile(const TCHAR* Filename, FMemoryFile& OutFile) const;
+
+	static FString GetKey(const TCHAR* Filename);
+
+	TMap<FString, FMemoryFile> Files;
+	mutable FRWLock FilesLock;
+
+	// Lets the common case of no memory file skip the lock and the path normalization.
+	std::atomic<int32> NumFiles{0};
+};
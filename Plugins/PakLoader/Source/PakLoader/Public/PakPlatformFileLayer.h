@@ -0,0 +1,66 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GenericPlatform/GenericPlatformFile.h"
+#include "Runtime/Launch/Resources/Version.h"
+
+/*
+	Platform file that forwards everything to its lower level.
+	Layers of the plugin derive from it and override only what they change. They are inserted between the pak
+	platform file and the physical platform file with FPakLoader::InsertPlatformFileLayer, so they see the reads
+	of mounted paks.
+*/
+class PAKLOADER_API FPakPlatformFileLayer : public IPlatformFile
+{
+public:
+	// IPlatformFile interface
+	virtual bool ShouldBeUsed(IPlatformFile* Inner, const TCHAR* CmdLine) const override { return false; }
+	virtual bool Initialize(IPlatformFile* Inner, const TCHAR* CmdLine) override;
+	virtual IPlatformFile* GetLowerLevel() override { return LowerLevel; }
+	virtual void SetLowerLevel(IPlatformFile* NewLowerLevel) override { LowerLevel = NewLowerLevel; }
+
+	virtual bool FileExists(const TCHAR* Filename) override { return LowerLevel->FileExists(Filename); }
+	virtual int64 FileSize(const TCHAR* Filename) override { return LowerLevel->FileSize(Filename); }
+	virtual bool DeleteFile(const TCHAR* Filename) override { return LowerLevel->DeleteFile(Filename); }
+	virtual bool IsReadOnly(const TCHAR* Filename) override { return LowerLevel->IsReadOnly(Filename); }
+	virtual bool MoveFile(const TCHAR* To, const TCHAR* From) override { return LowerLevel->MoveFile(To, From); }
+	virtual bool SetReadOnly(const TCHAR* Filename, bool bNewReadOnlyValue) override { return LowerLevel->SetReadOnly(Filename, bNewReadOnlyValue); }
+	virtual FDateTime GetTimeStamp(const TCHAR* Filename) override { return LowerLevel->GetTimeStamp(Filename); }
+	virtual void SetTimeStamp(const TCHAR* Filename, FDateTime DateTime) override { LowerLevel->SetTimeStamp(Filename, DateTime); }
+	virtual FDateTime GetAccessTimeStamp(const TCHAR* Filename) override { return LowerLevel->GetAccessTimeStamp(Filename); }
+	virtual FString GetFilenameOnDisk(const TCHAR* Filename) override { return LowerLevel->GetFilenameOnDisk(Filename); }
+	virtual IFileHandle* OpenRead(const TCHAR* Filename, bool bAllowWrite = false) override { return LowerLevel->OpenRead(Filename, bAllowWrite); }
+	virtual IFileHandle* OpenWrite(const TCHAR* Filename, bool bAppend = false, bool bAllowRead = false) override { return LowerLevel->OpenWrite(Filename, bAppend, bAllowRead); }
+	virtual bool DirectoryExists(const TCHAR* Directory) override { return LowerLevel->DirectoryExists(Directory); }
+	virtual bool CreateDirectory(const TCHAR* Directory) override { return LowerLevel->CreateDirectory(Directory); }
+	virtual bool DeleteDirectory(const TCHAR* Directory) override { return LowerLevel->DeleteDirectory(Directory); }
+	virtual FFileStatData GetStatData(const TCHAR* FilenameOrDirectory) override { return LowerLevel->GetStatData(FilenameOrDirectory); }
+	virtual bool IterateDirectory(const TCHAR* Directory, FDirectoryVisitor& Visitor) override { return LowerLevel->IterateDirectory(Directory, Visitor); }
+	virtual bool IterateDirectoryStat(const TCHAR* Directory, FDirectoryStatVisitor& Visitor) override { return LowerLevel->IterateDirectoryStat(Directory, Visitor); }
+
+	// Keep the native async and mapped IO of the lower level, the generic fallbacks would read through OpenRead.
+	virtual IAsyncReadFileHandle* OpenAsyncRead(const TCHAR* Filename) override { return LowerLevel->OpenAsyncRead(Filename); }
+#if ENGINE_MINOR_VERSION >= 3 && ENGINE_MAJOR_VERSION == 5
+	virtual FOpenMappedResult OpenMappedEx(const TCHAR* Filename, EOpenReadFlags OpenOptions = EOpenReadFlags::None, int64 MaximumSize = 0) override { return LowerLevel->OpenMappedEx(Filename, OpenOptions, MaximumSize); }
+#else
+	virtual IMappedFileHandle* OpenMapped(const TCHAR* Filename) override { return LowerLevel->OpenMapped(Filename); }
+#endif
+	virtual void SetAsyncMinimumPriority(EAsyncIOPriorityAndFlags MinPriority) override { LowerLevel->SetAsyncMinimumPriority(MinPriority); }
+	virtual FString ConvertToAbsolutePathForExternalAppForRead(const TCHAR* Filename) override { return LowerLevel->ConvertToAbsolutePathForExternalAppForRead(Filename); }
+	virtual FString ConvertToAbsolutePathForExternalAppForWrite(const TCHAR* Filename) override { return LowerLevel->ConvertToAbsolutePathForExternalAppForWrite(Filename); }
+
+protected:
+	/* Calls the generic async read implementation, which reads through this layer's OpenRead. */
+	IAsyncReadFileHandle* OpenGenericAsyncRead(const TCHAR* Filename) { return IPlatformFile::OpenAsyncRead(Filename); }
+
+	/* Calls the generic mapping, which maps nothing. For files of the layer that must be read through OpenRead. */
+#if ENGINE_MINOR_VERSION >= 3 && ENGINE_MAJOR_VERSION == 5
+	FOpenMappedResult OpenGenericMapped(const TCHAR* Filename, EOpenReadFlags OpenOptions, int64 MaximumSize) { return IPlatformFile::OpenMappedEx(Filename, OpenOptions, MaximumSize); }
+#else
+	IMappedFileHandle* OpenGenericMapped(const TCHAR* Filename) { return IPlatformFile::OpenMapped(Filename); }
+#endif
+
+	IPlatformFile* LowerLevel = nullptr;
+};
@@ -0,0 +1,52 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Kismet/BlueprintAsyncActionBase.h"
+#include "UObject/UObjectGlobals.h"
+#include "PakPreloader.generated.h"
+
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_ThreeParams(FPakPreloadDelegate, bool, bSuccess, UObject*, Asset, UClass*, Class);
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FPakPreloadProgressDelegate, int32, NumLoaded, int32, NumPackages);
+
+UCLASS()
+class PAKLOADER_API UAsyncPakPreloader : public UBlueprintAsyncActionBase
+{
+	GENERATED_UCLASS_BODY()
+
+public:
+	/*
+		Loads an asset of a mounted pak and everything it depends on in the background. The dependencies are taken from
+		the asset registry and all of them are requested at once, so the async loader reads them in parallel instead of
+		one after another in a blocking GetPakFileClass or GetPakFileObject. Keep a reference to Asset or Class, they
+		keep their dependencies loaded.
+		Filename: The asset to load. (Example: /TestDLC/Blueprints/BP_Test)
+	*/
+	UFUNCTION(BlueprintCallable, Category = "PakLoader", meta = (BlueprintInternalUseOnly = "true"))
+	static UAsyncPakPreloader *PreloadPakAsset(const FString &Filename);
+
+	/* Called once the asset and all its dependencies are loaded. Class is set for Blueprints. */
+	UPROPERTY(BlueprintAssignable)
+	FPakPreloadDelegate OnCompleted;
+
+	UPROPERTY(BlueprintAssignable)
+	FPakPreloadProgressDelegate OnProgress;
+
+private:
+	void Start(const FString& Filename);
+
+	void HandlePackageLoaded(const FName& PackageName, UPackage* Package, EAsyncLoadingResult::Type Result);
+
+	void Complete();
+
+	// Keeps loaded packages from being collected until all are loaded.
+	UPROPERTY()
+	TArray<UPackage*> LoadedPackages;
+
+	FString PackageName;
+	int32 NumPackages = 0;
+	int32 NumFinished = 0;
+	int32 NumFailed = 0;
+	double StartSeconds = 0.0;
+};
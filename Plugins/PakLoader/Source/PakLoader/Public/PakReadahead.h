@@ -0,0 +1,60 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PakReadahead.generated.h"
+
+USTRUCT(BlueprintType)
+struct PAKLOADER_API FPakReadaheadRegion
+{
+	GENERATED_BODY()
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "PakLoader|Readahead")
+	int64 Offset = 0;
+
+	// 0 reaches to the end of the pak.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "PakLoader|Readahead")
+	int64 Size = 0;
+};
+
+/* Parts of a pak the OS is asked to read into the page cache while it is mounted, see FPakLoader::MountPakFile. */
+USTRUCT(BlueprintType)
+struct PAKLOADER_API FPakReadaheadOptions
+{
+	GENERATED_BODY()
+
+	// The index and footer at the end of the pak, read by the mount itself.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "PakLoader|Readahead")
+	bool bIndex = true;
+
+	// The whole pak, e.g. for paks that are small or read completely soon after mounting.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "PakLoader|Readahead")
+	bool bWholePak = false;
+
+	// Byte ranges of the pak, e.g. of content that is loaded right after mounting.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "PakLoader|Readahead")
+	TArray<FPakReadaheadRegion> Regions;
+
+	bool IsEnabled() const
+	{
+		return bIndex || bWholePak || Regions.Num() > 0;
+	}
+};
+
+/*
+	Page cache hints for files on disk (posix_fadvise). The OS reads hinted ranges in the background, so the first
+	reads of a freshly mounted pak don't wait for random reads from a cold disk. Only Linux and Android support them,
+	elsewhere the functions do nothing and return false.
+*/
+class PAKLOADER_API FPakReadahead
+{
+public:
+	static bool IsSupported();
+
+	/* Asks the OS to read the regions of Filename into the page cache. Doesn't wait for the reads. */
+	static bool WillNeed(const FString& Filename, const TArray<FPakReadaheadRegion>& Regions);
+
+	/* Tells the OS the cached pages of Filename are not needed anymore, e.g. after the pak was unmounted. */
+	static bool DontNeed(const FString& Filename);
+};
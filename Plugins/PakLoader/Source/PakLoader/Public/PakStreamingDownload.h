@@ -0,0 +1,134 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Interfaces/IHttpRequest.h"
+#include "Interfaces/IHttpResponse.h"
+#include "Runtime/Launch/Resources/Version.h"
+#include <atomic>
+
+#if ENGINE_MINOR_VERSION >= 4 && ENGINE_MAJOR_VERSION == 5
+
+class FPakDownloadFileWriter;
+class FPakDownloadStream;
+class FPakBandwidthLimiter;
+class FPakStreamingFile;
+
+enum class EPakStreamingState : uint8
+{
+	// Fetching the footer and the index of the pak.
+	FetchingIndex,
+
+	// The index is downloaded, the pak can be mounted. Content is fetched in the background.
+	Mountable,
+
+	// All bytes are downloaded, Finalize() closes the file.
+	Downloaded,
+
+	Failed
+};
+
+/*
+	Downloads a pak so it can be mounted before it is complete.
+	The footer and the index are fetched first with range requests, then the rest of the file in pieces over several
+	connections. Reads of the mounted pak that need a missing piece move it to the front of the queue.
+	Requests complete on the HTTP thread, a read blocking the game thread doesn't stall the download.
+*/
+class PAKLOADER_API FPakStreamingDownload : public TSharedFromThis<FPakStreamingDownload, ESPMode::ThreadSafe>
+{
+public:
+	FPakStreamingDownload(const FString& InURL, const FString& InFilename, int32 InMaxConnections);
+
+	void Start();
+
+	/* Stops all requests, reads of missing ranges fail. */
+	void Cancel();
+
+	/* Waits for all writes and closes the file. Call once the state is Downloaded. */
+	bool Finalize();
+
+	/* Deletes the file. Call after the pak was unmounted. */
+	void DeleteFile();
+
+	EPakStreamingState GetState() const { return State; }
+
+	/* Valid once the state is Mountable. */
+	TSharedPtr<FPakStreamingFile, ESPMode::ThreadSafe> GetStreamingFile() const { return StreamingFile; }
+
+	int64 GetBytesReceived() const { return BytesReceived; }
+	int64 GetTotalBytes() const { return FileSize; }
+
+private:
+	enum class EPieceState : uint8
+	{
+		Pending,
+		Active,
+		Done
+	};
+
+	struct FPiece
+	{
+		// Inclusive byte range.
+		int64 Start = 0;
+		int64 End = 0;
+		int32 Retries = 0;
+		EPieceState State = EPieceState::Pending;
+		bool bIndex = false;
+	};
+
+	struct FActivePiece
+	{
+		FHttpRequestPtr HttpRequest;
+		TSharedPtr<FPakDownloadStream, ESPMode::ThreadSafe> Stream;
+	};
+
+	FHttpRequestPtr CreateHttpRequest(const FString& Range) const;
+
+	void HandleTailComplete(FHttpRequestPtr HttpRequest, FHttpResponsePtr HttpResponse, bool bSucceeded);
+	void HandlePieceComplete(FHttpRequestPtr HttpRequest, FHttpResponsePtr HttpResponse, bool bSucceeded, int32 PieceIndex);
+
+	/* Moves the pieces of a range that a read waits for to the front. Called from reading threads. */
+	void Prioritize(int64 Offset, int64 Size);
+
+	/* Creates requests for free connections. Returns them so they are sent after the lock is released. */
+	TArray<FHttpRequestPtr> StartPieces_Locked();
+	FHttpRequestPtr StartPiece_Locked(int32 PieceIndex);
+
+	/* Starts the next pending piece once the bandwidth limit allowed it. */
+	void StartDeferredPiece();
+
+	static void ProcessRequests(const TArray<FHttpRequestPtr>& Requests);
+
+	void Fail(const FString& Reason);
+
+	FString URL;
+	FString Filename;
+	int32 MaxConnections = 4;
+
+	TSharedRef<FPakDownloadFileWriter, ESPMode::ThreadSafe> Writer;
+	TSharedPtr<FPakBandwidthLimiter, ESPMode::ThreadSafe> BandwidthLimiter;
+	TSharedPtr<FPakStreamingFile, ESPMode::ThreadSafe> StreamingFile;
+
+	std::atomic<EPakStreamingState> State{EPakStreamingState::FetchingIndex};
+	std::atomic<int64> FileSize{0};
+	std::atomic<int64> BytesReceived{0};
+
+	FCriticalSection Lock;
+	FHttpRequestPtr TailRequest;
+	TArray<FPiece> Pieces;
+	TMap<int32, FActivePiece> ActivePieces;
+
+	// Pieces reads are waiting for, started before all others and on extra connections.
+	TArray<int32> PriorityPieces;
+
+	// Pieces before this index are not pending, except for retries which move it back.
+	int32 NextPiece = 0;
+	int32 NumPiecesDone = 0;
+	int32 NumIndexPiecesLeft = 0;
+
+	// Pieces that wait for the bandwidth limit, they count as connections.
+	int32 NumDeferredPieces = 0;
+};
+
+#endif
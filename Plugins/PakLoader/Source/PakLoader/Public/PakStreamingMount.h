@@ -0,0 +1,71 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Kismet/BlueprintAsyncActionBase.h"
+#include "Containers/Ticker.h"
+#include "Runtime/Launch/Resources/Version.h"
+#include "PakStreamingMount.generated.h"
+
+class FPakStreamingDownload;
+
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FPakStreamingMountDelegate, const FString, PakFilename);
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FPakStreamingMountProgressDelegate, int64, BytesReceived, int64, TotalBytes);
+
+UCLASS()
+class PAKLOADER_API UAsyncPakStreamingMount : public UBlueprintAsyncActionBase
+{
+	GENERATED_UCLASS_BODY()
+
+public:
+	/*
+		Mounts a pak while it is downloading. The footer and the index are downloaded first, then the pak is mounted
+		and the rest is fetched in the background. Loading content that is not downloaded yet blocks until its range
+		arrived, those ranges are fetched before all others.
+		Requires a server that supports range requests and Unreal Engine 5.4 or newer.
+		URL: The URL of the pak.
+		SavePath: Directory or path where to save the pak.
+		MaxConnections: Number of ranges fetched in parallel.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "PakLoader|Download", meta = (BlueprintInternalUseOnly = "true"))
+	static UAsyncPakStreamingMount *StreamAndMountPak(const FString &URL, const FString &SavePath, int32 MaxConnections = 4);
+
+	/* Called once the pak is mounted, its content can be loaded from now on. */
+	UPROPERTY(BlueprintAssignable)
+	FPakStreamingMountDelegate OnMounted;
+
+	/* Called once the whole pak is downloaded. The pak stays mounted. */
+	UPROPERTY(BlueprintAssignable)
+	FPakStreamingMountDelegate OnCompleted;
+
+	/* Called when the download failed. The pak is unmounted and the partial file is deleted. */
+	UPROPERTY(BlueprintAssignable)
+	FPakStreamingMountDelegate OnFail;
+
+	UPROPERTY(BlueprintAssignable)
+	FPakStreamingMountProgressDelegate OnProgress;
+
+	/* Stops the download. Unmounts the pak if it was already mounted, OnFail is called. */
+	UFUNCTION(BlueprintCallable, Category = "PakLoader|Download")
+	void Cancel();
+
+private:
+	void Start(const FString& URL, int32 MaxConnections);
+
+	bool Mount();
+	void Complete();
+	void Fail();
+
+#if ENGINE_MINOR_VERSION >= 4 && ENGINE_MAJOR_VERSION == 5
+	bool Tick(float DeltaTime);
+
+	TSharedPtr<FPakStreamingDownload, ESPMode::ThreadSafe> Download;
+	FTSTicker::FDelegateHandle TickerHandle;
+#endif
+
+	FString PakFilename;
+	int64 LastBytesReceived = -1;
+	bool bMounted = false;
+	bool bFinished = false;
+};
@@ -0,0 +1,100 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PakPlatformFileLayer.h"
+#include "Misc/ScopeRWLock.h"
+#include <atomic>
+
+class FEvent;
+
+/*
+	A file that is still being written by a download. Tracks which byte ranges are on disk so reads can wait for
+	the ranges they need. Shared between the download and the read handles of the pak platform file.
+*/
+class PAKLOADER_API FPakStreamingFile : public TSharedFromThis<FPakStreamingFile, ESPMode::ThreadSafe>
+{
+public:
+	explicit FPakStreamingFile(int64 InFileSize);
+	~FPakStreamingFile();
+
+	FPakStreamingFile(const FPakStreamingFile&) = delete;
+	FPakStreamingFile& operator=(const FPakStreamingFile&) = delete;
+
+	int64 GetFileSize() const { return FileSize; }
+
+	/* Called by the download once a range reached the disk. Wakes up waiting reads. */
+	void MarkAvailable(int64 Offset, int64 Size);
+
+	/* All bytes are on disk, reads no longer wait. */
+	void MarkComplete();
+
+	/* The download stopped, reads of missing ranges fail from now on. */
+	void MarkFailed();
+
+	bool IsComplete() const { return bComplete; }
+	bool IsRangeAvailable(int64 Offset, int64 Size) const;
+
+	/*
+		Blocks until the range is on disk. The range is passed to the range request handler first so the download
+		fetches it next. Returns false if the download failed before the range arrived.
+	*/
+	bool WaitForRange(int64 Offset, int64 Size);
+
+	/* Called from the reading thread when a read needs a range that is not on disk yet. */
+	void SetRangeRequestHandler(TFunction<void(int64 Offset, int64 Size)>&& InHandler);
+
+private:
+	const int64 FileSize;
+
+	// Sorted, non overlapping [Start, End) ranges that are on disk.
+	TArray<TPair<int64, int64>> Ranges;
+	mutable FRWLock RangesLock;
+
+	TFunction<void(int64, int64)> RangeRequestHandler;
+	FCriticalSection HandlerLock;
+
+	FEvent* RangeAvailableEvent = nullptr;
+
+	std::atomic<bool> bComplete{false};
+	std::atomic<bool> bFailed{false};
+};
+
+/*
+	Platform file layer that lets the pak platform file read paks which are still downloading.
+	Reads of registered files wait for the ranges they need, all other files pass through unchanged.
+*/
+class PAKLOADER_API FPakStreamingPlatformFile : public FPakPlatformFileLayer
+{
+public:
+	static const TCHAR* GetTypeName() { return TEXT("PakStreamingFile"); }
+
+	/* Routes reads of Filename through File until UnregisterFile is called. */
+	void RegisterFile(const FString& Filename, const TSharedRef<FPakStreamingFile, ESPMode::ThreadSafe>& File);
+	void UnregisterFile(const FString& Filename);
+
+	bool IsRegistered(const FString& Filename) const { return FindFile(*Filename).IsValid(); }
+
+	// IPlatformFile interface
+	virtual const TCHAR* GetName() const override { return GetTypeName(); }
+	virtual int64 FileSize(const TCHAR* Filename) override;
+	virtual IFileHandle* OpenRead(const TCHAR* Filename, bool bAllowWrite = false) override;
+	virtual IAsyncReadFileHandle* OpenAsyncRead(const TCHAR* Filename) override;
+#if ENGINE_MINOR_VERSION >= 3 && ENGINE_MAJOR_VERSION == 5
+	virtual FOpenMappedResult OpenMappedEx(const TCHAR* Filename, EOpenReadFlags OpenOptions = EOpenReadFlags::None, int64 MaximumSize = 0) override;
+#else
+	virtual IMappedFileHandle* OpenMapped(const TCHAR* Filename) override;
+#endif
+
+private:
+	TSharedPtr<FPakStreamingFile, ESPMode::ThreadSafe> FindFile(const TCHAR* Filename) const;
+
+	static FString GetKey(const TCHAR* Filename);
+
+	TMap<FString, TSharedRef<FPakStreamingFile, ESPMode::ThreadSafe>> Files;
+	mutable FRWLock FilesLock;
+
+	// Lets the common case of no streaming file skip the lock and the path normalization.
+	std::atomic<int32> NumFiles{0};
+};
@@ -0,0 +1,73 @@
+// Copyright (C) 2019-2024 Blue Mountains GmbH. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include <atomic>
+
+/*
+	Records mount, unmount, asset registry, object load and download events of the plugin with their thread, duration
+	and byte counts. Export() writes them as Chrome trace JSON, which chrome://tracing and Perfetto open, so traces
+	from player machines can be analysed without Unreal Insights.
+	Recording is off by default, instrumented code only checks an atomic flag then.
+*/
+class PAKLOADER_API FPakTraceRecorder
+{
+public:
+	/* Starts recording, events recorded before are discarded. */
+	static void Start();
+	static void Stop();
+
+	static bool IsRecording() { return bRecording.load(std::memory_order_relaxed); }
+
+	/*
+		Records an event that started at StartSeconds (FPlatformTime::Seconds) and took DurationSeconds.
+		Bytes is the amount of data the operation handled, -1 if not applicable. Detail is shown as argument, e.g. a filename.
+	*/
+	static void AddEvent(const TCHAR* Name, const TCHAR* Category, double StartSeconds, double DurationSeconds, int64 Bytes = -1, const FString& Detail = FString());
+
+	/* Records an event without duration. */
+	static void AddInstantEvent(const TCHAR* Name, const TCHAR* Category, int64 Bytes = -1, const FString& Detail = FString());
+
+	/* Writes the recorded events to Filename as Chrome trace JSON. Recording may continue. */
+	static bool Export(const FString& Filename);
+
+	/* Number of events recorded since Start(). */
+	static int32 GetNumEvents();
+
+private:
+	static std::atomic<bool> bRecording;
+};
+
+/* Records the lifetime of the scope as an event. */
+class PAKLOADER_API FPakTraceScope
+{
+public:
+	FPakTraceScope(const TCHAR* InName, const TCHAR* InCategory, const FString& InDetail = FString())
+		: Name(InName)
+		, Category(InCategory)
+		, StartSeconds(FPakTraceRecorder::IsRecording() ? FPlatformTime::Seconds() : 0.0)
+	{
+		if (StartSeconds > 0.0)
+		{
+			Detail = InDetail;
+		}
+	}
+
+	~FPakTraceScope()
+	{
+		if (StartSeconds > 0.0 && FPakTraceRecorder::IsRecording())
+		{
+			FPakTraceRecorder::AddEvent(Name, Category, StartSeconds, FPlatformTime::Seconds() - StartSeconds, Bytes, Detail);
+		}
+	}
+
+	void SetBytes(int64 InBytes) { Bytes = InBytes; }
+
+private:
+	const TCHAR* Name;
+	const TCHAR* Category;
+	double StartSeconds;
+	int64 Bytes = -1;
+	FString Detail;
+};